@@ -38,6 +38,8 @@
 #include "cplx_wavelet_dec.h"
 #include "median.h"
 #include "iccstore.h"
+#include "fftplancache.h"
+#include "denoisescheduler.h"
 #include "imagesource.h"
 #include "rt_algo.h"
 #include "guidedfilter.h"
@@ -48,6 +50,9 @@
 #include <omp.h>
 #endif
 #include "StopWatch.h"
+#ifdef BENCHMARK
+#  include <iostream>
+#endif
 
 #define TS 64       // Tile size
 #define offset 25   // shift between tiles
@@ -566,7 +571,7 @@ void RGBoutput_tile_row(double scale, float *bloxrow_L, float ** Ldetail, float
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
-float MadRgb(float * DataList, const int datalen)
+float MadRgb(float * DataList, const int datalen, int *histo_buf=nullptr)
 {
     if (datalen <= 1) { // Avoid possible buffer underrun
         return 0;
@@ -574,7 +579,7 @@ float MadRgb(float * DataList, const int datalen)
 
     //computes Median Absolute Deviation
     //DataList values should mostly have abs val < 65536 because we are in RGB mode
-    int * histo = new int[65536];
+    int * histo = histo_buf ? histo_buf : new int[65536];
 
     for (int i = 0; i < 65536; ++i) {
         histo[i] = 0;
@@ -598,7 +603,9 @@ float MadRgb(float * DataList, const int datalen)
     int count_ = count - histo[median - 1];
 
     // interpolate
-    delete[] histo;
+    if (!histo_buf) {
+        delete[] histo;
+    }
     return (((median - 1) + (datalen / 2 - count_) / (static_cast<float>(count - count_))) / 0.6745);
 }
 
@@ -728,7 +735,7 @@ void ShrinkAllL(double scale, wavelet_decomposition &WaveletCoeffs_L, float **bu
 
 void ShrinkAllAB(double scale, wavelet_decomposition &WaveletCoeffs_L, wavelet_decomposition &WaveletCoeffs_ab, float **buffer, int level, int dir,
         float *noisevarchrom, float noisevar_ab, const bool useNoiseCCurve, bool autoch,
-        float * madL, float * madaab=nullptr,  bool madCalculated=false)
+        float * madL, float * madaab=nullptr,  bool madCalculated=false, int *histo=nullptr)
 
 {
     //simple wavelet shrinkage
@@ -754,7 +761,7 @@ void ShrinkAllAB(double scale, wavelet_decomposition &WaveletCoeffs_L, wavelet_d
     if (madCalculated) {
         madab = madaab[dir - 1];
     } else {
-        madab = SQR(MadRgb(WavCoeffs_ab[dir], W_ab * H_ab));
+        madab = SQR(MadRgb(WavCoeffs_ab[dir], W_ab * H_ab, histo));
     }
 
     if (noisevar_ab > 0.001f) {
@@ -839,276 +846,304 @@ void ShrinkAllAB(double scale, wavelet_decomposition &WaveletCoeffs_L, wavelet_d
 }
 
 
-bool WaveletDenoiseAll_BiShrinkL(double scale, wavelet_decomposition &WaveletCoeffs_L, float *noisevarlum, float madL[8][3])
+// a chrominance channel to denoise, with the noise variance set by the user
+struct ChromaChannel {
+    wavelet_decomposition *coeffs;
+    float noisevar;
+};
+
+
+// unit of work of the wavelet shrinkage passes: direction dir of level lvl
+// of channel chan. Pointwise passes are split further in bands of
+// coefficients [begin, end)
+struct SubbandTask {
+    int chan;
+    int lvl;
+    int dir;
+    int begin;
+    int end;
+};
+
+constexpr int SUBBAND_BAND_SIZE = 1 << 16; // must be a multiple of 4
+
+
+void add_subband_tasks(wavelet_decomposition &coeffs, int chan, int lvl, bool split, float weight, std::vector<SubbandTask> &tasks, std::vector<float> &costs)
 {
-    int maxlvl = min(WaveletCoeffs_L.maxlevel(), 5);
-    const float eps = 0.01f;
+    const int size = coeffs.level_W(lvl) * coeffs.level_H(lvl);
+    const int step = split ? SUBBAND_BAND_SIZE : max(size, 1);
 
+    for (int dir = 1; dir < 4; ++dir) {
+        for (int begin = 0; begin < size; begin += step) {
+            const int end = min(begin + step, size);
+            tasks.push_back({chan, lvl, dir, begin, end});
+            costs.push_back(weight * (end - begin));
+        }
+    }
+}
+
+
+int max_level_size(wavelet_decomposition &WaveletCoeffs, int maxlvl)
+{
     int maxWL = 0, maxHL = 0;
 
     for (int lvl = 0; lvl < maxlvl; ++lvl) {
-        if (WaveletCoeffs_L.level_W(lvl) > maxWL) {
-            maxWL = WaveletCoeffs_L.level_W(lvl);
-        }
+        maxWL = max(maxWL, WaveletCoeffs.level_W(lvl));
+        maxHL = max(maxHL, WaveletCoeffs.level_H(lvl));
+    }
 
-        if (WaveletCoeffs_L.level_H(lvl) > maxHL) {
-            maxHL = WaveletCoeffs_L.level_H(lvl);
-        }
+    return maxWL * maxHL;
+}
+
+
+// buffers as expected by ShrinkAllL and ShrinkAllAB
+void get_buffers(ScratchArena &arena, int size, float **buffer, int num)
+{
+    for (int i = 0; i < num; ++i) {
+        buffer[i] = arena.get(i, size + 32 * (i + 1));
     }
+}
 
-    constexpr bool memoryAllocationFailed = false;
-#ifdef _OPENMP
-    #pragma omp parallel num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
-#endif
-    {
-        float *buffer[3];
-        buffer[0] = new /*(std::nothrow)*/ float[maxWL * maxHL + 32];
-        buffer[1] = new /*(std::nothrow)*/ float[maxWL * maxHL + 64];
-        buffer[2] = new /*(std::nothrow)*/ float[maxWL * maxHL + 96];
 
-        // if (buffer[0] == nullptr || buffer[1] == nullptr || buffer[2] == nullptr) {
-        //     memoryAllocationFailed = true;
-        // }
+void compute_madL(TileScheduler &sched, wavelet_decomposition &WaveletCoeffs_L, float madL[8][3])
+{
+    std::vector<SubbandTask> tasks;
+    std::vector<float> costs;
 
-        if (!memoryAllocationFailed) {
+    for (int lvl = 0; lvl < WaveletCoeffs_L.maxlevel(); ++lvl) {
+        add_subband_tasks(WaveletCoeffs_L, 0, lvl, false, 1.f, tasks, costs);
+    }
 
-#ifdef _OPENMP
-            #pragma omp for schedule(dynamic) collapse(2)
-#endif
+    sched.run(costs,
+              [&](int task, ScratchArena &arena) -> void
+              {
+                  // compute median absolute deviation (MAD) of detail coefficients as robust noise estimator
+                  const SubbandTask &t = tasks[task];
+                  float ** WavCoeffs_L = WaveletCoeffs_L.level_coeffs(t.lvl);
+                  madL[t.lvl][t.dir - 1] = SQR(MadRgb(WavCoeffs_L[t.dir], t.end - t.begin, arena.histogram()));
+              });
+}
 
-            for (int lvl = maxlvl - 1; lvl >= 0; lvl--) { //for levels less than max, use level diff to make edge mask
-                for (int dir = 1; dir < 4; ++dir) {
-                    int Wlvl_L = WaveletCoeffs_L.level_W(lvl);
-                    int Hlvl_L = WaveletCoeffs_L.level_H(lvl);
 
-                    float ** WavCoeffs_L = WaveletCoeffs_L.level_coeffs(lvl);
+bool WaveletDenoiseAll_BiShrinkL(TileScheduler &sched, double scale, wavelet_decomposition &WaveletCoeffs_L, float *noisevarlum, float madL[8][3])
+{
+    const int maxlvl = min(WaveletCoeffs_L.maxlevel(), 5);
+    const float eps = 0.01f;
+    const int bufsize = max_level_size(WaveletCoeffs_L, maxlvl);
 
-                    if (lvl == maxlvl - 1) {
-                        int edge = 0;
-                        ShrinkAllL(scale, WaveletCoeffs_L, buffer, lvl, dir, noisevarlum, madL[lvl], nullptr, edge);
-                    } else {
-                        //simple wavelet shrinkage
-                        float * sfave = buffer[0] + 32;
-                        float * sfaved = buffer[2] + 96;
-                        float * blurBuffer = buffer[1] + 64;
+    std::vector<SubbandTask> tasks;
+    std::vector<float> costs;
 
-                        float mad_Lr = madL[lvl][dir - 1];
+    for (int lvl = maxlvl - 1; lvl >= 0; lvl--) { //for levels less than max, use level diff to make edge mask
+        add_subband_tasks(WaveletCoeffs_L, 0, lvl, false, 1.f, tasks, costs);
+    }
 
-                        float levelFactor = mad_Lr * 5.f / (lvl + 1);
-#ifdef __SSE2__
-                        __m128 mad_Lv;
-                        __m128 ninev = _mm_set1_ps(9.0f);
-                        __m128 epsv = _mm_set1_ps(eps);
-                        __m128 mag_Lv;
-                        __m128 levelFactorv = _mm_set1_ps(levelFactor);
-                        int coeffloc_L;
-
-                        for (coeffloc_L = 0; coeffloc_L < Hlvl_L * Wlvl_L - 3; coeffloc_L += 4) {
-                            mad_Lv = LVFU(noisevarlum[coeffloc_L]) * levelFactorv;
-                            mag_Lv = SQRV(LVFU(WavCoeffs_L[dir][coeffloc_L]));
-                            _mm_storeu_ps(&sfave[coeffloc_L], mag_Lv / (mag_Lv + mad_Lv * xexpf(-mag_Lv / (mad_Lv * ninev)) + epsv));
-                        }
+    sched.run(costs,
+              [&](int task, ScratchArena &arena) -> void
+              {
+                  const int lvl = tasks[task].lvl;
+                  const int dir = tasks[task].dir;
 
-                        for (; coeffloc_L < Hlvl_L * Wlvl_L; ++coeffloc_L) {
-                            float mag_L = SQR(WavCoeffs_L[dir][coeffloc_L]);
-                            sfave[coeffloc_L] = mag_L / (mag_L + levelFactor * noisevarlum[coeffloc_L] * xexpf(-mag_L / (9.f * levelFactor * noisevarlum[coeffloc_L])) + eps);
-                        }
+                  float *buffer[3];
+                  get_buffers(arena, bufsize, buffer, 3);
+
+                  int Wlvl_L = WaveletCoeffs_L.level_W(lvl);
+                  int Hlvl_L = WaveletCoeffs_L.level_H(lvl);
+
+                  float ** WavCoeffs_L = WaveletCoeffs_L.level_coeffs(lvl);
+
+                  if (lvl == maxlvl - 1) {
+                      int edge = 0;
+                      ShrinkAllL(scale, WaveletCoeffs_L, buffer, lvl, dir, noisevarlum, madL[lvl], nullptr, edge);
+                  } else {
+                      //simple wavelet shrinkage
+                      float * sfave = buffer[0] + 32;
+                      float * sfaved = buffer[2] + 96;
+                      float * blurBuffer = buffer[1] + 64;
+
+                      float mad_Lr = madL[lvl][dir - 1];
+
+                      float levelFactor = mad_Lr * 5.f / (lvl + 1);
+#ifdef __SSE2__
+                      __m128 mad_Lv;
+                      __m128 ninev = _mm_set1_ps(9.0f);
+                      __m128 epsv = _mm_set1_ps(eps);
+                      __m128 mag_Lv;
+                      __m128 levelFactorv = _mm_set1_ps(levelFactor);
+                      int coeffloc_L;
+
+                      for (coeffloc_L = 0; coeffloc_L < Hlvl_L * Wlvl_L - 3; coeffloc_L += 4) {
+                          mad_Lv = LVFU(noisevarlum[coeffloc_L]) * levelFactorv;
+                          mag_Lv = SQRV(LVFU(WavCoeffs_L[dir][coeffloc_L]));
+                          _mm_storeu_ps(&sfave[coeffloc_L], mag_Lv / (mag_Lv + mad_Lv * xexpf(-mag_Lv / (mad_Lv * ninev)) + epsv));
+                      }
+
+                      for (; coeffloc_L < Hlvl_L * Wlvl_L; ++coeffloc_L) {
+                          float mag_L = SQR(WavCoeffs_L[dir][coeffloc_L]);
+                          sfave[coeffloc_L] = mag_L / (mag_L + levelFactor * noisevarlum[coeffloc_L] * xexpf(-mag_L / (9.f * levelFactor * noisevarlum[coeffloc_L])) + eps);
+                      }
 
 #else
 
-                        for (int i = 0; i < Hlvl_L; ++i) {
-                            for (int j = 0; j < Wlvl_L; ++j) {
+                      for (int i = 0; i < Hlvl_L; ++i) {
+                          for (int j = 0; j < Wlvl_L; ++j) {
 
-                                int coeffloc_L = i * Wlvl_L + j;
-                                float mag_L = SQR(WavCoeffs_L[dir][coeffloc_L]);
-                                sfave[coeffloc_L] = mag_L / (mag_L + levelFactor * noisevarlum[coeffloc_L] * xexpf(-mag_L / (9.f * levelFactor * noisevarlum[coeffloc_L])) + eps);
-                            }
-                        }
+                              int coeffloc_L = i * Wlvl_L + j;
+                              float mag_L = SQR(WavCoeffs_L[dir][coeffloc_L]);
+                              sfave[coeffloc_L] = mag_L / (mag_L + levelFactor * noisevarlum[coeffloc_L] * xexpf(-mag_L / (9.f * levelFactor * noisevarlum[coeffloc_L])) + eps);
+                          }
+                      }
 
 #endif
-                        const int blur_rad = max(1, int((lvl + 2) / scale));
-                        boxblur(sfave, sfaved, blurBuffer, blur_rad, blur_rad, Wlvl_L, Hlvl_L); //increase smoothness by locally averaging shrinkage
+                      const int blur_rad = max(1, int((lvl + 2) / scale));
+                      boxblur(sfave, sfaved, blurBuffer, blur_rad, blur_rad, Wlvl_L, Hlvl_L); //increase smoothness by locally averaging shrinkage
 #ifdef __SSE2__
-                        __m128 sfavev;
-                        __m128 sf_Lv;
-
-                        for (coeffloc_L = 0; coeffloc_L < Hlvl_L * Wlvl_L - 3; coeffloc_L += 4) {
-                            sfavev = LVFU(sfaved[coeffloc_L]);
-                            sf_Lv = LVFU(sfave[coeffloc_L]);
-                            _mm_storeu_ps(&WavCoeffs_L[dir][coeffloc_L], LVFU(WavCoeffs_L[dir][coeffloc_L]) * (SQRV(sfavev) + SQRV(sf_Lv)) / (sfavev + sf_Lv + epsv));
-                            //use smoothed shrinkage unless local shrinkage is much less
-                        }
-
-                        // few remaining pixels
-                        for (; coeffloc_L < Hlvl_L * Wlvl_L; ++coeffloc_L) {
-                            float sf_L = sfave[coeffloc_L];
-                            //use smoothed shrinkage unless local shrinkage is much less
-                            WavCoeffs_L[dir][coeffloc_L] *= (SQR(sfaved[coeffloc_L]) + SQR(sf_L)) / (sfaved[coeffloc_L] + sf_L + eps);
-                        }//now luminance coeffs are denoised
+                      __m128 sfavev;
+                      __m128 sf_Lv;
+
+                      for (coeffloc_L = 0; coeffloc_L < Hlvl_L * Wlvl_L - 3; coeffloc_L += 4) {
+                          sfavev = LVFU(sfaved[coeffloc_L]);
+                          sf_Lv = LVFU(sfave[coeffloc_L]);
+                          _mm_storeu_ps(&WavCoeffs_L[dir][coeffloc_L], LVFU(WavCoeffs_L[dir][coeffloc_L]) * (SQRV(sfavev) + SQRV(sf_Lv)) / (sfavev + sf_Lv + epsv));
+                          //use smoothed shrinkage unless local shrinkage is much less
+                      }
+
+                      // few remaining pixels
+                      for (; coeffloc_L < Hlvl_L * Wlvl_L; ++coeffloc_L) {
+                          float sf_L = sfave[coeffloc_L];
+                          //use smoothed shrinkage unless local shrinkage is much less
+                          WavCoeffs_L[dir][coeffloc_L] *= (SQR(sfaved[coeffloc_L]) + SQR(sf_L)) / (sfaved[coeffloc_L] + sf_L + eps);
+                      }//now luminance coeffs are denoised
 
 #else
 
-                        for (int i = 0; i < Hlvl_L; ++i) {
-                            for (int j = 0; j < Wlvl_L; ++j) {
-                                int coeffloc_L = i * Wlvl_L + j;
-                                float sf_L = sfave[coeffloc_L];
-                                //use smoothed shrinkage unless local shrinkage is much less
-                                WavCoeffs_L[dir][coeffloc_L] *= (SQR(sfaved[coeffloc_L]) + SQR(sf_L)) / (sfaved[coeffloc_L] + sf_L + eps);
-                            }//now luminance coeffs are denoised
-                        }
+                      for (int i = 0; i < Hlvl_L; ++i) {
+                          for (int j = 0; j < Wlvl_L; ++j) {
+                              int coeffloc_L = i * Wlvl_L + j;
+                              float sf_L = sfave[coeffloc_L];
+                              //use smoothed shrinkage unless local shrinkage is much less
+                              WavCoeffs_L[dir][coeffloc_L] *= (SQR(sfaved[coeffloc_L]) + SQR(sf_L)) / (sfaved[coeffloc_L] + sf_L + eps);
+                          }//now luminance coeffs are denoised
+                      }
 
 #endif
-                    }
-                }
-            }
-        }
+                  }
+              });
 
-        for (int i = 2; i >= 0; i--) {
-            if (buffer[i] != nullptr) {
-                delete[] buffer[i];
-            }
-        }
-
-    }
-    return (!memoryAllocationFailed);
+    return true;
 }
 
-bool WaveletDenoiseAll_BiShrinkAB(double scale, wavelet_decomposition &WaveletCoeffs_L, wavelet_decomposition &WaveletCoeffs_ab,
-        float *noisevarchrom, float madL[8][3], float noisevar_ab, const bool useNoiseCCurve, bool autoch)
+bool WaveletDenoiseAll_BiShrinkAB(TileScheduler &sched, double scale, wavelet_decomposition &WaveletCoeffs_L, const std::vector<ChromaChannel> &chroma,
+        float *noisevarchrom, float madL[8][3], const bool useNoiseCCurve, bool autoch)
 {
-    int maxlvl = WaveletCoeffs_L.maxlevel();
+    const int maxlvl = WaveletCoeffs_L.maxlevel();
+    const int bufsize = max_level_size(WaveletCoeffs_L, maxlvl);
 
-    if (autoch && noisevar_ab <= 0.001f) {
-        noisevar_ab = 0.02f;
+    std::vector<float> noisevar_ab(chroma.size());
+    for (size_t c = 0; c < chroma.size(); ++c) {
+        noisevar_ab[c] = (autoch && chroma[c].noisevar <= 0.001f) ? 0.02f : chroma[c].noisevar;
     }
 
-    float madab[8][3];
+    std::vector<float> madab_buf(chroma.size() * 8 * 3);
+    const auto madab =
+        [&](int chan, int lvl) -> float *
+        {
+            return &madab_buf[(chan * 8 + lvl) * 3];
+        };
 
-    int maxWL = 0, maxHL = 0;
+    std::vector<SubbandTask> tasks;
+    std::vector<float> costs;
 
-    for (int lvl = 0; lvl < maxlvl; ++lvl) {
-        if (WaveletCoeffs_L.level_W(lvl) > maxWL) {
-            maxWL = WaveletCoeffs_L.level_W(lvl);
+    for (size_t c = 0; c < chroma.size(); ++c) {
+        for (int lvl = 0; lvl < maxlvl; ++lvl) {
+            add_subband_tasks(*chroma[c].coeffs, c, lvl, false, 1.f, tasks, costs);
         }
+    }
 
-        if (WaveletCoeffs_L.level_H(lvl) > maxHL) {
-            maxHL = WaveletCoeffs_L.level_H(lvl);
+    sched.run(costs,
+              [&](int task, ScratchArena &arena) -> void
+              {
+                  // compute median absolute deviation (MAD) of detail coefficients as robust noise estimator
+                  const SubbandTask &t = tasks[task];
+                  float ** WavCoeffs_ab = chroma[t.chan].coeffs->level_coeffs(t.lvl);
+                  madab(t.chan, t.lvl)[t.dir - 1] = SQR(MadRgb(WavCoeffs_ab[t.dir], t.end - t.begin, arena.histogram()));
+              });
+
+    tasks.clear();
+    costs.clear();
+
+    for (size_t c = 0; c < chroma.size(); ++c) {
+        for (int lvl = maxlvl - 1; lvl >= 0; lvl--) { //for levels less than max, use level diff to make edge mask
+            // only the shrinkage of the last level needs the whole subband
+            const bool pointwise = lvl < maxlvl - 1;
+            add_subband_tasks(*chroma[c].coeffs, c, lvl, pointwise, pointwise ? 1.f : 3.f, tasks, costs);
         }
     }
 
-    constexpr bool memoryAllocationFailed = false;
-#ifdef _OPENMP
-    #pragma omp parallel num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
-#endif
-    {
-        float *buffer[3];
-        buffer[0] = new /*(std::nothrow)*/ float[maxWL * maxHL + 32];
-        buffer[1] = new /*(std::nothrow)*/ float[maxWL * maxHL + 64];
-        buffer[2] = new /*(std::nothrow)*/ float[maxWL * maxHL + 96];
-
-        // if (buffer[0] == nullptr || buffer[1] == nullptr || buffer[2] == nullptr) {
-        //     memoryAllocationFailed = true;
-        // }
-
-        if (!memoryAllocationFailed) {
-
-
-#ifdef _OPENMP
-            #pragma omp for schedule(dynamic) collapse(2)
-#endif
-
-            for (int lvl = 0; lvl < maxlvl; ++lvl) {
-                for (int dir = 1; dir < 4; ++dir) {
-                    // compute median absolute deviation (MAD) of detail coefficients as robust noise estimator
-                    int Wlvl_ab = WaveletCoeffs_ab.level_W(lvl);
-                    int Hlvl_ab = WaveletCoeffs_ab.level_H(lvl);
-                    float ** WavCoeffs_ab = WaveletCoeffs_ab.level_coeffs(lvl);
-                    madab[lvl][dir - 1] = SQR(MadRgb(WavCoeffs_ab[dir], Wlvl_ab * Hlvl_ab));
-                }
-            }
-
-#ifdef _OPENMP
-            #pragma omp for schedule(dynamic) collapse(2)
-#endif
-
-            for (int lvl = maxlvl - 1; lvl >= 0; lvl--) { //for levels less than max, use level diff to make edge mask
-                for (int dir = 1; dir < 4; ++dir) {
-                    int Wlvl_ab = WaveletCoeffs_ab.level_W(lvl);
-                    int Hlvl_ab = WaveletCoeffs_ab.level_H(lvl);
-
-                    float ** WavCoeffs_L = WaveletCoeffs_L.level_coeffs(lvl);
-                    float ** WavCoeffs_ab = WaveletCoeffs_ab.level_coeffs(lvl);
-
-                    if (lvl == maxlvl - 1) {
-                        ShrinkAllAB(scale, WaveletCoeffs_L, WaveletCoeffs_ab, buffer, lvl, dir, noisevarchrom, noisevar_ab, useNoiseCCurve, autoch, madL[lvl], madab[lvl], true);
-                    } else {
-                        //simple wavelet shrinkage
-
-                        float mad_Lr = madL[lvl][dir - 1];
-                        float mad_abr = useNoiseCCurve ? noisevar_ab * madab[lvl][dir - 1] : SQR(noisevar_ab) * madab[lvl][dir - 1];
-
-                        if (noisevar_ab > 0.001f) {
+    sched.run(costs,
+              [&](int task, ScratchArena &arena) -> void
+              {
+                  const SubbandTask &t = tasks[task];
+                  const int lvl = t.lvl;
+                  const int dir = t.dir;
+                  wavelet_decomposition &WaveletCoeffs_ab = *chroma[t.chan].coeffs;
+
+                  float ** WavCoeffs_L = WaveletCoeffs_L.level_coeffs(lvl);
+                  float ** WavCoeffs_ab = WaveletCoeffs_ab.level_coeffs(lvl);
+
+                  if (lvl == maxlvl - 1) {
+                      float *buffer[3];
+                      get_buffers(arena, bufsize, buffer, 3);
+                      ShrinkAllAB(scale, WaveletCoeffs_L, WaveletCoeffs_ab, buffer, lvl, dir, noisevarchrom, noisevar_ab[t.chan], useNoiseCCurve, autoch, madL[lvl], madab(t.chan, lvl), true);
+                  } else if (noisevar_ab[t.chan] > 0.001f) {
+                      //simple wavelet shrinkage
+                      const float noisevar = noisevar_ab[t.chan];
+                      float mad_Lr = madL[lvl][dir - 1];
+                      float mad_abr = useNoiseCCurve ? noisevar * madab(t.chan, lvl)[dir - 1] : SQR(noisevar) * madab(t.chan, lvl)[dir - 1];
 
 #ifdef __SSE2__
-                            __m128 onev = _mm_set1_ps(1.f);
-                            __m128 mad_abrv = _mm_set1_ps(mad_abr);
-                            __m128 rmad_Lm9v = onev / _mm_set1_ps(mad_Lr * 9.f);
-                            __m128 mad_abv;
-                            __m128 mag_Lv, mag_abv;
-                            __m128 tempabv;
-                            int coeffloc_ab;
-
-                            for (coeffloc_ab = 0; coeffloc_ab < Hlvl_ab * Wlvl_ab - 3; coeffloc_ab += 4) {
-                                mad_abv = LVFU(noisevarchrom[coeffloc_ab]) * mad_abrv;
-
-                                tempabv = LVFU(WavCoeffs_ab[dir][coeffloc_ab]);
-                                mag_Lv = LVFU(WavCoeffs_L[dir][coeffloc_ab]);
-                                mag_abv = SQRV(tempabv);
-                                mag_Lv = SQRV(mag_Lv) * rmad_Lm9v;
-                                _mm_storeu_ps(&WavCoeffs_ab[dir][coeffloc_ab], tempabv * SQRV((onev - xexpf(-(mag_abv / mad_abv) - (mag_Lv)))));
-                            }
-
-                            // few remaining pixels
-                            for (; coeffloc_ab < Hlvl_ab * Wlvl_ab; ++coeffloc_ab) {
-                                float mag_L = SQR(WavCoeffs_L[dir][coeffloc_ab ]);
-                                float mag_ab = SQR(WavCoeffs_ab[dir][coeffloc_ab]);
-                                WavCoeffs_ab[dir][coeffloc_ab] *= SQR(1.f - xexpf(-(mag_ab / (noisevarchrom[coeffloc_ab] * mad_abr)) - (mag_L / (9.f * mad_Lr)))/*satfactor_a*/);
-                            }//now chrominance coefficients are denoised
+                      __m128 onev = _mm_set1_ps(1.f);
+                      __m128 mad_abrv = _mm_set1_ps(mad_abr);
+                      __m128 rmad_Lm9v = onev / _mm_set1_ps(mad_Lr * 9.f);
+                      __m128 mad_abv;
+                      __m128 mag_Lv, mag_abv;
+                      __m128 tempabv;
+                      int coeffloc_ab;
+
+                      for (coeffloc_ab = t.begin; coeffloc_ab < t.end - 3; coeffloc_ab += 4) {
+                          mad_abv = LVFU(noisevarchrom[coeffloc_ab]) * mad_abrv;
+
+                          tempabv = LVFU(WavCoeffs_ab[dir][coeffloc_ab]);
+                          mag_Lv = LVFU(WavCoeffs_L[dir][coeffloc_ab]);
+                          mag_abv = SQRV(tempabv);
+                          mag_Lv = SQRV(mag_Lv) * rmad_Lm9v;
+                          _mm_storeu_ps(&WavCoeffs_ab[dir][coeffloc_ab], tempabv * SQRV((onev - xexpf(-(mag_abv / mad_abv) - (mag_Lv)))));
+                      }
+
+                      // few remaining pixels
+                      for (; coeffloc_ab < t.end; ++coeffloc_ab) {
+                          float mag_L = SQR(WavCoeffs_L[dir][coeffloc_ab ]);
+                          float mag_ab = SQR(WavCoeffs_ab[dir][coeffloc_ab]);
+                          WavCoeffs_ab[dir][coeffloc_ab] *= SQR(1.f - xexpf(-(mag_ab / (noisevarchrom[coeffloc_ab] * mad_abr)) - (mag_L / (9.f * mad_Lr)))/*satfactor_a*/);
+                      }//now chrominance coefficients are denoised
 
 #else
 
-                            for (int i = 0; i < Hlvl_ab; ++i) {
-                                for (int j = 0; j < Wlvl_ab; ++j) {
-                                    int coeffloc_ab = i * Wlvl_ab + j;
-
-                                    float mag_L = SQR(WavCoeffs_L[dir][coeffloc_ab ]);
-                                    float mag_ab = SQR(WavCoeffs_ab[dir][coeffloc_ab]);
+                      for (int coeffloc_ab = t.begin; coeffloc_ab < t.end; ++coeffloc_ab) {
+                          float mag_L = SQR(WavCoeffs_L[dir][coeffloc_ab ]);
+                          float mag_ab = SQR(WavCoeffs_ab[dir][coeffloc_ab]);
 
-                                    WavCoeffs_ab[dir][coeffloc_ab] *= SQR(1.f - xexpf(-(mag_ab / (noisevarchrom[coeffloc_ab] * mad_abr)) - (mag_L / (9.f * mad_Lr)))/*satfactor_a*/);
-
-                                }
-                            }//now chrominance coefficients are denoised
+                          WavCoeffs_ab[dir][coeffloc_ab] *= SQR(1.f - xexpf(-(mag_ab / (noisevarchrom[coeffloc_ab] * mad_abr)) - (mag_L / (9.f * mad_Lr)))/*satfactor_a*/);
+                      }//now chrominance coefficients are denoised
 
 #endif
-                        }
+                  }
+              });
 
-                    }
-                }
-            }
-        }
-
-        for (int i = 2; i >= 0; i--) {
-            if (buffer[i] != nullptr) {
-                delete[] buffer[i];
-            }
-        }
-
-    }
-    return (!memoryAllocationFailed);
+    return true;
 }
 
 
-bool WaveletDenoiseAllL(double scale, wavelet_decomposition &WaveletCoeffs_L, float *noisevarlum, float madL[8][3], float * vari, int edge)//mod JD
+bool WaveletDenoiseAllL(TileScheduler &sched, double scale, wavelet_decomposition &WaveletCoeffs_L, float *noisevarlum, float madL[8][3], float * vari, int edge)//mod JD
 
 {
 
@@ -1118,106 +1153,54 @@ bool WaveletDenoiseAllL(double scale, wavelet_decomposition &WaveletCoeffs_L, fl
         maxlvl = 4;    //for refine denoise edge wavelet
     }
 
-    int maxWL = 0, maxHL = 0;
+    const int bufsize = max_level_size(WaveletCoeffs_L, maxlvl);
 
-    for (int lvl = 0; lvl < maxlvl; ++lvl) {
-        if (WaveletCoeffs_L.level_W(lvl) > maxWL) {
-            maxWL = WaveletCoeffs_L.level_W(lvl);
-        }
+    std::vector<SubbandTask> tasks;
+    std::vector<float> costs;
 
-        if (WaveletCoeffs_L.level_H(lvl) > maxHL) {
-            maxHL = WaveletCoeffs_L.level_H(lvl);
-        }
+    for (int lvl = 0; lvl < maxlvl; ++lvl) {
+        add_subband_tasks(WaveletCoeffs_L, 0, lvl, false, 1.f, tasks, costs);
     }
 
-    constexpr bool memoryAllocationFailed = false;
-#ifdef _OPENMP
-    #pragma omp parallel num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
-#endif
-    {
-        float *buffer[4];
-        buffer[0] = new /*(std::nothrow)*/ float[maxWL * maxHL + 32];
-        buffer[1] = new /*(std::nothrow)*/ float[maxWL * maxHL + 64];
-        buffer[2] = new /*(std::nothrow)*/ float[maxWL * maxHL + 96];
-        buffer[3] = new /*(std::nothrow)*/ float[maxWL * maxHL + 128];
-
-        // if (buffer[0] == nullptr || buffer[1] == nullptr || buffer[2] == nullptr || buffer[3] == nullptr) {
-        //     memoryAllocationFailed = true;
-        // }
+    sched.run(costs,
+              [&](int task, ScratchArena &arena) -> void
+              {
+                  float *buffer[3];
+                  get_buffers(arena, bufsize, buffer, 3);
+                  ShrinkAllL(scale, WaveletCoeffs_L, buffer, tasks[task].lvl, tasks[task].dir, noisevarlum, madL[tasks[task].lvl], vari, edge);
+              });
 
-        if (!memoryAllocationFailed) {
-#ifdef _OPENMP
-            #pragma omp for schedule(dynamic) collapse(2)
-#endif
-
-            for (int lvl = 0; lvl < maxlvl; ++lvl) {
-                for (int dir = 1; dir < 4; ++dir) {
-                    ShrinkAllL(scale, WaveletCoeffs_L, buffer, lvl, dir, noisevarlum, madL[lvl], vari, edge);
-                }
-            }
-        }
-
-        for (int i = 3; i >= 0; i--) {
-            if (buffer[i] != nullptr) {
-                delete[] buffer[i];
-            }
-        }
-    }
-    return (!memoryAllocationFailed);
+    return true;
 }
 
 
-bool WaveletDenoiseAllAB(double scale, wavelet_decomposition &WaveletCoeffs_L, wavelet_decomposition &WaveletCoeffs_ab,
-        float *noisevarchrom, float madL[8][3], float noisevar_ab, const bool useNoiseCCurve, bool autoch)
+bool WaveletDenoiseAllAB(TileScheduler &sched, double scale, wavelet_decomposition &WaveletCoeffs_L, const std::vector<ChromaChannel> &chroma,
+        float *noisevarchrom, float madL[8][3], const bool useNoiseCCurve, bool autoch)
 
 {
 
-    int maxlvl = WaveletCoeffs_L.maxlevel();
-    int maxWL = 0, maxHL = 0;
+    const int maxlvl = WaveletCoeffs_L.maxlevel();
+    const int bufsize = max_level_size(WaveletCoeffs_L, maxlvl);
 
-    for (int lvl = 0; lvl < maxlvl; ++lvl) {
-        if (WaveletCoeffs_L.level_W(lvl) > maxWL) {
-            maxWL = WaveletCoeffs_L.level_W(lvl);
-        }
+    std::vector<SubbandTask> tasks;
+    std::vector<float> costs;
 
-        if (WaveletCoeffs_L.level_H(lvl) > maxHL) {
-            maxHL = WaveletCoeffs_L.level_H(lvl);
+    for (size_t c = 0; c < chroma.size(); ++c) {
+        for (int lvl = 0; lvl < maxlvl; ++lvl) {
+            add_subband_tasks(*chroma[c].coeffs, c, lvl, false, 1.f, tasks, costs);
         }
     }
 
-    constexpr bool memoryAllocationFailed = false;
-#ifdef _OPENMP
-    #pragma omp parallel num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
-#endif
-    {
-        float *buffer[3];
-        buffer[0] = new /*(std::nothrow)*/ float[maxWL * maxHL + 32];
-        buffer[1] = new /*(std::nothrow)*/ float[maxWL * maxHL + 64];
-        buffer[2] = new /*(std::nothrow)*/ float[maxWL * maxHL + 96];
+    sched.run(costs,
+              [&](int task, ScratchArena &arena) -> void
+              {
+                  const SubbandTask &t = tasks[task];
+                  float *buffer[3];
+                  get_buffers(arena, bufsize, buffer, 3);
+                  ShrinkAllAB(scale, WaveletCoeffs_L, *chroma[t.chan].coeffs, buffer, t.lvl, t.dir, noisevarchrom, chroma[t.chan].noisevar, useNoiseCCurve, autoch, madL[t.lvl], nullptr, false, arena.histogram());
+              });
 
-        // if (buffer[0] == nullptr || buffer[1] == nullptr || buffer[2] == nullptr) {
-        //     memoryAllocationFailed = true;
-        // }
-
-        if (!memoryAllocationFailed) {
-#ifdef _OPENMP
-            #pragma omp for schedule(dynamic) collapse(2)
-#endif
-
-            for (int lvl = 0; lvl < maxlvl; ++lvl) {
-                for (int dir = 1; dir < 4; ++dir) {
-                    ShrinkAllAB(scale, WaveletCoeffs_L, WaveletCoeffs_ab, buffer, lvl, dir, noisevarchrom, noisevar_ab, useNoiseCCurve, autoch, madL[lvl]);
-                }
-            }
-        }
-
-        for (int i = 2; i >= 0; i--) {
-            if (buffer[i] != nullptr) {
-                delete[] buffer[i];
-            }
-        }
-    }
-    return (!memoryAllocationFailed);
+    return true;
 }
 
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
@@ -1910,27 +1893,31 @@ BENCHFUN
             // calculate min size of numblox_W.
             int min_numblox_W = ceil((static_cast<float>((MIN(imwidth, ((numtiles_W - 1) * tileWskip) + tilewidth)) - ((numtiles_W - 1) * tileWskip))) / (offset)) + 2 * blkrad;
 
-            // these are needed only for creation of the plans and will be freed before entering the parallel loop
+            // the plans come from the global cache, so that they are measured
+            // only once for each combination of sizes
+            FFTPlanCache::Plan plans_blox[4];
             fftwf_plan plan_forward_blox[2];
             fftwf_plan plan_backward_blox[2];
 
             if (denoiseLuminance) {
-                float *Lbloxtmp  = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
-                float *fLbloxtmp = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
-
-                int nfwd[2] = {TS, TS};
-
-                //for DCT:
-                fftw_r2r_kind fwdkind[2] = {FFTW_REDFT10, FFTW_REDFT10};
-                fftw_r2r_kind bwdkind[2] = {FFTW_REDFT01, FFTW_REDFT01};
-
-                // Creating the plans with FFTW_MEASURE instead of FFTW_ESTIMATE speeds up the execute a bit
-                plan_forward_blox[0]  = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, Lbloxtmp, nullptr, 1, TS * TS, fLbloxtmp, nullptr, 1, TS * TS, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-                plan_backward_blox[0] = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, fLbloxtmp, nullptr, 1, TS * TS, Lbloxtmp, nullptr, 1, TS * TS, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-                plan_forward_blox[1]  = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, Lbloxtmp, nullptr, 1, TS * TS, fLbloxtmp, nullptr, 1, TS * TS, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-                plan_backward_blox[1] = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, fLbloxtmp, nullptr, 1, TS * TS, Lbloxtmp, nullptr, 1, TS * TS, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+                // these are needed only to tell the planner the alignment of the actual arrays
+                float *Lbloxtmp  = reinterpret_cast<float*>(fftwf_malloc(TS * TS * sizeof(float)));
+                float *fLbloxtmp = reinterpret_cast<float*>(fftwf_malloc(TS * TS * sizeof(float)));
+
+                // Creating the plans with FFTW_MEASURE instead of FFTW_ESTIMATE speeds up the execute a bit.
+                // The backward transform is executed in-place
+                FFTPlanCache *fftcache = FFTPlanCache::getInstance();
+                plans_blox[0] = fftcache->r2r_2d(TS, TS, max_numblox_W, FFTW_REDFT10, FFTW_REDFT10, Lbloxtmp, fLbloxtmp, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+                plans_blox[1] = fftcache->r2r_2d(TS, TS, max_numblox_W, FFTW_REDFT01, FFTW_REDFT01, fLbloxtmp, fLbloxtmp, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+                plans_blox[2] = fftcache->r2r_2d(TS, TS, min_numblox_W, FFTW_REDFT10, FFTW_REDFT10, Lbloxtmp, fLbloxtmp, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+                plans_blox[3] = fftcache->r2r_2d(TS, TS, min_numblox_W, FFTW_REDFT01, FFTW_REDFT01, fLbloxtmp, fLbloxtmp, FFTW_MEASURE | FFTW_DESTROY_INPUT);
                 fftwf_free(Lbloxtmp);
                 fftwf_free(fLbloxtmp);
+
+                plan_forward_blox[0] = plans_blox[0].get();
+                plan_backward_blox[0] = plans_blox[1].get();
+                plan_forward_blox[1] = plans_blox[2].get();
+                plan_backward_blox[1] = plans_blox[3].get();
             }
 
 // #ifndef _OPENMP
@@ -1970,6 +1957,10 @@ BENCHFUN
 #endif // _OPENMP
             const std::size_t blox_array_size = denoiseNestedLevels * numthreads;
 
+            // schedules the subbands of the wavelet passes, and keeps the
+            // scratch buffers of each thread for the whole run
+            TileScheduler sched(denoiseNestedLevels);
+
             float *LbloxArray[blox_array_size];
             float *fLbloxArray[blox_array_size];
 
@@ -2303,46 +2294,32 @@ BENCHFUN
 
                             if (!memoryAllocationFailed) {
                                 // precalculate madL, because it's used in adecomp and bdecomp
-                                int maxlvl = Ldecomp->maxlevel();
-#ifdef _OPENMP
-                                #pragma omp parallel for schedule(dynamic) collapse(2) num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
-#endif
-
-                                for (int lvl = 0; lvl < maxlvl; ++lvl) {
-                                    for (int dir = 1; dir < 4; ++dir) {
-                                        // compute median absolute deviation (MAD) of detail coefficients as robust noise estimator
-                                        int Wlvl_L = Ldecomp->level_W(lvl);
-                                        int Hlvl_L = Ldecomp->level_H(lvl);
-
-                                        float ** WavCoeffs_L = Ldecomp->level_coeffs(lvl);
-                                        madL[lvl][dir - 1] = SQR(MadRgb(WavCoeffs_L[dir], Wlvl_L * Hlvl_L));
-                                    }
-                                }
+                                compute_madL(sched, *Ldecomp, madL);
                             }
 
-                            float chresid = 0.f;
-                            float chresidtemp = 0.f;
-                            float chmaxresid = 0.f;
-                            float chmaxresidtemp = 0.f;
-
+                            // both chrominance channels are denoised at
+                            // once, so that their subbands can be balanced
+                            // among the threads
                             adecomp = new wavelet_decomposition(labdn->a[0], labdn->W, labdn->H, levwav, 1, 1, max(1, denoiseNestedLevels));
+                            wavelet_decomposition* bdecomp = new wavelet_decomposition(labdn->b[0], labdn->W, labdn->H, levwav, 1, 1, max(1, denoiseNestedLevels));
 
-                            // if (adecomp->memoryAllocationFailed) {
-                            //     memoryAllocationFailed = true;
-                            // }
+                            const std::vector<ChromaChannel> chroma = {
+                                { adecomp, noisevarab_r },
+                                { bdecomp, noisevarab_b }
+                            };
 
                             if (!memoryAllocationFailed) {
                                 if (nrQuality == QUALITY_STANDARD) {
-                                    if (!WaveletDenoiseAllAB(scale, *Ldecomp, *adecomp, noisevarchrom, madL, noisevarab_r, useNoiseCCurve, autoch)) { //enhance mode
+                                    if (!WaveletDenoiseAllAB(sched, scale, *Ldecomp, chroma, noisevarchrom, madL, useNoiseCCurve, autoch)) { //enhance mode
                                         //memoryAllocationFailed = true;
                                     }
                                 } else { /*if (nrQuality==QUALITY_HIGH)*/
-                                    if (!WaveletDenoiseAll_BiShrinkAB(scale, *Ldecomp, *adecomp, noisevarchrom, madL, noisevarab_r, useNoiseCCurve, autoch)) { //enhance mode
+                                    if (!WaveletDenoiseAll_BiShrinkAB(sched, scale, *Ldecomp, chroma, noisevarchrom, madL, useNoiseCCurve, autoch)) { //enhance mode
                                         //memoryAllocationFailed = true;
                                     }
 
                                     if (!memoryAllocationFailed) {
-                                        if (!WaveletDenoiseAllAB(scale, *Ldecomp, *adecomp, noisevarchrom, madL, noisevarab_r, useNoiseCCurve, autoch)) {
+                                        if (!WaveletDenoiseAllAB(sched, scale, *Ldecomp, chroma, noisevarchrom, madL, useNoiseCCurve, autoch)) {
                                             //memoryAllocationFailed = true;
                                         }
                                     }
@@ -2351,91 +2328,60 @@ BENCHFUN
 
                             if (!memoryAllocationFailed) {
                                 if (kall == 0) {
+                                    float chresid = 0.f;
+                                    float chmaxresid = 0.f;
                                     Noise_residualAB(*adecomp, chresid, chmaxresid);
-                                    chresidtemp = chresid;
-                                    chmaxresidtemp = chmaxresid;
+                                    const float chresidtemp = chresid;
+                                    const float chmaxresidtemp = chmaxresid;
+                                    Noise_residualAB(*bdecomp, chresid, chmaxresid);
+                                    chresid += chresidtemp;
+                                    chmaxresid += chmaxresidtemp;
+                                    chresid = sqrt(chresid / (6 * (levwav)));
+                                    highresi = chresid + 0.66f * (sqrt(chmaxresid) - chresid); //evaluate sigma
+                                    nresi = chresid;
                                 }
 
                                 adecomp->reconstruct(labdn->a[0]);
+                                bdecomp->reconstruct(labdn->b[0]);
                             }
 
                             delete adecomp;
+                            delete bdecomp;
 
                             if (!memoryAllocationFailed) {
-                                wavelet_decomposition* bdecomp = new wavelet_decomposition(labdn->b[0], labdn->W, labdn->H, levwav, 1, 1, max(1, denoiseNestedLevels));
+                                if (denoiseLuminance) {
+                                    int edge = 0;
 
-                                // if (bdecomp->memoryAllocationFailed) {
-                                //     memoryAllocationFailed = true;
-                                // }
-
-                                if (!memoryAllocationFailed) {
                                     if (nrQuality == QUALITY_STANDARD) {
-                                        if (!WaveletDenoiseAllAB(scale, *Ldecomp, *bdecomp, noisevarchrom, madL, noisevarab_b, useNoiseCCurve, autoch)) { //enhance mode
+                                        if (!WaveletDenoiseAllL(sched, scale, *Ldecomp, noisevarlum, madL, nullptr, edge)) { //enhance mode
                                             //memoryAllocationFailed = true;
                                         }
                                     } else { /*if (nrQuality==QUALITY_HIGH)*/
-                                        if (!WaveletDenoiseAll_BiShrinkAB(scale, *Ldecomp, *bdecomp, noisevarchrom, madL, noisevarab_b, useNoiseCCurve, autoch)) { //enhance mode
+                                        if (!WaveletDenoiseAll_BiShrinkL(sched, scale, *Ldecomp, noisevarlum, madL)) { //enhance mode
                                             //memoryAllocationFailed = true;
                                         }
 
                                         if (!memoryAllocationFailed) {
-                                            if (!WaveletDenoiseAllAB(scale, *Ldecomp, *bdecomp, noisevarchrom, madL, noisevarab_b, useNoiseCCurve, autoch)) {
+                                            if (!WaveletDenoiseAllL(sched, scale, *Ldecomp, noisevarlum, madL, nullptr, edge)) {
                                                 //memoryAllocationFailed = true;
                                             }
                                         }
                                     }
-                                }
 
-                                if (!memoryAllocationFailed) {
-                                    if (kall == 0) {
-                                        Noise_residualAB(*bdecomp, chresid, chmaxresid);
-                                        chresid += chresidtemp;
-                                        chmaxresid += chmaxresidtemp;
-                                        chresid = sqrt(chresid / (6 * (levwav)));
-                                        highresi = chresid + 0.66f * (sqrt(chmaxresid) - chresid); //evaluate sigma
-                                        nresi = chresid;
-                                    }
-
-                                    bdecomp->reconstruct(labdn->b[0]);
-                                }
-
-                                delete bdecomp;
-
-                                if (!memoryAllocationFailed) {
-                                    if (denoiseLuminance) {
-                                        int edge = 0;
-
-                                        if (nrQuality == QUALITY_STANDARD) {
-                                            if (!WaveletDenoiseAllL(scale, *Ldecomp, noisevarlum, madL, nullptr, edge)) { //enhance mode
-                                                //memoryAllocationFailed = true;
-                                            }
-                                        } else { /*if (nrQuality==QUALITY_HIGH)*/
-                                            if (!WaveletDenoiseAll_BiShrinkL(scale, *Ldecomp, noisevarlum, madL)) { //enhance mode
-                                                //memoryAllocationFailed = true;
-                                            }
-
-                                            if (!memoryAllocationFailed) {
-                                                if (!WaveletDenoiseAllL(scale, *Ldecomp, noisevarlum, madL, nullptr, edge)) {
-                                                    //memoryAllocationFailed = true;
-                                                }
-                                            }
-                                        }
-
-                                        if (!memoryAllocationFailed) {
-                                            // copy labdn->L to Lin before it gets modified by reconstruction
-                                            Lin = new array2D<float>(width, height);
+                                    if (!memoryAllocationFailed) {
+                                        // copy labdn->L to Lin before it gets modified by reconstruction
+                                        Lin = new array2D<float>(width, height);
 #ifdef _OPENMP
-                                            #pragma omp parallel for num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
+                                        #pragma omp parallel for num_threads(denoiseNestedLevels) if (denoiseNestedLevels>1)
 #endif
 
-                                            for (int i = 0; i < height; ++i) {
-                                                for (int j = 0; j < width; ++j) {
-                                                    (*Lin)[i][j] = labdn->L[i][j];
-                                                }
+                                        for (int i = 0; i < height; ++i) {
+                                            for (int j = 0; j < width; ++j) {
+                                                (*Lin)[i][j] = labdn->L[i][j];
                                             }
-
-                                            Ldecomp->reconstruct(labdn->L[0]);
                                         }
+
+                                        Ldecomp->reconstruct(labdn->L[0]);
                                     }
                                 }
                             }
@@ -2656,13 +2602,6 @@ BENCHFUN
                 }
             }
 
-            if (denoiseLuminance) {
-                // destroy the plans
-                fftwf_destroy_plan(plan_forward_blox[0]);
-                fftwf_destroy_plan(plan_backward_blox[0]);
-                fftwf_destroy_plan(plan_forward_blox[1]);
-                fftwf_destroy_plan(plan_backward_blox[1]);
-            }
         // } while (memoryAllocationFailed && numTries < 2 && (options.rgbDenoiseThreadLimit == 0) && !ponder);
 
         if (memoryAllocationFailed) {
@@ -2688,8 +2627,77 @@ BENCHFUN
 
 }
 
+#ifdef BENCHMARK
+
+void benchmark_denoise()
+{
+    constexpr int W = 4000;
+    constexpr int H = 3000;
+    constexpr int levwav = 5;
+    constexpr double scale = 1.0;
+
+    array2D<float> planes[3];
+    for (int c = 0; c < 3; ++c) {
+        planes[c](W, H);
+    }
+
+    unsigned int seed = 12345;
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            seed = seed * 1664525u + 1013904223u;
+            const float noise = float(seed >> 16) / 65536.f - 0.5f;
+            const float smooth = 0.5f + 0.25f * std::sin(x * 0.01f) * std::cos(y * 0.013f);
+            planes[0][y][x] = 32768.f * smooth + 2000.f * noise;
+            planes[1][y][x] = 3000.f * std::sin(x * 0.003f) + 800.f * noise;
+            planes[2][y][x] = 3000.f * std::cos(y * 0.002f) - 600.f * noise;
+        }
+    }
+
+    std::vector<float> noisevar(((H + 1) / 2) * ((W + 1) / 2), 1.f);
+
+    int maxthreads = 1;
+#ifdef _OPENMP
+    maxthreads = std::min(omp_get_num_procs(), 64);
+#endif
+    const int oldlevels = denoiseNestedLevels;
+    double base = 0;
+
+    for (int n = 1; ; n = std::min(2 * n, maxthreads)) {
+        denoiseNestedLevels = n;
+        wavelet_decomposition Ldecomp(planes[0][0], W, H, levwav, 1, 1, n);
+        wavelet_decomposition adecomp(planes[1][0], W, H, levwav, 1, 1, n);
+        wavelet_decomposition bdecomp(planes[2][0], W, H, levwav, 1, 1, n);
+        const std::vector<ChromaChannel> chroma = {
+            { &adecomp, 2.f },
+            { &bdecomp, 2.f }
+        };
+
+        TileScheduler sched(n);
+        float madL[8][3];
+        MyTime t1, t2;
+        t1.set();
+        compute_madL(sched, Ldecomp, madL);
+        WaveletDenoiseAll_BiShrinkAB(sched, scale, Ldecomp, chroma, noisevar.data(), madL, false, false);
+        WaveletDenoiseAllAB(sched, scale, Ldecomp, chroma, noisevar.data(), madL, false, false);
+        WaveletDenoiseAll_BiShrinkL(sched, scale, Ldecomp, noisevar.data(), madL);
+        WaveletDenoiseAllL(sched, scale, Ldecomp, noisevar.data(), madL, nullptr, 0);
+        t2.set();
+        const double us = std::max(t2.etime(t1), 1);
+        if (n == 1) {
+            base = us;
+        }
+        std::cout << "Denoise wavelet shrinkage, " << n << " thread(s): " << (double(W) * H / us) << " Mpix/s, speedup " << (base / us) << std::endl;
+        if (n == maxthreads) {
+            break;
+        }
+    }
+
+    denoiseNestedLevels = oldlevels;
+}
+
+#endif // BENCHMARK
+
 } // namespace denoise
 
 
 } // namespace rtengine
-
@@ -21,6 +21,10 @@
 #include "LUT3D.h"
 #include "linalgebra.h"
 #include "opthelper.h"
+#ifdef BENCHMARK
+#  include "StopWatch.h"
+#  include <iostream>
+#endif
 
 
 namespace rtengine {
@@ -84,6 +88,37 @@ bool LUT3D::operator()(float &r, float &g, float &b)
 }
 
 
+bool LUT3D::apply(float *r, float *g, float *b, int n)
+{
+    if (lut_.isEmpty()) {
+        return false;
+    }
+
+    int i = 0;
+#ifdef __SSE2__
+    const vfloat scalev = F2V(input_is_01_ ? 1.f : 1.f / 65535.f);
+    for (; i < n - 3; i += 4) {
+        vfloat rv = LVFU(r[i]) * scalev;
+        vfloat gv = LVFU(g[i]) * scalev;
+        vfloat bv = LVFU(b[i]) * scalev;
+        apply_tetra(rv, gv, bv);
+        STVFU(r[i], rv);
+        STVFU(g[i], gv);
+        STVFU(b[i], bv);
+    }
+#endif
+    for (; i < n; ++i) {
+        if (!input_is_01_) {
+            r[i] /= 65535.f;
+            g[i] /= 65535.f;
+            b[i] /= 65535.f;
+        }
+        apply_tetra(r[i], g[i], b[i]);
+    }
+    return true;
+}
+
+
 LUT3D::operator bool() const
 {
     return !lut_.isEmpty();
@@ -298,4 +333,183 @@ inline void LUT3D::apply_tetra(float &r, float &g, float &b)
     b = out[2];
 }
 
+
+#ifdef __SSE2__
+
+namespace {
+
+inline vfloat gather(const float *base, vint idx)
+{
+#ifdef __AVX2__
+    return _mm_i32gather_ps(base, idx, sizeof(float));
+#else
+    int ALIGNED16 i[4];
+    _mm_store_si128(reinterpret_cast<vint *>(i), idx);
+    return _mm_setr_ps(base[i[0]], base[i[1]], base[i[2]], base[i[3]]);
+#endif
+}
+
+} // namespace
+
+// vectorized version of the above, processing 4 pixels at a time. The
+// tetrahedron containing each point is selected with masks instead of
+// branches; the corner indices are computed in floating point (exact, as
+// they are < 2^24 for any reasonable LUT size)
+inline void LUT3D::apply_tetra(vfloat &r, vfloat &g, vfloat &b)
+{
+    const vfloat dimMinusOnev = F2V(dim_minus_one_);
+    const vfloat zerov = ZEROV;
+    const vfloat onev = F2V(1.f);
+    const vfloat strideR = F2V(3 * dim_ * dim_);
+    const vfloat strideG = F2V(3 * dim_);
+    const vfloat strideB = F2V(3);
+    const float *lut = lut_.data;
+
+    // NaNs become 0.
+    const vfloat idxR = vminf(vmaxf(r * dimMinusOnev, zerov), dimMinusOnev);
+    const vfloat idxG = vminf(vmaxf(g * dimMinusOnev, zerov), dimMinusOnev);
+    const vfloat idxB = vminf(vmaxf(b * dimMinusOnev, zerov), dimMinusOnev);
+
+    // the indices are non-negative, so truncation is the same as floor
+    const vfloat lowR = _mm_cvtepi32_ps(_mm_cvttps_epi32(idxR));
+    const vfloat lowG = _mm_cvtepi32_ps(_mm_cvttps_epi32(idxG));
+    const vfloat lowB = _mm_cvtepi32_ps(_mm_cvttps_epi32(idxB));
+
+    const vfloat fx = idxR - lowR;
+    const vfloat fy = idxG - lowG;
+    const vfloat fz = idxB - lowB;
+
+    // offsets of the "high" corner along each axis
+    const vfloat dR = vselfzero(vmaskf_gt(fx, zerov), strideR);
+    const vfloat dG = vselfzero(vmaskf_gt(fy, zerov), strideG);
+    const vfloat dB = vselfzero(vmaskf_gt(fz, zerov), strideB);
+
+    const vfloat n000 = lowR * strideR + lowG * strideG + lowB * strideB;
+
+    // same case analysis as the scalar version
+    const vmask xy = vmaskf_gt(fx, fy);
+    const vmask yz = vmaskf_gt(fy, fz);
+    const vmask xz = vmaskf_gt(fx, fz);
+    const vmask zy = vmaskf_gt(fz, fy);
+    const vmask zx = vmaskf_gt(fz, fx);
+
+    const vmask c1 = vandm(xy, yz);                          // x > y > z
+    const vmask c2 = vandm(vandnotm(yz, xy), xz);            // x > z >= y
+    const vmask c3 = vandnotm(xz, vandnotm(yz, xy));         // z >= x > y
+    const vmask c4 = vandnotm(xy, zy);                       // z > y >= x
+    const vmask c5 = vandm(vandnotm(xy, vnotm(zy)), zx);     // y >= z > x
+    // c6: y >= x >= z (remaining case)
+
+    // axes of the largest, middle and smallest fraction
+    const vmask maxx = vorm(c1, c2);
+    const vmask maxz = vorm(c3, c4);
+    const vmask midy = vorm(c1, c4);
+    const vmask midz = vorm(c2, c5);
+    const vmask miny = vorm(c2, c3);
+    const vmask minx = vorm(c4, c5);
+
+    const vfloat fmax = vself(maxx, fx, vself(maxz, fz, fy));
+    const vfloat fmid = vself(midy, fy, vself(midz, fz, fx));
+    const vfloat fmin = vself(miny, fy, vself(minx, fx, fz));
+
+    // the two intermediate corners of the tetrahedron: the first is high
+    // along the axis of the largest fraction, the second along all but the
+    // axis of the smallest one
+    const vfloat dsum = dR + dG + dB;
+    const vfloat d1 = vself(maxx, dR, vself(maxz, dB, dG));
+    const vfloat d2 = dsum - vself(miny, dG, vself(minx, dR, dB));
+
+    const vint i0 = _mm_cvtps_epi32(n000);
+    const vint i1 = _mm_cvtps_epi32(n000 + d1);
+    const vint i2 = _mm_cvtps_epi32(n000 + d2);
+    const vint i3 = _mm_cvtps_epi32(n000 + dsum);
+
+    const vfloat w0 = onev - fmax;
+    const vfloat w1 = fmax - fmid;
+    const vfloat w2 = fmid - fmin;
+    const vfloat w3 = fmin;
+
+    vfloat out[3];
+    for (int c = 0; c < 3; ++c) {
+        out[c] = w0 * gather(lut + c, i0) + w1 * gather(lut + c, i1) + w2 * gather(lut + c, i2) + w3 * gather(lut + c, i3);
+    }
+
+    r = out[0];
+    g = out[1];
+    b = out[2];
+}
+
+#endif // __SSE2__
+
+
+#ifdef BENCHMARK
+
+namespace {
+
+class BenchInitializer: public LUT3D::initializer {
+public:
+    explicit BenchInitializer(int dim): dim_(dim), i_(0) {}
+
+    void operator()(float &r, float &g, float &b) override
+    {
+        const int d2 = dim_ * dim_;
+        const float x = float(i_ / d2) / (dim_ - 1);
+        const float y = float((i_ / dim_) % dim_) / (dim_ - 1);
+        const float z = float(i_ % dim_) / (dim_ - 1);
+        ++i_;
+        r = SQR(x) * 0.8f + y * 0.2f;
+        g = std::sqrt(y) * 0.9f + z * 0.1f;
+        b = z * 0.7f + x * y * 0.3f;
+    }
+
+private:
+    int dim_;
+    int i_;
+};
+
+} // namespace
+
+
+void benchmark_LUT3D()
+{
+    constexpr int W = 4096;
+    constexpr int H = 512;
+    std::vector<float> src[3], buf[3];
+    for (int c = 0; c < 3; ++c) {
+        src[c].resize(W);
+        buf[c].resize(W);
+        for (int x = 0; x < W; ++x) {
+            src[c][x] = float((x * (c + 7) * 131) % 65536) / 65535.f;
+        }
+    }
+
+    for (int dim : { 33, 65 }) {
+        LUT3D lut;
+        BenchInitializer init(dim);
+        lut.init(dim, init);
+
+        for (int batched = 0; batched < 2; ++batched) {
+            MyTime t1, t2;
+            t1.set();
+            for (int y = 0; y < H; ++y) {
+                for (int c = 0; c < 3; ++c) {
+                    std::copy(src[c].begin(), src[c].end(), buf[c].begin());
+                }
+                if (batched) {
+                    lut.apply(&buf[0][0], &buf[1][0], &buf[2][0], W);
+                } else {
+                    for (int x = 0; x < W; ++x) {
+                        lut(buf[0][x], buf[1][x], buf[2][x]);
+                    }
+                }
+            }
+            t2.set();
+            const double us = std::max(t2.etime(t1), 1);
+            std::cout << "LUT3D " << dim << "^3 " << (batched ? "batched" : "per-pixel") << ": " << (double(W) * H / us) << " Mpix/s" << std::endl;
+        }
+    }
+}
+
+#endif // BENCHMARK
+
 } // namespace rtengine
@@ -21,6 +21,7 @@
 
 #include "rt_math.h"
 #include "alignedbuffer.h"
+#include "opthelper.h"
 #include <vector>
 
 
@@ -39,12 +40,17 @@ public:
 
     void init(int dim, initializer &f, bool input_is_01=true);
     bool operator()(float &r, float &g, float &b);
+    // batched version, processing n pixels in place
+    bool apply(float *r, float *g, float *b, int n);
 
     int dimension() const { return dim_; }
     operator bool() const;
 
 private:
     void apply_tetra(float &r, float &g, float &b);
+#ifdef __SSE2__
+    void apply_tetra(vfloat &r, vfloat &g, vfloat &b);
+#endif
 
     bool input_is_01_;
     int dim_;
@@ -52,4 +58,9 @@ private:
     AlignedBuffer<float> lut_;
 };
 
+#ifdef BENCHMARK
+// prints the throughput of the per-pixel and batched LUT application
+void benchmark_LUT3D();
+#endif
+
 } // namespace rtengine
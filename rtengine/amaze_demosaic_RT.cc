@@ -38,6 +38,7 @@
 namespace rtengine
 {
 
+RT_AVX2_CLONES
 void RawImageSource::amaze_demosaic_RT(int winx, int winy, int winw, int winh, const array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue)
 {
     BENCHFUN
@@ -0,0 +1,82 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "benchmark.h"
+
+#ifdef BENCHMARK
+
+#include <iostream>
+#include <algorithm>
+#include <utility>
+#include "LUT3D.h"
+#include "demosaic_benchmark.h"
+#include "ipdenoise.h"
+#include "imageio.h"
+#include "guidedfilter.h"
+#include "improcfun.h"
+#include "rawimage.h"
+
+namespace rtengine {
+
+int run_benchmarks(const std::vector<std::string> &names)
+{
+    const std::vector<std::pair<std::string, bool(*)()>> benchmarks = {
+        { "lut3d", []() -> bool { benchmark_LUT3D(); return true; } },
+        { "amaze", benchmark_amaze_demosaic },
+        { "rcd", benchmark_rcd_demosaic },
+        { "rawdecode", benchmark_raw_decode },
+        { "denoise", []() -> bool { denoise::benchmark_denoise(); return true; } },
+        { "savetiff", []() -> bool { benchmark_save_tiff(); return true; } },
+        { "guidedfilter", []() -> bool { benchmark_guided_filter(); return true; } },
+        { "strips", benchmark_strips }
+    };
+
+    int ret = 0;
+    for (auto &n : names) {
+        bool found = false;
+        for (auto &b : benchmarks) {
+            found = found || b.first == n;
+        }
+        if (!found) {
+            std::cerr << "unknown benchmark: " << n << std::endl;
+            ret = 1;
+        }
+    }
+    if (ret) {
+        std::cerr << "available benchmarks:";
+        for (auto &b : benchmarks) {
+            std::cerr << " " << b.first;
+        }
+        std::cerr << std::endl;
+        return ret;
+    }
+
+    for (auto &b : benchmarks) {
+        if (names.empty() || std::find(names.begin(), names.end(), b.first) != names.end()) {
+            if (!b.second()) {
+                ret = 1;
+            }
+        }
+    }
+
+    return ret;
+}
+
+} // namespace rtengine
+
+#endif // BENCHMARK
@@ -0,0 +1,36 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifdef BENCHMARK
+
+#include <string>
+#include <vector>
+
+namespace rtengine {
+
+// Runs the micro-benchmarks of the engine, after rtengine::init() (see the
+// --benchmark option of ART-cli in builds with WITH_BENCHMARK). If names is
+// empty, all of them are run. Returns 0 on success, 1 if some name is not
+// known or some of the checks done by the benchmarks failed
+int run_benchmarks(const std::vector<std::string> &names);
+
+} // namespace rtengine
+
+#endif // BENCHMARK
@@ -48,9 +48,19 @@ namespace cache_helper
     {
     };
 
+    // default weight of a cache entry: the size of the cache is then the
+    // maximum number of entries
+    template<typename V>
+    struct unit_weight {
+        unsigned long operator()(const V&) const
+        {
+            return 1;
+        }
+    };
+
 }
 
-template<class K, class V>
+template<class K, class V, class W = cache_helper::unit_weight<V>>
 class Cache
 {
 public:
@@ -68,6 +78,7 @@ public:
 
     Cache(unsigned long _size, Hook* _hook = nullptr) :
         store_size(std::max(_size, static_cast<unsigned long>(1))),
+        store_weight(0),
         hook(_hook)
     {
     }
@@ -129,7 +140,7 @@ public:
     void resize(unsigned long size)
     {
         mutex.lock();
-        while (lru_list.size() > size) {
+        while (!lru_list.empty() && (store_weight > size || size == 0)) {
             discard();
         }
         store_size = size;
@@ -146,6 +157,7 @@ public:
         }
         lru_list.clear();
         store.clear();
+        store_weight = 0;
         mutex.unlock();
     }
 
@@ -165,6 +177,7 @@ private:
 
     struct Value {
         V value;
+        unsigned long weight;
         LruListIterator lru_list_it;
     };
 
@@ -180,6 +193,7 @@ private:
         if (hook) {
             hook->onDiscard(store_it->first, store_it->second->value);
         }
+        store_weight -= store_it->second->weight;
         store.erase(store_it);
         lru_list.pop_back();
     }
@@ -191,17 +205,20 @@ private:
         const bool is_new_key = store_it == store.end();
         if (is_new_key) {
             if (mode == Mode::UNCOND || mode == Mode::UNKNOWN) {
-                if (lru_list.size() >= store_size) {
+                const unsigned long weight = W()(value);
+                while (!lru_list.empty() && store_weight + weight > store_size) {
                     discard();
                 }
                 lru_list.push_front(store.end());
                 std::unique_ptr<Value> v(
                     new Value{
                         value,
+                        weight,
                         lru_list.begin()
                     }
                 );
                 lru_list.front() = store.emplace(key, std::move(v)).first;
+                store_weight += weight;
             }
         } else {
             if (mode == Mode::UNCOND || mode == Mode::KNOWN) {
@@ -213,7 +230,13 @@ private:
                     lru_list,
                     store_it->second->lru_list_it
                 );
+                store_weight -= store_it->second->weight;
                 store_it->second->value = value;
+                store_it->second->weight = W()(value);
+                store_weight += store_it->second->weight;
+                while (lru_list.size() > 1 && store_weight > store_size) {
+                    discard();
+                }
             }
         }
         mutex.unlock();
@@ -226,11 +249,13 @@ private:
         if (hook) {
             hook->onRemove(store_it->first, store_it->second->value);
         }
+        store_weight -= store_it->second->weight;
         lru_list.erase(store_it->second->lru_list_it);
         store.erase(store_it);
     }
 
     unsigned long store_size;
+    unsigned long store_weight;
     Hook* const hook;
     mutable MyMutex mutex;
     Store store;
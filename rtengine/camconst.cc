@@ -803,6 +803,8 @@ CameraConstantsStore::parse_camera_constants_file(Glib::ustring filename_)
 
     buf[datasize] = '\0';
 
+    checksum_ = Glib::Checksum::compute_checksum(Glib::Checksum::CHECKSUM_MD5, checksum_ + std::string(buf, datasize));
+
     // remove comments
     cJSON_Minify(buf);
 
@@ -60,6 +60,7 @@ public:
 class CameraConstantsStore {
 private:
     std::map<std::string, CameraConst *> mCameraConstants;
+    std::string checksum_;
 
     CameraConstantsStore();
     bool parse_camera_constants_file(Glib::ustring filename);
@@ -69,6 +70,8 @@ public:
     void init(Glib::ustring baseDir, Glib::ustring userSettingsDir);
     static CameraConstantsStore *getInstance(void);
     CameraConst *get(const char make[], const char model[]);
+    // MD5 of the contents of all the files loaded by init()
+    const std::string &getChecksum() const { return checksum_; }
 };
 
 } // namespace rtengine
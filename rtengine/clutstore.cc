@@ -1656,15 +1656,12 @@ inline void CLUTApplication::CTL_apply(int thread_id, int W, float *r, float *g,
         }
 
         if (ctl_lut_) {
-            for (int x = 0; x < W; ++x) {
-                float r = CTL_shaper(rgb[0][x], false);
-                float g = CTL_shaper(rgb[1][x], false);
-                float b = CTL_shaper(rgb[2][x], false);
-                ctl_lut_(r, g, b);
-                rgb[0][x] = r;
-                rgb[1][x] = g;
-                rgb[2][x] = b;
-            }            
+            for (int i = 0; i < 3; ++i) {
+                for (int x = 0; x < W; ++x) {
+                    rgb[i][x] = CTL_shaper(rgb[i][x], false);
+                }
+            }
+            ctl_lut_.apply(&rgb[0][0], &rgb[1][0], &rgb[2][0], W);
         } else {
             for (int x = 0; x < W; x += ctl_chunk_size_) {
                 const auto n = (x + ctl_chunk_size_ < W ? ctl_chunk_size_ : W - x);
@@ -845,6 +845,13 @@ struct jhead {
 };
 
 int CLASS ljpeg_start (struct jhead *jh, int info_only)
+{
+  int ret = ljpeg_start (jh, info_only, ifp);
+  if (ret && !info_only) zero_after_ff = 1;
+  return ret;
+}
+
+int CLASS ljpeg_start (struct jhead *jh, int info_only, IMFILE *fp)
 {
   ushort c, tag, len;
   uchar data[0x10000];
@@ -852,13 +859,13 @@ int CLASS ljpeg_start (struct jhead *jh, int info_only)
 
   memset (jh, 0, sizeof *jh);
   jh->restart = INT_MAX;
-  if ((fgetc(ifp),fgetc(ifp)) != 0xd8) return 0;
+  if ((fgetc(fp),fgetc(fp)) != 0xd8) return 0;
   do {
-    if (!fread (data, 2, 2, ifp)) return 0;
+    if (!fread (data, 2, 2, fp)) return 0;
     tag =  data[0] << 8 | data[1];
     len = (data[2] << 8 | data[3]) - 2;
     if (tag <= 0xff00) return 0;
-    fread (data, 1, len, ifp);
+    fread (data, 1, len, fp);
     switch (tag) {
       case 0xffc3:
 	jh->sraw = ((data[7] >> 4) * (data[7] & 15) - 1) & 3;
@@ -869,7 +876,7 @@ int CLASS ljpeg_start (struct jhead *jh, int info_only)
 	jh->high = data[1] << 8 | data[2];
 	jh->wide = data[3] << 8 | data[4];
 	jh->clrs = data[5] + jh->sraw;
-	if (len == 9 && !dng_version) getc(ifp);
+	if (len == 9 && !dng_version) getc(fp);
 	break;
       case 0xffc4:
 	if (info_only) break;
@@ -898,7 +905,7 @@ int CLASS ljpeg_start (struct jhead *jh, int info_only)
   }
   jh->row = (ushort *) calloc (2 * jh->wide*jh->clrs, 4);
   merror (jh->row, "ljpeg_start()");
-  return zero_after_ff = 1;
+  return 1;
 }
 
 void CLASS ljpeg_end (struct jhead *jh)
@@ -909,19 +916,29 @@ void CLASS ljpeg_end (struct jhead *jh)
 }
 
 inline int CLASS ljpeg_diff (ushort *huff)
+{
+  return ljpeg_diff (huff, getbithuff);
+}
+
+inline int CLASS ljpeg_diff (ushort *huff, getbithuff_t &bithuff)
 {
   int len, diff;
 
-  len = gethuff(huff);
+  len = bithuff(*huff, huff+1);
   if (len == 16 && (!dng_version || dng_version >= 0x1010000))
     return -32768;
-  diff = getbits(len);
+  diff = bithuff(len, 0);
   if ((diff & (1 << (len-1))) == 0)
     diff -= (1 << len) - 1;
   return diff;
 }
 
 ushort * CLASS ljpeg_row (int jrow, struct jhead *jh)
+{
+  return ljpeg_row (jrow, jh, ifp, getbithuff);
+}
+
+ushort * CLASS ljpeg_row (int jrow, struct jhead *jh, IMFILE *fp, getbithuff_t &bithuff)
 {
   int col, c, diff, pred, spred=0;
   ushort mark=0, *row[3];
@@ -929,16 +946,16 @@ ushort * CLASS ljpeg_row (int jrow, struct jhead *jh)
   if (jrow * jh->wide % jh->restart == 0) {
     FORC(6) jh->vpred[c] = 1 << (jh->bits-1);
     if (jrow) {
-      fseek (ifp, -2, SEEK_CUR);
-      do mark = (mark << 8) + (c = fgetc(ifp));
+      fseek (fp, -2, SEEK_CUR);
+      do mark = (mark << 8) + (c = fgetc(fp));
       while (c != EOF && mark >> 4 != 0xffd);
     }
-    getbits(-1);
+    bithuff(-1, 0);
   }
   FORC3 row[c] = (jh->row + ((jrow & 1) + 1) * (jh->wide*jh->clrs*((jrow+c) & 1)));
   for (col=0; col < jh->wide; col++)
     FORC(jh->clrs) {
-      diff = ljpeg_diff (jh->huff[c]);
+      diff = ljpeg_diff (jh->huff[c], bithuff);
       if (jh->sraw && c <= jh->sraw && (col | c))
 		    pred = spred;
       else if (col) pred = row[0][-jh->clrs];
@@ -959,54 +976,125 @@ ushort * CLASS ljpeg_row (int jrow, struct jhead *jh)
   return row[2];
 }
 
+/*
+   RT: find the start of each restart interval of a lossless JPEG stream,
+   beginning at the current position of ifp. Returns false if the intervals
+   can't be decoded independently by ljpeg_row.
+ */
+bool CLASS ljpeg_find_restarts (const struct jhead &jh, std::vector<ssize_t> &starts)
+{
+  starts.clear();
+  if (jh.restart >= INT_MAX || jh.restart % jh.wide || jh.psv != 1)
+    return false;
+  const int rows = jh.restart / jh.wide;
+  const int count = (jh.high + rows - 1) / rows;
+  const uchar *data = fdata(0, ifp);
+  ssize_t pos = ftell(ifp);
+  starts.push_back(pos);
+  // in the entropy-coded data 0xff is always followed by 0x00, so
+  // 0xff 0xd0-0xd7 can only be a restart marker
+  while ((int)starts.size() < count && pos < ifp->size - 1) {
+    const uchar *p = (const uchar *) memchr(data + pos, 0xff, ifp->size - 1 - pos);
+    if (!p) break;
+    pos = p - data + 1;
+    if ((data[pos] & 0xf8) == 0xd0)
+      starts.push_back(++pos);
+    else if (data[pos] == 0xd9)
+      break;
+  }
+  return (int)starts.size() == count;
+}
+
 void CLASS lossless_jpeg_load_raw()
 {
   struct jhead jh;
   int row=0, col=0;
 
   if (!ljpeg_start (&jh, 0)) return;
-  int jwide = jh.wide * jh.clrs;
-  ushort *rp[2];
-  rp[0] = ljpeg_row (0, &jh);
-
-  for (int jrow=0; jrow < jh.high; jrow++) {
+  const int jwide = jh.wide * jh.clrs;
+
+  // RT: decode the whole bitstream first, then copy the samples to their
+  // place in the raw image. If the stream has restart markers, the
+  // intervals are decoded in parallel
+  std::vector<ushort> samples((size_t) jwide * jh.high);
+  std::vector<ssize_t> starts;
+  if (ljpeg_find_restarts (jh, starts) && starts.size() > 1) {
+    const int rows = jh.restart / jh.wide;
 #ifdef _OPENMP
-#pragma omp parallel sections
+#pragma omp parallel
 #endif
 {
+    IMFILE ifpthr = *ifp;
+    IMFILE *fp = &ifpthr;
+    unsigned zaf = 1;
+    getbithuff_t bithuff(this, fp, zaf);
+    struct jhead jhthr = jh;
+    jhthr.row = (ushort *) calloc (2 * jh.wide*jh.clrs, 4);
+    merror (jhthr.row, "lossless_jpeg_load_raw()");
+    ifpthr.plistener = nullptr;
 #ifdef _OPENMP
-    #pragma omp section
+    #pragma omp master
 #endif
     {
-        if(jrow < jh.high - 1)
-            rp[(jrow + 1)&1] = ljpeg_row (jrow + 1, &jh);
+    ifpthr.plistener = ifp->plistener;
     }
 #ifdef _OPENMP
-     #pragma omp section
+    #pragma omp for schedule(dynamic) nowait
 #endif
-    {
-    if (load_flags & 1)
-      row = jrow & 1 ? height-1-jrow/2 : jrow/2;
-    for (int jcol=0; jcol < jwide; jcol++) {
-      int val = curve[*rp[jrow&1]++];
-      if (cr2_slice[0]) {
-	int jidx = jrow*jwide + jcol;
-	int i = jidx / (cr2_slice[1]*raw_height);
-	int j;
-	if ((j = i >= cr2_slice[0]))
-		 i  = cr2_slice[0];
-	jidx -= i * (cr2_slice[1]*raw_height);
-	row = jidx / cr2_slice[1+j];
-	col = jidx % cr2_slice[1+j] + i*cr2_slice[1];
+    for (size_t i = 0; i < starts.size(); i++) {
+      // at the start of an interval, ljpeg_row resets the predictors and
+      // the bit reader (finding the restart marker just before starts[i])
+      fseek (fp, starts[i], SEEK_SET);
+      for (int jrow = i * rows; jrow < std::min<int>((i+1) * rows, jh.high); jrow++) {
+        ushort *rp = ljpeg_row (jrow, &jhthr, fp, bithuff);
+        memcpy (&samples[(size_t) jrow * jwide], rp, jwide * sizeof(ushort));
       }
-      if (raw_width == 3984 && (col -= 2) < 0)
-	col += (row--,raw_width);
-      if ((unsigned) row < raw_height) RAW(row,col) = val;
-      if (++col >= raw_width)
-	col = (row++,0);
-    }
     }
+    free (jhthr.row);
 }
+  } else {
+    for (int jrow=0; jrow < jh.high; jrow++) {
+      ushort *rp = ljpeg_row (jrow, &jh);
+      memcpy (&samples[(size_t) jrow * jwide], rp, jwide * sizeof(ushort));
+    }
+  }
+
+  if (cr2_slice[0]) {
+    // the position of each sample only depends on its index
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (int jrow=0; jrow < jh.high; jrow++) {
+      const ushort *rp = &samples[(size_t) jrow * jwide];
+      for (int jcol=0; jcol < jwide; jcol++) {
+        int val = curve[rp[jcol]];
+        int jidx = jrow*jwide + jcol;
+        int i = jidx / (cr2_slice[1]*raw_height);
+        int j;
+        if ((j = i >= cr2_slice[0]))
+          i  = cr2_slice[0];
+        jidx -= i * (cr2_slice[1]*raw_height);
+        int row = jidx / cr2_slice[1+j];
+        int col = jidx % cr2_slice[1+j] + i*cr2_slice[1];
+        if (raw_width == 3984 && (col -= 2) < 0)
+          col += (row--,raw_width);
+        if ((unsigned) row < raw_height) RAW(row,col) = val;
+      }
+    }
+  } else {
+    for (int jrow=0; jrow < jh.high; jrow++) {
+      const ushort *rp = &samples[(size_t) jrow * jwide];
+      if (load_flags & 1)
+        row = jrow & 1 ? height-1-jrow/2 : jrow/2;
+      for (int jcol=0; jcol < jwide; jcol++) {
+        int val = curve[rp[jcol]];
+        if (raw_width == 3984 && (col -= 2) < 0)
+          col += (row--,raw_width);
+        if ((unsigned) row < raw_height) RAW(row,col) = val;
+        if (++col >= raw_width)
+          col = (row++,0);
+      }
+    }
   }
   ljpeg_end (&jh);
 }
@@ -1193,12 +1281,87 @@ void CLASS lossless_dnglj92_load_raw()
     }
 }
 
+/*
+   RT: decode the tiles of a lossless JPEG DNG in parallel. Returns false
+   (without consuming any input) if this is not possible, e.g. because the
+   data is not tiled or some tiles use the lossy DCT encoding.
+ */
+bool CLASS lossless_dng_load_tiles()
+{
+  if (tile_length >= INT_MAX || !tile_width || !tile_length)
+    return false;
+
+  const int tiles_across = (raw_width + tile_width - 1) / tile_width;
+  const int tiles_down = (raw_height + tile_length - 1) / tile_length;
+  const int tiles = tiles_across * tiles_down;
+  if (tiles < 2)
+    return false;
+
+  const ssize_t save = ftell(ifp);
+  std::vector<unsigned> offsets(tiles);
+  bool ok = true;
+  for (int t=0; t < tiles && ok; t++) {
+    struct jhead jh;
+    offsets[t] = get4();
+    const ssize_t next = ftell(ifp);
+    fseek (ifp, offsets[t], SEEK_SET);
+    ok = ljpeg_start (&jh, 1, ifp) && jh.algo == 0xc3;
+    fseek (ifp, next, SEEK_SET);
+  }
+  if (!ok) {
+    fseek (ifp, save, SEEK_SET);
+    return false;
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+{
+  IMFILE ifpthr = *ifp;
+  IMFILE *fp = &ifpthr;
+  unsigned zaf = 1;
+  getbithuff_t bithuff(this, fp, zaf);
+  ifpthr.plistener = nullptr;
+#ifdef _OPENMP
+  #pragma omp master
+#endif
+  {
+  ifpthr.plistener = ifp->plistener;
+  }
+#ifdef _OPENMP
+  #pragma omp for schedule(dynamic) nowait
+#endif
+  for (int t=0; t < tiles; t++) {
+    struct jhead jh;
+    fseek (fp, offsets[t], SEEK_SET);
+    if (!ljpeg_start (&jh, 0, fp)) continue;
+    const unsigned trow = (t / tiles_across) * tile_length;
+    const unsigned tcol = (t % tiles_across) * tile_width;
+    unsigned jwide = jh.wide;
+    if (filters || (colors == 1 && jh.clrs > 1)) jwide *= jh.clrs;
+    jwide /= MIN (is_raw, tiff_samples);
+    for (unsigned row=0, col=0, jrow=0; jrow < jh.high; jrow++) {
+      ushort *rp = ljpeg_row (jrow, &jh, fp, bithuff);
+      for (unsigned jcol=0; jcol < jwide; jcol++) {
+        adobe_copy_pixel (trow+row, tcol+col, &rp);
+        if (++col >= tile_width || col >= raw_width)
+          row += 1 + (col = 0);
+      }
+    }
+    ljpeg_end (&jh);
+  }
+}
+  return true;
+}
+
 void CLASS lossless_dng_load_raw()
 {
   unsigned save, trow=0, tcol=0, jwide, jrow, jcol, row, col, i, j;
   struct jhead jh;
   ushort *rp;
 
+  if (lossless_dng_load_tiles()) return;
+
   while (trow < raw_height) {
     save = ftell(ifp);
     if (tile_length < INT_MAX)
@@ -1241,45 +1404,114 @@ void CLASS lossless_dng_load_raw()
 
 void CLASS packed_dng_load_raw()
 {
-  ushort *pixel, *rp;
-  int row, col;
   int isfloat = (tiff_nifds == 1 && tiff_ifd[0].sample_format == 3 && (tiff_bps == 16 || tiff_bps == 32));
   if (isfloat) {
     float_raw_image = new float[raw_width * raw_height];
   }
 
-  pixel = (ushort *) calloc (raw_width, tiff_samples*sizeof *pixel);
+  // RT: rows start at predictable offsets unless bytes can be stuffed in
+  // the bit stream, so in that case they can be decoded in parallel
+  const ssize_t start = ftell(ifp);
+  ssize_t row_bytes = 0;
+  if (tiff_bps == 16) {
+    row_bytes = (ssize_t) raw_width * tiff_samples * 2;
+  } else if (isfloat) {
+    row_bytes = (ssize_t) raw_width * sizeof(float);
+  } else if (!zero_after_ff) {
+    row_bytes = ((ssize_t) raw_width * tiff_samples * tiff_bps + 7) / 8;
+  }
+  const bool swap = (order == 0x4949) == (ntohs(0x1234) == 0x1234);
+
+#ifdef _OPENMP
+#pragma omp parallel if (row_bytes)
+#endif
+{
+  IMFILE ifpthr = *ifp;
+  IMFILE *fp = &ifpthr;
+  unsigned zaf = zero_after_ff;
+  getbithuff_t bithuff(this, fp, zaf);
+  ushort *pixel = (ushort *) calloc (raw_width, tiff_samples*sizeof *pixel);
   merror (pixel, "packed_dng_load_raw()");
-  for (row=0; row < raw_height; row++) {
+  ifpthr.plistener = nullptr;
+#ifdef _OPENMP
+  #pragma omp master
+#endif
+  {
+  ifpthr.plistener = ifp->plistener;
+  }
+#ifdef _OPENMP
+  #pragma omp for schedule(dynamic,16) nowait
+#endif
+  for (int row=0; row < raw_height; row++) {
+    if (row_bytes) {
+      fseek (fp, start + row * row_bytes, SEEK_SET);
+    }
     if (tiff_bps == 16) {
-      read_shorts (pixel, raw_width * tiff_samples);
+      if (fread (pixel, 2, raw_width * tiff_samples, fp) < raw_width * tiff_samples) derror();
+      if (swap) rtengine::swab ((char*)pixel, (char*)pixel, raw_width * tiff_samples * 2);
       if (isfloat) {
           uint32_t *dst = reinterpret_cast<uint32_t *>(&float_raw_image[row*raw_width]);
-          for (col = 0; col < raw_width; col++) {
+          for (int col = 0; col < raw_width; col++) {
               uint32_t f = DNG_HalfToFloat_i(pixel[col]);
               dst[col] = f;
           }
       }
     } else if (isfloat) {
-      if (fread(&float_raw_image[row*raw_width], sizeof(float), raw_width, ifp) != raw_width) {
+      if (fread(&float_raw_image[row*raw_width], sizeof(float), raw_width, fp) != raw_width) {
         derror();
       }
-      if ((order == 0x4949) == (ntohs(0x1234) == 0x1234)) {
-        char *d = reinterpret_cast<char *>(float_raw_image);
-        rtengine::swab(d, d, sizeof(float)*raw_width);
+      if (swap) {
+        uchar *d = reinterpret_cast<uchar *>(&float_raw_image[row*raw_width]);
+        for (int col = 0; col < raw_width; col++, d += 4) {
+          std::swap(d[0], d[3]);
+          std::swap(d[1], d[2]);
+        }
       }
     } else {
-      getbits(-1);
-      for (col=0; col < raw_width * tiff_samples; col++)
-	pixel[col] = getbits(tiff_bps);
+      bithuff(-1, 0);
+      for (int col=0; col < raw_width * tiff_samples; col++)
+	pixel[col] = bithuff(tiff_bps, 0);
     }
     if (!isfloat) {
-        for (rp=pixel, col=0; col < raw_width; col++)
+        ushort *rp = pixel;
+        for (int col=0; col < raw_width; col++)
             adobe_copy_pixel (row, col, &rp);
     }
   }
   free (pixel);
 }
+}
+
+/*
+   RT: name of the raw decoder in use, for diagnostic messages
+ */
+const char *CLASS load_raw_name()
+{
+#define RT_LOAD_RAW_NAME(f) if (load_raw == &CLASS f) return #f;
+  RT_LOAD_RAW_NAME(lossless_jpeg_load_raw)
+  RT_LOAD_RAW_NAME(lossless_dng_load_raw)
+  RT_LOAD_RAW_NAME(lossless_dnglj92_load_raw)
+  RT_LOAD_RAW_NAME(packed_dng_load_raw)
+  RT_LOAD_RAW_NAME(deflate_dng_load_raw)
+  RT_LOAD_RAW_NAME(lossy_dng_load_raw)
+  RT_LOAD_RAW_NAME(canon_sraw_load_raw)
+  RT_LOAD_RAW_NAME(nikon_load_raw)
+  RT_LOAD_RAW_NAME(nikon_14bit_load_raw)
+  RT_LOAD_RAW_NAME(sony_arw_load_raw)
+  RT_LOAD_RAW_NAME(sony_arw2_load_raw)
+  RT_LOAD_RAW_NAME(sony_arq_load_raw)
+  RT_LOAD_RAW_NAME(fuji_compressed_load_raw)
+  RT_LOAD_RAW_NAME(fuji_14bit_load_raw)
+  RT_LOAD_RAW_NAME(panasonic_load_raw)
+  RT_LOAD_RAW_NAME(panasonicC6_load_raw)
+  RT_LOAD_RAW_NAME(olympus_load_raw)
+  RT_LOAD_RAW_NAME(pentax_load_raw)
+  RT_LOAD_RAW_NAME(packed_load_raw)
+  RT_LOAD_RAW_NAME(unpacked_load_raw)
+  RT_LOAD_RAW_NAME(crxLoadRaw)
+#undef RT_LOAD_RAW_NAME
+  return "other";
+}
 
 void CLASS pentax_load_raw()
 {
@@ -3381,7 +3613,7 @@ void CLASS sony_arw_load_raw()
 void CLASS sony_arw2_load_raw()
 {
 
-#if defined( _OPENMP ) && defined( MYFILE_MMAP )
+#ifdef _OPENMP
 #pragma omp parallel
 #endif
 {
@@ -3391,7 +3623,7 @@ void CLASS sony_arw2_load_raw()
     int pos = ifpthr.pos;
     ushort pix[16];
 
-#if defined( _OPENMP ) && defined( MYFILE_MMAP )
+#ifdef _OPENMP
     // only master thread will update the progress bar
     ifpthr.plistener = nullptr;
     #pragma omp master
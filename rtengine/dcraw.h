@@ -22,6 +22,7 @@
 
 #include "myfile.h"
 #include <csetjmp>
+#include <vector>
 
 
 class DCraw
@@ -359,6 +360,14 @@ int ljpeg_start (struct jhead *jh, int info_only);
 void ljpeg_end (struct jhead *jh);
 int ljpeg_diff (ushort *huff);
 ushort * ljpeg_row (int jrow, struct jhead *jh);
+// RT: versions using an explicit input stream and bit reader, so that
+// independent parts of the data can be decoded in parallel
+int ljpeg_start (struct jhead *jh, int info_only, IMFILE *fp);
+int ljpeg_diff (ushort *huff, getbithuff_t &bithuff);
+ushort * ljpeg_row (int jrow, struct jhead *jh, IMFILE *fp, getbithuff_t &bithuff);
+bool ljpeg_find_restarts (const struct jhead &jh, std::vector<ssize_t> &starts);
+bool lossless_dng_load_tiles();
+const char *load_raw_name();
 void lossless_jpeg_load_raw();
 void ljpeg_idct (struct jhead *jh);
 
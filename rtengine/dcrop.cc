@@ -201,7 +201,9 @@ void Crop::update(int todo)
         }
 
         PreviewProps pp(trafx, trafy, trafw * skip, trafh * skip, skip);
-        parent->imgsrc->getImage(parent->currWB, tr, origCrop, pp, params.exposure, params.raw);
+        if (!parent->preview_pyramid.getImage(parent->imgsrc, parent->currWB, origCrop, pp, params.exposure, params.raw)) {
+            parent->imgsrc->getImage(parent->currWB, tr, origCrop, pp, params.exposure, params.raw);
+        }
         
         if (!invert_negative(origCrop)) {
             parent->imgsrc->convertColorSpace(origCrop, params.icm, parent->currWB);
@@ -294,7 +296,14 @@ void Crop::update(int todo)
                 drCompCrop.reset(f);
                 PreviewProps pp(0, 0, parent->fw, parent->fh, skip);
                 int tr = getCoarseBitMask(params.coarse);
-                parent->imgsrc->getImage(parent->currWB, tr, f, pp, params.exposure, params.raw);
+                bool cached = false;
+                {
+                    MyMutex::MyLock lock(parent->minit);
+                    cached = parent->preview_pyramid.getImage(parent->imgsrc, parent->currWB, f, pp, params.exposure, params.raw);
+                }
+                if (!cached) {
+                    parent->imgsrc->getImage(parent->currWB, tr, f, pp, params.exposure, params.raw);
+                }
                 if (!invert_negative(f)) {
                     parent->imgsrc->convertColorSpace(f, params.icm, parent->currWB);
                 }
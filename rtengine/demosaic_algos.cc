@@ -18,6 +18,7 @@
  */
 #include <cmath>
 #include <cassert>
+#include <algorithm>
 
 #include "rawimagesource.h"
 #include "rawimage.h"
@@ -1201,6 +1202,56 @@ void RawImageSource::nodemosaic(bool bw)
     }
 }
 
+/*
+ * Reduced-resolution demosaic used for zoomed-out previews. Each block of
+ * n x n pixels (n = 2 for Bayer, 3 for X-Trans, so that every block contains
+ * all the three colours) becomes one pixel of red, green and blue, with the
+ * average of the samples of each colour. The planes are allocated at the
+ * reduced size, getImage() takes care of the scaling (see demosaicReduction).
+ */
+void RawImageSource::superpixel_demosaic(int n)
+{
+    const bool xtrans = ri->getSensorType() == ST_FUJI_XTRANS;
+    const int w = (W + n - 1) / n;
+    const int h = (H + n - 1) / n;
+
+    red(w, h);
+    green(w, h);
+    blue(w, h);
+    demosaicReduction = n;
+
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 16)
+#endif
+    for (int y = 0; y < h; ++y) {
+        // blocks at the right and bottom borders are moved inwards, so that
+        // they still cover a whole set of colours
+        const int y0 = std::min(y * n, H - n);
+
+        for (int x = 0; x < w; ++x) {
+            const int x0 = std::min(x * n, W - n);
+
+            float sum[3] = { 0.f, 0.f, 0.f };
+            int count[3] = { 0, 0, 0 };
+
+            for (int i = y0; i < y0 + n; ++i) {
+                for (int j = x0; j < x0 + n; ++j) {
+                    unsigned c = xtrans ? ri->XTRANSFC(i, j) : FC(i, j);
+                    if (c == 3) { // second green
+                        c = 1;
+                    }
+                    sum[c] += rawData[i][j];
+                    ++count[c];
+                }
+            }
+
+            red[y][x] = count[0] ? sum[0] / count[0] : 0.f;
+            green[y][x] = count[1] ? sum[1] / count[1] : 0.f;
+            blue[y][x] = count[2] ? sum[2] / count[2] : 0.f;
+        }
+    }
+}
+
 /*
  *      Redistribution and use in source and binary forms, with or without
  *      modification, are permitted provided that the following conditions are
@@ -0,0 +1,213 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "demosaic_benchmark.h"
+
+#ifdef BENCHMARK
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+
+#include "rawimagesource.h"
+#include "rt_math.h"
+#include "sleef.h"
+#include "median.h"
+#include "StopWatch.h"
+#include "../rtgui/multilangmgr.h"
+#include "opthelper.h"
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+// Second copies of the demosaic functions marked with RT_AVX2_CLONES, built
+// only for the generic target, which is what the "default" clones run. The
+// headers they use are already included above, so the renaming macros only
+// affect the definitions
+#undef RT_AVX2_CLONES
+#define RT_AVX2_CLONES
+
+#define amaze_demosaic_RT amaze_demosaic_RT_reference
+#include "amaze_demosaic_RT.cc"
+#undef amaze_demosaic_RT
+
+#define rcd_demosaic rcd_demosaic_reference
+#include "rcd_demosaic.cc"
+#undef rcd_demosaic
+
+namespace rtengine {
+
+namespace {
+
+// Fills raw with a synthetic RGGB mosaic
+void make_benchmark_mosaic(array2D<float> &raw, int W, int H)
+{
+    raw(W, H);
+
+    unsigned int seed = 12345;
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            seed = seed * 1664525u + 1013904223u;
+            const float noise = float(seed >> 16) / 65536.f;
+            const float smooth = 0.5f + 0.25f * std::sin(x * 0.01f) * std::cos(y * 0.013f);
+            const float detail = ((x / 3 + y / 5) & 1) ? 0.2f : 0.f;
+            const float scale = (y & 1) ? ((x & 1) ? 0.6f : 1.f) : ((x & 1) ? 1.f : 0.8f);
+            raw[y][x] = 65535.f * scale * std::min(1.f, smooth + detail + 0.05f * noise);
+        }
+    }
+}
+
+
+// Runs a demosaic kernel on a W x H mosaic with 1, 2, 4, ... threads and
+// prints its throughput
+void benchmark_demosaic_kernel(const char *name, int W, int H, const std::function<void()> &kernel)
+{
+    int maxthreads = 1;
+#ifdef _OPENMP
+    maxthreads = omp_get_max_threads();
+#endif
+
+    for (int n = 1; ; n = std::min(2 * n, maxthreads)) {
+#ifdef _OPENMP
+        omp_set_num_threads(n);
+#endif
+        MyTime t1, t2;
+        t1.set();
+        kernel();
+        t2.set();
+        const double us = std::max(t2.etime(t1), 1);
+        std::cout << name << ", " << n << " thread(s): " << (double(W) * H / us) << " Mpix/s" << std::endl;
+        if (n == maxthreads) {
+            break;
+        }
+    }
+
+#ifdef _OPENMP
+    omp_set_num_threads(maxthreads);
+#endif
+}
+
+
+// Compares the output of a demosaic kernel with the one of its generic
+// build, bit for bit
+bool check_demosaic_kernel(const char *name, int W, int H, array2D<float> *const out[3], const std::function<void()> &kernel, const std::function<void()> &reference)
+{
+    reference();
+    std::unique_ptr<array2D<float>> ref[3];
+    for (int c = 0; c < 3; ++c) {
+        ref[c].reset(new array2D<float>(W, H, *out[c]));
+    }
+
+    kernel();
+
+    size_t diff = 0;
+    for (int c = 0; c < 3; ++c) {
+        for (int y = 0; y < H; ++y) {
+            if (std::memcmp((*ref[c])[y], (*out[c])[y], W * sizeof(float)) != 0) {
+                for (int x = 0; x < W; ++x) {
+                    diff += std::memcmp(&(*ref[c])[y][x], &(*out[c])[y][x], sizeof(float)) != 0;
+                }
+            }
+        }
+    }
+
+    if (diff) {
+        std::cout << name << ": " << diff << " values differ from the generic build" << std::endl;
+    } else {
+        std::cout << name << ": output identical to the generic build" << std::endl;
+    }
+    return diff == 0;
+}
+
+} // namespace
+
+
+bool benchmark_amaze_demosaic()
+{
+    constexpr int W = 4000;
+    constexpr int H = 3000;
+
+    RawImageSource src;
+    src.riFrames[0] = src.ri = new RawImage("");
+    src.numFrames = 1;
+    src.ri->set_filters(0x94949494); // RGGB
+    src.W = W;
+    src.H = H;
+    src.initialGain = 1.0;
+    make_benchmark_mosaic(src.rawData, W, H);
+    src.red(W, H);
+    src.green(W, H);
+    src.blue(W, H);
+    array2D<float> *const out[3] = { &src.red, &src.green, &src.blue };
+
+    const auto kernel =
+        [&]() -> void
+        {
+            src.amaze_demosaic_RT(0, 0, W, H, src.rawData, src.red, src.green, src.blue);
+        };
+
+    const bool ok = check_demosaic_kernel("AMaZE", W, H, out, kernel,
+        [&]() -> void
+        {
+            src.amaze_demosaic_RT_reference(0, 0, W, H, src.rawData, src.red, src.green, src.blue);
+        });
+    benchmark_demosaic_kernel("AMaZE", W, H, kernel);
+    return ok;
+}
+
+
+bool benchmark_rcd_demosaic()
+{
+    constexpr int W = 4000;
+    constexpr int H = 3000;
+
+    RawImageSource src;
+    src.riFrames[0] = src.ri = new RawImage("");
+    src.numFrames = 1;
+    src.ri->set_filters(0x94949494); // RGGB
+    src.W = W;
+    src.H = H;
+    src.initialGain = 1.0;
+    make_benchmark_mosaic(src.rawData, W, H);
+    src.red(W, H);
+    src.green(W, H);
+    src.blue(W, H);
+    array2D<float> *const out[3] = { &src.red, &src.green, &src.blue };
+
+    const auto kernel =
+        [&]() -> void
+        {
+            src.rcd_demosaic();
+        };
+
+    const bool ok = check_demosaic_kernel("RCD", W, H, out, kernel,
+        [&]() -> void
+        {
+            src.rcd_demosaic_reference();
+        });
+    benchmark_demosaic_kernel("RCD", W, H, kernel);
+    return ok;
+}
+
+} // namespace rtengine
+
+#endif // BENCHMARK
@@ -0,0 +1,35 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#ifdef BENCHMARK
+
+namespace rtengine {
+
+// Run AMaZE and RCD on a synthetic mosaic and print their throughput. They
+// also check that the output of the variant chosen for the CPU (see
+// RT_AVX2_CLONES in opthelper.h) is bit for bit the same as that of the
+// generic build, and return false if it is not. Defined in
+// demosaic_benchmark.cc
+bool benchmark_amaze_demosaic();
+bool benchmark_rcd_demosaic();
+
+} // namespace rtengine
+
+#endif // BENCHMARK
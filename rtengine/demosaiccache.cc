@@ -0,0 +1,413 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "demosaiccache.h"
+#include "camconst.h"
+#include "halffloat.h"
+#include "settings.h"
+#include "threadpool.h"
+#include "utils.h"
+#include "../rtgui/options.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <stdio.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <glib/gstdio.h>
+#include <giomm.h>
+
+namespace rtengine {
+
+extern const Settings *settings;
+
+namespace {
+
+constexpr char MAGIC[8] = { 'A', 'R', 'T', 'D', 'M', 'C', '0', '2' };
+constexpr float SCALE = 65535.f;
+
+struct Header {
+    char magic[8];
+    int32_t width;
+    int32_t height;
+    DemosaicCache::State state;
+    uint64_t zsize[DemosaicCache::NUM_PLANES];
+};
+
+
+// pixels are delta-coded along rows (with wrap-around, so this is lossless
+// for any T) and zlib-compressed
+template <class T>
+std::string encode_plane(std::vector<T> &pixels, int W, int H)
+{
+    for (int y = 0; y < H; ++y) {
+        T *row = &pixels[size_t(y) * W];
+        for (int x = W-1; x > 0; --x) {
+            row[x] -= row[x-1];
+        }
+    }
+
+    const size_t sz = pixels.size() * sizeof(T);
+    uLongf zsize = compressBound(sz);
+    std::string res(zsize, '\0');
+    if (compress2(reinterpret_cast<Bytef *>(&res[0]), &zsize, reinterpret_cast<const Bytef *>(pixels.data()), sz, 1) != Z_OK) {
+        return "";
+    }
+    res.resize(zsize);
+    return res;
+}
+
+
+template <class T>
+bool decode_pixels(const char *zdata, size_t zsize, int W, int H, std::vector<T> &pixels)
+{
+    pixels.resize(size_t(W) * H);
+    uLongf size = pixels.size() * sizeof(T);
+    if (uncompress(reinterpret_cast<Bytef *>(pixels.data()), &size, reinterpret_cast<const Bytef *>(zdata), zsize) != Z_OK || size != pixels.size() * sizeof(T)) {
+        return false;
+    }
+
+    for (int y = 0; y < H; ++y) {
+        T *row = &pixels[size_t(y) * W];
+        for (int x = 1; x < W; ++x) {
+            row[x] += row[x-1];
+        }
+    }
+    return true;
+}
+
+
+// the raw data are stored losslessly (as the bits of the floats), since
+// everything computed after preprocess() depends on them, while the
+// demosaiced planes are stored as half-floats
+bool decode_plane(const char *zdata, size_t zsize, int W, int H, bool lossless, array2D<float> &out)
+{
+    if (lossless) {
+        std::vector<uint32_t> pixels;
+        if (!decode_pixels(zdata, zsize, W, H, pixels)) {
+            return false;
+        }
+        out(W, H);
+        for (int y = 0; y < H; ++y) {
+            memcpy(out[y], &pixels[size_t(y) * W], W * sizeof(float));
+        }
+    } else {
+        std::vector<uint16_t> pixels;
+        if (!decode_pixels(zdata, zsize, W, H, pixels)) {
+            return false;
+        }
+        out(W, H);
+        for (int y = 0; y < H; ++y) {
+            const uint16_t *row = &pixels[size_t(y) * W];
+            for (int x = 0; x < W; ++x) {
+                out[y][x] = DNG_HalfToFloat(row[x]) * SCALE;
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+
+DemosaicCache::DemosaicCache()
+{
+}
+
+
+DemosaicCache *DemosaicCache::getInstance()
+{
+    static DemosaicCache instance;
+    return &instance;
+}
+
+
+bool DemosaicCache::enabled() const
+{
+    return settings->demosaic_cache_size > 0;
+}
+
+
+Glib::ustring DemosaicCache::getDir() const
+{
+    return Glib::build_filename(options.cacheBaseDir, "demosaic");
+}
+
+
+std::string DemosaicCache::getKey(const Glib::ustring &fname, unsigned int frame, const procparams::RAWParams &raw, const procparams::LensProfParams &lensProf, const procparams::CoarseTransformParams &coarse, const ColorTemp &wb)
+{
+    procparams::ProcParams pp;
+    pp.raw = raw;
+    pp.lensProf = lensProf;
+    pp.coarse = coarse;
+
+    const auto md5 = getMD5(fname, true);
+    const auto wbs = Glib::ustring::compose("%1 %2 %3", wb.getTemp(), wb.getGreen(), wb.getEqual());
+
+    // the preprocessing also depends on the camera constants and on the
+    // contents of the dark frame and flat field files, which are identified
+    // like the raw file itself
+    std::string extra = CameraConstantsStore::getInstance()->getChecksum();
+    if (raw.enable_darkframe && !raw.dark_frame.empty()) {
+        extra += "\n" + getMD5(raw.dark_frame, true);
+    }
+    if (raw.enable_flatfield && !raw.ff_file.empty()) {
+        extra += "\n" + getMD5(raw.ff_file, true);
+    }
+
+    return Glib::Checksum::compute_checksum(Glib::Checksum::CHECKSUM_SHA256, md5 + "\n" + std::to_string(frame) + "\n" + wbs + "\n" + extra + "\n" + pp.to_data());
+}
+
+
+bool DemosaicCache::load(const std::string &key, int W, int H, State &state, array2D<float> *planes[NUM_PLANES])
+{
+    const auto name = Glib::build_filename(getDir(), key);
+    std::string data;
+    try {
+        data = Glib::file_get_contents(name);
+    } catch (Glib::Exception &) {
+        if (settings->verbose > 1) {
+            std::cout << "demosaic cache miss: " << key << std::endl;
+        }
+        return false;
+    }
+
+    Header hdr;
+    if (data.size() < sizeof(Header)) {
+        return false;
+    }
+    memcpy(&hdr, data.data(), sizeof(Header));
+    if (memcmp(hdr.magic, MAGIC, sizeof(MAGIC)) != 0 || hdr.width != W || hdr.height != H) {
+        return false;
+    }
+    size_t offset[NUM_PLANES];
+    size_t total = sizeof(Header);
+    for (int i = 0; i < NUM_PLANES; ++i) {
+        offset[i] = total;
+        total += hdr.zsize[i];
+    }
+    if (total != data.size()) {
+        return false;
+    }
+
+    bool ok = true;
+#ifdef _OPENMP
+#   pragma omp parallel for num_threads(NUM_PLANES)
+#endif
+    for (int i = 0; i < NUM_PLANES; ++i) {
+        if (!decode_plane(data.data() + offset[i], hdr.zsize[i], W, H, i == RAW_DATA, *planes[i])) {
+#ifdef _OPENMP
+#           pragma omp atomic write
+#endif
+            ok = false;
+        }
+    }
+
+    if (!ok) {
+        g_remove(name.c_str());
+        return false;
+    }
+
+    state = hdr.state;
+    // mark the entry as recently used, for trim()
+    g_utime(name.c_str(), nullptr);
+
+    if (settings->verbose > 1) {
+        std::cout << "demosaic cache hit: " << key << std::endl;
+    }
+    return true;
+}
+
+
+void DemosaicCache::store(const std::string &key, int W, int H, const State &state, const array2D<float> *const planes[NUM_PLANES])
+{
+    if (!enabled()) {
+        return;
+    }
+
+    // the copies are done here, so that the caller can modify the planes as
+    // soon as we return
+    auto raw = std::make_shared<std::vector<uint32_t>>(size_t(W) * H);
+    for (int y = 0; y < H; ++y) {
+        memcpy(&(*raw)[size_t(y) * W], (*planes[RAW_DATA])[y], W * sizeof(float));
+    }
+
+    std::shared_ptr<std::vector<uint16_t>> pixels[NUM_PLANES];
+    for (int i = RAW_DATA + 1; i < NUM_PLANES; ++i) {
+        pixels[i] = std::make_shared<std::vector<uint16_t>>(size_t(W) * H);
+        const array2D<float> &src = *planes[i];
+        std::vector<uint16_t> &dst = *pixels[i];
+#ifdef _OPENMP
+#       pragma omp parallel for
+#endif
+        for (int y = 0; y < H; ++y) {
+            for (int x = 0; x < W; ++x) {
+                dst[size_t(y) * W + x] = DNG_FloatToHalf(src[y][x] / SCALE);
+            }
+        }
+    }
+
+    auto header = std::make_shared<Header>();
+    memcpy(header->magic, MAGIC, sizeof(MAGIC));
+    header->width = W;
+    header->height = H;
+    header->state = state;
+
+    const auto work =
+        [=]() -> void
+        {
+            std::string zdata[NUM_PLANES];
+#ifdef _OPENMP
+#           pragma omp parallel for num_threads(NUM_PLANES)
+#endif
+            for (int i = 0; i < NUM_PLANES; ++i) {
+                if (i == RAW_DATA) {
+                    zdata[i] = encode_plane(*raw, W, H);
+                    raw->clear();
+                    raw->shrink_to_fit();
+                } else {
+                    zdata[i] = encode_plane(*pixels[i], W, H);
+                    pixels[i]->clear();
+                    pixels[i]->shrink_to_fit();
+                }
+            }
+
+            for (int i = 0; i < NUM_PLANES; ++i) {
+                if (zdata[i].empty()) {
+                    return;
+                }
+                header->zsize[i] = zdata[i].size();
+            }
+            std::string data(reinterpret_cast<const char *>(header.get()), sizeof(Header));
+            for (int i = 0; i < NUM_PLANES; ++i) {
+                data += zdata[i];
+                zdata[i] = std::string();
+            }
+            write(key, std::move(data));
+        };
+
+    ThreadPool::add_task(ThreadPool::Priority::LOWEST, work);
+}
+
+
+void DemosaicCache::write(const std::string &key, std::string data)
+{
+    const auto dir = getDir();
+    if (g_mkdir_with_parents(dir.c_str(), 0777) != 0) {
+        return;
+    }
+
+    const auto name = Glib::build_filename(dir, key);
+    std::string tmpname = name + ".tmp-XXXXXX";
+    int fd = Glib::mkstemp(tmpname);
+    if (fd < 0) {
+        return;
+    }
+
+    bool ok = true;
+    for (size_t pos = 0; ok && pos < data.size(); ) {
+        const auto n = ::write(fd, data.data() + pos, data.size() - pos);
+        if (n <= 0) {
+            ok = false;
+        } else {
+            pos += n;
+        }
+    }
+    ok = (close(fd) == 0) && ok;
+
+    if (ok && g_rename(tmpname.c_str(), name.c_str()) == 0) {
+        if (settings->verbose > 1) {
+            std::cout << "demosaic cache store: " << key << " (" << data.size() / 1024 << " KB)" << std::endl;
+        }
+        trim();
+    } else {
+        g_remove(tmpname.c_str());
+    }
+}
+
+
+void DemosaicCache::trim()
+{
+    MyMutex::MyLock lock(trim_mutex_);
+
+    const auto dir_name = getDir();
+    const auto dir = Gio::File::create_for_path(dir_name);
+    const goffset max_size = goffset(settings->demosaic_cache_size) * 1024 * 1024;
+
+    struct Entry {
+        Glib::ustring name;
+        Glib::TimeVal mtime;
+        goffset size;
+    };
+    std::vector<Entry> files;
+    goffset total = 0;
+
+    try {
+        auto enumerator = dir->enumerate_children("standard::name,standard::size,time::modified");
+        while (auto file = enumerator->next_file()) {
+            files.push_back({file->get_name(), file->modification_time(), file->get_size()});
+            total += files.back().size;
+        }
+    } catch (Glib::Exception &) {}
+
+    if (total <= max_size) {
+        return;
+    }
+
+    std::sort(files.begin(), files.end(), [](const Entry &lhs, const Entry &rhs) -> bool
+    {
+        return lhs.mtime < rhs.mtime;
+    });
+
+    size_t num_removed = 0;
+    for (auto entry = files.begin(); total > max_size && entry != files.end(); ++entry) {
+        auto pth = Glib::build_filename(dir_name, entry->name);
+        auto error = g_remove(pth.c_str());
+        if (error && settings->verbose) {
+            std::cerr << "demosaic cache - error removing file: " << entry->name << std::endl;
+        } else {
+            total -= entry->size;
+            ++num_removed;
+        }
+    }
+
+    if (settings->verbose > 1) {
+        std::cout << "demosaic cache - removed " << num_removed << " files" << std::endl;
+    }
+}
+
+
+void DemosaicCache::clear()
+{
+    MyMutex::MyLock lock(trim_mutex_);
+
+    try {
+        const auto dirname = getDir();
+        Glib::Dir dir(dirname);
+
+        for (auto entry = dir.begin(); entry != dir.end(); ++entry) {
+            auto pth = Glib::build_filename(dirname, *entry);
+            g_remove(pth.c_str());
+        }
+    } catch (Glib::Exception &) {}
+}
+
+} // namespace rtengine
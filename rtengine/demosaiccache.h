@@ -0,0 +1,106 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <glibmm/ustring.h>
+
+#include "array2D.h"
+#include "colortemp.h"
+#include "noncopyable.h"
+#include "procparams.h"
+#include "../rtgui/threadutils.h"
+
+namespace rtengine {
+
+/**
+ * Persistent cache of the preprocessed raw data and of the demosaiced RGB
+ * data of the images opened in the editor, so that reopening an image with
+ * unchanged raw parameters skips RawImageSource::preprocess() and
+ * RawImageSource::demosaic().
+ *
+ * Entries are stored in the "demosaic" subdirectory of the cache directory,
+ * one file per entry, named after a SHA-256 of the file MD5, the frame
+ * number, the raw, lens correction and coarse transform parameters, the
+ * white balance used for preprocessing, the camera constants and the dark
+ * frame and flat field files in use. An entry is used only when all of
+ * these match, i.e. on an exact demosaic hit. The raw data are stored
+ * losslessly, so that demosaicing them again with other parameters gives
+ * the same result as without the cache. The demosaiced planes are stored
+ * as half-floats (scaled by 1/65535, so that highlights above the white
+ * level do not overflow). All planes are delta-coded along rows and
+ * zlib-compressed, in parallel. Writing happens in the background on the
+ * thread pool. The total size of the directory is kept within
+ * Settings::demosaic_cache_size MB by removing the least recently used
+ * entries. A size of 0 (the default) disables the cache.
+ *
+ * The cache is meant for the editor only: the half-float storage of the
+ * demosaiced planes is not lossless, so batch processing never uses it.
+ */
+class DemosaicCache: public NonCopyable {
+public:
+    enum Plane {
+        RAW_DATA,
+        RED,
+        GREEN,
+        BLUE,
+        NUM_PLANES
+    };
+
+    // the state of a RawImageSource after preprocess() and demosaic(),
+    // besides the pixel data
+    struct State {
+        float scale_mul[4];
+        float c_white[4];
+        float cblacksom[4];
+        float ref_pre_mul[4];
+        float chmax[4];
+        float clmax[4];
+        double refwb_red;
+        double refwb_green;
+        double refwb_blue;
+        double initialGain;
+        double defGain;
+        double contrastThreshold;
+        int flatFieldAutoClipValue;
+    };
+
+    static DemosaicCache *getInstance();
+
+    bool enabled() const;
+
+    static std::string getKey(const Glib::ustring &fname, unsigned int frame, const procparams::RAWParams &raw, const procparams::LensProfParams &lensProf, const procparams::CoarseTransformParams &coarse, const ColorTemp &wb);
+
+    // on success, the planes are resized to W x H
+    bool load(const std::string &key, int W, int H, State &state, array2D<float> *planes[NUM_PLANES]);
+    void store(const std::string &key, int W, int H, const State &state, const array2D<float> *const planes[NUM_PLANES]);
+
+    void clear();
+
+private:
+    DemosaicCache();
+
+    void write(const std::string &key, std::string data);
+    void trim();
+    Glib::ustring getDir() const;
+
+    MyMutex trim_mutex_;
+};
+
+} // namespace rtengine
@@ -0,0 +1,184 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "denoisescheduler.h"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <numeric>
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+namespace rtengine { namespace denoise {
+
+float *ScratchArena::get(int n, size_t size)
+{
+    AlignedBuffer<float> &buf = bufs_[n];
+    if (buf.getSize() < size) {
+        // no need to preserve the old contents
+        buf.resize(0);
+        buf.resize(size);
+    }
+    return buf.data;
+}
+
+
+int *ScratchArena::histogram()
+{
+    if (histo_.isEmpty()) {
+        histo_.resize(65536);
+    }
+    return histo_.data;
+}
+
+
+namespace {
+
+class TaskQueue {
+public:
+    TaskQueue(): pending_(0) {}
+
+    void push(int task, float cost)
+    {
+        tasks_.push_back(task);
+        pending_ += cost;
+    }
+
+    bool pop_front(const std::vector<float> &costs, int &task)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (tasks_.empty()) {
+            return false;
+        }
+        task = tasks_.front();
+        tasks_.pop_front();
+        pending_ -= costs[task];
+        return true;
+    }
+
+    bool pop_back(const std::vector<float> &costs, int &task)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (tasks_.empty()) {
+            return false;
+        }
+        task = tasks_.back();
+        tasks_.pop_back();
+        pending_ -= costs[task];
+        return true;
+    }
+
+    double pending()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tasks_.empty() ? 0 : std::max(pending_, 1e-6);
+    }
+
+private:
+    std::mutex mutex_;
+    std::deque<int> tasks_;
+    double pending_;
+};
+
+
+bool steal(std::vector<TaskQueue> &queues, const std::vector<float> &costs, int &task)
+{
+    while (true) {
+        int victim = -1;
+        double most = 0;
+        for (size_t i = 0; i < queues.size(); ++i) {
+            const double p = queues[i].pending();
+            if (p > most) {
+                most = p;
+                victim = i;
+            }
+        }
+        if (victim < 0) {
+            return false;
+        }
+        if (queues[victim].pop_back(costs, task)) {
+            return true;
+        }
+        // somebody else emptied the victim in the meantime, try again
+    }
+}
+
+} // namespace
+
+
+TileScheduler::TileScheduler(int num_threads)
+{
+    for (int i = 0, n = std::max(num_threads, 1); i < n; ++i) {
+        arenas_.emplace_back(new ScratchArena());
+    }
+}
+
+
+TileScheduler::~TileScheduler()
+{
+}
+
+
+void TileScheduler::run(const std::vector<float> &costs, const Worker &work)
+{
+    const int num_tasks = costs.size();
+    const int nthreads = std::min(num_tasks, num_threads());
+
+    std::vector<int> order(num_tasks);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](int a, int b) -> bool { return costs[a] > costs[b]; });
+
+    if (nthreads <= 1) {
+        for (int task : order) {
+            work(task, *arenas_[0]);
+        }
+        return;
+    }
+
+    // longest processing time first: each task goes to the least loaded
+    // thread so far
+    std::vector<TaskQueue> queues(nthreads);
+    std::vector<double> load(nthreads, 0.0);
+    for (int task : order) {
+        const int t = std::min_element(load.begin(), load.end()) - load.begin();
+        queues[t].push(task, costs[task]);
+        load[t] += costs[task];
+    }
+
+#ifdef _OPENMP
+#   pragma omp parallel num_threads(nthreads)
+#endif
+    {
+#ifdef _OPENMP
+        const int t = omp_get_thread_num();
+#else
+        const int t = 0;
+#endif
+        ScratchArena &arena = *arenas_[t];
+        int task;
+        while (queues[t].pop_front(costs, task) || steal(queues, costs, task)) {
+            work(task, arena);
+        }
+    }
+}
+
+}} // namespace rtengine::denoise
@@ -0,0 +1,88 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "alignedbuffer.h"
+#include "noncopyable.h"
+
+namespace rtengine { namespace denoise {
+
+/**
+ * Scratch memory of one worker thread of a TileScheduler.
+ *
+ * Buffers only grow, so they are allocated once per denoise run instead of
+ * once per wavelet pass. They are allocated lazily by the thread that uses
+ * them, so that with the usual first-touch policy their pages end up on the
+ * memory node of that thread.
+ */
+class ScratchArena: public NonCopyable {
+public:
+    static constexpr int NUM_BUFFERS = 4;
+
+    // returns buffer n (0 <= n < NUM_BUFFERS), with room for at least size
+    // floats. The contents are undefined
+    float *get(int n, size_t size);
+    // returns a histogram buffer of 65536 entries, for MadRgb()
+    int *histogram();
+
+private:
+    AlignedBuffer<float> bufs_[NUM_BUFFERS];
+    AlignedBuffer<int> histo_;
+};
+
+
+/**
+ * Runs a list of independent tasks of different costs on a fixed set of
+ * threads.
+ *
+ * The tasks of a denoise run are the subbands of the wavelet
+ * decompositions (or row bands of them) of the luminance and chrominance
+ * channels, whose sizes differ by a factor of 4 from one level to the
+ * next. Tasks are sorted by decreasing cost and dealt to per-thread queues
+ * so that each thread gets about the same total cost; each thread then
+ * takes its tasks from the front of its queue, and when it runs out it
+ * steals from the back of the queue with the most pending work.
+ *
+ * The scheduler also owns one ScratchArena per thread, which is passed to
+ * the tasks run by that thread. Since the assignment only depends on the
+ * costs, calling run() repeatedly with the same task list gives the same
+ * tasks (and the same arenas) to the same threads, except for stolen ones.
+ */
+class TileScheduler: public NonCopyable {
+public:
+    typedef std::function<void(int task, ScratchArena &arena)> Worker;
+
+    explicit TileScheduler(int num_threads);
+    ~TileScheduler();
+
+    int num_threads() const { return arenas_.size(); }
+
+    // runs work(i, arena) for each i in [0, costs.size()), and returns when
+    // all of them are done
+    void run(const std::vector<float> &costs, const Worker &work);
+
+private:
+    std::vector<std::unique_ptr<ScratchArena>> arenas_;
+};
+
+}} // namespace rtengine::denoise
@@ -35,6 +35,7 @@
 #include <giomm.h>
 #include <algorithm>
 #include <locale.h>
+#include <string.h>
 
 namespace rtengine {
 
@@ -133,7 +134,7 @@ std::pair<std::string, std::string> get_cache_keys(const Glib::ustring &filename
 }
 
 
-std::string find_in_cache(MyMutex &mtx, const std::string &key)
+std::string find_in_cache(const std::string &key)
 {
     auto name = Glib::build_filename(options.cacheBaseDir, "extlut", key);
     if (Glib::file_test(name, Glib::FILE_TEST_EXISTS)) {
@@ -143,15 +144,16 @@ std::string find_in_cache(MyMutex &mtx, const std::string &key)
             return "";
         }
         close(fd);
-        {
-            MyMutex::MyLock lck(mtx);
-            if (decompress_to(name, templ)) {
-                if (settings->verbose > 1) {
-                    std::cout << "extlut cache hit: " << key << std::endl;
-                }
-                return templ;
+        // entries are stored atomically (see store_in_cache), so no locking
+        // is needed here. If the entry is removed concurrently by
+        // trim_cache(), this is just a cache miss
+        if (decompress_to(name, templ)) {
+            if (settings->verbose > 1) {
+                std::cout << "extlut cache hit: " << key << std::endl;
             }
+            return templ;
         }
+        g_remove(templ.c_str());
     }
     if (settings->verbose > 1) {
         std::cout << "extlut cache miss: " << key << std::endl;
@@ -160,19 +162,77 @@ std::string find_in_cache(MyMutex &mtx, const std::string &key)
 }
 
 
-void store_in_cache(MyMutex &mtx, const std::string &key, const std::string &fn)
+void store_in_cache(const std::string &key, const std::string &fn)
 {
     auto dir = Glib::build_filename(options.cacheBaseDir, "extlut");
     auto error = g_mkdir_with_parents(dir.c_str(), 0777);
     if (!error) {
         auto name = Glib::build_filename(dir, key);
-        MyMutex::MyLock lck(mtx);
-        if (compress_to(fn, name)) {
+        std::string tmpname = name + ".tmp-XXXXXX";
+        int fd = Glib::mkstemp(tmpname);
+        if (fd < 0) {
+            return;
+        }
+        close(fd);
+        if (compress_to(fn, tmpname) && g_rename(tmpname.c_str(), name.c_str()) == 0) {
             if (settings->verbose > 1) {
                 std::cout << "extlut cache store: " << key << std::endl;
             }
+        } else {
+            g_remove(tmpname.c_str());
+        }
+    }
+}
+
+
+unsigned long get_processor_size(const OCIO::ConstProcessorRcPtr &proc)
+{
+    // rough estimate of the memory used by the processor, dominated by the
+    // LUT data
+    unsigned long sz = 4096;
+    try {
+        auto group = proc->createGroupTransform();
+        for (int i = 0, n = group->getNumTransforms(); i < n; ++i) {
+            OCIO::ConstTransformRcPtr t = group->getTransform(i);
+            if (auto l3 = OCIO::DynamicPtrCast<const OCIO::Lut3DTransform>(t)) {
+                const unsigned long g = l3->getGridSize();
+                sz += g * g * g * 3 * sizeof(float);
+            } else if (auto l1 = OCIO::DynamicPtrCast<const OCIO::Lut1DTransform>(t)) {
+                sz += l1->getLength() * 3 * sizeof(float);
+            }
         }
+    } catch (...) {
     }
+    return sz;
+}
+
+
+constexpr char FRAME_MAGIC[] = "ARTL";
+constexpr uint32_t FRAME_MAX_SIZE = 256 * 1024 * 1024;
+
+
+void put_blob(std::string &buf, const std::string &data)
+{
+    const uint32_t n = data.size();
+    for (int i = 0; i < 4; ++i) {
+        buf.push_back(char((n >> (8 * i)) & 0xff));
+    }
+    buf += data;
+}
+
+
+bool get_blob(subprocess::SubprocessInfo *p, std::string &data)
+{
+    unsigned char b[4];
+    if (p->read(reinterpret_cast<char *>(b), 4) != 4) {
+        return false;
+    }
+    const uint32_t n = uint32_t(b[0]) | (uint32_t(b[1]) << 8) | (uint32_t(b[2]) << 16) | (uint32_t(b[3]) << 24);
+    if (n > FRAME_MAX_SIZE) {
+        return false;
+    }
+    data.resize(n);
+    return n == 0 || p->read(&data[0], n) == n;
 }
 
 
@@ -203,112 +263,194 @@ bool skip_line(subprocess::SubprocessInfo *p, std::vector<char> *buf)
 ExternalLUT3D::SubprocessManager::~SubprocessManager()
 {
     for (auto &p : procs_) {
-        if (p.second->live()) {
+        auto &proc = p.second->proc;
+        if (proc->live()) {
             if (settings->verbose > 1) {
-                std::cout << "extlut - terminating process with id: " << p.second->id() << ", key: " << p.first << std::endl;
+                std::cout << "extlut - terminating process with id: " << proc->id() << ", key: " << p.first << std::endl;
             }
-            p.second->kill();
+            proc->kill();
         }
     }
 }
 
 
-bool ExternalLUT3D::SubprocessManager::process(const Glib::ustring &filename, const Glib::ustring &workdir, const std::vector<Glib::ustring> &argv, const std::string &params, const std::string &outname)
+std::shared_ptr<ExternalLUT3D::SubprocessManager::Server> ExternalLUT3D::SubprocessManager::get_server(const std::string &key, const Glib::ustring &filename, const Glib::ustring &workdir, const std::vector<Glib::ustring> &argv, bool framed)
 {
-    auto key = getMD5(filename, true);
+    MyMutex::MyLock lck(mutex_);
+
     auto it = procs_.find(key);
-    subprocess::SubprocessInfo *p = nullptr;
-    if (it == procs_.end() || !it->second->live()) {
-        if (settings->verbose > 1) {
-            std::cout << "extlut - executing server:";
-            for (auto &a : argv) {
-                std::cout << " " << a;
-            }
-            std::cout << "\nworkdir: " << workdir << std::endl;
-        }
-        auto pp = subprocess::popen(workdir, argv, true, true, true);
-        if (!pp) {
-            return false;
-        }
-        p = pp.get();
-        procs_[key] = std::move(pp);
-        if (settings->verbose > 1) {
-            std::cout << "extlut - started server for filename: " << filename << ", key: " << key << ", id: " << p->id() << std::endl;
+    if (it != procs_.end() && it->second->proc->live()) {
+        return it->second;
+    }
+    
+    if (settings->verbose > 1) {
+        std::cout << "extlut - executing server:";
+        for (auto &a : argv) {
+            std::cout << " " << a;
         }
-    } else {
-        p = it->second.get();
+        std::cout << "\nworkdir: " << workdir << std::endl;
+    }
+    // with the framed protocol, stdout carries binary data, so stderr is
+    // kept separate
+    auto pp = subprocess::popen(workdir, argv, true, true, true, !framed);
+    if (!pp) {
+        return nullptr;
     }
+    std::shared_ptr<Server> srv(new Server());
+    srv->proc = std::move(pp);
+    procs_[key] = srv;
+    if (settings->verbose > 1) {
+        std::cout << "extlut - started server for filename: " << filename << ", key: " << key << ", id: " << srv->proc->id() << std::endl;
+    }
+    return srv;
+}
+
+
+void ExternalLUT3D::SubprocessManager::drop_server(const std::string &key, const std::shared_ptr<Server> &srv)
+{
+    srv->proc->kill();
+    
+    MyMutex::MyLock lck(mutex_);
+    auto it = procs_.find(key);
+    if (it != procs_.end() && it->second == srv) {
+        procs_.erase(it);
+    }
+}
+
+
+bool ExternalLUT3D::SubprocessManager::process(const Glib::ustring &filename, const Glib::ustring &workdir, const std::vector<Glib::ustring> &argv, const std::string &params, const std::string &outname)
+{
+    auto key = getMD5(filename, true);
+    auto srv = get_server(key, filename, workdir, argv, false);
+    if (!srv) {
+        return false;
+    }
+
+    // requests to the same server are serialized, different servers can
+    // run concurrently
+    MyMutex::MyLock lck(srv->mutex);
+    auto p = srv->proc.get();
+    
     bool err = false;
-    if (p) {
-        if (!p->write(params.c_str(), params.size()) || !p->write("\n", 1) ||
-            !p->write(outname.c_str(), outname.size()) || !p->write("\n", 1)) {
+    if (!p->write(params.c_str(), params.size()) || !p->write("\n", 1) ||
+        !p->write(outname.c_str(), outname.size()) || !p->write("\n", 1)) {
+        err = true;
+    }
+    while (!err) {
+        int c = p->read();
+        if (c < 0) {
             err = true;
-        }
-        while (true) {
-            int c = p->read();
-            if (c < 0) {
-                err = true;
-                break;
-            } else if (c == 'Y' || c == 'N') {
-                bool success = (c == 'Y');
-                std::vector<char> buf;
-                while (true) {
-                    c = p->read();
-                    if (c < 0) {
+            break;
+        } else if (c == 'Y' || c == 'N') {
+            bool success = (c == 'Y');
+            std::vector<char> buf;
+            while (true) {
+                c = p->read();
+                if (c < 0) {
+                    err = true;
+                    break;
+                } else if (c == '\n') {
+                    buf.push_back(0);
+                    break;
+                } else {
+                    buf.push_back(c);
+                }
+            }
+            if (!err) {
+                int n = atoi(&buf[0]);
+                buf.clear();
+                while (n > 0) {
+                    if (!skip_line(p, settings->verbose > 1 ? &buf : nullptr)) {
                         err = true;
                         break;
-                    } else if (c == '\n') {
-                        buf.push_back(0);
-                        break;
-                    } else {
-                        buf.push_back(c);
                     }
+                    --n;
                 }
-                if (!err) {
-                    int n = atoi(&buf[0]);
-                    buf.clear();
-                    while (n > 0) {
-                        if (!skip_line(p, settings->verbose > 1 ? &buf : nullptr)) {
-                            err = true;
-                            break;
-                        }
-                        --n;
-                    }
-                    if (settings->verbose > 1) {
-                        buf.push_back(0);
-                        std::cout << "subprocess output:\n" << (&buf[0]) << std::endl;
-                    }
-                }
-                if (!err) {
-                    return success;
+                if (settings->verbose > 1) {
+                    buf.push_back(0);
+                    std::cout << "subprocess output:\n" << (&buf[0]) << std::endl;
                 }
-            } else {
-                if (settings->verbose) {
-                    std::cout << "unexpected output from subprocess: " << char(c);
-                    const char *dbg = g_getenv("ART_DEBUG_EXTCLUT");
-                    if (dbg && atoi(dbg)) {
-                        while ((c = p->read()) > 0) {
-                            std::cout << char(c);
-                        }
+            }
+            if (!err) {
+                return success;
+            }
+        } else {
+            if (settings->verbose) {
+                std::cout << "unexpected output from subprocess: " << char(c);
+                const char *dbg = g_getenv("ART_DEBUG_EXTCLUT");
+                if (dbg && atoi(dbg)) {
+                    while ((c = p->read()) > 0) {
+                        std::cout << char(c);
                     }
-                    std::cout << std::endl;
                 }
-                err = true;
-                break;
+                std::cout << std::endl;
             }
+            err = true;
+            break;
         }
-    } else {
-        err = true;
+    }
+
+    drop_server(key, srv);
+    return false;
+}
+
+
+/*
+ * Framed binary protocol, used by servers declaring "protocol": 2. All
+ * integers are 32-bit little endian, and a blob is a length followed by that
+ * many bytes.
+ *
+ * request (ART -> server):  "ARTL" <key blob> <params blob>
+ * response (server -> ART): "ARTL" <key blob> <status byte> <log blob> <LUT blob>
+ *
+ * The params blob is the JSON object with the parameter values, and the key
+ * is an opaque identifier (a hash of the LUT file and of the parameters)
+ * that the server must echo back. The status is 'Y' on success and 'N' on
+ * failure. On success, the LUT blob contains the LUT in any format readable
+ * by OCIO (typically CLF). The log is only used for diagnostics, and should
+ * also be used by the server instead of stdout for any other output.
+ */
+bool ExternalLUT3D::SubprocessManager::process_framed(const Glib::ustring &filename, const Glib::ustring &workdir, const std::vector<Glib::ustring> &argv, const std::string &key, const std::string &params, std::string &out)
+{
+    auto id = getMD5(filename, true);
+    auto srv = get_server(id, filename, workdir, argv, true);
+    if (!srv) {
+        return false;
+    }
+
+    MyMutex::MyLock lck(srv->mutex);
+    auto p = srv->proc.get();
+
+    std::string req = FRAME_MAGIC;
+    put_blob(req, key);
+    put_blob(req, params);
+
+    bool err = !p->write(req.c_str(), req.size());
+    bool success = false;
+    std::string log;
+    if (!err) {
+        char magic[4];
+        std::string rkey;
+        char status = 0;
+        err = p->read(magic, 4) != 4 || memcmp(magic, FRAME_MAGIC, 4) != 0
+            || !get_blob(p, rkey) || rkey != key
+            || p->read(&status, 1) != 1
+            || !get_blob(p, log) || !get_blob(p, out);
+        success = !err && status == 'Y';
+    }
+
+    if (settings->verbose > 1 && !log.empty()) {
+        std::cout << "subprocess output:\n" << log << std::endl;
     }
 
     if (err) {
-        if (p) {
-            p->kill();
+        if (settings->verbose) {
+            std::cout << "extlut - protocol error from server for " << filename << std::endl;
         }
-        procs_.erase(key);
+        drop_server(id, srv);
     }
-    
-    return false;
+
+    return success;
 }
 
 //-----------------------------------------------------------------------------
@@ -316,14 +458,18 @@ bool ExternalLUT3D::SubprocessManager::process(const Glib::ustring &filename, co
 //-----------------------------------------------------------------------------
 
 
-Cache<std::string, OCIO::ConstProcessorRcPtr> ExternalLUT3D::cache_(options.clutCacheSize * 4);
-MyMutex ExternalLUT3D::disk_cache_mutex_;
+// the actual size (in MB, from options.extlut_cache_size) is set when the
+// cache is used, since the options are not loaded yet at this point
+Cache<std::string, ExternalLUT3D::CacheEntry, ExternalLUT3D::CacheEntrySize> ExternalLUT3D::cache_(1);
+MyMutex ExternalLUT3D::pending_mutex_;
+std::unordered_map<std::string, std::weak_ptr<MyMutex>> ExternalLUT3D::pending_;
 ExternalLUT3D::SubprocessManager ExternalLUT3D::smgr_;
 
 
 ExternalLUT3D::ExternalLUT3D():
     ok_(false),
-    is_server_(false)
+    is_server_(false),
+    is_framed_(false)
 {
 }
 
@@ -331,6 +477,7 @@ ExternalLUT3D::ExternalLUT3D():
 ExternalLUT3D::ExternalLUT3D(const Glib::ustring &filename):
     ok_(false),
     is_server_(false),
+    is_framed_(false),
     filename_(filename)
 {
     init(filename);
@@ -341,6 +488,7 @@ bool ExternalLUT3D::init(const Glib::ustring &filename)
 {
     ok_ = false;
     is_server_ = false;
+    is_framed_ = false;
     filename_ = filename;
     
     const std::unique_ptr<FILE, std::function<void (FILE*)>> file(
@@ -423,6 +571,18 @@ bool ExternalLUT3D::init(const Glib::ustring &filename)
         }
         is_server_ = cJSON_IsTrue(is_server);
     }
+
+    cJSON *protocol = cJSON_GetObjectItem(root, "protocol");
+    if (protocol) {
+        if (!cJSON_IsNumber(protocol)) {
+            return false;
+        }
+        const int v = protocol->valueint;
+        if (v != 1 && v != 2) {
+            return false;
+        }
+        is_framed_ = is_server_ && (v == 2);
+    }
     
     if (gui_name_.empty()) {
         gui_name_ = removeExtension(Glib::path_get_basename(filename_));
@@ -439,46 +599,71 @@ bool ExternalLUT3D::set_param_values(const CLUTParamValueMap &values)
         return false;
     }
     bool success = true;
-    OCIO::ConstProcessorRcPtr lut;
+    CacheEntry lut;
     std::pair<std::string, std::string> key = get_cache_keys(filename_, params_, values);
     bool found = cache_.get(key.first, lut);
     if (!found) {
-        if (settings->verbose) {
-            std::cout << "computing 3dlut for " << filename_ << std::endl;
-        }
-        std::string pn = generate_params(params_, values);
-        std::string fn = find_in_cache(disk_cache_mutex_, key.second);
-        if (fn.empty()) {
-            fn = recompute_lut(pn);
-            if (!fn.empty()) {
-                store_in_cache(disk_cache_mutex_, key.second, fn);
+        // concurrent requests for the same parameters wait for the first one
+        // to compute the LUT, instead of computing it again
+        std::shared_ptr<MyMutex> pending;
+        {
+            MyMutex::MyLock lck(pending_mutex_);
+            for (auto it = pending_.begin(); it != pending_.end(); ) {
+                if (it->second.expired()) {
+                    it = pending_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            auto &p = pending_[key.first];
+            pending = p.lock();
+            if (!pending) {
+                pending = std::make_shared<MyMutex>();
+                p = pending;
             }
         }
+        MyMutex::MyLock plck(*pending);
+        found = cache_.get(key.first, lut);
+        if (!found) {
+            if (settings->verbose) {
+                std::cout << "computing 3dlut for " << filename_ << std::endl;
+            }
+            std::string pn = is_framed_ ? get_params_json(params_, values) : generate_params(params_, values);
+            std::string fn = find_in_cache(key.second);
+            if (fn.empty()) {
+                fn = is_framed_ ? recompute_lut_framed(key.first, pn) : recompute_lut(pn);
+                if (!fn.empty()) {
+                    store_in_cache(key.second, fn);
+                }
+            }
 
-        try {
-            OCIO::ConstConfigRcPtr config = OCIO::Config::CreateRaw();
-            OCIO::FileTransformRcPtr t = OCIO::FileTransform::Create();
-            t->setSrc(fn.c_str());
-            t->setInterpolation(OCIO::INTERP_BEST);
-            lut = config->getProcessor(t);
-            cache_.set(key.first, lut);
-        } catch (...) {
-            ok_ = false;
-            success = false;
-        }
+            try {
+                OCIO::ConstConfigRcPtr config = OCIO::Config::CreateRaw();
+                OCIO::FileTransformRcPtr t = OCIO::FileTransform::Create();
+                t->setSrc(fn.c_str());
+                t->setInterpolation(OCIO::INTERP_BEST);
+                lut.proc = config->getProcessor(t);
+                lut.size = get_processor_size(lut.proc);
+                cache_.resize((unsigned long)(std::max(options.extlut_cache_size, 1)) << 20);
+                cache_.set(key.first, lut);
+            } catch (...) {
+                ok_ = false;
+                success = false;
+            }
         
-        if (!pn.empty()) {
-            g_remove(pn.c_str());
-        }
-        if (!fn.empty()) {
-            g_remove(fn.c_str());
+            if (!pn.empty() && !is_framed_) {
+                g_remove(pn.c_str());
+            }
+            if (!fn.empty()) {
+                g_remove(fn.c_str());
+            }
         }
     }
-    if (lut) {
+    if (lut.proc) {
         try {
-            proc_ = lut->getOptimizedCPUProcessor(OCIO::BIT_DEPTH_F32, 
-                                                  OCIO::BIT_DEPTH_F32,
-                                                  OCIO::OPTIMIZATION_DEFAULT);
+            proc_ = lut.proc->getOptimizedCPUProcessor(OCIO::BIT_DEPTH_F32, 
+                                                       OCIO::BIT_DEPTH_F32,
+                                                       OCIO::OPTIMIZATION_DEFAULT);
         } catch (...) {
             ok_ = false;
             success = false;
@@ -492,8 +677,6 @@ bool ExternalLUT3D::set_param_values(const CLUTParamValueMap &values)
 
 void ExternalLUT3D::trim_cache()
 {
-    MyMutex::MyLock lck(disk_cache_mutex_);
-    
     size_t num_files = 0;
     const size_t max_num_files = std::min(size_t(options.clutCacheSize) * 100, options.maxCacheEntries);
     const auto dir_name = Glib::build_filename(options.cacheBaseDir, "extlut");
@@ -551,8 +734,6 @@ void ExternalLUT3D::trim_cache()
 
 void ExternalLUT3D::clear_cache()
 {
-    MyMutex::MyLock lck(disk_cache_mutex_);
-
     try {
         auto dirname = Glib::build_filename(options.cacheBaseDir, "extlut");
         Glib::Dir dir(dirname);
@@ -598,7 +779,6 @@ std::string ExternalLUT3D::recompute_lut(const std::string &params)
             if (settings->verbose > 1) {
                 std::cout << "extlut - executing server for " << filename_ << ": " << params << " " << fn << std::endl;
             }
-            MyMutex::MyLock lck(disk_cache_mutex_);
             if (!smgr_.process(filename_, workdir_, argv_, params, fn)) {
                 if (settings->verbose) {
                     std::cout << "extlut - exec server error for " << filename_ << std::endl;
@@ -638,4 +818,49 @@ std::string ExternalLUT3D::recompute_lut(const std::string &params)
     return fn;
 }
 
+std::string ExternalLUT3D::recompute_lut_framed(const std::string &key, const std::string &params)
+{
+    if (params.empty()) {
+        return "";
+    }
+
+    std::string data;
+    try {
+        if (settings->verbose > 1) {
+            std::cout << "extlut - executing server for " << filename_ << ": " << params << std::endl;
+        }
+        if (!smgr_.process_framed(filename_, workdir_, argv_, key, params, data)) {
+            if (settings->verbose) {
+                std::cout << "extlut - exec server error for " << filename_ << std::endl;
+            }
+            return "";
+        }
+    } catch (subprocess::error &err) {
+        if (settings->verbose) {
+            std::cout << "  exec error: " << err.what() << std::endl;
+        }
+        return "";
+    }
+
+    // OCIO can only read LUTs from files
+    std::string fn = Glib::build_filename(Glib::get_tmp_dir(), "ART-extclut-lut-XXXXXX");
+    int fd = Glib::mkstemp(fn);
+    if (fd < 0) {
+        return "";
+    }
+    close(fd);
+
+    FILE *out = g_fopen(fn.c_str(), "wb");
+    if (!out || fwrite(data.data(), 1, data.size(), out) != data.size()) {
+        if (out) {
+            fclose(out);
+        }
+        g_remove(fn.c_str());
+        return "";
+    }
+    fclose(out);
+
+    return fn;
+}
+
 } // namespace rtengine
@@ -20,6 +20,8 @@
 #pragma once
 
 #include <glibmm.h>
+#include <memory>
+#include <unordered_map>
 #include <OpenColorIO/OpenColorIO.h>
 namespace OCIO = OCIO_NAMESPACE;
 
@@ -49,18 +51,38 @@ private:
     public:
         ~SubprocessManager();
         bool process(const Glib::ustring &filename, const Glib::ustring &workdir, const std::vector<Glib::ustring> &argv, const std::string &params, const std::string &outname);
+        bool process_framed(const Glib::ustring &filename, const Glib::ustring &workdir, const std::vector<Glib::ustring> &argv, const std::string &key, const std::string &params, std::string &out);
 
     private:
-        std::unordered_map<std::string, std::unique_ptr<subprocess::SubprocessInfo>> procs_;
+        struct Server {
+            std::unique_ptr<subprocess::SubprocessInfo> proc;
+            MyMutex mutex;
+        };
+        std::shared_ptr<Server> get_server(const std::string &key, const Glib::ustring &filename, const Glib::ustring &workdir, const std::vector<Glib::ustring> &argv, bool framed);
+        void drop_server(const std::string &key, const std::shared_ptr<Server> &srv);
+
+        MyMutex mutex_;
+        std::unordered_map<std::string, std::shared_ptr<Server>> procs_;
+    };
+
+    struct CacheEntry {
+        OCIO::ConstProcessorRcPtr proc;
+        unsigned long size;
+    };
+    struct CacheEntrySize {
+        unsigned long operator()(const CacheEntry &e) const { return e.size; }
     };
-    static Cache<std::string, OCIO::ConstProcessorRcPtr> cache_;
-    static MyMutex disk_cache_mutex_;
+    static Cache<std::string, CacheEntry, CacheEntrySize> cache_;
+    static MyMutex pending_mutex_;
+    static std::unordered_map<std::string, std::weak_ptr<MyMutex>> pending_;
     static SubprocessManager smgr_;
 
     std::string recompute_lut(const std::string &params);
+    std::string recompute_lut_framed(const std::string &key, const std::string &params);
     
     bool ok_;
     bool is_server_;
+    bool is_framed_;
     Glib::ustring filename_;
     std::vector<CLUTParamDescriptor> params_;
     OCIO::ConstCPUProcessorRcPtr proc_;
@@ -0,0 +1,232 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fftplancache.h"
+#include "settings.h"
+
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <glibmm.h>
+
+namespace rtengine {
+
+extern const Settings *settings;
+
+namespace {
+
+constexpr unsigned long PLAN_CACHE_SIZE = 64;
+
+} // namespace
+
+
+FFTPlanCache::FFTPlanCache():
+    plans_(PLAN_CACHE_SIZE)
+{
+}
+
+
+FFTPlanCache *FFTPlanCache::getInstance()
+{
+    static FFTPlanCache instance;
+    return &instance;
+}
+
+
+void FFTPlanCache::init(const Glib::ustring &user_dir)
+{
+    std::lock_guard<std::recursive_mutex> lock(planner_mutex_);
+
+#ifdef RT_FFTW3F_OMP
+    fftwf_init_threads();
+#endif
+
+    wisdom_fname_ = Glib::build_filename(user_dir, "fftw-wisdom");
+    if (Glib::file_test(wisdom_fname_, Glib::FILE_TEST_EXISTS)) {
+        try {
+            const std::string wisdom = Glib::file_get_contents(wisdom_fname_);
+            if (!fftwf_import_wisdom_from_string(wisdom.c_str()) && settings->verbose) {
+                std::cout << "FFTPlanCache: ignoring invalid wisdom in " << wisdom_fname_ << std::endl;
+            }
+        } catch (Glib::Exception &exc) {
+            if (settings->verbose) {
+                std::cout << "FFTPlanCache: error reading " << wisdom_fname_ << ": " << exc.what() << std::endl;
+            }
+        }
+    }
+}
+
+
+void FFTPlanCache::cleanup()
+{
+    std::lock_guard<std::recursive_mutex> lock(planner_mutex_);
+    plans_.clear();
+}
+
+
+FFTPlanCache::Plan FFTPlanCache::r2r_2d(int rows, int cols, int howmany, fftw_r2r_kind kind0, fftw_r2r_kind kind1, float *in, float *out, unsigned flags, int nthreads)
+{
+    return get_plan(R2R, rows, cols, howmany, kind0, kind1, in, out, flags, nthreads);
+}
+
+
+FFTPlanCache::Plan FFTPlanCache::r2c_2d(int rows, int cols, float *in, fftwf_complex *out, unsigned flags, int nthreads)
+{
+    return get_plan(R2C, rows, cols, 1, FFTW_R2HC, FFTW_R2HC, in, out, flags, nthreads);
+}
+
+
+FFTPlanCache::Plan FFTPlanCache::c2r_2d(int rows, int cols, fftwf_complex *in, float *out, unsigned flags, int nthreads)
+{
+    return get_plan(C2R, rows, cols, 1, FFTW_R2HC, FFTW_R2HC, in, out, flags, nthreads);
+}
+
+
+FFTPlanCache::Plan FFTPlanCache::get_plan(Kind kind, int rows, int cols, int howmany, fftw_r2r_kind kind0, fftw_r2r_kind kind1, void *in, void *out, unsigned flags, int nthreads)
+{
+    // plans created for aligned arrays can't be used with unaligned ones
+    if (fftwf_alignment_of(static_cast<float *>(in)) != 0 || fftwf_alignment_of(static_cast<float *>(out)) != 0) {
+        flags |= FFTW_UNALIGNED;
+    }
+#ifndef RT_FFTW3F_OMP
+    nthreads = 1;
+#endif
+
+    std::ostringstream buf;
+    buf << kind << ' ' << rows << ' ' << cols << ' ' << howmany << ' ' << kind0 << ' ' << kind1 << ' ' << flags << ' ' << nthreads << ' ' << (in == out);
+    const std::string key = buf.str();
+
+    Plan ret;
+    if (plans_.get(key, ret)) {
+        return ret;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(planner_mutex_);
+
+    // another thread might have created it while we were waiting
+    if (plans_.get(key, ret)) {
+        return ret;
+    }
+
+#ifdef RT_FFTW3F_OMP
+    fftwf_plan_with_nthreads(nthreads);
+#endif
+    fftwf_plan p = make_plan(kind, rows, cols, howmany, kind0, kind1, in, out, flags);
+#ifdef RT_FFTW3F_OMP
+    fftwf_plan_with_nthreads(1);
+#endif
+
+    if (!p) {
+        return ret;
+    }
+
+    if (!(flags & FFTW_ESTIMATE)) {
+        save_wisdom();
+    }
+
+    ret = Plan(p,
+               [this](fftwf_plan plan) -> void
+               {
+                   std::lock_guard<std::recursive_mutex> lock(planner_mutex_);
+                   fftwf_destroy_plan(plan);
+               });
+    plans_.set(key, ret);
+
+    if (settings->verbose > 1) {
+        std::cout << "FFTPlanCache: new plan " << key << std::endl;
+    }
+
+    return ret;
+}
+
+
+fftwf_plan FFTPlanCache::make_plan(Kind kind, int rows, int cols, int howmany, fftw_r2r_kind kind0, fftw_r2r_kind kind1, void *in, void *out, unsigned flags)
+{
+    // FFTW_ESTIMATE doesn't touch the arrays, all the other planner flags
+    // overwrite them while measuring
+    const bool scratch = !(flags & FFTW_ESTIMATE);
+    const bool inplace = (in == out);
+
+    const size_t real_size = size_t(rows) * cols * howmany;
+    const size_t complex_size = size_t(rows) * (cols / 2 + 1);
+    const size_t in_size = kind == C2R ? complex_size * 2 : real_size;
+    const size_t out_size = kind == R2C ? complex_size * 2 : real_size;
+
+    float *pin = static_cast<float *>(in);
+    float *pout = static_cast<float *>(out);
+    if (scratch) {
+        pin = static_cast<float *>(fftwf_malloc(in_size * sizeof(float)));
+        pout = inplace ? pin : static_cast<float *>(fftwf_malloc(out_size * sizeof(float)));
+        if (!pin || !pout) {
+            fftwf_free(pin);
+            if (pout != pin) {
+                fftwf_free(pout);
+            }
+            return nullptr;
+        }
+    }
+
+    fftwf_plan p = nullptr;
+    switch (kind) {
+    case R2R: {
+        const int n[2] = { rows, cols };
+        const fftw_r2r_kind kinds[2] = { kind0, kind1 };
+        p = fftwf_plan_many_r2r(2, n, howmany, pin, nullptr, 1, rows * cols, pout, nullptr, 1, rows * cols, kinds, flags);
+        break;
+    }
+    case R2C:
+        p = fftwf_plan_dft_r2c_2d(rows, cols, pin, reinterpret_cast<fftwf_complex *>(pout), flags);
+        break;
+    case C2R:
+        p = fftwf_plan_dft_c2r_2d(rows, cols, reinterpret_cast<fftwf_complex *>(pin), pout, flags);
+        break;
+    }
+
+    if (scratch) {
+        fftwf_free(pin);
+        if (pout != pin) {
+            fftwf_free(pout);
+        }
+    }
+
+    return p;
+}
+
+
+void FFTPlanCache::save_wisdom()
+{
+    if (wisdom_fname_.empty()) {
+        return;
+    }
+
+    char *wisdom = fftwf_export_wisdom_to_string();
+    if (!wisdom) {
+        return;
+    }
+
+    try {
+        Glib::file_set_contents(wisdom_fname_, wisdom);
+    } catch (Glib::Exception &exc) {
+        if (settings->verbose) {
+            std::cout << "FFTPlanCache: error saving " << wisdom_fname_ << ": " << exc.what() << std::endl;
+        }
+    }
+    free(wisdom);
+}
+
+} // namespace rtengine
@@ -0,0 +1,86 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <fftw3.h>
+#include <glibmm/ustring.h>
+
+#include "cache.h"
+#include "noncopyable.h"
+
+namespace rtengine {
+
+/**
+ * Process-wide cache of FFTW plans.
+ *
+ * Creating a plan is slow (especially with FFTW_MEASURE) and not
+ * thread-safe, whereas executing one is. Plans are therefore created once
+ * for each combination of transform kind, sizes, batch size, flags, memory
+ * alignment and number of threads, under an internal lock, and then shared.
+ * They must be executed with the new-array execute functions
+ * (fftwf_execute_r2r(), fftwf_execute_dft_r2c(), fftwf_execute_dft_c2r()) on
+ * arrays with the same alignment and in-place/out-of-place status as the
+ * ones passed when requesting the plan. Unless FFTW_ESTIMATE is given,
+ * planning happens on scratch arrays, so the contents of the ones passed are
+ * never touched.
+ *
+ * The wisdom accumulated by the planner is saved in the user's config
+ * directory, so that plans that need measuring are measured only once per
+ * machine.
+ */
+class FFTPlanCache: public NonCopyable {
+public:
+    typedef std::shared_ptr<fftwf_plan_s> Plan;
+
+    static FFTPlanCache *getInstance();
+
+    void init(const Glib::ustring &user_dir);
+    // destroys all the plans; must be called before the FFTW cleanup
+    void cleanup();
+
+    // howmany consecutive rows x cols real arrays
+    Plan r2r_2d(int rows, int cols, int howmany, fftw_r2r_kind kind0, fftw_r2r_kind kind1, float *in, float *out, unsigned flags, int nthreads=1);
+    // out-of-place only
+    Plan r2c_2d(int rows, int cols, float *in, fftwf_complex *out, unsigned flags, int nthreads=1);
+    Plan c2r_2d(int rows, int cols, fftwf_complex *in, float *out, unsigned flags, int nthreads=1);
+
+private:
+    FFTPlanCache();
+
+    enum Kind {
+        R2R,
+        R2C,
+        C2R
+    };
+
+    Plan get_plan(Kind kind, int rows, int cols, int howmany, fftw_r2r_kind kind0, fftw_r2r_kind kind1, void *in, void *out, unsigned flags, int nthreads);
+    fftwf_plan make_plan(Kind kind, int rows, int cols, int howmany, fftw_r2r_kind kind0, fftw_r2r_kind kind1, void *in, void *out, unsigned flags);
+    void save_wisdom();
+
+    Cache<std::string, Plan> plans_;
+    // recursive, because destroying a plan (which is a planner operation as
+    // well) can happen while inserting a new one in plans_
+    std::recursive_mutex planner_mutex_;
+    Glib::ustring wisdom_fname_;
+};
+
+} // namespace rtengine
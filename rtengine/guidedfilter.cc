@@ -29,10 +29,22 @@
  */
 
 #include "guidedfilter.h"
-#include "boxblur.h"
 #include "sleef.h"
 #include "rescale.h"
 #include "imagefloat.h"
+#include "alignedbuffer.h"
+#include <algorithm>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef BENCHMARK
+#include <iostream>
+#include "boxblur.h"
+#include "mytime.h"
+#endif
 
 namespace rtengine {
 
@@ -74,10 +86,331 @@ int calculate_subsampling(int w, int h, int r)
     return LIM(r / 2, 2, 4);
 }
 
+
+/**
+ * Computes the box means of radius r of N planes of size w x h at once, and
+ * passes them to a callback one row at a time, instead of blurring each
+ * plane in a separate full-size pass.
+ *
+ * The image is split in strips of rows. For each strip, a thread keeps the
+ * vertical sums of the last 2r+1 rows of each plane in a row buffer, and
+ * runs a horizontal sliding window over these sums to get the means of the
+ * current row. update(y_add, y_sub, colsum) must add the values of row y_add
+ * of each plane to colsum, and subtract those of row y_sub, where either
+ * can be -1 for "none"; this way the input planes can be computed on the fly
+ * (e.g. products of other planes) without storing them. emit(y, means)
+ * receives the means of row y. Only a few rows per plane are live at any
+ * time, so the intermediate data stays in cache.
+ *
+ * The window is truncated at the borders, as in boxblur().
+ */
+template <int N, class Update, class Emit>
+void box_means(int w, int h, int r, bool multithread, const Update &update, const Emit &emit)
+{
+#ifdef _OPENMP
+    const int num_threads = multithread ? omp_get_max_threads() : 1;
+#else
+    const int num_threads = 1;
+#endif
+    // long enough to amortize the initialization of the vertical sums, but
+    // still giving a few strips per thread
+    const int strip = max(min(max(128, 8 * r), (h + 2 * num_threads - 1) / (2 * num_threads)), 1);
+    const int num_strips = (h + strip - 1) / strip;
+
+    std::vector<float> rch(w);
+    for (int x = 0; x < w; ++x) {
+        rch[x] = 1.f / (min(x + r, w - 1) - max(x - r, 0) + 1);
+    }
+
+#ifdef _OPENMP
+#   pragma omp parallel if (multithread)
+#endif
+    {
+        AlignedBuffer<float> buffer(2 * N * w);
+        float *colsum[N];
+        float *out[N];
+        for (int k = 0; k < N; ++k) {
+            colsum[k] = buffer.data + k * w;
+            out[k] = buffer.data + (N + k) * w;
+        }
+
+#ifdef _OPENMP
+#       pragma omp for schedule(dynamic)
+#endif
+        for (int s = 0; s < num_strips; ++s) {
+            const int y0 = s * strip;
+            const int y1 = min(y0 + strip, h);
+
+            for (int k = 0; k < N; ++k) {
+                std::fill(colsum[k], colsum[k] + w, 0.f);
+            }
+            for (int y = max(y0 - r, 0), end = min(y0 + r, h - 1); y <= end; ++y) {
+                update(y, -1, colsum);
+            }
+
+            for (int y = y0; y < y1; ++y) {
+                if (y > y0) {
+                    update(y + r < h ? y + r : -1, y - r - 1, colsum);
+                }
+
+                // horizontal sliding window. This is a sequential chain
+                // per plane, so the planes are interleaved to hide the
+                // latency
+                float sum[N] = {};
+                for (int x = 0, end = min(r, w - 1); x <= end; ++x) {
+                    for (int k = 0; k < N; ++k) {
+                        sum[k] += colsum[k][x];
+                    }
+                }
+                int x = 0;
+                for (; x < r && x < w; ++x) {
+                    for (int k = 0; k < N; ++k) {
+                        out[k][x] = sum[k];
+                        if (x + r + 1 < w) {
+                            sum[k] += colsum[k][x + r + 1];
+                        }
+                    }
+                }
+                for (; x < w - r - 1; ++x) {
+                    for (int k = 0; k < N; ++k) {
+                        out[k][x] = sum[k];
+                        sum[k] += colsum[k][x + r + 1] - colsum[k][x - r];
+                    }
+                }
+                for (; x < w; ++x) {
+                    for (int k = 0; k < N; ++k) {
+                        out[k][x] = sum[k];
+                        sum[k] -= colsum[k][x - r];
+                    }
+                }
+
+                const float rcv = 1.f / (min(y + r, h - 1) - max(y - r, 0) + 1);
+                for (int k = 0; k < N; ++k) {
+                    float *o = out[k];
+                    for (x = 0; x < w; ++x) {
+                        o[x] *= rch[x] * rcv;
+                    }
+                }
+
+                emit(y, out);
+            }
+        }
+    }
+}
+
 } // namespace
 
 
 void guidedFilter(const array2D<float> &guide, const array2D<float> &src, array2D<float> &dst, int r, float epsilon, bool multithread, int subsampling)
+{
+    const int W = src.width();
+    const int H = src.height();
+
+    if (subsampling <= 0) {
+        subsampling = calculate_subsampling(W, H, r);
+    }
+
+    // use the terminology of the paper (Algorithm 2)
+    const array2D<float> &I = guide;
+    const array2D<float> &p = src;
+    array2D<float> &q = dst;
+
+    const int w = W / subsampling;
+    const int h = H / subsampling;
+
+    // without subsampling the filter reads the inputs directly
+    array2D<float> I1, p1;
+    if (subsampling > 1) {
+        I1(w, h, ARRAY2D_ALIGNED);
+        p1(w, h, ARRAY2D_ALIGNED);
+        rescaleBilinear(I, I1, multithread);
+        rescaleBilinear(p, p1, multithread);
+    }
+    const array2D<float> &Is = subsampling > 1 ? I1 : I;
+    const array2D<float> &ps = subsampling > 1 ? p1 : p;
+
+    const float r1 = float(r) / subsampling;
+    const int rad = LIM(int(r1), 0, (min(w, h) - 1) / 2 - 1);
+
+    array2D<float> a(w, h, ARRAY2D_ALIGNED);
+    array2D<float> b(w, h, ARRAY2D_ALIGNED);
+
+    // rows of zeros, for the rows outside of the window in box_means()
+    const std::vector<float> zero(w);
+    const auto get_row =
+        [&](const array2D<float> &m, int y) -> const float *
+        {
+            return y >= 0 ? m[y] : zero.data();
+        };
+
+    // first pass: the means of I, p, I*I and I*p, and from them the
+    // coefficients a and b
+    box_means<4>(w, h, rad, multithread,
+        [&](int y_add, int y_sub, float **colsum) -> void
+        {
+            const float *Ia = get_row(Is, y_add);
+            const float *pa = get_row(ps, y_add);
+            const float *Isub = get_row(Is, y_sub);
+            const float *psub = get_row(ps, y_sub);
+            float *sI = colsum[0];
+            float *sp = colsum[1];
+            float *sII = colsum[2];
+            float *sIp = colsum[3];
+            for (int x = 0; x < w; ++x) {
+                sI[x] += Ia[x] - Isub[x];
+                sp[x] += pa[x] - psub[x];
+                sII[x] += Ia[x] * Ia[x] - Isub[x] * Isub[x];
+                sIp[x] += Ia[x] * pa[x] - Isub[x] * psub[x];
+            }
+        },
+        [&](int y, float **mean) -> void
+        {
+            const float *meanI = mean[0];
+            const float *meanp = mean[1];
+            const float *corrI = mean[2];
+            const float *corrIp = mean[3];
+            float *ar = a[y];
+            float *br = b[y];
+            for (int x = 0; x < w; ++x) {
+                const float varI = corrI[x] - meanI[x] * meanI[x];
+                const float covIp = corrIp[x] - meanI[x] * meanp[x];
+                ar[x] = covIp / (varI + epsilon);
+                br[x] = meanp[x] - ar[x] * meanI[x];
+            }
+        });
+
+    DEBUG_DUMP(a);
+    DEBUG_DUMP(b);
+
+    const auto update_ab =
+        [&](int y_add, int y_sub, float **colsum) -> void
+        {
+            const float *aa = get_row(a, y_add);
+            const float *ba = get_row(b, y_add);
+            const float *asub = get_row(a, y_sub);
+            const float *bsub = get_row(b, y_sub);
+            float *sa = colsum[0];
+            float *sb = colsum[1];
+            for (int x = 0; x < w; ++x) {
+                sa[x] += aa[x] - asub[x];
+                sb[x] += ba[x] - bsub[x];
+            }
+        };
+
+    if (subsampling == 1) {
+        // second pass: the means of a and b, and the output
+        box_means<2>(w, h, rad, multithread, update_ab,
+            [&](int y, float **mean) -> void
+            {
+                const float *meana = mean[0];
+                const float *meanb = mean[1];
+                const float *Ir = I[y];
+                float *qr = q[y];
+                for (int x = 0; x < w; ++x) {
+                    qr[x] = meana[x] * Ir[x] + meanb[x];
+                }
+            });
+        return;
+    }
+
+    array2D<float> meana(w, h, ARRAY2D_ALIGNED);
+    array2D<float> meanb(w, h, ARRAY2D_ALIGNED);
+    box_means<2>(w, h, rad, multithread, update_ab,
+        [&](int y, float **mean) -> void
+        {
+            std::copy(mean[0], mean[0] + w, meana[y]);
+            std::copy(mean[1], mean[1] + w, meanb[y]);
+        });
+
+    DEBUG_DUMP(meana);
+    DEBUG_DUMP(meanb);
+
+    // bilinear upsampling of meana and meanb, fused with the computation of
+    // the output. The vertical interpolation is done once per row, and the
+    // horizontal one uses precomputed column indices and weights
+    const int Ws = meana.width();
+    const int Hs = meana.height();
+    const int Wd = q.width();
+    const int Hd = q.height();
+    const float col_scale = float(Ws) / float(Wd);
+    const float row_scale = float(Hs) / float(Hd);
+
+    std::vector<int> xi(Wd), xi1(Wd);
+    std::vector<float> xf(Wd);
+    for (int x = 0; x < Wd; ++x) {
+        const float xs = x * col_scale;
+        xi[x] = min(int(xs), Ws - 1);
+        xi1[x] = min(xi[x] + 1, Ws - 1);
+        xf[x] = xs - xi[x];
+    }
+
+#ifdef _OPENMP
+#   pragma omp parallel if (multithread)
+#endif
+    {
+        std::vector<float> rowa(Ws), rowb(Ws);
+
+#ifdef _OPENMP
+#       pragma omp for
+#endif
+        for (int y = 0; y < Hd; ++y) {
+            const float ys = y * row_scale;
+            const int yi = min(int(ys), Hs - 1);
+            const int yi1 = min(yi + 1, Hs - 1);
+            const float yf = ys - yi;
+            for (int x = 0; x < Ws; ++x) {
+                rowa[x] = yf * meana[yi1][x] + (1.f - yf) * meana[yi][x];
+                rowb[x] = yf * meanb[yi1][x] + (1.f - yf) * meanb[yi][x];
+            }
+            const float *Ir = I[y];
+            float *qr = q[y];
+            for (int x = 0; x < Wd; ++x) {
+                const float f = xf[x];
+                const float va = f * rowa[xi1[x]] + (1.f - f) * rowa[xi[x]];
+                const float vb = f * rowb[xi1[x]] + (1.f - f) * rowb[xi[x]];
+                qr[x] = va * Ir[x] + vb;
+            }
+        }
+    }
+}
+
+
+void guidedFilterLog(const array2D<float> &guide, float base, array2D<float> &chan, int r, float eps, bool multithread, int subsampling)
+{
+#ifdef _OPENMP
+#    pragma omp parallel for if (multithread)
+#endif
+    for (int y = 0; y < chan.height(); ++y) {
+        for (int x = 0; x < chan.width(); ++x) {
+            chan[y][x] = xlin2log(max(chan[y][x], 0.f), base);
+        }
+    }
+
+    guidedFilter(guide, chan, chan, r, eps, multithread, subsampling);
+
+#ifdef _OPENMP
+#    pragma omp parallel for if (multithread)
+#endif
+    for (int y = 0; y < chan.height(); ++y) {
+        for (int x = 0; x < chan.width(); ++x) {
+            chan[y][x] = xlog2lin(max(chan[y][x], 0.f), base);
+        }
+    }
+}
+
+
+void guidedFilterLog(float base, array2D<float> &chan, int r, float eps, bool multithread, int subsampling)
+{
+    guidedFilterLog(chan, base, chan, r, eps, multithread, subsampling);
+}
+
+#ifdef BENCHMARK
+
+namespace {
+
+// the original implementation, with one full-plane pass per step, kept as a
+// reference for benchmark_guided_filter()
+void guidedFilter_ref(const array2D<float> &guide, const array2D<float> &src, array2D<float> &dst, int r, float epsilon, bool multithread, int subsampling)
 {
 
     const int W = src.width();
@@ -240,34 +573,57 @@ void guidedFilter(const array2D<float> &guide, const array2D<float> &src, array2
     }
 }
 
+} // namespace
 
-void guidedFilterLog(const array2D<float> &guide, float base, array2D<float> &chan, int r, float eps, bool multithread, int subsampling)
+
+void benchmark_guided_filter()
 {
-#ifdef _OPENMP
-#    pragma omp parallel for if (multithread)
-#endif
-    for (int y = 0; y < chan.height(); ++y) {
-        for (int x = 0; x < chan.width(); ++x) {
-            chan[y][x] = xlin2log(max(chan[y][x], 0.f), base);
+    constexpr int W = 6000;
+    constexpr int H = 4000;
+
+    array2D<float> guide(W, H);
+    array2D<float> src(W, H);
+    unsigned int seed = 12345;
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            seed = seed * 1664525u + 1013904223u;
+            const float noise = float(seed >> 16) / 65536.f - 0.5f;
+            const float smooth = 0.5f + 0.25f * std::sin(x * 0.01f) * std::cos(y * 0.013f);
+            guide[y][x] = smooth + 0.05f * noise;
+            src[y][x] = smooth * smooth + 0.1f * noise;
         }
     }
 
-    guidedFilter(guide, chan, chan, r, eps, multithread, subsampling);
+    array2D<float> out_ref(W, H);
+    array2D<float> out(W, H);
+
+    for (int r : { 4, 30, 100 }) {
+        for (int subsampling : { 1, 0 }) {
+            constexpr float epsilon = 0.001f;
+            MyTime t1, t2, t3;
+            t1.set();
+            guidedFilter_ref(guide, src, out_ref, r, epsilon, true, subsampling);
+            t2.set();
+            guidedFilter(guide, src, out, r, epsilon, true, subsampling);
+            t3.set();
+
+            double maxerr = 0;
+            for (int y = 0; y < H; ++y) {
+                for (int x = 0; x < W; ++x) {
+                    maxerr = std::max(maxerr, double(std::abs(out[y][x] - out_ref[y][x])));
+                }
+            }
 
-#ifdef _OPENMP
-#    pragma omp parallel for if (multithread)
-#endif
-    for (int y = 0; y < chan.height(); ++y) {
-        for (int x = 0; x < chan.width(); ++x) {
-            chan[y][x] = xlog2lin(max(chan[y][x], 0.f), base);
+            const double ref_ms = t2.etime(t1) / 1000.0;
+            const double ms = std::max(t3.etime(t2), 1) / 1000.0;
+            std::cout << "BENCHMARK guidedFilter " << W << "x" << H << " r=" << r
+                      << " subsampling=" << (subsampling > 0 ? std::to_string(subsampling) : "auto")
+                      << ": reference " << ref_ms << " ms, fused " << ms << " ms, speedup " << ref_ms / ms
+                      << ", max abs diff " << maxerr << std::endl;
         }
     }
 }
 
-
-void guidedFilterLog(float base, array2D<float> &chan, int r, float eps, bool multithread, int subsampling)
-{
-    guidedFilterLog(chan, base, chan, r, eps, multithread, subsampling);
-}
+#endif // BENCHMARK
 
 } // namespace rtengine
@@ -30,4 +30,8 @@ void guidedFilterLog(float base, array2D<float> &chan, int r, float eps, bool mu
 
 void guidedFilterLog(const array2D<float> &guide, float base, array2D<float> &chan, int r, float eps, bool multithread, int subsampling=0);
 
+#ifdef BENCHMARK
+void benchmark_guided_filter();
+#endif
+
 } // namespace rtengine
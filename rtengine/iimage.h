@@ -22,6 +22,8 @@
 
 #include <glibmm.h>
 #include <vector>
+#include <string>
+#include <cstring>
 #include "rt_math.h"
 #include "alignedbuffer.h"
 #include "imagedimensions.h"
@@ -88,6 +90,9 @@ public:
     void readData  (FILE *fh) {}
     // Write a raw dump of the data
     void writeData (FILE *fh) const {}
+    // Same as above, from/to a memory buffer. readData returns the number of bytes used
+    size_t readData (const char *buf, size_t size) { return 0; }
+    void writeData (std::string &buf) const {}
 
     virtual void computeHistogramAutoWB (double &avg_r, double &avg_g, double &avg_b, int &n, LUTu &histogram, int compression) const {}
     virtual void getSpotWBData (double &reds, double &greens, double &blues, int &rn, int &gn, int &bn,
@@ -575,6 +580,25 @@ public:
         }
     }
 
+    size_t readData (const char *buf, size_t size)
+    {
+        const size_t rowsize = sizeof(T) * width;
+        size_t pos = 0;
+
+        for (int i = 0; i < height && pos + rowsize <= size; i++, pos += rowsize) {
+            memcpy(v(i), buf + pos, rowsize);
+        }
+
+        return pos;
+    }
+
+    void writeData (std::string &buf) const
+    {
+        for (int i = 0; i < height; i++) {
+            buf.append(reinterpret_cast<const char *>(v(i)), sizeof(T) * width);
+        }
+    }
+
     void fill (T value) {
         for (int i = 0; i < height; i++) {
             for (int j = 0; j < width; j++) {
@@ -1171,6 +1195,29 @@ public:
         }
     }
 
+    size_t readData (const char *buf, size_t size)
+    {
+        const size_t rowsize = sizeof(T) * width;
+        size_t pos = 0;
+
+        for (int c = 0; c < 3; ++c) {
+            for (int i = 0; i < height && pos + rowsize <= size; i++, pos += rowsize) {
+                memcpy(c == 0 ? r(i) : c == 1 ? g(i) : b(i), buf + pos, rowsize);
+            }
+        }
+
+        return pos;
+    }
+
+    void writeData (std::string &buf) const
+    {
+        for (int c = 0; c < 3; ++c) {
+            for (int i = 0; i < height; i++) {
+                buf.append(reinterpret_cast<const char *>(c == 0 ? r(i) : c == 1 ? g(i) : b(i)), sizeof(T) * width);
+            }
+        }
+    }
+
 };
 
 // --------------------------------------------------------------------
@@ -1733,6 +1780,25 @@ public:
         }
     }
 
+    size_t readData (const char *buf, size_t size)
+    {
+        const size_t rowsize = sizeof(T) * 3 * width;
+        size_t pos = 0;
+
+        for (int i = 0; i < height && pos + rowsize <= size; i++, pos += rowsize) {
+            memcpy(r(i), buf + pos, rowsize);
+        }
+
+        return pos;
+    }
+
+    void writeData (std::string &buf) const
+    {
+        for (int i = 0; i < height; i++) {
+            buf.append(reinterpret_cast<const char *>(r(i)), sizeof(T) * 3 * width);
+        }
+    }
+
 };
 
 // --------------------------------------------------------------------
@@ -23,7 +23,10 @@
 #include <tiffio.h>
 #include <cstdio>
 #include <cstring>
+#include <sstream>
+#include <vector>
 #include <fcntl.h>
+#include <zlib.h>
 #include "rt_math.h"
 #include "../rtgui/options.h"
 #include "../rtgui/version.h"
@@ -45,6 +48,16 @@
 
 #include "rtjpeg.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef BENCHMARK
+#include <iostream>
+#include "imagefloat.h"
+#include "mytime.h"
+#endif
+
 using namespace rtengine;
 using namespace rtengine::procparams;
 
@@ -901,6 +914,201 @@ int ImageIO::loadPPMFromMemory(const char* buffer, int width, int height, bool s
 }
 
 
+namespace {
+
+constexpr size_t STREAM_MAX_BLOB_SIZE = 64 * 1024 * 1024;
+
+bool parse_stream_header(const std::string &header, int &width, int &height, int &bps, bool &isFloat, size_t &icclen, size_t &exiflen)
+{
+    std::istringstream in(header);
+    std::string magic, fmt;
+    int version = 0;
+    if (!(in >> magic >> version >> width >> height >> fmt >> icclen >> exiflen)) {
+        return false;
+    }
+    if (magic != "ART-IMAGE" || version != 1 || width < 1 || height < 1 ||
+        icclen > STREAM_MAX_BLOB_SIZE || exiflen > STREAM_MAX_BLOB_SIZE) {
+        return false;
+    }
+    if (fmt == "u8") {
+        bps = 8;
+        isFloat = false;
+    } else if (fmt == "u16") {
+        bps = 16;
+        isFloat = false;
+    } else if (fmt == "f16") {
+        bps = 16;
+        isFloat = true;
+    } else if (fmt == "f32") {
+        bps = 32;
+        isFloat = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+
+int ImageIO::getStreamSampleFormat(const std::string &header, IIOSampleFormat &sFormat, IIOSampleArrangement &sArrangement)
+{
+    int width, height, bps;
+    bool isFloat;
+    size_t icclen, exiflen;
+    if (!parse_stream_header(header, width, height, bps, isFloat, icclen, exiflen)) {
+        return IMIO_VARIANTNOTSUPPORTED;
+    }
+
+    sArrangement = IIOSA_CHUNKY;
+    if (isFloat) {
+        sFormat = bps == 16 ? IIOSF_FLOAT16 : IIOSF_FLOAT32;
+    } else {
+        sFormat = bps == 8 ? IIOSF_UNSIGNED_CHAR : IIOSF_UNSIGNED_SHORT;
+    }
+    return IMIO_SUCCESS;
+}
+
+
+int ImageIO::loadFromStream(const std::string &header, const StreamReader &in)
+{
+    int width, height, bps;
+    bool isFloat;
+    size_t icclen, exiflen;
+    if (!parse_stream_header(header, width, height, bps, isFloat, icclen, exiflen)) {
+        return IMIO_INVALIDHEADER;
+    }
+
+    if (pl) {
+        pl->setProgressStr("PROGRESSBAR_LOADING");
+        pl->setProgress(0.0);
+    }
+
+    deleteLoadedProfileData();
+    loadedProfileDataJpg = false;
+    embProfile = nullptr;
+
+    if (icclen > 0) {
+        loadedProfileData = new char[icclen];
+        loadedProfileLength = icclen;
+        if (in(loadedProfileData, icclen) != icclen) {
+            return IMIO_READERROR;
+        }
+        embProfile = cmsOpenProfileFromMem(loadedProfileData, loadedProfileLength);
+    }
+
+    // the metadata are read from the source file, so the Exif blob is
+    // skipped here
+    if (exiflen > 0) {
+        std::vector<char> exif(exiflen);
+        if (in(&exif[0], exiflen) != exiflen) {
+            return IMIO_READERROR;
+        }
+    }
+
+    allocate(width, height);
+
+    const size_t lineWidth = size_t(width) * 3 * bps / 8;
+    std::vector<unsigned char> linebuffer(lineWidth);
+
+    for (int row = 0; row < height; ++row) {
+        if (in(reinterpret_cast<char *>(&linebuffer[0]), lineWidth) != lineWidth) {
+            return IMIO_READERROR;
+        }
+
+        setScanline(row, &linebuffer[0], bps);
+
+        if (pl && !(row % 100)) {
+            pl->setProgress((double)(row + 1) / height);
+        }
+    }
+
+    if (pl) {
+        pl->setProgressStr("PROGRESSBAR_READY");
+        pl->setProgress(1.0);
+    }
+
+    return IMIO_SUCCESS;
+}
+
+
+int ImageIO::saveToStream(const StreamWriter &out, int bps, bool isFloat) const
+{
+    if (getWidth() < 1 || getHeight() < 1) {
+        return IMIO_HEADERERROR;
+    }
+
+    const int width = getWidth();
+    const int height = getHeight();
+
+    if (bps < 0) {
+        bps = getBPS();
+    }
+    if (isFloat) {
+        bps = bps == 16 ? 16 : 32;
+    } else {
+        bps = bps == 8 ? 8 : 16;
+    }
+
+    Exiv2::Blob exif;
+    if (!metadataInfo.filename().empty()) {
+        try {
+            metadataInfo.load();
+            auto exifdata = metadataInfo.getOutputExifData();
+            exifdata["Exif.Image.Software"] = RTNAME " " RTVERSION;
+            if (!profileData) {
+                exifdata["Exif.Photo.ColorSpace"] = 1;
+            }
+            Exiv2::ExifParser::encode(exif, Exiv2::littleEndian, exifdata);
+        } catch (std::exception &exc) {
+            if (pl) {
+                pl->error(Glib::ustring::compose(M("METADATA_SAVE_ERROR"), metadataInfo.filename(), exc.what()));
+            }
+            exif.clear();
+        }
+    }
+
+    if (pl) {
+        pl->setProgressStr("PROGRESSBAR_SAVING");
+        pl->setProgress(0.0);
+    }
+
+    const char *fmt = isFloat ? (bps == 16 ? "f16" : "f32") : (bps == 8 ? "u8" : "u16");
+    const size_t icclen = profileData ? profileLength : 0;
+    std::ostringstream header;
+    header << "ART-IMAGE 1 " << width << " " << height << " " << fmt << " " << icclen << " " << exif.size() << "\n";
+    const std::string hs = header.str();
+
+    if (!out(hs.c_str(), hs.size()) ||
+        (icclen > 0 && !out(profileData, icclen)) ||
+        (!exif.empty() && !out(reinterpret_cast<const char *>(&exif[0]), exif.size()))) {
+        return IMIO_CANNOTWRITEFILE;
+    }
+
+    const size_t lineWidth = size_t(width) * 3 * bps / 8;
+    std::vector<unsigned char> linebuffer(lineWidth);
+
+    for (int row = 0; row < height; ++row) {
+        getScanline(row, &linebuffer[0], bps, isFloat);
+
+        if (!out(reinterpret_cast<const char *>(&linebuffer[0]), lineWidth)) {
+            return IMIO_CANNOTWRITEFILE;
+        }
+
+        if (pl && !(row % 100)) {
+            pl->setProgress((double)(row + 1) / height);
+        }
+    }
+
+    if (pl) {
+        pl->setProgressStr("PROGRESSBAR_READY");
+        pl->setProgress(1.0);
+    }
+
+    return IMIO_SUCCESS;
+}
+
+
 int ImageIO::savePNG(const Glib::ustring &fname, int bps, bool uncompressed) const
 {
     if (getWidth() < 1 || getHeight() < 1) {
@@ -1186,6 +1394,83 @@ int ImageIO::saveJPEG (const Glib::ustring &fname, int quality, int subSamp) con
 }
 
 
+namespace {
+
+// target uncompressed size of the strips of saved TIFFs. Strips are
+// compressed in parallel, so they must be small enough to keep all the
+// threads busy, but not so small that deflate loses efficiency
+constexpr size_t TIFF_STRIP_SIZE = 1 << 20;
+
+template <class T>
+void tiff_hor_diff(unsigned char *data, size_t rowsize)
+{
+    T *p = reinterpret_cast<T *>(data);
+    for (size_t i = rowsize / sizeof(T) - 1; i >= 3; --i) {
+        p[i] -= p[i-3];
+    }
+}
+
+
+// same as the libtiff predictors used by TIFFWriteScanline(): horizontal
+// differencing of the samples for integer data, and for floating point data
+// byte planes (most significant byte first) followed by horizontal
+// differencing of the bytes
+void tiff_predict(unsigned char *row, size_t rowsize, int bps, bool isFloat, std::vector<unsigned char> &tmp)
+{
+    if (isFloat) {
+        const size_t bytes = bps / 8;
+        const size_t wc = rowsize / bytes;
+        tmp.assign(row, row + rowsize);
+        for (size_t count = 0; count < wc; ++count) {
+            for (size_t byte = 0; byte < bytes; ++byte) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                row[byte * wc + count] = tmp[bytes * count + byte];
+#else
+                row[(bytes - byte - 1) * wc + count] = tmp[bytes * count + byte];
+#endif
+            }
+        }
+        tiff_hor_diff<uint8_t>(row, rowsize);
+    } else if (bps == 8) {
+        tiff_hor_diff<uint8_t>(row, rowsize);
+    } else if (bps == 16) {
+        tiff_hor_diff<uint16_t>(row, rowsize);
+    } else {
+        tiff_hor_diff<uint32_t>(row, rowsize);
+    }
+}
+
+
+// encodes the rows [row, row+nrows) of img as a TIFF strip, ready for
+// TIFFWriteRawStrip()
+bool tiff_encode_strip(const ImageIO &img, int row, int nrows, int bps, bool isFloat, bool uncompressed, std::vector<unsigned char> &pixels, std::vector<unsigned char> &tmp, std::vector<unsigned char> &out)
+{
+    const size_t rowsize = size_t(img.getWidth()) * 3 * bps / 8;
+    std::vector<unsigned char> &buf = uncompressed ? out : pixels;
+    buf.resize(rowsize * nrows);
+
+    for (int i = 0; i < nrows; ++i) {
+        unsigned char *dst = &buf[rowsize * i];
+        img.getScanline(row + i, dst, bps, isFloat);
+        if (!uncompressed) {
+            tiff_predict(dst, rowsize, bps, isFloat && (bps == 16 || bps == 32), tmp);
+        }
+    }
+
+    if (!uncompressed) {
+        uLongf zsize = compressBound(buf.size());
+        out.resize(zsize);
+        if (compress2(out.data(), &zsize, buf.data(), buf.size(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+            return false;
+        }
+        out.resize(zsize);
+    }
+    return true;
+}
+
+} // namespace
+
+
 int ImageIO::saveTIFF (const Glib::ustring &fname, int bps, bool isFloat, bool uncompressed) const
 {
     if (getWidth() < 1 || getHeight() < 1) {
@@ -1200,8 +1485,9 @@ int ImageIO::saveTIFF (const Glib::ustring &fname, int bps, bool isFloat, bool u
         bps = getBPS ();
     }
 
-    int lineWidth = width * 3 * bps / 8;
-    unsigned char* linebuffer = new unsigned char[lineWidth];
+    const size_t lineWidth = size_t(width) * 3 * bps / 8;
+    const int rowsPerStrip = LIM<int>(TIFF_STRIP_SIZE / lineWidth, 1, height);
+    const int numStrips = (height + rowsPerStrip - 1) / rowsPerStrip;
 
     // little hack to get libTiff to use proper byte order (see TIFFClienOpen()):
     const char *mode = "w";
@@ -1216,7 +1502,6 @@ int ImageIO::saveTIFF (const Glib::ustring &fname, int bps, bool isFloat, bool u
 #endif
 
     if (!out) {
-        delete [] linebuffer;
         return IMIO_CANNOTWRITEFILE;
     }
 
@@ -1225,14 +1510,12 @@ int ImageIO::saveTIFF (const Glib::ustring &fname, int bps, bool isFloat, bool u
         pl->setProgress (0.0);
     }
 
-    bool needsReverse = false;
-
     TIFFSetField (out, TIFFTAG_SOFTWARE, RTNAME " " RTVERSION);
     TIFFSetField (out, TIFFTAG_IMAGEWIDTH, width);
     TIFFSetField (out, TIFFTAG_IMAGELENGTH, height);
     TIFFSetField (out, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
     TIFFSetField (out, TIFFTAG_SAMPLESPERPIXEL, 3);
-    TIFFSetField (out, TIFFTAG_ROWSPERSTRIP, height);
+    TIFFSetField (out, TIFFTAG_ROWSPERSTRIP, rowsPerStrip);
     TIFFSetField (out, TIFFTAG_BITSPERSAMPLE, bps);
     TIFFSetField (out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
     TIFFSetField (out, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
@@ -1271,38 +1554,54 @@ int ImageIO::saveTIFF (const Glib::ustring &fname, int bps, bool isFloat, bool u
         TIFFSetField (out, TIFFTAG_ICCPROFILE, profileLength, profileData);
     }
 
-    for (int row = 0; row < height; row++) {
-        getScanline (row, linebuffer, bps, isFloat);
+    // the strips are encoded in parallel, a batch at a time to bound the
+    // memory used, and then written in order
+#ifdef _OPENMP
+    const int numThreads = omp_get_max_threads();
+#else
+    const int numThreads = 1;
+#endif
+    const int batchSize = 2 * numThreads;
+    std::vector<std::vector<unsigned char>> strips(batchSize);
+    std::vector<std::vector<unsigned char>> pixels(numThreads);
+    std::vector<std::vector<unsigned char>> tmp(numThreads);
 
-        if (bps == 16) {
-            if(needsReverse && !uncompressed && isFloat) {
-                for(int i = 0; i < lineWidth; i += 2) {
-                    char temp = linebuffer[i];
-                    linebuffer[i] = linebuffer[i + 1];
-                    linebuffer[i + 1] = temp;
-                }
+    for (int batch = 0; batch < numStrips; batch += batchSize) {
+        const int n = std::min(batchSize, numStrips - batch);
+        bool encodeOk = true;
+
+#ifdef _OPENMP
+#       pragma omp parallel for schedule(dynamic) if (n > 1)
+#endif
+        for (int i = 0; i < n; ++i) {
+#ifdef _OPENMP
+            const int tid = omp_get_thread_num();
+#else
+            const int tid = 0;
+#endif
+            const int row = (batch + i) * rowsPerStrip;
+            const int nrows = std::min(rowsPerStrip, height - row);
+            if (!tiff_encode_strip(*this, row, nrows, bps, isFloat, uncompressed, pixels[tid], tmp[tid], strips[i])) {
+#ifdef _OPENMP
+#               pragma omp atomic write
+#endif
+                encodeOk = false;
             }
-        } else if (bps == 32) {
-            if(needsReverse && !uncompressed) {
-                for(int i = 0; i < lineWidth; i += 4) {
-                    char temp = linebuffer[i];
-                    linebuffer[i] = linebuffer[i + 3];
-                    linebuffer[i + 3] = temp;
-                    temp = linebuffer[i + 1];
-                    linebuffer[i + 1] = linebuffer[i + 2];
-                    linebuffer[i + 2] = temp;
-                }
+        }
+
+        for (int i = 0; encodeOk && i < n; ++i) {
+            if (TIFFWriteRawStrip(out, batch + i, strips[i].data(), strips[i].size()) < 0) {
+                encodeOk = false;
             }
         }
 
-        if (TIFFWriteScanline (out, linebuffer, row, 0) < 0) {
+        if (!encodeOk) {
             TIFFClose (out);
-            delete [] linebuffer;
             return IMIO_CANNOTWRITEFILE;
         }
 
-        if (pl && !(row % 100)) {
-            pl->setProgress ((double)(row + 1) / height);
+        if (pl) {
+            pl->setProgress (double(batch + n) / numStrips);
         }
     }
 
@@ -1315,8 +1614,6 @@ int ImageIO::saveTIFF (const Glib::ustring &fname, int bps, bool isFloat, bool u
     fclose (file);
 #endif
 
-    delete [] linebuffer;
-
     if (!saveMetadata(fname)) {
         writeOk = false;
     }
@@ -1494,3 +1791,65 @@ bool ImageIO::saveMetadata(const Glib::ustring &fname) const
 
     return true;
 }
+
+
+#ifdef BENCHMARK
+
+namespace rtengine {
+
+void benchmark_save_tiff()
+{
+    constexpr int W = 9000;
+    constexpr int H = 6000;
+
+    Imagefloat img(W, H);
+    unsigned int seed = 12345;
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            seed = seed * 1664525u + 1013904223u;
+            const float noise = float(seed >> 16) / 65536.f - 0.5f;
+            const float smooth = 0.5f + 0.25f * std::sin(x * 0.01f) * std::cos(y * 0.013f);
+            img.r(y, x) = 65535.f * smooth + 500.f * noise;
+            img.g(y, x) = 65535.f * smooth * 0.8f + 400.f * noise;
+            img.b(y, x) = 65535.f * smooth * 0.6f - 300.f * noise;
+        }
+    }
+
+    const auto fname = Glib::build_filename(Glib::get_tmp_dir(), "ART-benchmark-save.tif");
+
+    int maxthreads = 1;
+#ifdef _OPENMP
+    maxthreads = omp_get_max_threads();
+#endif
+
+    for (int bps : { 16, 32 }) {
+        const bool isFloat = bps == 32;
+        double base = 0;
+        for (int n = 1; ; n = std::min(2 * n, maxthreads)) {
+#ifdef _OPENMP
+            omp_set_num_threads(n);
+#endif
+            MyTime t1, t2;
+            t1.set();
+            img.saveTIFF(fname, bps, isFloat);
+            t2.set();
+            const double us = std::max(t2.etime(t1), 1);
+            if (n == 1) {
+                base = us;
+            }
+            std::cout << "BENCHMARK saveTIFF " << W << "x" << H << " " << bps << "-bit" << (isFloat ? " float" : "") << ", " << n << " threads: " << us / 1000.0 << " ms, speedup " << base / us << std::endl;
+            if (n == maxthreads) {
+                break;
+            }
+        }
+    }
+
+#ifdef _OPENMP
+    omp_set_num_threads(maxthreads);
+#endif
+    g_remove(fname.c_str());
+}
+
+} // namespace rtengine
+
+#endif // BENCHMARK
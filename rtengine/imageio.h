@@ -29,6 +29,7 @@
 #define IMIO_CANNOTWRITEFILE       7
 
 #include <glibmm.h>
+#include <functional>
 #include "rtengine.h"
 #include "imageformat.h"
 #include "procparams.h"
@@ -93,6 +94,15 @@ public:
     static int getPNGSampleFormat (const Glib::ustring &fname, IIOSampleFormat &sFormat, IIOSampleArrangement &sArrangement);
     static int getTIFFSampleFormat (const Glib::ustring &fname, IIOSampleFormat &sFormat, IIOSampleArrangement &sArrangement);
 
+    // raw pixel stream used by the pipe transport of ImageIOManager: a
+    // one-line text header followed by the ICC profile, an Exif blob and
+    // interleaved RGB samples (see imgiomanager.cc for the details)
+    typedef std::function<size_t(char *, size_t)> StreamReader;
+    typedef std::function<bool(const char *, size_t)> StreamWriter;
+    static int getStreamSampleFormat(const std::string &header, IIOSampleFormat &sFormat, IIOSampleArrangement &sArrangement);
+    int loadFromStream(const std::string &header, const StreamReader &in);
+    int saveToStream(const StreamWriter &out, int bps = -1, bool isFloat = false) const;
+
     int loadJPEGFromMemory (const char* buffer, int bufsize);
     int loadPPMFromMemory(const char* buffer, int width, int height, bool swap, int bps);
 
@@ -111,5 +121,9 @@ public:
     MyMutex& mutex ();
 };
 
+#ifdef BENCHMARK
+void benchmark_save_tiff();
+#endif
+
 }
 #endif
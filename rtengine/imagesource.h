@@ -67,6 +67,10 @@ public:
     virtual int load(const Glib::ustring &fname) = 0;
     virtual void preprocess(const RAWParams &raw, const LensProfParams &lensProf, const CoarseTransformParams& coarse, bool prepareDenoise=true, const ColorTemp &wb=ColorTemp()) {};
     virtual void demosaic(const RAWParams &raw, bool autoContrast, double &contrastThreshold) {};
+    // cheaper, reduced-resolution demosaic, for previews that are going to
+    // be sampled at most every skip pixels. Returns false (without doing
+    // anything) if it can't be used, in which case demosaic() is needed
+    virtual bool previewDemosaic(const RAWParams &raw, int skip) { return false; }
     virtual void flushRawData() {};
     virtual void flushRGB() {};
     virtual void HLRecovery_Global(const ExposureParams &hrp) {};
@@ -75,6 +79,9 @@ public:
     virtual bool isRGBSourceModified() const = 0; // tracks whether cached rgb output of demosaic has been modified
 
     virtual void setBorder(unsigned int border) {}
+    // allow the source to keep its preprocessed/demosaiced data in the
+    // on-disk DemosaicCache (meant for interactive sessions only)
+    virtual void enableDemosaicCache(bool yes) {}
     virtual void setCurrentFrame(unsigned int frameNum) = 0;
     virtual int getFrameCount() = 0;
     virtual int getFlatFieldAutoClipValue() = 0;
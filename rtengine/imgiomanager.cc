@@ -31,6 +31,9 @@
 #include <iostream>
 #include <glib/gstdio.h>
 #include <unistd.h>
+#ifndef WIN32
+#  include <signal.h>
+#endif
 
 namespace rtengine {
 
@@ -55,9 +58,12 @@ std::ostream &operator<<(std::ostream &out, const S &s)
 }
 
 
-inline void exec_sync(const Glib::ustring &usrdir, const Glib::ustring &sysdir, const Glib::ustring &workdir, const std::vector<Glib::ustring> &argv, bool search_in_path, std::string *out, std::string *err)
+// Extends PATH with the bin directories of the loaders and savers. This is
+// done only once at initialization, since setenv() is not thread-safe and
+// the external programs can be invoked concurrently (e.g. by the parallel
+// jobs of the CLI or of the batch queue)
+void extend_path(const Glib::ustring &usrdir, const Glib::ustring &sysdir)
 {
-    auto pth = Glib::getenv("PATH");
     auto extrapath = Glib::build_filename(usrdir, "bin") + G_SEARCHPATH_SEPARATOR_S + Glib::build_filename(sysdir, "bin");
 #ifdef BUILD_BUNDLE
     extrapath += G_SEARCHPATH_SEPARATOR_S + options.ART_base_dir;
@@ -66,9 +72,66 @@ inline void exec_sync(const Glib::ustring &usrdir, const Glib::ustring &sysdir,
     if (!epth.empty()) {
         extrapath += G_SEARCHPATH_SEPARATOR_S + epth;
     }
-    Glib::setenv("PATH", extrapath + G_SEARCHPATH_SEPARATOR_S + pth);
+    Glib::setenv("PATH", extrapath + G_SEARCHPATH_SEPARATOR_S + Glib::getenv("PATH"));
+}
+
+
+// Savers using the pipe transport can exit before consuming all their input,
+// and writing to the pipe afterwards must not terminate ART. SIGPIPE is
+// ignored once at initialization, like the PATH above, so that the write
+// errors are reported by SubprocessInfo::write() instead
+void ignore_sigpipe()
+{
+#ifndef WIN32
+    signal(SIGPIPE, SIG_IGN);
+#endif
+}
+
+
+inline void exec_sync(const Glib::ustring &workdir, const std::vector<Glib::ustring> &argv, bool search_in_path, std::string *out, std::string *err)
+{
     subprocess::exec_sync(workdir, argv, search_in_path, out, err);
-    Glib::setenv("PATH", pth);
+}
+
+
+inline std::unique_ptr<subprocess::SubprocessInfo> open_pipe(const Glib::ustring &workdir, const std::vector<Glib::ustring> &argv, bool pipe_in, bool pipe_out)
+{
+    return subprocess::popen(workdir, argv, true, pipe_in, pipe_out, false);
+}
+
+
+// reads the output of a child process until EOF, discarding it
+void drain(subprocess::SubprocessInfo *p)
+{
+    char buf[4096];
+    while (p->read(buf, sizeof(buf)) == sizeof(buf)) {
+    }
+}
+
+
+void get_stream_params(ImageIOManager::Format fmt, int &bps, bool &isFloat)
+{
+    switch (fmt) {
+    case ImageIOManager::FMT_JPG:
+    case ImageIOManager::FMT_PNG:
+        bps = 8;
+        isFloat = false;
+        break;
+    case ImageIOManager::FMT_PNG16:
+    case ImageIOManager::FMT_TIFF:
+        bps = 16;
+        isFloat = false;
+        break;
+    case ImageIOManager::FMT_TIFF_FLOAT16:
+        bps = 16;
+        isFloat = true;
+        break;
+    case ImageIOManager::FMT_TIFF_FLOAT:
+    default:
+        bps = 32;
+        isFloat = true;
+        break;
+    }
 }
 
 } // namespace
@@ -84,6 +147,8 @@ void ImageIOManager::init(const Glib::ustring &base_dir, const Glib::ustring &us
 {
     sysdir_ = Glib::build_filename(base_dir, "imageio");
     usrdir_ = Glib::build_filename(user_dir, "imageio");
+    extend_path(usrdir_, sysdir_);
+    ignore_sigpipe();
     do_init(sysdir_);
     do_init(usrdir_);
 }
@@ -137,6 +202,11 @@ void ImageIOManager::do_init(const Glib::ustring &dirname)
                 if (kf.has_key(group, "ReadCommand")) {
                     cmd = kf.get_string(group, "ReadCommand");
                     loaders_[ext] = Pair(dirname, cmd);
+                    if (kf.has_key(group, "ReadPipe") && kf.get_boolean(group, "ReadPipe")) {
+                        pipe_loaders_.insert(ext);
+                    } else {
+                        pipe_loaders_.erase(ext);
+                    }
 
                     if (settings->verbose > 1) {
                         std::cout << "Found loader for extension \"" << ext << "\": " << S(cmd) << std::endl;
@@ -146,6 +216,11 @@ void ImageIOManager::do_init(const Glib::ustring &dirname)
                 if (kf.has_key(group, "WriteCommand")) {
                     cmd = kf.get_string(group, "WriteCommand");
                     savers_[savefmt] = Pair(dirname, cmd);
+                    if (kf.has_key(group, "WritePipe") && kf.get_boolean(group, "WritePipe")) {
+                        pipe_savers_.insert(savefmt);
+                    } else {
+                        pipe_savers_.erase(savefmt);
+                    }
                     Glib::ustring lbl;
                     if (kf.has_key(group, "Label")) {
                         lbl = kf.get_string(group, "Label");
@@ -215,6 +290,31 @@ Glib::ustring ImageIOManager::get_ext(Format f)
 }
 
 
+/*
+ * Loaders and savers can exchange pixel data with ART either through
+ * temporary files (the default), or through the standard input/output of the
+ * external command, if the codec description sets ReadPipe=true and/or
+ * WritePipe=true. In the latter case, the arguments of the command are:
+ *
+ *   - loaders: <input file> - <max width hint> <max height hint>
+ *   - savers: - <output file>
+ *
+ * and the image is sent (to the saver's stdin) or expected (from the loader's
+ * stdout) in the following format:
+ *
+ *   ART-IMAGE 1 <width> <height> <sample type> <ICC size> <Exif size>\n
+ *   <ICC profile data>
+ *   <Exif data, TIFF structure as in the APP1 segment of JPEG files>
+ *   <RGB pixel data>
+ *
+ * where <sample type> is one of u8, u16, f16 and f32, and the pixel data are
+ * interleaved RGB triplets in native byte order, row by row from the top.
+ * Floating-point values are normalized to [0, 1]. Savers must consume exactly
+ * the advertised amount of data. Loaders should write their diagnostics to
+ * stderr, and may leave the Exif block empty.
+ *
+ * If the pipe transport fails, the temporary file one is used as a fallback.
+ */
 bool ImageIOManager::load(const Glib::ustring &fileName, ProgressListener *plistener, ImageIO *&img, int maxw_hint, int maxh_hint)
 {
     auto ext = std::string(getFileExtension(fileName).lowercase());
@@ -227,16 +327,116 @@ bool ImageIOManager::load(const Glib::ustring &fileName, ProgressListener *plist
         plistener->setProgress(0.0);
     }
 
+    if (pipe_loaders_.find(ext) != pipe_loaders_.end()) {
+        if (load_pipe(it->second, fileName, plistener, img, maxw_hint, maxh_hint)) {
+            return true;
+        } else if (settings->verbose) {
+            std::cout << "  pipe transport failed, retrying with a temporary file" << std::endl;
+        }
+    }
+
+    return load_file(it->second, fmts_[ext], fileName, plistener, img, maxw_hint, maxh_hint);
+}
+
+
+bool ImageIOManager::load_pipe(const Pair &loader, const Glib::ustring &fileName, ProgressListener *plistener, ImageIO *&img, int maxw_hint, int maxh_hint)
+{
+    auto &dir = loader.first;
+    auto &cmd = loader.second;
+    if (settings->verbose) {
+        std::cout << "loading " << fileName << " with " << cmd << " (pipe)" << std::endl;
+    }
+
+    std::unique_ptr<subprocess::SubprocessInfo> p;
+    try {
+        std::vector<Glib::ustring> argv = subprocess::split_command_line(cmd);
+        argv.push_back(fileName);
+        argv.push_back("-");
+        argv.push_back(std::to_string(maxw_hint));
+        argv.push_back(std::to_string(maxh_hint));
+        p = open_pipe(dir, argv, false, true);
+    } catch (subprocess::error &err) {
+        if (settings->verbose) {
+            std::cout << "  exec error: " << err.what() << std::endl;
+        }
+        return false;
+    }
+    if (!p) {
+        return false;
+    }
+
+    constexpr size_t max_header_size = 256;
+    std::string header;
+    for (int c = p->read(); c != EOF && c != '\n'; c = p->read()) {
+        header.push_back(c);
+        if (header.size() > max_header_size) {
+            break;
+        }
+    }
+
+    IIOSampleFormat sFormat;
+    IIOSampleArrangement sArrangement;
+    if (ImageIO::getStreamSampleFormat(header, sFormat, sArrangement) != IMIO_SUCCESS) {
+        if (settings->verbose) {
+            std::cout << "  invalid header: " << header.substr(0, max_header_size) << std::endl;
+        }
+        p->kill();
+        drain(p.get());
+        p->wait();
+        return false;
+    }
+
+    ImageIO *fimg = nullptr;
+    switch (sFormat) {
+    case IIOSF_UNSIGNED_CHAR:
+        fimg = new Image8();
+        break;
+    case IIOSF_UNSIGNED_SHORT:
+        fimg = new Image16();
+        break;
+    default:
+        fimg = new Imagefloat();
+        break;
+    }
+
+    fimg->setProgressListener(plistener);
+    fimg->setSampleFormat(sFormat);
+    fimg->setSampleArrangement(sArrangement);
+
+    const auto reader =
+        [&](char *buf, size_t n) -> size_t
+        {
+            return p->read(buf, n);
+        };
+    bool ok = fimg->loadFromStream(header, reader) == IMIO_SUCCESS;
+    if (!ok) {
+        p->kill();
+    }
+    // the loader might be blocked writing more data than we consumed, so
+    // stdout must be read to the end before waiting for it to exit
+    drain(p.get());
+    ok = (p->wait() == 0) && ok;
+
+    if (ok) {
+        img = fimg;
+    } else {
+        delete fimg;
+    }
+    return ok;
+}
+
+
+bool ImageIOManager::load_file(const Pair &loader, Format fmt, const Glib::ustring &fileName, ProgressListener *plistener, ImageIO *&img, int maxw_hint, int maxh_hint)
+{
     std::string templ = Glib::build_filename(Glib::get_tmp_dir(), Glib::ustring::compose("ART-load-%1-XXXXXX", Glib::path_get_basename(fileName)));
     int fd = Glib::mkstemp(templ);
     if (fd < 0) {
         return false;
     }
-    auto fmt = fmts_[ext];
     Glib::ustring outname = fname_to_utf8(templ) + get_ext(fmt);
     // int exit_status = -1;
-    auto &dir = it->second.first;
-    auto &cmd = it->second.second;
+    auto &dir = loader.first;
+    auto &cmd = loader.second;
     std::vector<Glib::ustring> argv = subprocess::split_command_line(cmd);
     argv.push_back(fileName);
     argv.push_back(outname);
@@ -248,7 +448,7 @@ bool ImageIOManager::load(const Glib::ustring &fileName, ProgressListener *plist
         std::cout << "loading " << fileName << " with " << cmd << std::endl;
     }
     try {
-        exec_sync(usrdir_, sysdir_, dir, argv, true, &sout, &serr);
+        exec_sync(dir, argv, true, &sout, &serr);
     } catch (subprocess::error &err) {
         if (settings->verbose) {
             std::cout << "  exec error: " << err.what() << std::endl;
@@ -356,12 +556,78 @@ bool ImageIOManager::save(IImagefloat *img, const std::string &ext, const Glib::
         plistener->setProgress(0.0);
     }
 
+    auto fmt = fmts_[ext];
+    if (fmt != FMT_UNKNOWN && pipe_savers_.find(ext) != pipe_savers_.end()) {
+        if (save_pipe(it->second, fmt, img, fileName, plistener)) {
+            return true;
+        } else if (settings->verbose) {
+            std::cout << "  pipe transport failed, retrying with a temporary file" << std::endl;
+        }
+    }
+
+    return save_file(it->second, fmt, img, fileName, plistener);
+}
+
+
+bool ImageIOManager::save_pipe(const Pair &saver, Format fmt, IImagefloat *img, const Glib::ustring &fileName, ProgressListener *plistener)
+{
+    const Imagefloat *fimg = dynamic_cast<const Imagefloat *>(img);
+    if (!fimg) {
+        return false;
+    }
+
+    auto &dir = saver.first;
+    auto &cmd = saver.second;
+    if (settings->verbose) {
+        std::cout << "saving " << fileName << " with " << cmd << " (pipe)" << std::endl;
+    }
+
+    std::unique_ptr<subprocess::SubprocessInfo> p;
+    try {
+        std::vector<Glib::ustring> argv = subprocess::split_command_line(cmd);
+        argv.push_back("-");
+        argv.push_back(fileName);
+        p = open_pipe(dir, argv, true, false);
+    } catch (subprocess::error &err) {
+        if (settings->verbose) {
+            std::cout << "  exec error: " << err.what() << std::endl;
+        }
+        return false;
+    }
+    if (!p) {
+        return false;
+    }
+
+    int bps;
+    bool isFloat;
+    get_stream_params(fmt, bps, isFloat);
+
+    const auto writer =
+        [&](const char *data, size_t n) -> bool
+        {
+            return p->write(data, n);
+        };
+    bool ok = fimg->saveToStream(writer, bps, isFloat) == IMIO_SUCCESS;
+    if (!ok) {
+        p->kill();
+    }
+    ok = (p->wait() == 0) && ok;
+
+    if (plistener) {
+        plistener->setProgress(1.0);
+    }
+
+    return ok;
+}
+
+
+bool ImageIOManager::save_file(const Pair &saver, Format fmt, IImagefloat *img, const Glib::ustring &fileName, ProgressListener *plistener)
+{
     std::string templ = Glib::build_filename(Glib::get_tmp_dir(), Glib::ustring::compose("ART-save-%1-XXXXXX", Glib::path_get_basename(fileName)));
     int fd = Glib::mkstemp(templ);
     if (fd < 0) {
         return false;
     }
-    auto fmt = fmts_[ext];
     Glib::ustring tmpname = fname_to_utf8(templ) + get_ext(fmt);
 
     bool ok = false;
@@ -396,8 +662,8 @@ bool ImageIOManager::save(IImagefloat *img, const std::string &ext, const Glib::
     }
         
     if (ok) {
-        auto &dir = it->second.first;
-        auto &cmd = it->second.second;
+        auto &dir = saver.first;
+        auto &cmd = saver.second;
         std::vector<Glib::ustring> argv = subprocess::split_command_line(cmd);
         argv.push_back(tmpname);
         argv.push_back(fileName);
@@ -406,7 +672,7 @@ bool ImageIOManager::save(IImagefloat *img, const std::string &ext, const Glib::
             std::cout << "saving " << fileName << " with " << cmd << std::endl;
         }
         try {
-            exec_sync(usrdir_, sysdir_, dir, argv, true, &sout, &serr);
+            exec_sync(dir, argv, true, &sout, &serr);
         } catch (subprocess::error &err) {
             if (settings->verbose) {
                 std::cout << "  exec error: " << err.what() << std::endl;
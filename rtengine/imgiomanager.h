@@ -26,6 +26,7 @@
 #include "procparams.h"
 #include <glibmm/ustring.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <map>
 
 namespace rtengine {
@@ -68,15 +69,23 @@ public:
     const procparams::PartialProfile *getSaveProfile(const std::string &ext) const;
 
 private:
+    typedef std::pair<Glib::ustring, Glib::ustring> Pair;
+
     void do_init(const Glib::ustring &dir);
     static Glib::ustring get_ext(Format f);
 
+    bool load_pipe(const Pair &loader, const Glib::ustring &fileName, ProgressListener *plistener, ImageIO *&img, int maxw_hint, int maxh_hint);
+    bool load_file(const Pair &loader, Format fmt, const Glib::ustring &fileName, ProgressListener *plistener, ImageIO *&img, int maxw_hint, int maxh_hint);
+    bool save_pipe(const Pair &saver, Format fmt, IImagefloat *img, const Glib::ustring &fileName, ProgressListener *plistener);
+    bool save_file(const Pair &saver, Format fmt, IImagefloat *img, const Glib::ustring &fileName, ProgressListener *plistener);
+
     Glib::ustring sysdir_;
     Glib::ustring usrdir_;
     
-    typedef std::pair<Glib::ustring, Glib::ustring> Pair;
     std::unordered_map<std::string, Pair> loaders_;
     std::unordered_map<std::string, Pair> savers_;
+    std::unordered_set<std::string> pipe_loaders_;
+    std::unordered_set<std::string> pipe_savers_;
     std::unordered_map<std::string, Format> fmts_;
     std::map<std::string, SaveFormatInfo> savelbls_;
     std::unordered_map<std::string, procparams::FilePartialProfile> saveprofiles_;
@@ -68,6 +68,7 @@ ImProcCoordinator::ImProcCoordinator():
     scale(10),
     highDetailPreprocessComputed(false),
     highDetailRawComputed(false),
+    fullDemosaicPending(false),
     allocated(false), 
 
     vhist16(65536),
@@ -132,11 +133,20 @@ ImProcCoordinator::ImProcCoordinator():
     for (auto &s : pipeline_stop_) {
         s = false;
     }
+    // the mask cache keys the parameters through the pipeline cache, even
+    // when the latter does not store anything
+    if (pipeline_cache.enabled() || mask_cache.enabled()) {
+        ipf.setPipelineCache(&pipeline_cache);
+    }
+    if (mask_cache.enabled()) {
+        ipf.setMaskCache(&mask_cache);
+    }
 }
 
 void ImProcCoordinator::assign(ImageSource* imgsrc)
 {
     this->imgsrc = imgsrc;
+    imgsrc->enableDemosaicCache(true);
     denoiseInfoStore.valid = false;
 }
 
@@ -283,6 +293,8 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
         }
         if (todo & M_INIT) {
             preproc_wb = currWB;
+            // the input of all the masks is going to change
+            mask_cache.clear();
         }
         
         // raw auto CA is bypassed if no high detail is needed, so we have to compute it when high detail is needed
@@ -301,7 +313,9 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
             imageTypeListener->imageTypeChanged(imgsrc->isRAW(), imgsrc->getSensorType() == ST_BAYER, imgsrc->getSensorType() == ST_FUJI_XTRANS, imgsrc->isMono());
         }
 
-        if ((todo & M_RAW) || (!highDetailRawComputed && highDetailNeeded)) {
+        // while the full demosaic is pending, it is needed right away only
+        // for the detail windows at 100%
+        if ((todo & M_RAW) || (!highDetailRawComputed && highDetailNeeded && (!fullDemosaicPending || highDetailNeeded_WB))) {
             if (settings->verbose) {
                 if (imgsrc->getSensorType() == ST_BAYER) {
                     std::cout << "Demosaic Bayer image n." << rp.bayersensor.imageNum + 1 << " using method: " << RAWParams::BayerSensor::getMethodString(rp.bayersensor.method) << std::endl;
@@ -320,7 +334,26 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
             }
             bool autoContrast = imgsrc->getSensorType() == ST_BAYER ? params.raw.bayersensor.dualDemosaicAutoContrast : params.raw.xtranssensor.dualDemosaicAutoContrast;
             double contrastThreshold = imgsrc->getSensorType() == ST_BAYER ? params.raw.bayersensor.dualDemosaicContrast : params.raw.xtranssensor.dualDemosaicContrast;
-            imgsrc->demosaic(rp, autoContrast, contrastThreshold); //enabled demosaic
+            // The demosaiced data is not sampled more finely than the preview
+            // or the detail windows do, so a reduced-resolution demosaic is
+            // enough until high detail is needed. In the default preview
+            // mode, this gives a quick first result and the full demosaic
+            // is deferred (see process())
+            const bool deferFull = options.prevdemo == PD_Sidecar && !highDetailNeeded_WB && !(todo & M_HIGHQUAL);
+            const bool hrColor = params.exposure.enabled && (params.exposure.hrmode == procparams::ExposureParams::HR_COLOR || params.exposure.hrmode == procparams::ExposureParams::HR_COLORSOFT);
+            bool reduced = false;
+            if ((!highDetailNeeded || deferFull) && !hrColor) {
+                int nW, nH;
+                int skip = getPreviewScale(scale, nW, nH);
+                for (auto c : crops) {
+                    skip = std::min(skip, c->get_skip());
+                }
+                reduced = imgsrc->previewDemosaic(rp, skip);
+            }
+            if (!reduced) {
+                imgsrc->demosaic(rp, autoContrast, contrastThreshold); //enabled demosaic
+            }
+            fullDemosaicPending = reduced && highDetailNeeded;
 
             if (imgsrc->getSensorType() == ST_BAYER && bayerAutoContrastListener && autoContrast) {
                 bayerAutoContrastListener->autoContrastChanged(autoContrast ? contrastThreshold : -1.0);
@@ -331,7 +364,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
     
             // if a demosaic happened we should also call getimage later, so we need to set the M_INIT flag
             todo |= M_INIT;
-            highDetailRawComputed = highDetailNeeded;
+            highDetailRawComputed = highDetailNeeded && !reduced;
         }   
     
         setScale(scale);
@@ -342,6 +375,11 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
 
         if (todo & (M_INIT | M_LINDENOISE | M_HDR)) {
             MyMutex::MyLock initLock(minit);  // Also used in crop window
+
+            preview_pyramid.setSource(fw, fh, tr);
+            if (todo & M_INIT) {
+                preview_pyramid.clear();
+            }
     
             if (params.wb.method == WBParams::AUTO) {
                 if (lastAwbEqual != params.wb.equal) {
@@ -375,6 +413,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
     
             //setScale(scale);
             imgsrc->getImage(currWB, tr, orig_prev, pp, params.exposure, params.raw);
+            preview_pyramid.set(scale, orig_prev);
             // if (todo & M_INIT) {
             //     denoiseInfoStore.pparams = params;
             //     denoiseInfoStore.valid = false;
@@ -695,6 +734,31 @@ void ImProcCoordinator::allocCache (Imagefloat* &imgfloat)
     }
 }
 
+/** @brief Computes the scale actually used for the preview
+ * The requested scale is reduced for small images, so that the preview is
+ * not too small.
+ *
+ * @param prevscale Requested preview's scale.
+ * @param nW Width of the preview at the returned scale.
+ * @param nH Height of the preview at the returned scale.
+ */
+int ImProcCoordinator::getPreviewScale(int prevscale, int &nW, int &nH)
+{
+    int w, h;
+    imgsrc->getFullSize(w, h, getCoarseBitMask(params.coarse));
+
+    prevscale++;
+
+    do {
+        prevscale--;
+        PreviewProps pp(0, 0, w, h, prevscale);
+        imgsrc->getSize(pp, nW, nH);
+    } while (nH < 400 && prevscale > 1 && (nW * nH < 1000000));  // sctually hardcoded values, perhaps a better choice is possible
+
+    return prevscale;
+}
+
+
 /** @brief Handles image buffer (re)allocation and trigger sizeChanged of SizeListener[s]
  * If the scale change, this method will free all buffers and reallocate ones of the new size.
  * It will then tell to the SizeListener that size has changed (sizeChanged)
@@ -709,13 +773,7 @@ void ImProcCoordinator::setScale(int prevscale)
     int nW, nH;
     imgsrc->getFullSize(fw, fh, tr);
 
-    prevscale++;
-
-    do {
-        prevscale--;
-        PreviewProps pp(0, 0, fw, fh, prevscale);
-        imgsrc->getSize(pp, nW, nH);
-    } while (nH < 400 && prevscale > 1 && (nW * nH < 1000000));  // sctually hardcoded values, perhaps a better choice is possible
+    prevscale = getPreviewScale(prevscale, nW, nH);
 
     if (nW != pW || nH != pH) {
 
@@ -1426,6 +1484,8 @@ void ImProcCoordinator::stopProcessing()
 
     if (updaterRunning) {
         changeSinceLast = 0;
+        // the next update will do the full demosaic if still needed
+        fullDemosaicPending = false;
         wait_not_running();
     }
     // if (updaterRunning && thread) {
@@ -1470,11 +1530,17 @@ void ImProcCoordinator::process()
     paramsUpdateMutex.lock();
 
     bool changed = false;
-    while (changeSinceLast) {
+    while (changeSinceLast || fullDemosaicPending) {
         const bool panningRelatedChange = true;
         params = nextParams;
         int change = changeSinceLast;
         changeSinceLast = 0;
+        if (!change) {
+            // nothing else to do, replace the reduced-resolution demosaic
+            // of the preview with the full one
+            change = DEMOSAIC | M_HIGHQUAL;
+            fullDemosaicPending = false;
+        }
         if (tweakOperator) {
             // TWEAKING THE PROCPARAMS FOR THE SPOT ADJUSTMENT MODE
             backupParams();
@@ -27,6 +27,9 @@
 #include "procevents.h"
 #include "dcrop.h"
 #include "LUT.h"
+#include "previewpyramid.h"
+#include "pipelinecache.h"
+#include "masks.h"
 #include "../rtgui/threadutils.h"
 
 #include <mutex>
@@ -84,6 +87,9 @@ protected:
     int scale;
     bool highDetailPreprocessComputed;
     bool highDetailRawComputed;
+    // the raw data has been demosaiced at reduced resolution, the full
+    // demosaic is done once there is nothing else to process
+    bool fullDemosaicPending;
     bool allocated;
 
     void freeAll ();
@@ -136,12 +142,16 @@ protected:
     bool resultValid;
 
     MyMutex minit;  // to gain mutually exclusive access to ... to what exactly?
+    PreviewPyramid preview_pyramid; // protected by minit
+    PipelineCache pipeline_cache;
+    MaskCache mask_cache;
     void backupParams();
     void restoreParams();
 
     void progress (Glib::ustring str, int pr);
     void reallocAll ();
     void allocCache (Imagefloat* &imgfloat);
+    int getPreviewScale (int prevscale, int &nW, int &nH);
     void setScale (int prevscale);
     void updatePreviewImage (int todo, bool panningRelatedChange);
     void updateWB();
@@ -17,6 +17,9 @@
  *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
 #include <glib.h>
 #include <glibmm.h>
 #ifdef _OPENMP
@@ -42,6 +45,8 @@
 #include "../rtgui/ppversion.h"
 #include "../rtgui/guiutils.h"
 #include "refreshmap.h"
+#include "pipelinecache.h"
+#include "matrixshaper.h"
 
 namespace rtengine {
 
@@ -59,6 +64,10 @@ ImProcFunctions::ImProcFunctions(const ProcParams* iparams, bool imultiThread):
     dcpProf(nullptr),
     dcpApplyState(nullptr),
     pipetteBuffer(nullptr),
+    pipelineCache(nullptr),
+    maskCache(nullptr),
+    mask_input_key(0),
+    has_mask_input_key(false),
     lumimul{},
     offset_x(0),
     offset_y(0),
@@ -70,7 +79,8 @@ ImProcFunctions::ImProcFunctions(const ProcParams* iparams, bool imultiThread):
     show_sharpening_mask(false),
     plistener(nullptr),
     progress_step(0),
-    progress_end(1)
+    progress_end(1),
+    strip_height(settings->output_strip_height)
 {
 }
 
@@ -95,9 +105,11 @@ void ImProcFunctions::updateColorProfiles (const Glib::ustring& monitorProfile,
         cmsDeleteTransform (monitorTransform);
     }
     gamutWarning.reset(nullptr);
+    monitorShaper.reset();
 
     monitorTransform = nullptr;
     monitor = nullptr;
+    cmsHPROFILE shaper_src = nullptr;
 
     if (settings->color_mgmt_mode != Settings::ColorManagementMode::APPLICATION) {
         monitor = ICCStore::getInstance()->getActiveMonitorProfile();
@@ -231,6 +243,9 @@ void ImProcFunctions::updateColorProfiles (const Glib::ustring& monitorProfile,
 
             monitorTransform = cmsCreateTransform (iprof, TYPE_RGB_FLT, 
                                                    monitor, TYPE_RGB_FLT, monitorIntent, flags);
+            if (monitorTransform) {
+                shaper_src = iprof;
+            }
         }
 
         if (gamutCheck && gamutprof) {
@@ -239,6 +254,11 @@ void ImProcFunctions::updateColorProfiles (const Glib::ustring& monitorProfile,
 
 //        cmsCloseProfile (iprof);
     }
+
+    // this takes the lcms lock itself
+    if (shaper_src) {
+        monitorShaper = MatrixShaperTransform::get(shaper_src, monitor, monitorIntent, settings->monitorBPC, 65536);
+    }
 }
 
 void ImProcFunctions::firstAnalysis (const Imagefloat* const original, const ProcParams &params, LUTu & histogram)
@@ -553,73 +573,330 @@ void ImProcFunctions::setProgressListener(ProgressListener *pl, int num_previews
 }
 
 
-template <class Ret, class Method>
-Ret ImProcFunctions::apply(Method op, Imagefloat *img)
+void ImProcFunctions::advanceProgress()
 {
     if (plistener) {
         float percent = float(++progress_step) / float(progress_end);
         plistener->setProgress(percent);
     }
+}
+
+
+template <class Ret, class Method>
+Ret ImProcFunctions::apply(Method op, Imagefloat *img)
+{
+    advanceProgress();
     return (this->*op)(img);
 }
 
 
+/*
+ * Memoization of the steps of process() in the PipelineCache (if any).
+ *
+ * Each step is given the parameters it reads, which are chained into the key
+ * of its output, and a flag telling whether its output is worth storing
+ * (i.e. whether the step is expensive and enabled). The image is hashed only
+ * when the first such step is reached, so the chain starts from the input of
+ * that step, and the steps before it just run. A step whose output is found
+ * in the cache is skipped; consecutive hits are resolved lazily, so that
+ * only the last cached output before a step that has to run is copied into
+ * the image. The cache is bypassed for the non-interactive pipelines, and
+ * when the steps have side outputs that would be skipped along with them
+ * (pipette buffers and colour picking in edit mode, sharpening mask). The
+ * steps that fill the curve histograms are never stored, so they always run.
+ *
+ * Each step is also told whether it is enabled, i.e. whether it can change
+ * the image. Once getMasks() has identified the image, the parameters of
+ * the enabled steps are chained into ImProcFunctions::mask_input_key, so
+ * that the image has to be hashed at most once per stage, and the tools
+ * that see the same image (because the steps between them are disabled)
+ * find the same masks.
+ */
+class ImProcFunctions::StepMemo {
+public:
+    StepMemo(ImProcFunctions *ipf, Pipeline pipeline, Imagefloat *img):
+        ipf_(ipf),
+        img_(img),
+        pipeline_(pipeline),
+        cache_(nullptr),
+        key_(0),
+        has_key_(false)
+    {
+        const bool interactive = pipeline == Pipeline::NAVIGATOR || pipeline == Pipeline::PREVIEW;
+        const bool editing = ipf->pipetteBuffer && ipf->pipetteBuffer->getEditID() != EUID_None;
+
+        if (ipf->pipelineCache && ipf->pipelineCache->enabled() && interactive && !editing && !ipf->show_sharpening_mask) {
+            cache_ = ipf->pipelineCache;
+        }
+        ipf_->has_mask_input_key = false;
+    }
+
+    ~StepMemo()
+    {
+        ipf_->has_mask_input_key = false;
+    }
+
+    template <class Method, class... P>
+    bool step(Method op, const char *name, bool store, bool enabled, const P&... params)
+    {
+        const bool stop = memo(op, name, store, params...);
+        if (enabled) {
+            chainMaskKey(name, params...);
+        }
+        return stop;
+    }
+
+    // for the operations that don't count as pipeline steps
+    template <class F, class... P>
+    void apply(F func, const char *name, const P&... params)
+    {
+        if (has_key_) {
+            key_ = cache_->getKey(key_, name, params...);
+            flush();
+        }
+        func();
+        chainMaskKey(name, params...);
+    }
+
+    // makes sure the image holds the output of the last step
+    void flush()
+    {
+        if (pending_) {
+            pending_->img->copyTo(img_);
+            pending_.reset();
+        }
+    }
+
+private:
+    template <class Method, class... P>
+    bool memo(Method op, const char *name, bool store, const P&... params)
+    {
+        if (!cache_ || (!store && !has_key_)) {
+            return call(op);
+        }
+
+        if (!has_key_) {
+            // no pending output here, img_ is the input of this step
+            key_ = cache_->getKey(PipelineCache::hash(img_, ipf_->multiThread), "context", int(pipeline_), ipf_->scale, ipf_->offset_x, ipf_->offset_y, ipf_->full_width, ipf_->full_height, static_cast<const void *>(ipf_->dcpProf), ipf_->params->icm);
+            has_key_ = true;
+        }
+
+        key_ = cache_->getKey(key_, name, params...);
+        PipelineCache::EntryPtr e;
+        if (store && cache_->get(key_, e)) {
+            pending_ = e;
+            ipf_->advanceProgress();
+            return e->stop;
+        }
+
+        flush();
+        const bool stop = call(op);
+        if (store) {
+            cache_->set(key_, img_, stop);
+        }
+        return stop;
+    }
+
+    template <class... P>
+    void chainMaskKey(const char *name, const P&... params)
+    {
+        if (ipf_->has_mask_input_key) {
+            ipf_->mask_input_key = ipf_->pipelineCache->getKey(ipf_->mask_input_key, name, params...);
+        }
+    }
+
+    bool call(void (ImProcFunctions::*op)(Imagefloat *))
+    {
+        ipf_->apply<void>(op, img_);
+        return false;
+    }
+
+    bool call(bool (ImProcFunctions::*op)(Imagefloat *))
+    {
+        return ipf_->apply<bool>(op, img_);
+    }
+
+    ImProcFunctions *ipf_;
+    Imagefloat *img_;
+    Pipeline pipeline_;
+    PipelineCache *cache_;
+    uint64_t key_;
+    bool has_key_;
+    PipelineCache::EntryPtr pending_;
+};
+
+
+bool ImProcFunctions::useStrips(Pipeline pipeline, const Imagefloat *img) const
+{
+    // the histograms of the curves would be filled once per strip
+    return pipeline == Pipeline::OUTPUT && strip_height > 0 && img->getHeight() > strip_height && !histToneCurve && !histLCurve;
+}
+
+
+/*
+ * Run a sequence of operations on horizontal strips of strip_height rows of
+ * img, so that the operators (and their temporary buffers) never see a
+ * full-frame image. Each strip is extended by margin rows above and below
+ * (the support of the operations), taken from the input of the sequence;
+ * only its central rows are written back. Peak memory is then img plus
+ * (strip_height + 3 * margin) rows, plus what the operators allocate for a
+ * buffer of that size. If the output of the operations at a given row only
+ * depends on the input rows within margin, the result is identical to the
+ * full-frame one.
+ */
+template <class Ops>
+void ImProcFunctions::processStrips(Imagefloat *img, int num_steps, int margin, Ops ops)
+{
+    const int W = img->getWidth();
+    const int H = img->getHeight();
+    const int sh = strip_height;
+    const int oy = offset_y;
+
+    if (settings->verbose > 1) {
+        std::cout << "processing " << num_steps << " steps on strips of " << sh << " rows, margin " << margin << std::endl;
+    }
+
+    const auto copy_rows =
+        [this,W](const Imagefloat *src, int src_y, Imagefloat *dst, int dst_y, int n) -> void
+        {
+#ifdef _OPENMP
+#           pragma omp parallel for if (multiThread)
+#endif
+            for (int y = 0; y < n; ++y) {
+                std::copy(src->r(src_y + y), src->r(src_y + y) + W, dst->r(dst_y + y));
+                std::copy(src->g(src_y + y), src->g(src_y + y) + W, dst->g(dst_y + y));
+                std::copy(src->b(src_y + y), src->b(src_y + y) + W, dst->b(dst_y + y));
+            }
+        };
+
+    Imagefloat strip(W, std::min(sh + 2 * margin, H), img);
+    // input rows above the current strip, already overwritten in img
+    Imagefloat above(W, std::max(margin, 1));
+    int above_y = 0;
+    
+    for (int y0 = 0; y0 < H; y0 += sh) {
+        const int y1 = std::min(y0 + sh, H);
+        const int top = std::max(y0 - margin, 0);
+        const int bottom = std::min(y1 + margin, H);
+        if (bottom - top != strip.getHeight()) {
+            strip.allocate(W, bottom - top);
+        }
+        img->copyState(&strip);
+
+        copy_rows(&above, top - above_y, &strip, 0, y0 - top);
+        copy_rows(img, y0, &strip, y0 - top, bottom - y0);
+
+        offset_y = oy + top;
+        ops(&strip);
+
+        if (margin > 0 && y1 < H) {
+            above_y = std::max(y1 - margin, 0);
+            copy_rows(img, above_y, &above, 0, y1 - above_y);
+        }
+        copy_rows(&strip, y0 - top, img, y0, y1 - y0);
+    }
+    offset_y = oy;
+    strip.copyState(img);
+
+    if (plistener) {
+        progress_step += num_steps;
+        plistener->setProgress(float(progress_step) / float(progress_end));
+    }
+}
+
+
 bool ImProcFunctions::process(Pipeline pipeline, Stage stage, Imagefloat *img)
 {
     bool stop = false;
     cur_pipeline = pipeline;
+    StepMemo memo(this, pipeline, img);
 
-#define STEP_(op) apply<void>(&ImProcFunctions::op, img)
-#define STEP_s_(op) apply<bool>(&ImProcFunctions::op, img)
+    // expensive steps are stored when enabled, cheap ones are never stored
+#define STEP_(op, enabled, ...) memo.step(&ImProcFunctions::op, #op, enabled, enabled, __VA_ARGS__)
+#define CHEAP_STEP_(op, enabled, ...) memo.step(&ImProcFunctions::op, #op, false, enabled, __VA_ARGS__)
         
     switch (stage) {
     case Stage::STAGE_0:
-        STEP_(dehaze);
-        STEP_(dynamicRangeCompression);
+        STEP_(dehaze, params->dehaze.enabled, params->dehaze);
+        STEP_(dynamicRangeCompression, params->fattal.enabled, params->fattal);
         break;
     case Stage::STAGE_1:
-        STEP_(channelMixer);
-        STEP_(exposure);
-        STEP_(hslEqualizer);
-        stop = STEP_s_(toneEqualizer);
+        if (useStrips(pipeline, img)) {
+            processStrips(img, 2, 0,
+                          [this](Imagefloat *strip) -> void
+                          {
+                              channelMixer(strip);
+                              exposure(strip);
+                          });
+        } else {
+            CHEAP_STEP_(channelMixer, params->chmixer.enabled, params->chmixer);
+            CHEAP_STEP_(exposure, params->exposure.enabled, params->exposure);
+        }
+        CHEAP_STEP_(hslEqualizer, params->hsl.enabled, params->hsl);
+        stop = STEP_(toneEqualizer, params->toneEqualizer.enabled, params->toneEqualizer);
         if (params->icm.workingProfile == "ProPhoto") {
-            proPhotoBlue(img, multiThread);
+            memo.apply([&]() { proPhotoBlue(img, multiThread); }, "proPhotoBlue");
         }
         break;
     case Stage::STAGE_2:
         if (pipeline == Pipeline::OUTPUT ||
             (pipeline == Pipeline::PREVIEW /*&& scale == 1*/)) {
-            stop = STEP_s_(sharpening);
+            stop = STEP_(sharpening, params->sharpening.enabled, params->sharpening);
             if (!stop) {
-                STEP_(impulsedenoise);
-                STEP_(defringe);
+                STEP_(impulsedenoise, params->impulseDenoise.enabled, params->impulseDenoise);
+                STEP_(defringe, params->defringe.enabled, params->defringe);
             }
         }
-        stop = stop || STEP_s_(colorCorrection);
-        stop = stop || STEP_s_(guidedSmoothing);
+        stop = stop || STEP_(colorCorrection, params->colorcorrection.enabled, params->colorcorrection);
+        stop = stop || STEP_(guidedSmoothing, params->smoothing.enabled, params->smoothing, params->denoise);
         break;
     case Stage::STAGE_3:
-        STEP_(creativeGradients);
-        stop = stop || STEP_s_(textureBoost);
+        STEP_(creativeGradients, needsGradient() || needsPCVignetting(), params->gradient, params->pcvignette, params->vignetting, params->crop);
+        stop = stop || STEP_(textureBoost, params->textureBoost.enabled, params->textureBoost);
         if (!stop) { 
-            STEP_(filmGrain);
-            STEP_(logEncoding);
-            STEP_(saturationVibrance);
-            dcpProfile(img, dcpProf, dcpApplyState, multiThread);
-            if (!params->filmSimulation.after_tone_curve) {
-                STEP_(filmSimulation);
-            }
-            STEP_(toneCurve);
-            if (params->filmSimulation.after_tone_curve) {
-                STEP_(filmSimulation);
+            STEP_(filmGrain, params->grain.enabled, params->grain);
+            STEP_(logEncoding, params->logenc.enabled, params->logenc);
+            // the legacy contrast of the tone curve and the contrast of the
+            // L*a*b* adjustments use the histogram of the whole image, so
+            // they can't run on strips
+            const bool hist_contrast =
+                (params->toneCurve.enabled && params->toneCurve.contrastLegacyMode && params->toneCurve.contrast) ||
+                (params->labCurve.enabled && params->labCurve.contrast);
+            if (useStrips(pipeline, img) && !hist_contrast) {
+                processStrips(img, 6, 0,
+                              [this](Imagefloat *strip) -> void
+                              {
+                                  saturationVibrance(strip);
+                                  dcpProfile(strip, dcpProf, dcpApplyState, multiThread);
+                                  if (!params->filmSimulation.after_tone_curve) {
+                                      filmSimulation(strip);
+                                  }
+                                  toneCurve(strip);
+                                  if (params->filmSimulation.after_tone_curve) {
+                                      filmSimulation(strip);
+                                  }
+                                  rgbCurves(strip);
+                                  labAdjustments(strip);
+                                  softLight(strip);
+                              });
+            } else {
+                CHEAP_STEP_(saturationVibrance, params->saturation.enabled, params->saturation);
+                memo.apply([&]() { dcpProfile(img, dcpProf, dcpApplyState, multiThread); }, "dcpProfile");
+                if (!params->filmSimulation.after_tone_curve) {
+                    CHEAP_STEP_(filmSimulation, params->filmSimulation.enabled, params->filmSimulation);
+                }
+                CHEAP_STEP_(toneCurve, params->toneCurve.enabled, params->toneCurve, params->logenc);
+                if (params->filmSimulation.after_tone_curve) {
+                    CHEAP_STEP_(filmSimulation, params->filmSimulation.enabled, params->filmSimulation);
+                }
+                CHEAP_STEP_(rgbCurves, params->rgbCurves.enabled, params->rgbCurves);
+                CHEAP_STEP_(labAdjustments, params->labCurve.enabled, params->labCurve);
+                CHEAP_STEP_(softLight, params->softlight.enabled, params->softlight);
             }
-            STEP_(rgbCurves);
-            STEP_(labAdjustments);
-            STEP_(softLight);
         }
-        stop = stop || STEP_s_(localContrast);
+        stop = stop || STEP_(localContrast, params->localContrast.enabled, params->localContrast);
         if (!stop) {
-            STEP_(blackAndWhite);
+            CHEAP_STEP_(blackAndWhite, params->blackwhite.enabled, params->blackwhite);
 //            STEP_(filmGrain);
         }
         if (pipeline == Pipeline::PREVIEW && params->prsharpening.enabled) {
@@ -628,11 +905,16 @@ bool ImProcFunctions::process(Pipeline pipeline, Stage stage, Imagefloat *img)
             int imw, imh;
             double s2 = resizeScale(params, fw, fh, imw, imh);
             scale = std::max(s * s2, 1.0);
-            STEP_s_(prsharpening);
+            STEP_(prsharpening, true, params->prsharpening, params->resize, params->crop);
             scale = s;
         }
         break;
     }
+
+#undef STEP_
+#undef CHEAP_STEP_
+
+    memo.flush();
     return stop;
 }
 
@@ -661,4 +943,133 @@ int ImProcFunctions::setDeltaEData(EditUniqueID id, double x, double y)
 }
 
 
+#ifdef BENCHMARK
+
+namespace {
+
+bool same_image(Imagefloat *a, Imagefloat *b)
+{
+    a->setMode(Imagefloat::Mode::RGB, true);
+    b->setMode(Imagefloat::Mode::RGB, true);
+    const int W = a->getWidth();
+    const int H = a->getHeight();
+    if (b->getWidth() != W || b->getHeight() != H) {
+        return false;
+    }
+    for (int y = 0; y < H; ++y) {
+        if (std::memcmp(a->r(y), b->r(y), W * sizeof(float)) != 0 ||
+            std::memcmp(a->g(y), b->g(y), W * sizeof(float)) != 0 ||
+            std::memcmp(a->b(y), b->b(y), W * sizeof(float)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+
+bool benchmark_strips()
+{
+    constexpr int W = 6000;
+    constexpr int H = 4000;
+    constexpr int SH = 256;
+
+    Imagefloat src(W, H);
+    unsigned int seed = 12345;
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            seed = seed * 1664525u + 1013904223u;
+            const float noise = float(seed >> 16) / 65536.f - 0.5f;
+            const float smooth = 0.5f + 0.25f * std::sin(x * 0.01f) * std::cos(y * 0.013f);
+            src.r(y, x) = 65535.f * smooth + 500.f * noise;
+            src.g(y, x) = 65535.f * smooth * 0.8f + 400.f * noise;
+            src.b(y, x) = 65535.f * smooth * 0.6f - 300.f * noise;
+        }
+    }
+
+    ProcParams params;
+    params.exposure.enabled = true;
+    params.exposure.expcomp = 0.5;
+    params.saturation.enabled = true;
+    params.saturation.saturation = 20;
+    params.saturation.vibrance = 10;
+    params.toneCurve.enabled = true;
+    params.toneCurve.contrast = 25;
+    params.toneCurve.contrastLegacyMode = false;
+    params.softlight.enabled = true;
+    params.softlight.strength = 30;
+
+    bool ok = true;
+
+    // the per-pixel steps give the same output on strips and on the full
+    // frame
+    for (auto stage : { ImProcFunctions::Stage::STAGE_1, ImProcFunctions::Stage::STAGE_3 }) {
+        const int n = stage == ImProcFunctions::Stage::STAGE_1 ? 1 : 3;
+        Imagefloat img[2];
+        double us[2];
+        for (int i = 0; i < 2; ++i) {
+            src.copyTo(&img[i]);
+            ImProcFunctions ipf(&params);
+            ipf.setStripHeight(i ? SH : 0);
+            MyTime t1, t2;
+            t1.set();
+            ipf.process(ImProcFunctions::Pipeline::OUTPUT, stage, &img[i]);
+            t2.set();
+            us[i] = t2.etime(t1);
+        }
+        const bool same = same_image(&img[0], &img[1]);
+        std::cout << "strips, stage " << n << ": full frame " << us[0] / 1000.0 << " ms, strips of " << SH << " rows " << us[1] / 1000.0 << " ms, " << (same ? "same output" : "OUTPUT DIFFERS") << std::endl;
+        ok = ok && same;
+    }
+
+    // the overlap margins make an operation with a bounded support (here a
+    // vertical box blur) give the same output, and the operations never see
+    // more than SH + 2 * margin rows
+    constexpr int R = 5;
+    int max_rows = 0;
+    const auto blur =
+        [&max_rows](Imagefloat *img) -> void
+        {
+            const int w = img->getWidth();
+            const int h = img->getHeight();
+            max_rows = std::max(max_rows, h);
+            array2D<float> tmp(w, h);
+#ifdef _OPENMP
+#           pragma omp parallel for
+#endif
+            for (int y = 0; y < h; ++y) {
+                for (int x = 0; x < w; ++x) {
+                    float sum = 0.f;
+                    for (int d = -R; d <= R; ++d) {
+                        sum += img->g(LIM(y + d, 0, h - 1), x);
+                    }
+                    tmp[y][x] = sum / (2 * R + 1);
+                }
+            }
+#ifdef _OPENMP
+#           pragma omp parallel for
+#endif
+            for (int y = 0; y < h; ++y) {
+                std::copy(tmp[y], tmp[y] + w, img->g(y));
+            }
+        };
+
+    Imagefloat full, strips;
+    src.copyTo(&full);
+    src.copyTo(&strips);
+    blur(&full);
+    max_rows = 0;
+    ImProcFunctions ipf(&params);
+    ipf.setStripHeight(SH);
+    ipf.processStrips(&strips, 0, R, blur);
+    const bool same = same_image(&full, &strips);
+    const bool bounded = max_rows <= SH + 2 * R;
+    std::cout << "strips, margin " << R << ": " << (same ? "same output" : "OUTPUT DIFFERS") << ", at most " << max_rows << " rows per operation" << (bounded ? "" : " (TOO MANY)") << std::endl;
+
+    return ok && same && bounded;
+}
+
+#endif // BENCHMARK
+
 } // namespace rtengine
@@ -39,6 +39,10 @@ namespace rtengine {
 
 using namespace procparams;
 
+class PipelineCache;
+class MaskCache;
+class MatrixShaperTransform;
+
 struct ImProcData {
     const ProcParams *params;
     double scale;
@@ -73,6 +77,21 @@ public:
         pipetteBuffer = pb;
     }
 
+    // if set, the results of the expensive steps of the NAVIGATOR and
+    // PREVIEW pipelines are memoized in pc (if enabled). It also provides
+    // the keys of the parameters for the MaskCache
+    void setPipelineCache(PipelineCache *pc)
+    {
+        pipelineCache = pc;
+    }
+
+    // if set, the masks of the NAVIGATOR and PREVIEW pipelines are
+    // memoized in mc
+    void setMaskCache(MaskCache *mc)
+    {
+        maskCache = mc;
+    }
+
     void setProgressListener(ProgressListener *pl, int num_previews);
     //----------------------------------------------------------------------
 
@@ -93,6 +112,11 @@ public:
     };
     bool process(Pipeline pipeline, Stage stage, Imagefloat *img);
 
+    // if > 0, the per-pixel steps of the OUTPUT pipeline are run on strips
+    // of this many rows (see processStrips()). Initialized from
+    // Settings::output_strip_height
+    void setStripHeight(int h) { strip_height = h; }
+
     void setViewport(int ox, int oy, int fw, int fh);
     void setOutputHistograms(LUTu *histToneCurve, LUTu *histCCurve, LUTu *histLCurve);
     void setShowSharpeningMask(bool yes);
@@ -110,6 +134,9 @@ public:
     void transform(Imagefloat* original, Imagefloat* transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const FramesMetaData *metadata, int rawRotationDeg, bool highQuality);    
     void resize(Imagefloat* src, Imagefloat* dst, float dScale);
     void Lanczos(Imagefloat *src, Imagefloat *dst, float scale);
+    // separable resampling of the three channels of src into dst, with
+    // weight tables cached per source/destination size and filter
+    static void resample(Imagefloat *src, Imagefloat *dst, float scale, ResizeParams::Filter filter, bool multithread);
     void impulsedenoise(Imagefloat *rgb);   //Emil's impulse denoise
     bool textureBoost(Imagefloat *rgb);
 
@@ -159,7 +186,7 @@ public:
     
     Image8 *rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch, const procparams::ColorManagementParams &icm, bool consider_histogram_settings = true);
 
-    Imagefloat *rgb2out(Imagefloat *img, const procparams::ColorManagementParams &icm);
+    Imagefloat *rgb2out(Imagefloat *img, const procparams::ColorManagementParams &icm, bool in_place=false);
 
     void rgb2lab(Imagefloat &src, LabImage &dst, const Glib::ustring &workingSpace);
     void rgb2lab(Imagefloat &src, LabImage &dst) { rgb2lab(src, dst, params->icm.workingProfile); }
@@ -209,6 +236,8 @@ public:
 private:
     cmsHPROFILE monitor;
     cmsHTRANSFORM monitorTransform;
+    // fast path for monitorTransform, if the profiles allow it
+    std::shared_ptr<const MatrixShaperTransform> monitorShaper;
     std::unique_ptr<GamutWarning> gamutWarning;
 
     const ProcParams* params;
@@ -220,6 +249,12 @@ private:
     const DCPProfile::ApplyState *dcpApplyState;
 
     PipetteBuffer *pipetteBuffer;
+    PipelineCache *pipelineCache;
+    MaskCache *maskCache;
+    // identity of the current contents of the image processed by process(),
+    // for the MaskCache (see StepMemo)
+    uint64_t mask_input_key;
+    bool has_mask_input_key;
 
     double lumimul[3];
 
@@ -238,11 +273,13 @@ private:
     int progress_step;
     int progress_end;
 
+    int strip_height;
+
     
 private:
     void transformLuminanceOnly(Imagefloat* original, Imagefloat* transformed, int cx, int cy, int oW, int oH, int fW, int fH, bool creative);
-    void transformGeneral(bool highQuality, Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap);
-    void transformLCPCAOnly(Imagefloat *original, Imagefloat *transformed, int cx, int cy, const LensCorrection *pLCPMap);
+    void transformGeneral(bool highQuality, Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap, const FramesMetaData *metadata, int rawRotationDeg);
+    void transformLCPCAOnly(Imagefloat *original, Imagefloat *transformed, int cx, int cy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap, const FramesMetaData *metadata, int rawRotationDeg);
 
     void expcomp(Imagefloat *rgb, const procparams::ExposureParams *expparams);
     
@@ -255,10 +292,30 @@ private:
     bool needsLCP();
     bool needsLensfun();
 
+    void advanceProgress();
+    // generateMasks() with the current viewport, going through maskCache
+    bool getMasks(Imagefloat *rgb, const std::vector<Mask> &masks, int show_mask_idx, std::vector<array2D<float>> *Lmask, std::vector<array2D<float>> *abmask);
     template <class Ret, class Method>
     Ret apply(Method op, Imagefloat *img);
+    class StepMemo;
+
+    bool useStrips(Pipeline pipeline, const Imagefloat *img) const;
+    template <class Ops>
+    void processStrips(Imagefloat *img, int num_steps, int margin, Ops ops);
+
+#ifdef BENCHMARK
+    friend bool benchmark_strips();
+#endif
 };
 
+#ifdef BENCHMARK
+// Checks that the per-pixel steps of the OUTPUT pipeline give the same
+// output on strips and on the full frame, and that the buffers seen by the
+// operators are bounded by the strip height plus the overlap margins. Also
+// prints the time taken in both modes
+bool benchmark_strips();
+#endif
+
 
 } // namespace rtengine
 
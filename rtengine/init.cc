@@ -35,6 +35,7 @@
 #include "metadata.h"
 #include "imgiomanager.h"
 #include "threadpool.h"
+#include "fftplancache.h"
 
 #ifdef _OPENMP
 # include <omp.h>
@@ -49,7 +50,6 @@ const Settings* settings;
 
 MyMutex *lcmsMutex = nullptr;
 MyMutex *fftwMutex = nullptr;
-MyMutex *librawMutex = nullptr;
 
 int init (const Settings* s, Glib::ustring baseDir, Glib::ustring userSettingsDir, bool loadAll)
 {
@@ -128,13 +128,11 @@ int init (const Settings* s, Glib::ustring baseDir, Glib::ustring userSettingsDi
 
     DynamicProfileRules::init(baseDir);
     ImageIOManager::getInstance()->init(baseDir, userSettingsDir);
+    FFTPlanCache::getInstance()->init(userSettingsDir);
     
     delete lcmsMutex;
     lcmsMutex = new MyMutex;
     fftwMutex = new MyMutex;
-#ifdef ART_USE_LIBRAW
-    librawMutex = new MyMutex;
-#endif
 
     return 0;
 }
@@ -145,6 +143,7 @@ void cleanup ()
     ProcParams::cleanup ();
     Color::cleanup ();
     RawImageSource::cleanup ();
+    FFTPlanCache::getInstance()->cleanup();
 
 #ifdef RT_FFTW3F_OMP
     fftwf_cleanup_threads();
@@ -182,6 +181,11 @@ Settings::Settings():
     metadata_xmp_sync(MetadataXmpSync::NONE),
     thread_pool_size(0),
     ctl_scripts_fast_preview(false),
+    pipeline_cache_size(0),
+    mask_cache_size(0),
+    preview_pyramid_cache_size(0),
+    demosaic_cache_size(0),
+    output_strip_height(0),
     os_monitor_profile(StdMonitorProfile::SRGB)
 {
 }
@@ -86,5 +86,11 @@ enum class BlurType {
 void detail_mask(const array2D<float> &src, array2D<float> &mask, float scaling, float threshold, float ceiling, float factor, BlurType blur, float blur_radius, bool multithread);
 
 void NLMeans(array2D<float> &img, float normcoeff, int strength, int detail_thresh, float scale, bool multithread);
+
+#ifdef BENCHMARK
+// prints the scaling of the wavelet shrinkage passes of RGB_denoise from 1
+// to (at most) 64 threads
+void benchmark_denoise();
+#endif
     
 }} // namespace rtengine::denoise
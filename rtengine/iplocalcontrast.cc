@@ -451,7 +451,7 @@ bool ImProcFunctions::localContrast(Imagefloat *rgb)
             show_mask_idx = -1;
         }
         std::vector<array2D<float>> mask(n);
-        if (!generateMasks(rgb, params->localContrast.labmasks, offset_x, offset_y, full_width, full_height, scale, multiThread, show_mask_idx, &mask, nullptr, cur_pipeline == Pipeline::NAVIGATOR ? plistener : nullptr)) {
+        if (!getMasks(rgb, params->localContrast.labmasks, show_mask_idx, &mask, nullptr)) {
             return true; // show mask is active, nothing more to do
         }
 
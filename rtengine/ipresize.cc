@@ -19,7 +19,13 @@
 
 #include "improcfun.h"
 
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <vector>
+
 #include "alignedbuffer.h"
+#include "cache.h"
 #include "opthelper.h"
 #include "rt_math.h"
 #include "sleef.h"
@@ -47,177 +53,235 @@ inline float Lanc(float x, float a)
     }
 }
 
-} // namespace
-
 
-void ImProcFunctions::Lanczos(Imagefloat *src, Imagefloat *dst, float scale)
+// Mitchell-Netravali family of cubic filters
+inline float BCcubic(float x, float B, float C)
 {
-    auto mode = src->mode();
-    src->setMode(Imagefloat::Mode::LAB, multiThread);
-    dst->assignMode(Imagefloat::Mode::LAB);
-
-    const int sW = src->getWidth();
-    const int sH = src->getHeight();
-    const int dW = dst->getWidth();
-    const int dH = dst->getHeight();
-    
-    const float delta = 1.0f / scale;
-    const float a = 3.0f;
-    const float sc = min (scale, 1.0f);
-    const int support = static_cast<int> (2.0f * a / sc) + 1;
-
-    // storage for precomputed parameters for horizontal interpolation
-    float* const wwh = new float[support * dW];
-    int* const jj0 = new int[dW];
-    int* const jj1 = new int[dW];
-
-    const auto sL = src->g.ptrs;
-    const auto sa = src->r.ptrs;
-    const auto sb = src->b.ptrs;
-
-    auto dL = dst->g.ptrs;
-    auto da = dst->r.ptrs;
-    auto db = dst->b.ptrs;
-
-    // Phase 1: precompute coefficients for horizontal interpolation
-    for (int j = 0; j < dW; j++) {
-
-        // x coord of the center of pixel on src image
-        float x0 = (static_cast<float> (j) + 0.5f) * delta - 0.5f;
-
-        // weights for interpolation in horizontal direction
-        float * w = wwh + j * support;
-
-        // sum of weights used for normalization
-        float ws = 0.0f;
-
-        jj0[j] = max (0, static_cast<int> (floorf (x0 - a / sc)) + 1);
-        jj1[j] = min (sW, static_cast<int> (floorf (x0 + a / sc)) + 1);
-
-        // calculate weights
-        for (int jj = jj0[j]; jj < jj1[j]; jj++) {
-            int k = jj - jj0[j];
-            float z = sc * (x0 - static_cast<float> (jj));
-            w[k] = Lanc (z, a);
-            ws += w[k];
-        }
-
-        // normalize weights
-        for (int k = 0; k < support; k++) {
-            w[k] /= ws;
-        }
+    x = std::abs(x);
+    if (x < 1.f) {
+        return ((12.f - 9.f * B - 6.f * C) * x * x * x + (-18.f + 12.f * B + 6.f * C) * x * x + (6.f - 2.f * B)) / 6.f;
+    } else if (x < 2.f) {
+        return ((-B - 6.f * C) * x * x * x + (6.f * B + 30.f * C) * x * x + (-12.f * B - 48.f * C) * x + (8.f * B + 24.f * C)) / 6.f;
+    } else {
+        return 0.f;
     }
+}
 
-#ifdef _OPENMP
-    #pragma omp parallel
-#endif
-    {
-        // temporal storage for vertically-interpolated row of pixels
-        AlignedBuffer<float> aligned_buffer_ll(sW);
-        AlignedBuffer<float> aligned_buffer_la(sW);
-        AlignedBuffer<float> aligned_buffer_lb(sW);
-        float* const lL = aligned_buffer_ll.data;
-        float* const la = aligned_buffer_la.data;
-        float* const lb = aligned_buffer_lb.data;
-        // weights for interpolation in y direction
-        float w[support] ALIGNED64;
-        memset(w, 0, sizeof(w));
-
-        // Phase 2: do actual interpolation
-#ifdef _OPENMP
-        #pragma omp for
-#endif
 
-        for (int i = 0; i < dH; i++) {
-            // y coord of the center of pixel on src image
-            float y0 = (static_cast<float> (i) + 0.5f) * delta - 0.5f;
+float filter_radius(ResizeParams::Filter filter)
+{
+    switch (filter) {
+    case ResizeParams::LANCZOS2:
+    case ResizeParams::MITCHELL:
+    case ResizeParams::CATMULL_ROM:
+        return 2.f;
+    case ResizeParams::LANCZOS4:
+        return 4.f;
+    case ResizeParams::LANCZOS3:
+    default:
+        return 3.f;
+    }
+}
 
-            // sum of weights used for normalization
-            float ws = 0.0f;
 
-            int ii0 = max (0, static_cast<int> (floorf (y0 - a / sc)) + 1);
-            int ii1 = min (sH, static_cast<int> (floorf (y0 + a / sc)) + 1);
+float filter_weight(ResizeParams::Filter filter, float x)
+{
+    switch (filter) {
+    case ResizeParams::LANCZOS2:
+        return Lanc(x, 2.f);
+    case ResizeParams::LANCZOS4:
+        return Lanc(x, 4.f);
+    case ResizeParams::MITCHELL:
+        return BCcubic(x, 1.f/3.f, 1.f/3.f);
+    case ResizeParams::CATMULL_ROM:
+        return BCcubic(x, 0.f, 0.5f);
+    case ResizeParams::LANCZOS3:
+    default:
+        return Lanc(x, 3.f);
+    }
+}
 
-            // calculate weights for vertical interpolation
-            for (int ii = ii0; ii < ii1; ii++) {
-                int k = ii - ii0;
-                float z = sc * (y0 - static_cast<float> (ii));
-                w[k] = Lanc (z, a);
-                ws += w[k];
-            }
 
-            // normalize weights
-            for (int k = 0; k < support; k++) {
-                w[k] /= ws;
+// Normalized filter weights for resampling a line of src_size samples into
+// one of dst_size samples. Each output sample is computed from the
+// support consecutive input samples starting at start[i], with the weights
+// in weights[i * support]. support is a multiple of 4 and the unused taps
+// have a zero weight, so that the horizontal pass can run on whole SIMD
+// vectors, provided that the input line is at least buf_size long and
+// zero-padded
+class ResampleTable {
+public:
+    ResampleTable(int src_size, int dst_size, float scale, ResizeParams::Filter filter)
+    {
+        const float delta = 1.f / scale;
+        const float sc = min(scale, 1.f);
+        const float r = filter_radius(filter) / sc;
+
+        support = (static_cast<int>(2.f * r) + 4) & ~3;
+        buf_size = max(src_size, support);
+        start.resize(dst_size);
+        weights.assign(size_t(dst_size) * support, 0.f);
+
+        for (int i = 0; i < dst_size; ++i) {
+            // coord of the center of the pixel on the src image
+            const float x0 = (static_cast<float>(i) + 0.5f) * delta - 0.5f;
+            const int j0 = max(0, static_cast<int>(floorf(x0 - r)) + 1);
+            const int j1 = min(src_size, static_cast<int>(floorf(x0 + r)) + 1);
+            // shift the window left near the end of the line, so that it
+            // never goes past buf_size
+            const int s = min(j0, buf_size - support);
+            float *w = &weights[size_t(i) * support];
+
+            float ws = 0.f;
+            for (int j = j0; j < j1; ++j) {
+                w[j - s] = filter_weight(filter, sc * (x0 - static_cast<float>(j)));
+                ws += w[j - s];
             }
 
-            // Do vertical interpolation. Store results.
-#ifdef __SSE2__
-            int j;
-            __m128 Lv, av, bv, wkv;
-
-            for (j = 0; j < sW - 3; j += 4) {
-                Lv = _mm_setzero_ps();
-                av = _mm_setzero_ps();
-                bv = _mm_setzero_ps();
-
-                for (int ii = ii0; ii < ii1; ii++) {
-                    int k = ii - ii0;
-                    wkv = _mm_set1_ps (w[k]);
-                    Lv += wkv * LVFU (sL[ii][j]);
-                    av += wkv * LVFU (sa[ii][j]);
-                    bv += wkv * LVFU (sb[ii][j]);
+            if (ws != 0.f) {
+                for (int k = 0; k < support; ++k) {
+                    w[k] /= ws;
                 }
-
-                STVF (lL[j], Lv);
-                STVF (la[j], av);
-                STVF (lb[j], bv);
+            } else {
+                w[LIM(static_cast<int>(x0 + 0.5f), j0, j1 - 1) - s] = 1.f;
             }
+            start[i] = s;
+        }
+    }
 
-#else
-            int j = 0;
-#endif
+    int support;
+    int buf_size;
+    std::vector<int> start;
+    std::vector<float> weights;
+};
 
-            for (; j < sW; j++) {
-                float L = 0.0f, a = 0.0f, b = 0.0f;
 
-                for (int ii = ii0; ii < ii1; ii++) {
-                    int k = ii - ii0;
+// the tables are reused across images of the same size, e.g. in batch
+// exports
+Cache<std::string, std::shared_ptr<const ResampleTable>> resample_tables(16);
 
-                    L += w[k] * sL[ii][j];
-                    a += w[k] * sa[ii][j];
-                    b += w[k] * sb[ii][j];
-                }
+std::shared_ptr<const ResampleTable> get_resample_table(int src_size, int dst_size, float scale, ResizeParams::Filter filter)
+{
+    std::ostringstream buf;
+    buf << src_size << ' ' << dst_size << ' ' << std::setprecision(9) << scale << ' ' << int(filter);
+    const std::string key = buf.str();
+
+    std::shared_ptr<const ResampleTable> ret;
+    if (!resample_tables.get(key, ret)) {
+        ret = std::make_shared<const ResampleTable>(src_size, dst_size, scale, filter);
+        resample_tables.set(key, ret);
+    }
+    return ret;
+}
 
-                lL[j] = L;
-                la[j] = a;
-                lb[j] = b;
-            }
+} // namespace
 
-            // Do horizontal interpolation
-            for (int j = 0; j < dW; j++) {
 
-                float * wh = wwh + support * j;
+void ImProcFunctions::resample(Imagefloat *src, Imagefloat *dst, float scale, ResizeParams::Filter filter, bool multithread)
+{
+    const int sW = src->getWidth();
+    const int sH = src->getHeight();
+    const int dW = dst->getWidth();
+    const int dH = dst->getHeight();
+
+    const auto tx = get_resample_table(sW, dW, scale, filter);
+    const auto ty = get_resample_table(sH, dH, scale, filter);
+    const int xsupport = tx->support;
+    const int ysupport = ty->support;
+    const int stride = (tx->buf_size + 3) & ~3;
 
-                float L = 0.0f, a = 0.0f, b = 0.0f;
+    float **const sp[3] = { src->r.ptrs, src->g.ptrs, src->b.ptrs };
+    float **const dp[3] = { dst->r.ptrs, dst->g.ptrs, dst->b.ptrs };
 
-                for (int jj = jj0[j]; jj < jj1[j]; jj++) {
-                    int k = jj - jj0[j];
+#ifdef _OPENMP
+    #pragma omp parallel if (multithread)
+#endif
+    {
+        // vertically-interpolated rows of the three channels, zero-padded
+        // up to the size required by the horizontal pass
+        AlignedBuffer<float> aligned_buffer(3 * stride);
+        float *const line[3] = { aligned_buffer.data, aligned_buffer.data + stride, aligned_buffer.data + 2 * stride };
+        memset(aligned_buffer.data, 0, 3 * stride * sizeof(float));
 
-                    L += wh[k] * lL[jj];
-                    a += wh[k] * la[jj];
-                    b += wh[k] * lb[jj];
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 16)
+#endif
+        for (int i = 0; i < dH; ++i) {
+            const float *const wy = &ty->weights[size_t(i) * ysupport];
+            const int y0 = ty->start[i];
+
+            // vertical pass: accumulate the source rows one at a time, so
+            // that they are read sequentially. Zero weights are skipped,
+            // which also excludes the padding taps that might lie past the
+            // last row
+            for (int c = 0; c < 3; ++c) {
+                float *const l = line[c];
+                bool first = true;
+                for (int k = 0; k < ysupport; ++k) {
+                    if (wy[k] == 0.f) {
+                        continue;
+                    }
+                    const float w = wy[k];
+                    const float *const s = sp[c][y0 + k];
+                    int j = 0;
+                    if (first) {
+                        for (; j < sW; ++j) {
+                            l[j] = w * s[j];
+                        }
+                        first = false;
+                        continue;
+                    }
+#ifdef __SSE2__
+                    const vfloat wv = F2V(w);
+                    for (; j < sW - 3; j += 4) {
+                        STVF(l[j], LVF(l[j]) + wv * LVFU(s[j]));
+                    }
+#endif
+                    for (; j < sW; ++j) {
+                        l[j] += w * s[j];
+                    }
                 }
+            }
 
-                dL[i][j] = L;
-                da[i][j] = a;
-                db[i][j] = b;
+            // horizontal pass
+            for (int j = 0; j < dW; ++j) {
+                const float *const wx = &tx->weights[size_t(j) * xsupport];
+                const int x0 = tx->start[j];
+#ifdef __SSE2__
+                vfloat s0 = ZEROV, s1 = ZEROV, s2 = ZEROV;
+                for (int k = 0; k < xsupport; k += 4) {
+                    const vfloat wv = LVFU(wx[k]);
+                    s0 += wv * LVFU(line[0][x0 + k]);
+                    s1 += wv * LVFU(line[1][x0 + k]);
+                    s2 += wv * LVFU(line[2][x0 + k]);
+                }
+                dp[0][i][j] = vhadd(s0);
+                dp[1][i][j] = vhadd(s1);
+                dp[2][i][j] = vhadd(s2);
+#else
+                float s0 = 0.f, s1 = 0.f, s2 = 0.f;
+                for (int k = 0; k < xsupport; ++k) {
+                    s0 += wx[k] * line[0][x0 + k];
+                    s1 += wx[k] * line[1][x0 + k];
+                    s2 += wx[k] * line[2][x0 + k];
+                }
+                dp[0][i][j] = s0;
+                dp[1][i][j] = s1;
+                dp[2][i][j] = s2;
+#endif
             }
         }
     }
-    delete[] jj0;
-    delete[] jj1;
-    delete[] wwh;
+}
+
+
+void ImProcFunctions::Lanczos(Imagefloat *src, Imagefloat *dst, float scale)
+{
+    auto mode = src->mode();
+    src->setMode(Imagefloat::Mode::LAB, multiThread);
+    dst->assignMode(Imagefloat::Mode::LAB);
+
+    resample(src, dst, scale, params ? params->resize.filter : ResizeParams::LANCZOS3, multiThread);
 
     dst->setMode(mode, multiThread);
 }
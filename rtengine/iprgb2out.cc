@@ -26,6 +26,7 @@
 #include "curves.h"
 #include "alignedbuffer.h"
 #include "color.h"
+#include "matrixshaper.h"
 
 #define BENCHMARK
 #include "StopWatch.h"
@@ -83,146 +84,6 @@ inline void copyAndClamp(Imagefloat *src, unsigned char *dst, const float rgb_xy
     }
 }
 
-
-class ARTOutputProfile {
-public:
-    ARTOutputProfile(cmsHPROFILE prof, const procparams::ColorManagementParams &icm, const Glib::ustring &colorspace, int lutsz):
-        mode_(MODE_INVALID),
-        tc_(nullptr),
-        lutsz_(lutsz),
-        factor_(float(lutsz-1))
-    {
-        auto ws = ICCStore::getInstance()->workingSpaceMatrix(colorspace);
-        Mat33<float> m, mi;
-        float g = 0, s = 0;
-        cmsCIEXYZ bp;
-        if (ICCStore::getProfileMatrix(prof, m) && ICCStore::getProfileParametricTRC(prof, g, s) && inverse(m, mi) && (!icm.outputBPC || !cmsDetectDestinationBlackPoint(&bp, prof, icm.outputIntent, 0) || (bp.X == 0 && bp.Y == 0 && bp.Z == 0))) {
-            if (g == -2) {
-                mode_ = MODE_PQ;
-            } else if (g == -1) {
-                mode_ = MODE_HLG;
-            } else if (g == 1 && s == 0) {
-                mode_ = MODE_LINEAR;
-            } else {
-                mode_ = MODE_GAMMA;
-                LMCSToneCurveParams params;
-                Color::compute_LCMS_tone_curve_params(g, s, params);
-                auto tc = cmsBuildParametricToneCurve(0, 5, &params[0]);
-                if (tc) {
-                    tc_ = cmsReverseToneCurve(tc);
-                    cmsFreeToneCurve(tc);
-                }
-                if (!tc_) {
-                    mode_ = MODE_INVALID;
-                }
-            }
-            matrix_ = dot_product(mi, ws);
-        }
-        if (mode_ != MODE_INVALID && lutsz_ > 0) {
-            compute_lut();
-        }
-    }
-
-    ~ARTOutputProfile()
-    {
-        if (tc_) {
-            cmsFreeToneCurve(tc_);
-        }
-    }
-
-    operator bool() const { return mode_ != MODE_INVALID; }
-    
-    void operator()(const Imagefloat *src, Imagefloat *dst, bool multiThread)
-    {
-        const int W = src->getWidth();
-        const int H = src->getHeight();
-
-#ifdef _OPENMP
-#       pragma omp parallel for if (multiThread)
-#endif
-        for (int y = 0; y < H; ++y) {
-            Vec3<float> rgb;
-            for (int x = 0; x < W; ++x) {
-                rgb[0] = src->r(y, x) / 65535.f;
-                rgb[1] = src->g(y, x) / 65535.f;
-                rgb[2] = src->b(y, x) / 65535.f;
-
-                rgb = dot_product(matrix_, rgb);
-
-                for (int i = 0; i < 3; ++i) {
-                    if (lutsz_ > 0 && rgb[i] <= 1.f) {
-                        rgb[i] = lut_[rgb[i] * factor_];
-                    } else {
-                        rgb[i] = eval(rgb[i]);
-                    }
-                }
-
-                dst->r(y, x) = rgb[0] * 65535.f;
-                dst->g(y, x) = rgb[1] * 65535.f;
-                dst->b(y, x) = rgb[2] * 65535.f;
-            }
-        }
-    }
-
-    void operator()(const float *src, float *dst, int W)
-    {
-        Vec3<float> rgb;
-        const int W3 = W * 3;
-        for (int x = 0; x < W3; x += 3) {
-            rgb[0] = src[x];
-            rgb[1] = src[x+1];
-            rgb[2] = src[x+2];
-
-            rgb = dot_product(matrix_, rgb);
-
-            for (int i = 0; i < 3; ++i) {
-                if (lutsz_ > 0 && rgb[i] <= 1.f) {
-                    rgb[i] = lut_[rgb[i] * factor_];
-                } else {
-                    rgb[i] = eval(rgb[i]);
-                }
-            }
-
-            dst[x] = rgb[0];
-            dst[x+1] = rgb[1];
-            dst[x+2] = rgb[2];
-        }
-    }
-
-private:
-    float eval(float x)
-    {
-        switch (mode_) {
-        case MODE_LINEAR:
-            return x;
-        case MODE_PQ:
-            return Color::eval_PQ_curve(x, true);
-        case MODE_HLG:
-            return Color::eval_HLG_curve(x, true);
-        default: // MODE_GAMMA
-            return cmsEvalToneCurveFloat(tc_, x);
-        }
-    }
-    
-    void compute_lut()
-    {
-        lut_(lutsz_);
-        for (int i = 0; i < lutsz_; ++i) {
-            float x = float(i)/float(lutsz_-1);
-            float y = eval(x);
-            lut_[i] = y;
-        }
-    }
-    
-    enum Mode { MODE_INVALID, MODE_LINEAR, MODE_GAMMA, MODE_HLG, MODE_PQ };
-    Mode mode_;
-    Mat33<float> matrix_;
-    cmsToneCurve *tc_;
-    const int lutsz_;
-    const float factor_;
-    LUTf lut_;
-};
-
 } // namespace
 
 void ImProcFunctions::rgb2monitor(Imagefloat *img, Image8* image, bool bypass_out)
@@ -248,6 +109,7 @@ void ImProcFunctions::rgb2monitor(Imagefloat *img, Image8* image, bool bypass_ou
         const int W = img->getWidth();
         const int H = img->getHeight();
         unsigned char * data = image->data;
+        const MatrixShaperTransform *fast = bypass_out ? nullptr : monitorShaper.get();
 
         // cmsDoTransform is relatively expensive
 #ifdef _OPENMP
@@ -256,6 +118,9 @@ void ImProcFunctions::rgb2monitor(Imagefloat *img, Image8* image, bool bypass_ou
         {
             AlignedBuffer<float> pBuf(3 * W);
             AlignedBuffer<float> mBuf(3 * W);
+            float *outR = pBuf.data;
+            float *outG = pBuf.data + W;
+            float *outB = pBuf.data + 2 * W;
 
             AlignedBuffer<float> gwBuf1;
             AlignedBuffer<float> gwBuf2;
@@ -292,6 +157,20 @@ void ImProcFunctions::rgb2monitor(Imagefloat *img, Image8* image, bool bypass_ou
                     }
                 }
 
+                if (fast) {
+                    (*fast)(img->r(i), img->g(i), img->b(i), outR, outG, outB, W, 1.f / 65535.f, MAXVALF);
+                    unsigned char *dst = data + ix;
+                    for (int j = 0; j < W; ++j) {
+                        *dst++ = uint16ToUint8Rounded(CLIP(outR[j]));
+                        *dst++ = uint16ToUint8Rounded(CLIP(outG[j]));
+                        *dst++ = uint16ToUint8Rounded(CLIP(outB[j]));
+                    }
+                    if (gamutWarning) {
+                        gamutWarning->markLine(image, i, gwSrcBuf.data, gwBuf1.data, gwBuf2.data);
+                    }
+                    continue;
+                }
+
                 iy = 0;
                 if (!bypass_out) {
                     float *rr = img->r(i);
@@ -372,7 +251,7 @@ Image8* ImProcFunctions::rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch
 
         cmsHTRANSFORM hTransform = nullptr;
 
-        ARTOutputProfile op(oprof, icm, img->colorSpace(), 256);
+        const auto op = MatrixShaperTransform::get(ICCStore::getInstance()->workingSpace(img->colorSpace()), oprof, icm.outputIntent, icm.outputBPC, 256);
 
         if (!op) {
             cmsUInt32Number flags = cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE;
@@ -406,23 +285,33 @@ Image8* ImProcFunctions::rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch
 #endif
 
             for (int i = cy; i < condition; i++) {
-                const int ix = i * 3 * cw;
-                int iy = 0;
+                const int ix = (i - cy) * 3 * cw;
                 float* rr = img->r(i);
                 float* rg = img->g(i);
                 float* rb = img->b(i);
 
+                if (op) {
+                    float *outR = buffer;
+                    float *outG = buffer + cw;
+                    float *outB = buffer + 2 * cw;
+                    (*op)(rr + cx, rg + cx, rb + cx, outR, outG, outB, cw, 1.f / 65535.f, MAXVALF);
+                    unsigned char *dst = data + ix;
+                    for (int j = 0; j < cw; ++j) {
+                        *dst++ = uint16ToUint8Rounded(CLIP(outR[j]));
+                        *dst++ = uint16ToUint8Rounded(CLIP(outG[j]));
+                        *dst++ = uint16ToUint8Rounded(CLIP(outB[j]));
+                    }
+                    continue;
+                }
+
+                int iy = 0;
                 for (int j = cx; j < cx + cw; j++) {
                     buffer[iy++] = rr[j] / 65535.f;
                     buffer[iy++] = rg[j] / 65535.f;
                     buffer[iy++] = rb[j] / 65535.f;
                 }
 
-                if (op) {
-                    op(buffer, outbuffer, cw);
-                } else {
-                    cmsDoTransform(hTransform, buffer, outbuffer, cw);
-                }
+                cmsDoTransform(hTransform, buffer, outbuffer, cw);
                 copyAndClampLine(outbuffer, data + ix, cw);
             }
         } // End of parallelization
@@ -439,7 +328,11 @@ Image8* ImProcFunctions::rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch
 }
 
 
-Imagefloat* ImProcFunctions::rgb2out(Imagefloat *img, const procparams::ColorManagementParams &icm)
+// if in_place is true, the conversion overwrites the data of img, which is
+// then returned (this avoids allocating a second full-size buffer for the
+// output pipeline). All the conversions below work pixel by pixel (or line by
+// line with temporary buffers), so src and dst can safely be the same image
+Imagefloat* ImProcFunctions::rgb2out(Imagefloat *img, const procparams::ColorManagementParams &icm, bool in_place)
 {
     //BENCHFUN
         
@@ -448,18 +341,21 @@ Imagefloat* ImProcFunctions::rgb2out(Imagefloat *img, const procparams::ColorMan
     const int cw = img->getWidth();
     const int ch = img->getHeight();
         
-    Imagefloat* image = new Imagefloat(cw, ch);
+    Imagefloat* image = in_place ? img : new Imagefloat(cw, ch);
     cmsHPROFILE oprof = ICCStore::getInstance()->getProfile(icm.outputProfile);
 
     if (oprof) {
         img->setMode(Imagefloat::Mode::RGB, multiThread);
 
-        ARTOutputProfile op(oprof, icm, img->colorSpace(), cur_pipeline == Pipeline::OUTPUT ? -1 : (cur_pipeline == Pipeline::PREVIEW && scale == 1 ? 65536 : (cur_pipeline == Pipeline::THUMBNAIL ? 256 : 1024)));
+        const int lutsz = cur_pipeline == Pipeline::OUTPUT ? -1 : (cur_pipeline == Pipeline::PREVIEW && scale == 1 ? 65536 : (cur_pipeline == Pipeline::THUMBNAIL ? 256 : 1024));
+        const auto op = MatrixShaperTransform::get(ICCStore::getInstance()->workingSpace(img->colorSpace()), oprof, icm.outputIntent, icm.outputBPC, lutsz);
         if (op) {
-            // if (settings->verbose) {
-            //     std::cout << "rgb2out: converting using fast path" << std::endl;
-            // }
-            op(img, image, multiThread);
+#ifdef _OPENMP
+#           pragma omp parallel for if (multiThread)
+#endif
+            for (int y = 0; y < ch; ++y) {
+                (*op)(img->r(y), img->g(y), img->b(y), image->r(y), image->g(y), image->b(y), cw, 1.f / 65535.f, 65535.f);
+            }
         } else {
             cmsUInt32Number flags = cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE;
 
@@ -496,8 +392,11 @@ Imagefloat* ImProcFunctions::rgb2out(Imagefloat *img, const procparams::ColorMan
                 image->b(i - cy, j - cx) = Color::gamma2curve[CLIP(B)];
             }
         }
+        image->assignMode(Imagefloat::Mode::RGB);
     } else {
-        img->copyTo(image);
+        if (image != img) {
+            img->copyTo(image);
+        }
         image->setMode(Imagefloat::Mode::RGB, multiThread);
     }
 
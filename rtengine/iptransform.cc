@@ -27,6 +27,12 @@
 #include "rtlensfun.h"
 #include "perspectivecorrection.h"
 #include "lensexif.h"
+#include "cache.h"
+#include "noncopyable.h"
+#include <memory>
+#include <sstream>
+#include <iomanip>
+#include <vector>
 #include "../rtgui/multilangmgr.h"
 
 namespace rtengine {
@@ -289,7 +295,141 @@ inline void interpolateTransformChannelsCubic(const float* const* src, int xs, i
 #endif // __SSE2__
 
 
-void transform_perspective(const ProcParams *params, const FramesMetaData *metadata, Imagefloat *orig, Imagefloat *dest, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, bool multiThread)
+/*
+ * Sparse sampling of a smooth geometric mapping (lens distortion and CA,
+ * rotation, perspective). The mapping is evaluated only on the nodes of a
+ * grid with a spacing of STEP pixels, and interpolated bilinearly in
+ * between. This is much cheaper than evaluating the lens models for every
+ * pixel, and for the smooth mappings used here the error is a small fraction
+ * of a pixel. Grids are cached, keyed on the geometry-related parameters and
+ * on the region they cover (see get_remap_key()).
+ */
+class RemapGrid: public NonCopyable {
+public:
+    static constexpr int STEP = 8;
+
+    // func(x, y, channel, X, Y) computes the mapping of pixel (x, y)
+    template <class F>
+    RemapGrid(int W, int H, int nch, const F &func, bool multiThread):
+        W_(W),
+        H_(H),
+        nch_(nch),
+        gw_((W - 1) / STEP + 2),
+        gh_((H - 1) / STEP + 2),
+        data_(size_t(gw_) * gh_ * nch * 2)
+    {
+#ifdef _OPENMP
+#       pragma omp parallel for if (multiThread)
+#endif
+        for (int i = 0; i < gh_; ++i) {
+            for (int j = 0; j < gw_; ++j) {
+                for (int c = 0; c < nch_; ++c) {
+                    double X = 0, Y = 0;
+                    func(j * STEP, i * STEP, c, X, Y);
+                    float *d = node(i, j, c);
+                    d[0] = X;
+                    d[1] = Y;
+                }
+            }
+        }
+    }
+
+    // fills xbuf and ybuf (W elements each) with the mapping of row y for
+    // the given channel
+    void get_row(int y, int c, float *xbuf, float *ybuf) const
+    {
+        const int i = y / STEP;
+        const float fy = float(y - i * STEP) / STEP;
+#ifdef __SSE2__
+        const vfloat offv = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+#endif
+
+        for (int j = 0, x = 0; x < W_; ++j, x += STEP) {
+            const float *a0 = node(i, j, c);
+            const float *a1 = node(i + 1, j, c);
+            const float *b0 = node(i, j + 1, c);
+            const float *b1 = node(i + 1, j + 1, c);
+            const float ax = a0[0] + fy * (a1[0] - a0[0]);
+            const float ay = a0[1] + fy * (a1[1] - a0[1]);
+            const float dx = (b0[0] + fy * (b1[0] - b0[0]) - ax) / STEP;
+            const float dy = (b0[1] + fy * (b1[1] - b0[1]) - ay) / STEP;
+            const int n = std::min(STEP, W_ - x);
+            int k = 0;
+#ifdef __SSE2__
+            const vfloat axv = F2V(ax);
+            const vfloat ayv = F2V(ay);
+            const vfloat dxv = F2V(dx);
+            const vfloat dyv = F2V(dy);
+            for (; k < n - 3; k += 4) {
+                const vfloat kv = F2V(float(k)) + offv;
+                STVFU(xbuf[x + k], axv + dxv * kv);
+                STVFU(ybuf[x + k], ayv + dyv * kv);
+            }
+#endif
+            for (; k < n; ++k) {
+                xbuf[x + k] = ax + dx * k;
+                ybuf[x + k] = ay + dy * k;
+            }
+        }
+    }
+
+private:
+    float *node(int i, int j, int c) { return &data_[((size_t(i) * gw_ + j) * nch_ + c) * 2]; }
+    const float *node(int i, int j, int c) const { return &data_[((size_t(i) * gw_ + j) * nch_ + c) * 2]; }
+
+    int W_;
+    int H_;
+    int nch_;
+    int gw_;
+    int gh_;
+    std::vector<float> data_;
+};
+
+Cache<std::string, std::shared_ptr<const RemapGrid>> remap_grid_cache(8);
+
+
+template <class F>
+std::shared_ptr<const RemapGrid> get_remap_grid(const std::string &key, int W, int H, int nch, const F &func, bool multiThread)
+{
+    std::shared_ptr<const RemapGrid> ret;
+    if (key.empty() || !remap_grid_cache.get(key, ret)) {
+        ret = std::make_shared<RemapGrid>(W, H, nch, func, multiThread);
+        if (!key.empty()) {
+            remap_grid_cache.set(key, ret);
+        }
+    }
+    return ret;
+}
+
+
+std::string get_remap_key(const char *kind, const ProcParams *params, const FramesMetaData *metadata, int rawRotationDeg, int oW, int oH, int fW, int fH, int cx, int cy, int W, int H, double scale)
+{
+    std::ostringstream buf;
+    buf << std::setprecision(17) << kind << '\n' << metadata->getFileName() << '\n'
+        << rawRotationDeg << ' ' << oW << ' ' << oH << ' ' << fW << ' ' << fH << ' '
+        << cx << ' ' << cy << ' ' << W << ' ' << H << ' ' << scale << '\n';
+
+    const auto &lp = params->lensProf;
+    buf << int(lp.lcMode) << ' ' << lp.useDist << ' ' << lp.useCA << '\n'
+        << lp.lcpFile << '\n' << lp.lfCameraMake << '\n' << lp.lfCameraModel << '\n' << lp.lfLens << '\n';
+
+    const auto &co = params->coarse;
+    buf << co.rotate << ' ' << co.hflip << ' ' << co.vflip << ' '
+        << params->commonTrans.autofill << ' '
+        << params->rotate.enabled << ' ' << params->rotate.degree << '\n';
+
+    const auto &pp = params->perspective;
+    buf << pp.enabled << ' ' << pp.horizontal << ' ' << pp.vertical << ' '
+        << pp.angle << ' ' << pp.shear << ' ' << pp.flength << ' '
+        << pp.cropfactor << ' ' << pp.aspect;
+    for (auto l : pp.control_lines) {
+        buf << ' ' << l;
+    }
+    return buf.str();
+}
+
+
+void transform_perspective(const ProcParams *params, const FramesMetaData *metadata, Imagefloat *orig, Imagefloat *dest, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, int rawRotationDeg, bool multiThread)
 {
     PerspectiveCorrection pc;
     pc.init(fW, fH, params->perspective, params->commonTrans.autofill, metadata);
@@ -302,45 +442,59 @@ void transform_perspective(const ProcParams *params, const FramesMetaData *metad
 
     constexpr float invalid = 0.f;
 
-#ifdef _OPENMP
-    #pragma omp parallel for if (multiThread)
-#endif
-    for (int y = 0; y < H; ++y) {
-        for (int x = 0; x < W; ++x) {
-            double Dx = (x + cx) * s;
-            double Dy = (y + cy) * s;
+    const auto grid = get_remap_grid(
+        get_remap_key("perspective", params, metadata, rawRotationDeg, oW, oH, fW, fH, cx, cy, W, H, s),
+        W, H, 1,
+        [&](int x, int y, int c, double &Dx, double &Dy) -> void
+        {
+            Dx = (x + cx) * s;
+            Dy = (y + cy) * s;
             pc(Dx, Dy);
             Dx /= s;
             Dy /= s;
-            Dx -= sx;
-            Dy -= sy;
-
-            // Extract integer and fractions of source screen coordinates
-            int xc = Dx;
-            Dx -= xc;
-            int yc = Dy;
-            Dy -= yc;
-
-            // Convert only valid pixels
-            if (yc >= 0 && yc < orig_H && xc >= 0 && xc < orig_W) {
-                if (yc > 0 && yc < orig_H - 2 && xc > 0 && xc < orig_W - 2) {
-                    // all interpolation pixels inside image
-                    interpolateTransformCubic(orig, xc - 1, yc - 1, Dx, Dy, dest->r(y, x), dest->g(y, x), dest->b(y, x));
+        }, multiThread);
+
+#ifdef _OPENMP
+    #pragma omp parallel if (multiThread)
+#endif
+    {
+        std::vector<float> gx(W), gy(W);
+#ifdef _OPENMP
+        #pragma omp for
+#endif
+        for (int y = 0; y < H; ++y) {
+            grid->get_row(y, 0, &gx[0], &gy[0]);
+            for (int x = 0; x < W; ++x) {
+                double Dx = gx[x] - sx;
+                double Dy = gy[x] - sy;
+
+                // Extract integer and fractions of source screen coordinates
+                int xc = Dx;
+                Dx -= xc;
+                int yc = Dy;
+                Dy -= yc;
+
+                // Convert only valid pixels
+                if (yc >= 0 && yc < orig_H && xc >= 0 && xc < orig_W) {
+                    if (yc > 0 && yc < orig_H - 2 && xc > 0 && xc < orig_W - 2) {
+                        // all interpolation pixels inside image
+                        interpolateTransformCubic(orig, xc - 1, yc - 1, Dx, Dy, dest->r(y, x), dest->g(y, x), dest->b(y, x));
+                    } else {
+                        // edge pixels
+                        int y1 = LIM (yc, 0, orig_H - 1);
+                        int y2 = LIM (yc + 1, 0, orig_H - 1);
+                        int x1 = LIM (xc, 0, orig_W - 1);
+                        int x2 = LIM (xc + 1, 0, orig_W - 1);
+
+                        dest->r(y, x) = (orig->r (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + orig->r (y1, x2) * Dx * (1.0 - Dy) + orig->r (y2, x1) * (1.0 - Dx) * Dy + orig->r (y2, x2) * Dx * Dy);
+                        dest->g (y, x) = (orig->g (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + orig->g (y1, x2) * Dx * (1.0 - Dy) + orig->g (y2, x1) * (1.0 - Dx) * Dy + orig->g (y2, x2) * Dx * Dy);
+                        dest->b (y, x) = (orig->b (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + orig->b (y1, x2) * Dx * (1.0 - Dy) + orig->b (y2, x1) * (1.0 - Dx) * Dy + orig->b (y2, x2) * Dx * Dy);
+                    }
                 } else {
-                    // edge pixels
-                    int y1 = LIM (yc, 0, orig_H - 1);
-                    int y2 = LIM (yc + 1, 0, orig_H - 1);
-                    int x1 = LIM (xc, 0, orig_W - 1);
-                    int x2 = LIM (xc + 1, 0, orig_W - 1);
-
-                    dest->r(y, x) = (orig->r (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + orig->r (y1, x2) * Dx * (1.0 - Dy) + orig->r (y2, x1) * (1.0 - Dx) * Dy + orig->r (y2, x2) * Dx * Dy);
-                    dest->g (y, x) = (orig->g (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + orig->g (y1, x2) * Dx * (1.0 - Dy) + orig->g (y2, x1) * (1.0 - Dx) * Dy + orig->g (y2, x2) * Dx * Dy);
-                    dest->b (y, x) = (orig->b (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + orig->b (y1, x2) * Dx * (1.0 - Dy) + orig->b (y2, x1) * (1.0 - Dx) * Dy + orig->b (y2, x2) * Dx * Dy);
+                    dest->r(y, x) = invalid;
+                    dest->g(y, x) = invalid;
+                    dest->b(y, x) = invalid;
                 }
-            } else {
-                dest->r(y, x) = invalid;
-                dest->g(y, x) = invalid;
-                dest->b(y, x) = invalid;
             }
         }
     }
@@ -611,7 +765,7 @@ void ImProcFunctions::transform(Imagefloat* original, Imagefloat* transformed, i
         }
         
         if (needs_transform_general) {
-            transformGeneral(highQuality, original, dest, dest_x, dest_y, sx, sy, oW, oH, fW, fH, pLCPMap.get());
+            transformGeneral(highQuality, original, dest, dest_x, dest_y, sx, sy, oW, oH, fW, fH, pLCPMap.get(), metadata, rawRotationDeg);
         } else {
             dest = original;
         }
@@ -625,14 +779,14 @@ void ImProcFunctions::transform(Imagefloat* original, Imagefloat* transformed, i
                 dest_x = sx;
                 dest_y = sy;
             }
-            transformLCPCAOnly(dest, out, dest_x, dest_y, pLCPMap.get());
+            transformLCPCAOnly(dest, out, dest_x, dest_y, oW, oH, fW, fH, pLCPMap.get(), metadata, rawRotationDeg);
             if (needs_perspective) {
                 tmpimg.reset(out);
                 dest = out;
             }
         }
         if (needs_perspective) {
-            transform_perspective(params, metadata, dest, transformed, cx, cy, sx, sy, oW, oH, fW, fH, multiThread);
+            transform_perspective(params, metadata, dest, transformed, cx, cy, sx, sy, oW, oH, fW, fH, rawRotationDeg, multiThread);
         }
 
         if (do_encode) {
@@ -1048,7 +1202,7 @@ void ImProcFunctions::transformLuminanceOnly(Imagefloat* original, Imagefloat* t
 }
 
 
-void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap)
+void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap, const FramesMetaData *metadata, int rawRotationDeg)
 {
     // set up stuff, depending on the mode we are
     bool enableLCPDist = pLCPMap && params->lensProf.useDist;
@@ -1111,137 +1265,167 @@ void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, I
 #if defined( __GNUC__ ) && __GNUC__ >= 7
 #pragma GCC diagnostic pop
 #endif
+    const int W = transformed->getWidth();
+    const int H = transformed->getHeight();
+
+    // the lens correction models are expensive to evaluate, so in that case
+    // the combined lens distortion + rotation mapping is sampled on a sparse
+    // grid and interpolated
+    std::shared_ptr<const RemapGrid> grid;
+    if (enableLCPDist) {
+        grid = get_remap_grid(
+            get_remap_key("general", params, metadata, rawRotationDeg, oW, oH, fW, fH, cx, cy, W, H, ascale),
+            W, H, 1,
+            [&](int x, int y, int c, double &Dxc, double &Dyc) -> void
+            {
+                double x_d = x, y_d = y;
+                pLCPMap->correctDistortion(x_d, y_d, cx, cy, ascale);
+                x_d += ascale * (cx - w2);
+                y_d += ascale * (cy - h2);
+                Dxc = x_d * cost - y_d * sint;
+                Dyc = x_d * sint + y_d * cost;
+            }, multiThread);
+    }
+
     // main cycle
     bool darkening = (params->vignetting.amount <= 0.0);
 #ifdef _OPENMP
-    #pragma omp parallel for if (multiThread)
+    #pragma omp parallel if (multiThread)
 #endif
-
-    for (int y = 0; y < transformed->getHeight(); y++) {
-        for (int x = 0; x < transformed->getWidth(); x++) {
-            double x_d = x, y_d = y;
-
-            if (enableLCPDist) {
-                pLCPMap->correctDistortion(x_d, y_d, cx, cy, ascale); // must be first transform
-            } else {
-                x_d *= ascale;
-                y_d *= ascale;
-            }
-
-            x_d += ascale * (cx - w2);     // centering x coord & scale
-            y_d += ascale * (cy - h2);     // centering y coord & scale
-
-            double vig_x_d = 0., vig_y_d = 0.;
-
-            if (enableVignetting) {
-                vig_x_d = ascale * (x + cx - vig_w2);       // centering x coord & scale
-                vig_y_d = ascale * (y + cy - vig_h2);       // centering y coord & scale
+    {
+        std::vector<float> gx(grid ? W : 0), gy(grid ? W : 0);
+#ifdef _OPENMP
+        #pragma omp for
+#endif
+        for (int y = 0; y < H; y++) {
+            if (grid) {
+                grid->get_row(y, 0, &gx[0], &gy[0]);
             }
+            for (int x = 0; x < W; x++) {
+                double Dxc, Dyc;
 
-            // rotate
-            double Dxc = x_d * cost - y_d * sint;
-            double Dyc = x_d * sint + y_d * cost;
+                if (grid) {
+                    Dxc = gx[x];
+                    Dyc = gy[x];
+                } else {
+                    double x_d = x * ascale, y_d = y * ascale;
 
-            // distortion correction
-            double s = 1;
+                    x_d += ascale * (cx - w2);     // centering x coord & scale
+                    y_d += ascale * (cy - h2);     // centering y coord & scale
 
-            if (enableDistortion) {
-                double r = sqrt (Dxc * Dxc + Dyc * Dyc) / maxRadius; // sqrt is slow
-                s = 1.0 - distAmount + distAmount * r ;
-            }
-
-            double r2 = 0.;
+                    // rotate
+                    Dxc = x_d * cost - y_d * sint;
+                    Dyc = x_d * sint + y_d * cost;
+                }
 
-            if (enableVignetting) {
-                double vig_Dx = vig_x_d * cost - vig_y_d * sint;
-                double vig_Dy = vig_x_d * sint + vig_y_d * cost;
-                r2 = sqrt (vig_Dx * vig_Dx + vig_Dy * vig_Dy);
-            }
+                double vig_x_d = 0., vig_y_d = 0.;
 
-            for (int c = 0; c < (enableCA ? 3 : 1); c++) {
-                double Dx = Dxc * (s + chDist[c]);
-                double Dy = Dyc * (s + chDist[c]);
+                if (enableVignetting) {
+                    vig_x_d = ascale * (x + cx - vig_w2);       // centering x coord & scale
+                    vig_y_d = ascale * (y + cy - vig_h2);       // centering y coord & scale
+                }
 
-                // de-center
-                Dx += w2;
-                Dy += h2;
+                // distortion correction
+                double s = 1;
 
-                // Extract integer and fractions of source screen coordinates
-                int xc = (int)Dx;
-                Dx -= (double)xc;
-                xc -= sx;
-                int yc = (int)Dy;
-                Dy -= (double)yc;
-                yc -= sy;
+                if (enableDistortion) {
+                    double r = sqrt (Dxc * Dxc + Dyc * Dyc) / maxRadius; // sqrt is slow
+                    s = 1.0 - distAmount + distAmount * r ;
+                }
 
-                // Convert only valid pixels
-                if (yc >= 0 && yc < original->getHeight() && xc >= 0 && xc < original->getWidth()) {
+                double r2 = 0.;
 
-                    // multiplier for vignetting correction
-                    double vignmul = 1.0;
+                if (enableVignetting) {
+                    double vig_Dx = vig_x_d * cost - vig_y_d * sint;
+                    double vig_Dy = vig_x_d * sint + vig_y_d * cost;
+                    r2 = sqrt (vig_Dx * vig_Dx + vig_Dy * vig_Dy);
+                }
 
-                    if (enableVignetting) {
-                        if (darkening) {
-                            vignmul /= std::max (v + mul * tanh (b * (maxRadius - s * r2) / maxRadius), 0.001);
-                        } else {
-                            vignmul *= (v + mul * tanh (b * (maxRadius - s * r2) / maxRadius));
+                for (int c = 0; c < (enableCA ? 3 : 1); c++) {
+                    double Dx = Dxc * (s + chDist[c]);
+                    double Dy = Dyc * (s + chDist[c]);
+
+                    // de-center
+                    Dx += w2;
+                    Dy += h2;
+
+                    // Extract integer and fractions of source screen coordinates
+                    int xc = (int)Dx;
+                    Dx -= (double)xc;
+                    xc -= sx;
+                    int yc = (int)Dy;
+                    Dy -= (double)yc;
+                    yc -= sy;
+
+                    // Convert only valid pixels
+                    if (yc >= 0 && yc < original->getHeight() && xc >= 0 && xc < original->getWidth()) {
+
+                        // multiplier for vignetting correction
+                        double vignmul = 1.0;
+
+                        if (enableVignetting) {
+                            if (darkening) {
+                                vignmul /= std::max (v + mul * tanh (b * (maxRadius - s * r2) / maxRadius), 0.001);
+                            } else {
+                                vignmul *= (v + mul * tanh (b * (maxRadius - s * r2) / maxRadius));
+                            }
                         }
-                    }
 
-                    if (enableGradient) {
-                        vignmul *= calcGradientFactor (gp, cx + x, cy + y);
-                    }
+                        if (enableGradient) {
+                            vignmul *= calcGradientFactor (gp, cx + x, cy + y);
+                        }
 
-                    if (enablePCVignetting) {
-                        vignmul *= calcPCVignetteFactor (pcv, cx + x, cy + y);
-                    }
+                        if (enablePCVignetting) {
+                            vignmul *= calcPCVignetteFactor (pcv, cx + x, cy + y);
+                        }
 
-                    if (use_enc) {
-                        vignmul = vignmul > 0.f ? xcbrtf(vignmul) : 0.f;
-                    }
+                        if (use_enc) {
+                            vignmul = vignmul > 0.f ? xcbrtf(vignmul) : 0.f;
+                        }
 
-                    if (yc > 0 && yc < original->getHeight() - 2 && xc > 0 && xc < original->getWidth() - 2) {
-                        // all interpolation pixels inside image
-                        if (!highQuality) {
-                            transformed->r(y, x) = vignmul * (original->r (yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->r (yc, xc + 1) * Dx * (1.0 - Dy) + original->r (yc + 1, xc) * (1.0 - Dx) * Dy + original->r (yc + 1, xc + 1) * Dx * Dy);
-                            transformed->g(y, x) = vignmul * (original->g (yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->g (yc, xc + 1) * Dx * (1.0 - Dy) + original->g (yc + 1, xc) * (1.0 - Dx) * Dy + original->g (yc + 1, xc + 1) * Dx * Dy);
-                            transformed->b(y, x) = vignmul * (original->b (yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->b (yc, xc + 1) * Dx * (1.0 - Dy) + original->b (yc + 1, xc) * (1.0 - Dx) * Dy + original->b (yc + 1, xc + 1) * Dx * Dy);
-                        } else if (enableCA) {
-                            interpolateTransformChannelsCubic(chOrig[c], xc - 1, yc - 1, Dx, Dy, chTrans[c][y][x]);
-                            chTrans[c][y][x] *= vignmul;
+                        if (yc > 0 && yc < original->getHeight() - 2 && xc > 0 && xc < original->getWidth() - 2) {
+                            // all interpolation pixels inside image
+                            if (!highQuality) {
+                                transformed->r(y, x) = vignmul * (original->r (yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->r (yc, xc + 1) * Dx * (1.0 - Dy) + original->r (yc + 1, xc) * (1.0 - Dx) * Dy + original->r (yc + 1, xc + 1) * Dx * Dy);
+                                transformed->g(y, x) = vignmul * (original->g (yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->g (yc, xc + 1) * Dx * (1.0 - Dy) + original->g (yc + 1, xc) * (1.0 - Dx) * Dy + original->g (yc + 1, xc + 1) * Dx * Dy);
+                                transformed->b(y, x) = vignmul * (original->b (yc, xc) * (1.0 - Dx) * (1.0 - Dy) + original->b (yc, xc + 1) * Dx * (1.0 - Dy) + original->b (yc + 1, xc) * (1.0 - Dx) * Dy + original->b (yc + 1, xc + 1) * Dx * Dy);
+                            } else if (enableCA) {
+                                interpolateTransformChannelsCubic(chOrig[c], xc - 1, yc - 1, Dx, Dy, chTrans[c][y][x]);
+                                chTrans[c][y][x] *= vignmul;
+                            } else {
+                                interpolateTransformCubic(original, xc - 1, yc - 1, Dx, Dy, transformed->r(y, x), transformed->g(y, x), transformed->b(y, x));
+                                transformed->r(y, x) *= vignmul;
+                                transformed->g(y, x) *= vignmul;
+                                transformed->b(y, x) *= vignmul;
+                            }
                         } else {
-                            interpolateTransformCubic(original, xc - 1, yc - 1, Dx, Dy, transformed->r(y, x), transformed->g(y, x), transformed->b(y, x));
-                            transformed->r(y, x) *= vignmul;
-                            transformed->g(y, x) *= vignmul;
-                            transformed->b(y, x) *= vignmul;
+                            // edge pixels
+                            int y1 = LIM (yc,   0, original->getHeight() - 1);
+                            int y2 = LIM (yc + 1, 0, original->getHeight() - 1);
+                            int x1 = LIM (xc,   0, original->getWidth() - 1);
+                            int x2 = LIM (xc + 1, 0, original->getWidth() - 1);
+
+                            if (enableCA) {
+                                chTrans[c][y][x] = vignmul * (chOrig[c][y1][x1] * (1.0 - Dx) * (1.0 - Dy) + chOrig[c][y1][x2] * Dx * (1.0 - Dy) + chOrig[c][y2][x1] * (1.0 - Dx) * Dy + chOrig[c][y2][x2] * Dx * Dy);
+                            } else {
+                                transformed->r(y, x) = (original->r (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->r (y1, x2) * Dx * (1.0 - Dy) + original->r (y2, x1) * (1.0 - Dx) * Dy + original->r (y2, x2) * Dx * Dy);
+                                transformed->g(y, x) = (original->g (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->g (y1, x2) * Dx * (1.0 - Dy) + original->g (y2, x1) * (1.0 - Dx) * Dy + original->g (y2, x2) * Dx * Dy);
+                                transformed->b(y, x) = (original->b (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->b (y1, x2) * Dx * (1.0 - Dy) + original->b (y2, x1) * (1.0 - Dx) * Dy + original->b (y2, x2) * Dx * Dy);
+                                transformed->r(y, x) *= vignmul;
+                                transformed->g(y, x) *= vignmul;
+                                transformed->b(y, x) *= vignmul;
+                            }
                         }
                     } else {
-                        // edge pixels
-                        int y1 = LIM (yc,   0, original->getHeight() - 1);
-                        int y2 = LIM (yc + 1, 0, original->getHeight() - 1);
-                        int x1 = LIM (xc,   0, original->getWidth() - 1);
-                        int x2 = LIM (xc + 1, 0, original->getWidth() - 1);
-
                         if (enableCA) {
-                            chTrans[c][y][x] = vignmul * (chOrig[c][y1][x1] * (1.0 - Dx) * (1.0 - Dy) + chOrig[c][y1][x2] * Dx * (1.0 - Dy) + chOrig[c][y2][x1] * (1.0 - Dx) * Dy + chOrig[c][y2][x2] * Dx * Dy);
+                            // not valid (source pixel x,y not inside source image, etc.)
+                            chTrans[c][y][x] = invalid;
                         } else {
-                            transformed->r(y, x) = (original->r (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->r (y1, x2) * Dx * (1.0 - Dy) + original->r (y2, x1) * (1.0 - Dx) * Dy + original->r (y2, x2) * Dx * Dy);
-                            transformed->g(y, x) = (original->g (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->g (y1, x2) * Dx * (1.0 - Dy) + original->g (y2, x1) * (1.0 - Dx) * Dy + original->g (y2, x2) * Dx * Dy);
-                            transformed->b(y, x) = (original->b (y1, x1) * (1.0 - Dx) * (1.0 - Dy) + original->b (y1, x2) * Dx * (1.0 - Dy) + original->b (y2, x1) * (1.0 - Dx) * Dy + original->b (y2, x2) * Dx * Dy);
-                            transformed->r(y, x) *= vignmul;
-                            transformed->g(y, x) *= vignmul;
-                            transformed->b(y, x) *= vignmul;
+                            transformed->r(y, x) = invalid;
+                            transformed->g(y, x) = invalid;
+                            transformed->b(y, x) = invalid;
                         }
                     }
-                } else {
-                    if (enableCA) {
-                        // not valid (source pixel x,y not inside source image, etc.)
-                        chTrans[c][y][x] = invalid;
-                    } else {
-                        transformed->r(y, x) = invalid;
-                        transformed->g(y, x) = invalid;
-                        transformed->b(y, x) = invalid;
-                    }
                 }
             }
         }
@@ -1249,7 +1433,7 @@ void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, I
 }
 
 
-void ImProcFunctions::transformLCPCAOnly(Imagefloat *original, Imagefloat *transformed, int cx, int cy, const LensCorrection *pLCPMap)
+void ImProcFunctions::transformLCPCAOnly(Imagefloat *original, Imagefloat *transformed, int cx, int cy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap, const FramesMetaData *metadata, int rawRotationDeg)
 {
     assert(pLCPMap && params->lensProf.useCA && pLCPMap->isCACorrectionAvailable());
 
@@ -1263,43 +1447,63 @@ void ImProcFunctions::transformLCPCAOnly(Imagefloat *original, Imagefloat *trans
     chTrans[1] = transformed->g.ptrs;
     chTrans[2] = transformed->b.ptrs;
 
+    const int W = transformed->getWidth();
+    const int H = transformed->getHeight();
+
+    const auto grid = get_remap_grid(
+        get_remap_key("lcpca", params, metadata, rawRotationDeg, oW, oH, fW, fH, cx, cy, W, H, 1.0),
+        W, H, 3,
+        [&](int x, int y, int c, double &Dx, double &Dy) -> void
+        {
+            Dx = x;
+            Dy = y;
+            pLCPMap->correctCA(Dx, Dy, cx, cy, c);
+        }, multiThread);
+
 #ifdef _OPENMP
-    #pragma omp parallel for if (multiThread)
+    #pragma omp parallel if (multiThread)
 #endif
-
-    for (int y = 0; y < transformed->getHeight(); y++) {
-        for (int x = 0; x < transformed->getWidth(); x++) {
+    {
+        std::vector<float> gx[3] = { std::vector<float>(W), std::vector<float>(W), std::vector<float>(W) };
+        std::vector<float> gy[3] = { std::vector<float>(W), std::vector<float>(W), std::vector<float>(W) };
+#ifdef _OPENMP
+        #pragma omp for
+#endif
+        for (int y = 0; y < H; y++) {
             for (int c = 0; c < 3; c++) {
-                double Dx = x;
-                double Dy = y;
-                
-                pLCPMap->correctCA(Dx, Dy, cx, cy, c);
-
-                // Extract integer and fractions of coordinates
-                int xc = (int)Dx;
-                Dx -= (double)xc;
-                int yc = (int)Dy;
-                Dy -= (double)yc;
-
-                // Convert only valid pixels
-                if (yc >= 0 && yc < original->getHeight() && xc >= 0 && xc < original->getWidth()) {
+                grid->get_row(y, c, &gx[c][0], &gy[c][0]);
+            }
+            for (int x = 0; x < W; x++) {
+                for (int c = 0; c < 3; c++) {
+                    double Dx = gx[c][x];
+                    double Dy = gy[c][x];
+
+                    // Extract integer and fractions of coordinates
+                    int xc = (int)Dx;
+                    Dx -= (double)xc;
+                    int yc = (int)Dy;
+                    Dy -= (double)yc;
+
+                    // Convert only valid pixels
+                    if (yc >= 0 && yc < original->getHeight() && xc >= 0 && xc < original->getWidth()) {
+
+                        // multiplier for vignetting correction
+                        if (yc > 0 && yc < original->getHeight() - 2 && xc > 0 && xc < original->getWidth() - 2) {
+                            // all interpolation pixels inside image
+                            interpolateTransformChannelsCubic(chOrig[c], xc - 1, yc - 1, Dx, Dy, chTrans[c][y][x]);
+                        } else {
+                            // edge pixels
+                            int y1 = LIM (yc,   0, original->getHeight() - 1);
+                            int y2 = LIM (yc + 1, 0, original->getHeight() - 1);
+                            int x1 = LIM (xc,   0, original->getWidth() - 1);
+                            int x2 = LIM (xc + 1, 0, original->getWidth() - 1);
 
-                    // multiplier for vignetting correction
-                    if (yc > 0 && yc < original->getHeight() - 2 && xc > 0 && xc < original->getWidth() - 2) {
-                        // all interpolation pixels inside image
-                        interpolateTransformChannelsCubic(chOrig[c], xc - 1, yc - 1, Dx, Dy, chTrans[c][y][x]);
+                            chTrans[c][y][x] = chOrig[c][y1][x1] * (1.0 - Dx) * (1.0 - Dy) + chOrig[c][y1][x2] * Dx * (1.0 - Dy) + chOrig[c][y2][x1] * (1.0 - Dx) * Dy + chOrig[c][y2][x2] * Dx * Dy;
+                        }
                     } else {
-                        // edge pixels
-                        int y1 = LIM (yc,   0, original->getHeight() - 1);
-                        int y2 = LIM (yc + 1, 0, original->getHeight() - 1);
-                        int x1 = LIM (xc,   0, original->getWidth() - 1);
-                        int x2 = LIM (xc + 1, 0, original->getWidth() - 1);
-
-                        chTrans[c][y][x] = chOrig[c][y1][x1] * (1.0 - Dx) * (1.0 - Dy) + chOrig[c][y1][x2] * Dx * (1.0 - Dy) + chOrig[c][y2][x1] * (1.0 - Dx) * Dy + chOrig[c][y2][x2] * Dx * Dy;
+                        // not valid (source pixel x,y not inside source image, etc.)
+                        chTrans[c][y][x] = -1.f;
                     }
-                } else {
-                    // not valid (source pixel x,y not inside source image, etc.)
-                    chTrans[c][y][x] = -1.f;
                 }
             }
         }
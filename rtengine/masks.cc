@@ -34,16 +34,46 @@
 #include "rt_math.h"
 #include "opthelper.h"
 #include "rescale.h"
+#include "improcfun.h"
+#include "pipelinecache.h"
+#include "settings.h"
 #include "../rtgui/multilangmgr.h"
+#include <iostream>
 
 namespace rtengine {
 
+extern const Settings *settings;
+
 using procparams::AreaMask;
 using procparams::Mask;
 using procparams::DrawnMask;
 
 namespace {
 
+void copy_masks(const std::vector<array2D<float>> &src, std::vector<array2D<float>> &dst)
+{
+    dst.resize(src.size());
+    for (size_t i = 0; i < src.size(); ++i) {
+        const int W = src[i].width();
+        const int H = src[i].height();
+        dst[i](W, H);
+        for (int y = 0; y < H; ++y) {
+            std::copy(src[i][y], src[i][y] + W, dst[i][y]);
+        }
+    }
+}
+
+
+size_t masks_size(const std::vector<array2D<float>> &m)
+{
+    size_t res = 0;
+    for (auto &a : m) {
+        res += size_t(a.width()) * a.height() * sizeof(float);
+    }
+    return res;
+}
+
+
 bool generate_area_mask(int ox, int oy, int width, int height, const array2D<float> &guide, const AreaMask &areaMask, float scale, bool multithread, array2D<float> &global_mask, ProgressListener *plistener)
 {
     if (!areaMask.enabled || areaMask.shapes.empty() || (areaMask.isTrivial() && areaMask.blur <= 0.f)) {
@@ -1306,4 +1336,113 @@ bool getDeltaEColor(Imagefloat *rgb, int x, int y, int offset_x, int offset_y, i
     return true;
 }
 
+
+
+MaskCache::MaskCache():
+    max_size_(size_t(std::max(settings->mask_cache_size, 0)) << 20),
+    size_(0)
+{
+}
+
+
+void MaskCache::clear()
+{
+    MyMutex::MyLock lock(mutex_);
+    entries_.clear();
+    size_ = 0;
+}
+
+
+bool MaskCache::get(uint64_t key, const std::vector<Mask> &masks, std::vector<array2D<float>> *Lmask, std::vector<array2D<float>> *abmask)
+{
+    MyMutex::MyLock lock(mutex_);
+
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->key == key && (!Lmask || it->has_L) && (!abmask || it->has_ab) && it->masks == masks) {
+            if (it != entries_.begin()) {
+                entries_.splice(entries_.begin(), entries_, it);
+            }
+            const Entry &e = entries_.front();
+            if (Lmask) {
+                copy_masks(e.L, *Lmask);
+            }
+            if (abmask) {
+                copy_masks(e.ab, *abmask);
+            }
+            if (settings->verbose > 1) {
+                std::cout << "mask cache hit: " << masks.size() << " masks" << std::endl;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void MaskCache::set(uint64_t key, const std::vector<Mask> &masks, const std::vector<array2D<float>> *Lmask, const std::vector<array2D<float>> *abmask)
+{
+    const size_t sz = (Lmask ? masks_size(*Lmask) : 0) + (abmask ? masks_size(*abmask) : 0);
+    if (sz > max_size_) {
+        return;
+    }
+
+    Entry e;
+    e.key = key;
+    e.masks = masks;
+    e.has_L = Lmask;
+    e.has_ab = abmask;
+    if (Lmask) {
+        copy_masks(*Lmask, e.L);
+    }
+    if (abmask) {
+        copy_masks(*abmask, e.ab);
+    }
+    e.size = sz;
+
+    MyMutex::MyLock lock(mutex_);
+
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->key == key && it->has_L == e.has_L && it->has_ab == e.has_ab && it->masks == masks) {
+            size_ -= it->size;
+            entries_.erase(it);
+            break;
+        }
+    }
+    entries_.emplace_front(std::move(e));
+    size_ += sz;
+
+    while (size_ > max_size_) {
+        size_ -= entries_.back().size;
+        entries_.pop_back();
+    }
+}
+
+
+bool ImProcFunctions::getMasks(Imagefloat *rgb, const std::vector<Mask> &masks, int show_mask_idx, std::vector<array2D<float>> *Lmask, std::vector<array2D<float>> *abmask)
+{
+    ProgressListener *pl = cur_pipeline == Pipeline::NAVIGATOR ? plistener : nullptr;
+    const bool interactive = cur_pipeline == Pipeline::NAVIGATOR || cur_pipeline == Pipeline::PREVIEW;
+
+    if (!maskCache || !pipelineCache || !interactive || show_mask_idx >= 0) {
+        return generateMasks(rgb, masks, offset_x, offset_y, full_width, full_height, scale, multiThread, show_mask_idx, Lmask, abmask, pl);
+    }
+
+    // the image is hashed only by the first tool of the stage asking for
+    // masks, the enabled steps after it are chained into the key by
+    // process(). Tools with the same masks on the same image share them
+    if (!has_mask_input_key) {
+        mask_input_key = pipelineCache->getKey(PipelineCache::hash(rgb, multiThread), "masks", int(cur_pipeline), scale, offset_x, offset_y, full_width, full_height, show_sharpening_mask, params->icm.workingProfile);
+        has_mask_input_key = true;
+    }
+    const uint64_t key = mask_input_key;
+    if (maskCache->get(key, masks, Lmask, abmask)) {
+        return true;
+    }
+    if (!generateMasks(rgb, masks, offset_x, offset_y, full_width, full_height, scale, multiThread, show_mask_idx, Lmask, abmask, pl)) {
+        return false;
+    }
+    maskCache->set(key, masks, Lmask, abmask);
+    return true;
+}
+
 } // namespace rtengine
@@ -20,16 +20,63 @@
 
 #pragma once
 
+#include <cstdint>
+#include <list>
 #include "procparams.h"
 #include "array2D.h"
 #include "labimage.h"
 #include "imagefloat.h"
+#include "noncopyable.h"
+#include "../rtgui/threadutils.h"
 
 
 namespace rtengine {
 
 bool generateMasks(Imagefloat *rgb, const std::vector<procparams::Mask> &masks, int offset_x, int offset_y, int full_width, int full_height, double scale, bool multithread, int show_mask_idx, std::vector<array2D<float>> *Lmask, std::vector<array2D<float>> *abmask, ProgressListener *pl);
 
+/**
+ * Cache of the outputs of generateMasks() for the interactive pipelines,
+ * shared by all the tools that use masks.
+ *
+ * An entry is identified by a key for the input of generateMasks() and by
+ * the mask definitions, compared with operator==. The key identifies the
+ * contents of the image together with the viewport and the scale, and it
+ * does not depend on the tool asking for the masks: it is computed by
+ * ImProcFunctions::getMasks() from a hash of the image taken once per stage
+ * of the pipeline, followed by the parameters of the enabled steps run
+ * since. Masks are reused when the image they are computed from did not
+ * change, e.g. when only a slider of the tool itself moved, and by the
+ * tools with the same mask definitions working on the same image. Entries
+ * are evicted in LRU order when their total size exceeds
+ * Settings::mask_cache_size.
+ */
+class MaskCache: public NonCopyable {
+public:
+    MaskCache();
+
+    bool enabled() const { return max_size_ > 0; }
+    void clear();
+
+    bool get(uint64_t key, const std::vector<procparams::Mask> &masks, std::vector<array2D<float>> *Lmask, std::vector<array2D<float>> *abmask);
+    void set(uint64_t key, const std::vector<procparams::Mask> &masks, const std::vector<array2D<float>> *Lmask, const std::vector<array2D<float>> *abmask);
+
+private:
+    struct Entry {
+        uint64_t key;
+        std::vector<procparams::Mask> masks;
+        bool has_L;
+        bool has_ab;
+        std::vector<array2D<float>> L;
+        std::vector<array2D<float>> ab;
+        size_t size;
+    };
+
+    size_t max_size_;
+    size_t size_;
+    std::list<Entry> entries_;
+    MyMutex mutex_;
+};
+
 enum class MasksEditID { H = 0, C, L };
 void fillPipetteMasks(Imagefloat *rgb, PlanarWhateverData<float> *editWhatever, MasksEditID id, bool multithread);
 
@@ -0,0 +1,415 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "matrixshaper.h"
+#include "cache.h"
+#include "color.h"
+#include "iccstore.h"
+#include "rt_math.h"
+#include "settings.h"
+
+#include <cmath>
+#include <glibmm/checksum.h>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+namespace rtengine {
+
+extern const Settings *settings;
+
+namespace {
+
+// maximum colour difference (Delta E) from lcms accepted when validating a
+// transform
+constexpr float MAX_DELTA_E = 0.1f;
+
+constexpr unsigned long CACHE_SIZE = 32;
+
+} // namespace
+
+
+MatrixShaperTransform::Curve::Curve():
+    type_(LINEAR),
+    inverse_(false),
+    tc_(nullptr),
+    factor_(0.f)
+{
+}
+
+
+MatrixShaperTransform::Curve::~Curve()
+{
+    if (tc_) {
+        cmsFreeToneCurve(tc_);
+    }
+}
+
+
+bool MatrixShaperTransform::Curve::init(cmsHPROFILE prof, int channel, bool inverse, int lut_size, bool &art_curve)
+{
+    inverse_ = inverse;
+
+    float g = 0, s = 0;
+    if (ICCStore::getProfileParametricTRC(prof, g, s)) {
+        // profiles generated by ART store the exact curve parameters
+        art_curve = true;
+        if (g == -2) {
+            type_ = PQ;
+        } else if (g == -1) {
+            type_ = HLG;
+        } else if (g == 1 && s == 0) {
+            type_ = LINEAR;
+        } else {
+            LMCSToneCurveParams params;
+            Color::compute_LCMS_tone_curve_params(g, s, params);
+            cmsToneCurve *tc = cmsBuildParametricToneCurve(0, 5, &params[0]);
+            if (!tc) {
+                return false;
+            }
+            if (inverse) {
+                tc_ = cmsReverseToneCurve(tc);
+                cmsFreeToneCurve(tc);
+            } else {
+                tc_ = tc;
+            }
+            type_ = LCMS;
+        }
+    } else {
+        static const cmsTagSignature tags[3] = { cmsSigRedTRCTag, cmsSigGreenTRCTag, cmsSigBlueTRCTag };
+        const cmsToneCurve *tc = static_cast<const cmsToneCurve *>(cmsReadTag(prof, tags[channel]));
+        if (!tc) {
+            return false;
+        }
+        if (cmsIsToneCurveLinear(tc)) {
+            type_ = LINEAR;
+        } else {
+            tc_ = inverse ? cmsReverseToneCurve(tc) : cmsDupToneCurve(tc);
+            type_ = LCMS;
+        }
+    }
+
+    if (type_ == LCMS && !tc_) {
+        return false;
+    }
+
+    if (type_ != LINEAR && lut_size > 0) {
+        lut_(lut_size);
+        factor_ = lut_size - 1;
+        for (int i = 0; i < lut_size; ++i) {
+            lut_[i] = eval(float(i) / factor_);
+        }
+    }
+
+    return true;
+}
+
+
+inline float MatrixShaperTransform::Curve::eval(float x) const
+{
+    switch (type_) {
+    case LINEAR:
+        return x;
+    case PQ:
+        return Color::eval_PQ_curve(x, inverse_);
+    case HLG:
+        return Color::eval_HLG_curve(x, inverse_);
+    default: // LCMS
+        return cmsEvalToneCurveFloat(tc_, x);
+    }
+}
+
+
+inline float MatrixShaperTransform::Curve::operator()(float x) const
+{
+    if (lut_ && x <= 1.f) {
+        return lut_[x * factor_];
+    }
+    return eval(x);
+}
+
+
+#ifdef __SSE2__
+inline vfloat MatrixShaperTransform::Curve::operator()(vfloat x) const
+{
+    if (type_ == LINEAR) {
+        return x;
+    } else if (lut_ && !vtest(vmaskf_gt(x, F2V(1.f)))) {
+        return lut_[x * F2V(factor_)];
+    } else {
+        float tmp[4];
+        STVFU(tmp[0], x);
+        for (int i = 0; i < 4; ++i) {
+            tmp[i] = (*this)(tmp[i]);
+        }
+        return LVFU(tmp[0]);
+    }
+}
+#endif // __SSE2__
+
+
+MatrixShaperTransform::MatrixShaperTransform():
+    src_linear_(true),
+    dst_linear_(true)
+{
+}
+
+
+MatrixShaperTransform::~MatrixShaperTransform()
+{
+}
+
+
+std::shared_ptr<const MatrixShaperTransform> MatrixShaperTransform::get(cmsHPROFILE src, cmsHPROFILE dst, RenderingIntent intent, bool bpc, int lut_size)
+{
+    static Cache<std::string, std::shared_ptr<const MatrixShaperTransform>> cache(CACHE_SIZE);
+
+    if (!src || !dst) {
+        return nullptr;
+    }
+
+    MyMutex::MyLock lock(*lcmsMutex);
+
+    // the key uses the contents of the profiles rather than the handles, as
+    // the latter can be reused for different profiles (e.g. after the
+    // ICCStore is reloaded)
+    std::ostringstream buf;
+    buf << Glib::Checksum::compute_checksum(Glib::Checksum::CHECKSUM_MD5, ProfileContent(src).getData())
+        << ' ' << Glib::Checksum::compute_checksum(Glib::Checksum::CHECKSUM_MD5, ProfileContent(dst).getData())
+        << ' ' << int(intent) << ' ' << bpc << ' ' << lut_size;
+    const std::string key = buf.str();
+
+    std::shared_ptr<const MatrixShaperTransform> ret;
+    if (cache.get(key, ret)) {
+        return ret;
+    }
+
+    std::shared_ptr<MatrixShaperTransform> t(new MatrixShaperTransform());
+    if (t->init(src, dst, intent, bpc, lut_size)) {
+        ret = t;
+    }
+
+    // negative results are cached as well, they depend only on the key
+    cache.set(key, ret);
+    return ret;
+}
+
+
+bool MatrixShaperTransform::init(cmsHPROFILE src, cmsHPROFILE dst, RenderingIntent intent, bool bpc, int lut_size)
+{
+    if (intent == RI_ABSOLUTE) {
+        return false;
+    }
+
+    Mat33<float> src_rgb_xyz, dst_rgb_xyz, dst_xyz_rgb;
+    if (!ICCStore::getProfileMatrix(src, src_rgb_xyz) || cmsIsCLUT(src, intent, LCMS_USED_AS_INPUT) ||
+        !ICCStore::getProfileMatrix(dst, dst_rgb_xyz) || cmsIsCLUT(dst, intent, LCMS_USED_AS_OUTPUT) ||
+        !inverse(dst_rgb_xyz, dst_xyz_rgb)) {
+        return false;
+    }
+
+    if (bpc) {
+        // black point compensation is a no-op if the black points coincide
+        cmsCIEXYZ sbp, dbp;
+        if (!cmsDetectBlackPoint(&sbp, src, intent, 0)) {
+            sbp.X = sbp.Y = sbp.Z = 0;
+        }
+        if (!cmsDetectDestinationBlackPoint(&dbp, dst, intent, 0)) {
+            dbp.X = dbp.Y = dbp.Z = 0;
+        }
+        if (std::abs(sbp.X - dbp.X) > 1e-6 || std::abs(sbp.Y - dbp.Y) > 1e-6 || std::abs(sbp.Z - dbp.Z) > 1e-6) {
+            return false;
+        }
+    }
+
+    bool src_art = false, dst_art = false;
+    for (int i = 0; i < 3; ++i) {
+        if (!src_curves_[i].init(src, i, false, lut_size, src_art) ||
+            !dst_curves_[i].init(dst, i, true, lut_size, dst_art)) {
+            return false;
+        }
+        src_linear_ = src_linear_ && src_curves_[i].is_linear();
+        dst_linear_ = dst_linear_ && dst_curves_[i].is_linear();
+    }
+
+    matrix_ = dot_product(dst_xyz_rgb, src_rgb_xyz);
+
+    return validate(src, dst, intent, bpc, src_art, dst_art);
+}
+
+
+bool MatrixShaperTransform::validate(cmsHPROFILE src, cmsHPROFILE dst, RenderingIntent intent, bool bpc, bool src_art, bool dst_art) const
+{
+    // the curves of ART profiles are evaluated from their parameters, which
+    // is more accurate than what lcms does with the (possibly tabulated)
+    // TRC tags. For such a profile, lcms gets a linear profile with the same
+    // matrix, and the curves are applied outside of it
+    const auto linear_profile =
+        [](cmsHPROFILE prof) -> cmsHPROFILE
+        {
+            Mat33<float> m;
+            if (!ICCStore::getProfileMatrix(prof, m)) {
+                return nullptr;
+            }
+            return ICCStore::createFromMatrix(m);
+        };
+
+    cmsHPROFILE lsrc = src_art ? linear_profile(src) : src;
+    cmsHPROFILE ldst = dst_art ? linear_profile(dst) : dst;
+
+    cmsHTRANSFORM xform = nullptr;
+    if (lsrc && ldst) {
+        cmsUInt32Number flags = cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE;
+        if (bpc) {
+            flags |= cmsFLAGS_BLACKPOINTCOMPENSATION;
+        }
+        xform = cmsCreateTransform(lsrc, TYPE_RGB_FLT, ldst, TYPE_RGB_FLT, intent, flags);
+    }
+    if (src_art && lsrc) {
+        cmsCloseProfile(lsrc);
+    }
+    if (dst_art && ldst) {
+        cmsCloseProfile(ldst);
+    }
+    if (!xform) {
+        return false;
+    }
+
+    // the differences are measured in Lab, through the destination profile
+    cmsHPROFILE lab = cmsCreateLab4Profile(nullptr);
+    cmsHTRANSFORM to_lab = cmsCreateTransform(dst, TYPE_RGB_FLT, lab, TYPE_Lab_FLT, INTENT_RELATIVE_COLORIMETRIC, cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE);
+    cmsCloseProfile(lab);
+    if (!to_lab) {
+        cmsDeleteTransform(xform);
+        return false;
+    }
+
+    // quadratic spacing, to have more samples in the shadows
+    constexpr int N = 9;
+    constexpr int n = N * N * N;
+    std::vector<float> in(n * 3);
+    std::vector<float> r(n), g(n), b(n);
+    for (int i = 0; i < n; ++i) {
+        r[i] = in[3*i] = SQR(float(i / (N * N)) / (N - 1));
+        g[i] = in[3*i+1] = SQR(float((i / N) % N) / (N - 1));
+        b[i] = in[3*i+2] = SQR(float(i % N) / (N - 1));
+    }
+
+    if (src_art) {
+        for (int i = 0; i < n * 3; ++i) {
+            in[i] = src_curves_[i % 3].eval(in[i]);
+        }
+    }
+    std::vector<float> ref(n * 3);
+    cmsDoTransform(xform, &in[0], &ref[0], n);
+    cmsDeleteTransform(xform);
+    if (dst_art) {
+        for (int i = 0; i < n * 3; ++i) {
+            ref[i] = dst_curves_[i % 3].eval(ref[i]);
+        }
+    }
+
+    // the transform is checked as it is used, i.e. with the LUTs
+    (*this)(&r[0], &g[0], &b[0], &r[0], &g[0], &b[0], n);
+    std::vector<float> out(n * 3);
+    for (int i = 0; i < n; ++i) {
+        out[3*i] = r[i];
+        out[3*i+1] = g[i];
+        out[3*i+2] = b[i];
+    }
+
+    std::vector<float> ref_lab(n * 3);
+    std::vector<float> out_lab(n * 3);
+    cmsDoTransform(to_lab, &ref[0], &ref_lab[0], n);
+    cmsDoTransform(to_lab, &out[0], &out_lab[0], n);
+    cmsDeleteTransform(to_lab);
+
+    double max_de = 0;
+    for (int i = 0; i < n * 3; i += 3) {
+        cmsCIELab l1 = { ref_lab[i], ref_lab[i+1], ref_lab[i+2] };
+        cmsCIELab l2 = { out_lab[i], out_lab[i+1], out_lab[i+2] };
+        max_de = std::max(max_de, cmsDeltaE(&l1, &l2));
+    }
+
+    if (settings->verbose > 1) {
+        std::cout << "MatrixShaperTransform: max Delta E wrt lcms is " << max_de << std::endl;
+    }
+
+    return max_de < MAX_DELTA_E;
+}
+
+
+void MatrixShaperTransform::operator()(const float *r, const float *g, const float *b, float *ro, float *go, float *bo, int W, float in_mul, float out_mul) const
+{
+    const auto &m = matrix_;
+    int x = 0;
+
+#ifdef __SSE2__
+    const vfloat inv = F2V(in_mul);
+    const vfloat outv = F2V(out_mul);
+    const vfloat m00v = F2V(m[0][0]), m01v = F2V(m[0][1]), m02v = F2V(m[0][2]);
+    const vfloat m10v = F2V(m[1][0]), m11v = F2V(m[1][1]), m12v = F2V(m[1][2]);
+    const vfloat m20v = F2V(m[2][0]), m21v = F2V(m[2][1]), m22v = F2V(m[2][2]);
+
+    for (; x < W - 3; x += 4) {
+        vfloat rv = LVFU(r[x]) * inv;
+        vfloat gv = LVFU(g[x]) * inv;
+        vfloat bv = LVFU(b[x]) * inv;
+        if (!src_linear_) {
+            rv = src_curves_[0](rv);
+            gv = src_curves_[1](gv);
+            bv = src_curves_[2](bv);
+        }
+        vfloat rov = m00v * rv + m01v * gv + m02v * bv;
+        vfloat gov = m10v * rv + m11v * gv + m12v * bv;
+        vfloat bov = m20v * rv + m21v * gv + m22v * bv;
+        if (!dst_linear_) {
+            rov = dst_curves_[0](rov);
+            gov = dst_curves_[1](gov);
+            bov = dst_curves_[2](bov);
+        }
+        STVFU(ro[x], rov * outv);
+        STVFU(go[x], gov * outv);
+        STVFU(bo[x], bov * outv);
+    }
+#endif
+
+    for (; x < W; ++x) {
+        float rv = r[x] * in_mul;
+        float gv = g[x] * in_mul;
+        float bv = b[x] * in_mul;
+        if (!src_linear_) {
+            rv = src_curves_[0](rv);
+            gv = src_curves_[1](gv);
+            bv = src_curves_[2](bv);
+        }
+        float rov = m[0][0] * rv + m[0][1] * gv + m[0][2] * bv;
+        float gov = m[1][0] * rv + m[1][1] * gv + m[1][2] * bv;
+        float bov = m[2][0] * rv + m[2][1] * gv + m[2][2] * bv;
+        if (!dst_linear_) {
+            rov = dst_curves_[0](rov);
+            gov = dst_curves_[1](gov);
+            bov = dst_curves_[2](bov);
+        }
+        ro[x] = rov * out_mul;
+        go[x] = gov * out_mul;
+        bo[x] = bov * out_mul;
+    }
+}
+
+} // namespace rtengine
@@ -0,0 +1,96 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <lcms2.h>
+
+#include "LUT.h"
+#include "linalgebra.h"
+#include "noncopyable.h"
+#include "opthelper.h"
+#include "rtengine.h"
+
+namespace rtengine {
+
+/**
+ * Fast replacement for an lcms transform between two matrix/TRC RGB
+ * profiles (e.g. working space -> output profile, or output profile ->
+ * monitor), applied directly to planar float data.
+ *
+ * The transform is linearization with the TRCs of the source, a single 3x3
+ * matrix and encoding with the inverse TRCs of the destination. The curves
+ * are sampled in LUTs of the requested size for values in [0,1] (lut_size
+ * <= 0 means always evaluating them exactly). get() returns nullptr when
+ * either profile is not a plain matrix-shaper, or when the intent or black
+ * point compensation would make lcms do something else; in that case the
+ * caller has to use lcms. The transform, including its LUTs, is also
+ * checked against the lcms one on a grid of colours when it is created, and
+ * rejected if the Delta E from lcms is 0.1 or more. Transforms are cached
+ * by the contents of the profiles, so get() is cheap to call for every
+ * image.
+ */
+class MatrixShaperTransform: public NonCopyable {
+public:
+    static std::shared_ptr<const MatrixShaperTransform> get(cmsHPROFILE src, cmsHPROFILE dst, RenderingIntent intent, bool bpc, int lut_size);
+
+    ~MatrixShaperTransform();
+
+    // converts W pixels of the planar rows r, g, b into ro, go, bo. Input
+    // values are multiplied by in_mul before the conversion (to bring them in
+    // [0,1]) and output values by out_mul after it. The output rows can be
+    // the same as the input ones
+    void operator()(const float *r, const float *g, const float *b, float *ro, float *go, float *bo, int W, float in_mul=1.f, float out_mul=1.f) const;
+
+private:
+    class Curve {
+    public:
+        Curve();
+        ~Curve();
+
+        bool init(cmsHPROFILE prof, int channel, bool inverse, int lut_size, bool &art_curve);
+        bool is_linear() const { return type_ == LINEAR; }
+
+        float operator()(float x) const;
+        float eval(float x) const;
+#ifdef __SSE2__
+        vfloat operator()(vfloat x) const;
+#endif
+
+    private:
+        enum Type { LINEAR, LCMS, PQ, HLG };
+        Type type_;
+        bool inverse_;
+        cmsToneCurve *tc_;
+        LUTf lut_;
+        float factor_;
+    };
+
+    MatrixShaperTransform();
+    bool init(cmsHPROFILE src, cmsHPROFILE dst, RenderingIntent intent, bool bpc, int lut_size);
+    bool validate(cmsHPROFILE src, cmsHPROFILE dst, RenderingIntent intent, bool bpc, bool src_art, bool dst_art) const;
+
+    Curve src_curves_[3];
+    Curve dst_curves_[3];
+    bool src_linear_;
+    bool dst_linear_;
+    Mat33<float> matrix_;
+};
+
+} // namespace rtengine
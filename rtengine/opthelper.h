@@ -41,4 +41,19 @@
         #define ALIGNED64
         #define ALIGNED16
     #endif
+
+    // Marks a function to be compiled twice, generic and for AVX2, with the
+    // variant chosen at load time according to the CPU (through an ifunc,
+    // hence ELF targets only). The AVX2 variant is just the same source
+    // auto-vectorized by the compiler for the wider registers, there are no
+    // hand-written AVX2 kernels. This applies also to the OpenMP regions in
+    // the function, so it is enough to mark the member functions running
+    // the hot loops. It is empty for builds already targeting AVX2. The
+    // "amaze" and "rcd" benchmarks of ART-cli --benchmark check that the
+    // two variants give the same output
+    #if defined(__GNUC__) && defined(__ELF__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && !defined(__AVX2__)
+        #define RT_AVX2_CLONES __attribute__ ((target_clones ("avx2", "default")))
+    #else
+        #define RT_AVX2_CLONES
+    #endif
 #endif
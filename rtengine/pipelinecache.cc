@@ -0,0 +1,128 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pipelinecache.h"
+#include "settings.h"
+
+#include <cstring>
+#include <vector>
+
+namespace rtengine {
+
+extern const Settings *settings;
+
+PipelineCache::Entry::Entry(const Imagefloat *src, bool s):
+    img(new Imagefloat(src->getWidth(), src->getHeight())),
+    stop(s)
+{
+    src->copyTo(img.get());
+}
+
+
+PipelineCache::PipelineCache():
+    max_size_((unsigned long)(std::max(settings->pipeline_cache_size, 0)) << 20),
+    entries_(std::max(max_size_, 1ul)),
+    last_params_id_(0)
+{
+}
+
+
+void PipelineCache::clear()
+{
+    entries_.clear();
+
+    MyMutex::MyLock lock(params_mutex_);
+    recent_params_.clear();
+}
+
+
+bool PipelineCache::get(uint64_t key, EntryPtr &entry)
+{
+    return entries_.get(key, entry);
+}
+
+
+void PipelineCache::set(uint64_t key, const Imagefloat *img, bool stop)
+{
+    if ((unsigned long)(img->getWidth()) * img->getHeight() * 3 * sizeof(float) > max_size_) {
+        return;
+    }
+    entries_.set(key, EntryPtr(new Entry(img, stop)));
+}
+
+
+uint64_t PipelineCache::combine(uint64_t seed, uint64_t value)
+{
+    // splitmix64 finalizer on the xor of the two
+    uint64_t z = seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+
+uint64_t PipelineCache::hash(const char *str)
+{
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *str; ++str) {
+        h = (h ^ uint64_t(static_cast<unsigned char>(*str))) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+
+uint64_t PipelineCache::hash(const Imagefloat *img, bool multithread)
+{
+    const int W = img->getWidth();
+    const int H = img->getHeight();
+    std::vector<uint64_t> rows(H);
+
+#ifdef _OPENMP
+#   pragma omp parallel for if (multithread)
+#endif
+    for (int y = 0; y < H; ++y) {
+        uint64_t h = combine(0, y);
+        const float *chan[3] = { img->r(y), img->g(y), img->b(y) };
+        for (int c = 0; c < 3; ++c) {
+            const float *row = chan[c];
+            int x = 0;
+            for (; x < W - 1; x += 2) {
+                uint32_t a, b;
+                std::memcpy(&a, row + x, sizeof(a));
+                std::memcpy(&b, row + x + 1, sizeof(b));
+                h = (h ^ ((uint64_t(a) << 32) | b)) * 0x100000001b3ULL;
+                h ^= h >> 29;
+            }
+            if (x < W) {
+                uint32_t a;
+                std::memcpy(&a, row + x, sizeof(a));
+                h = (h ^ a) * 0x100000001b3ULL;
+            }
+        }
+        rows[y] = h;
+    }
+
+    uint64_t ret = combine(combine(W, H), combine(int(img->mode()), hash(img->colorSpace().c_str())));
+    for (int y = 0; y < H; ++y) {
+        ret = combine(ret, rows[y]);
+    }
+    return ret;
+}
+
+} // namespace rtengine
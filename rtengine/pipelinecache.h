@@ -0,0 +1,133 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include "cache.h"
+#include "imagefloat.h"
+#include "noncopyable.h"
+#include "../rtgui/threadutils.h"
+
+namespace rtengine {
+
+/**
+ * Memoization of the outputs of the individual steps of
+ * ImProcFunctions::process() for the interactive pipelines.
+ *
+ * The output of a step is identified by a 64-bit key obtained by chaining
+ * the key of its input with the name of the step and the values of the
+ * parameters that the step reads, so that the key of the output of the n-th
+ * step only depends on the input of the stage and on the parameters of the
+ * first n steps. Parameter values are not hashed: each distinct value seen
+ * recently for a given step is compared with operator== and mapped to a
+ * small integer id, so that going back to a previous value (e.g. with undo)
+ * gives a cache hit as well. Outputs are evicted in LRU order when their
+ * total size exceeds Settings::pipeline_cache_size.
+ */
+class PipelineCache: public NonCopyable {
+public:
+    struct Entry {
+        Entry(const Imagefloat *img, bool stop);
+
+        std::unique_ptr<Imagefloat> img;
+        bool stop;
+    };
+    typedef std::shared_ptr<const Entry> EntryPtr;
+
+    PipelineCache();
+
+    bool enabled() const { return max_size_ > 0; }
+    void clear();
+
+    bool get(uint64_t key, EntryPtr &entry);
+    void set(uint64_t key, const Imagefloat *img, bool stop);
+
+    // key of the output of step `name` given the key of its input and the
+    // values of the parameters it depends on
+    template <class... P>
+    uint64_t getKey(uint64_t input, const char *name, const P&... params)
+    {
+        return combine(combine(input, hash(name)), getParamsId(name, std::make_tuple(params...)));
+    }
+
+    static uint64_t hash(const Imagefloat *img, bool multithread);
+    static uint64_t hash(const char *str);
+    static uint64_t combine(uint64_t seed, uint64_t value);
+
+private:
+    struct ParamsBase {
+        explicit ParamsBase(uint64_t i): id(i) {}
+        virtual ~ParamsBase() = default;
+        uint64_t id;
+    };
+
+    template <class T>
+    struct Params: public ParamsBase {
+        Params(uint64_t i, const T &v): ParamsBase(i), value(v) {}
+        T value;
+    };
+
+    template <class T>
+    uint64_t getParamsId(const char *name, const T &value)
+    {
+        MyMutex::MyLock lock(params_mutex_);
+
+        auto &recent = recent_params_[name];
+        for (auto it = recent.begin(); it != recent.end(); ++it) {
+            auto p = dynamic_cast<const Params<T> *>(it->get());
+            if (p && p->value == value) {
+                const uint64_t id = p->id;
+                if (it != recent.begin()) {
+                    std::unique_ptr<ParamsBase> tmp = std::move(*it);
+                    recent.erase(it);
+                    recent.emplace_front(std::move(tmp));
+                }
+                return id;
+            }
+        }
+        recent.emplace_front(new Params<T>(++last_params_id_, value));
+        if (recent.size() > MAX_RECENT_PARAMS) {
+            recent.pop_back();
+        }
+        return last_params_id_;
+    }
+
+    struct EntryWeight {
+        unsigned long operator()(const EntryPtr &e) const
+        {
+            return (unsigned long)(e->img->getWidth()) * e->img->getHeight() * 3 * sizeof(float);
+        }
+    };
+
+    static constexpr size_t MAX_RECENT_PARAMS = 16;
+
+    unsigned long max_size_;
+    Cache<uint64_t, EntryPtr, EntryWeight> entries_;
+    MyMutex params_mutex_;
+    std::map<std::string, std::deque<std::unique_ptr<ParamsBase>>> recent_params_;
+    uint64_t last_params_id_;
+};
+
+} // namespace rtengine
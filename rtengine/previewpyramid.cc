@@ -0,0 +1,194 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "previewpyramid.h"
+#include "settings.h"
+#include "rt_math.h"
+
+#include <iostream>
+
+namespace rtengine {
+
+extern const Settings *settings;
+
+namespace {
+
+// box-average src by an integer factor into dst
+void downscale(const Imagefloat *src, Imagefloat *dst, int factor)
+{
+    const int sW = src->getWidth();
+    const int sH = src->getHeight();
+    const int dW = dst->getWidth();
+    const int dH = dst->getHeight();
+
+#ifdef _OPENMP
+#   pragma omp parallel for
+#endif
+    for (int y = 0; y < dH; ++y) {
+        const int y0 = min(y * factor, sH - 1);
+        const int y1 = min(y0 + factor, sH);
+        for (int x = 0; x < dW; ++x) {
+            const int x0 = min(x * factor, sW - 1);
+            const int x1 = min(x0 + factor, sW);
+            float r = 0.f, g = 0.f, b = 0.f;
+            for (int yy = y0; yy < y1; ++yy) {
+                for (int xx = x0; xx < x1; ++xx) {
+                    r += src->r(yy, xx);
+                    g += src->g(yy, xx);
+                    b += src->b(yy, xx);
+                }
+            }
+            const float n = (y1 - y0) * (x1 - x0);
+            dst->r(y, x) = r / n;
+            dst->g(y, x) = g / n;
+            dst->b(y, x) = b / n;
+        }
+    }
+}
+
+} // namespace
+
+
+PreviewPyramid::PreviewPyramid():
+    levels_(std::max((unsigned long)(std::max(settings->preview_pyramid_cache_size, 0)) << 20, 1ul)),
+    max_size_((unsigned long)(std::max(settings->preview_pyramid_cache_size, 0)) << 20),
+    fw_(0),
+    fh_(0),
+    tr_(0)
+{
+}
+
+
+void PreviewPyramid::clear()
+{
+    levels_.clear();
+}
+
+
+void PreviewPyramid::setSource(int fw, int fh, int tr)
+{
+    if (fw != fw_ || fh != fh_ || tr != tr_) {
+        clear();
+        fw_ = fw;
+        fh_ = fh;
+        tr_ = tr;
+    }
+}
+
+
+void PreviewPyramid::set(int skip, const Imagefloat *img)
+{
+    if ((unsigned long)(img->getWidth()) * img->getHeight() * 3 * sizeof(float) > max_size_) {
+        return;
+    }
+
+    Level l(new Imagefloat(img->getWidth(), img->getHeight()));
+    img->copyTo(l.get());
+    levels_.set(skip, l);
+}
+
+
+PreviewPyramid::Level PreviewPyramid::getLevel(ImageSource *src, const ColorTemp &wb, const PreviewProps &pp, const procparams::ExposureParams &exposure, const procparams::RAWParams &raw)
+{
+    const int skip = pp.getSkip();
+    Level ret;
+
+    if (levels_.get(skip, ret)) {
+        return ret;
+    }
+
+    PreviewProps full(0, 0, fw_, fh_, skip);
+    int w, h;
+    src->getSize(full, w, h);
+    if (w <= 0 || h <= 0 || (unsigned long)(w) * h * 3 * sizeof(float) > max_size_) {
+        return ret;
+    }
+
+    Level finer;
+    int factor = 0;
+    for (int f = skip / 2; f >= 1; --f) {
+        if (skip % f == 0 && levels_.get(f, finer)) {
+            factor = skip / f;
+            break;
+        }
+    }
+
+    if (!finer) {
+        // computing a new level from the image source costs more than
+        // computing just the requested area, so do it only if the
+        // requested area covers a significant part of the image
+        const double area = double(pp.getWidth() / skip) * double(pp.getHeight() / skip);
+        if (area * 4 < double(w) * double(h)) {
+            return ret;
+        }
+    }
+
+    ret.reset(new Imagefloat(w, h));
+    if (finer) {
+        downscale(finer.get(), ret.get(), factor);
+    } else {
+        src->getImage(wb, tr_, ret.get(), full, exposure, raw);
+    }
+    levels_.set(skip, ret);
+
+    if (settings->verbose > 1) {
+        std::cout << "PreviewPyramid: computed level " << skip << " (" << w << "x" << h << ")";
+        if (finer) {
+            std::cout << " from level " << (skip / factor);
+        }
+        std::cout << std::endl;
+    }
+
+    return ret;
+}
+
+
+bool PreviewPyramid::getImage(ImageSource *src, const ColorTemp &wb, Imagefloat *dst, const PreviewProps &pp, const procparams::ExposureParams &exposure, const procparams::RAWParams &raw)
+{
+    if (!max_size_) {
+        return false;
+    }
+
+    const Level l = getLevel(src, wb, pp, exposure, raw);
+    if (!l) {
+        return false;
+    }
+
+    const int skip = pp.getSkip();
+    const int ox = pp.getX() / skip;
+    const int oy = pp.getY() / skip;
+    const int W = l->getWidth();
+    const int H = l->getHeight();
+
+#ifdef _OPENMP
+#   pragma omp parallel for
+#endif
+    for (int y = 0; y < dst->getHeight(); ++y) {
+        const int sy = LIM(oy + y, 0, H - 1);
+        for (int x = 0; x < dst->getWidth(); ++x) {
+            const int sx = LIM(ox + x, 0, W - 1);
+            dst->r(y, x) = l->r(sy, sx);
+            dst->g(y, x) = l->g(sy, sx);
+            dst->b(y, x) = l->b(sy, sx);
+        }
+    }
+
+    return true;
+}
+
+} // namespace rtengine
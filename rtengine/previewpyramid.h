@@ -0,0 +1,85 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+
+#include "cache.h"
+#include "imagefloat.h"
+#include "imagesource.h"
+#include "noncopyable.h"
+
+namespace rtengine {
+
+/**
+ * Multi-resolution cache of the output of ImageSource::getImage() for the
+ * editor.
+ *
+ * Each level holds the whole image at a given skip factor. A level is
+ * computed the first time a detail window needs it, by box-averaging a
+ * finer cached level when possible (which is what getImage() does on the
+ * raw data) or by calling getImage() on the whole image otherwise; zoom
+ * changes and pans then just copy from the cached levels instead of going
+ * back to the image source. Levels are evicted in LRU order when their
+ * total size exceeds Settings::preview_pyramid_cache_size.
+ *
+ * The owner must call clear() whenever something that affects the output
+ * of getImage() changes (i.e. for M_INIT updates). Access must be
+ * serialized by the caller (ImProcCoordinator::minit).
+ */
+class PreviewPyramid: public NonCopyable {
+public:
+    PreviewPyramid();
+
+    void clear();
+
+    // drops all the levels if the full image size or coarse transformation
+    // changed
+    void setSource(int fw, int fh, int tr);
+
+    // stores a copy of img, which must be the output of getImage() for the
+    // whole image at the given skip
+    void set(int skip, const Imagefloat *img);
+
+    // fills dst with the area of the image described by pp, using the
+    // cached levels. Returns false (without touching dst) if the level for
+    // pp.getSkip() is not cached and is not worth computing, in which case
+    // the caller should use src->getImage() directly
+    bool getImage(ImageSource *src, const ColorTemp &wb, Imagefloat *dst, const PreviewProps &pp, const procparams::ExposureParams &exposure, const procparams::RAWParams &raw);
+
+private:
+    typedef std::shared_ptr<Imagefloat> Level;
+
+    struct LevelWeight {
+        unsigned long operator()(const Level &l) const
+        {
+            return (unsigned long)(l->getWidth()) * l->getHeight() * 3 * sizeof(float);
+        }
+    };
+
+    Level getLevel(ImageSource *src, const ColorTemp &wb, const PreviewProps &pp, const procparams::ExposureParams &exposure, const procparams::RAWParams &raw);
+
+    Cache<int, Level, LevelWeight> levels_;
+    unsigned long max_size_;
+    int fw_;
+    int fh_;
+    int tr_;
+};
+
+} // namespace rtengine
@@ -2466,7 +2466,8 @@ ResizeParams::ResizeParams() :
     height(900),
     allowUpscaling(false),
     ppi(300),
-    unit(PX)
+    unit(PX),
+    filter(LANCZOS3)
 {
 }
 
@@ -2481,7 +2482,8 @@ bool ResizeParams::operator ==(const ResizeParams& other) const
         && height == other.height
         && allowUpscaling == other.allowUpscaling
         && ppi == other.ppi
-        && unit == other.unit;
+        && unit == other.unit
+        && filter == other.filter;
 }
 
 bool ResizeParams::operator !=(const ResizeParams& other) const
@@ -3845,6 +3847,14 @@ int ProcParams::save(ProgressListener *pl, bool save_general,
             default: u = "px"; break;
             }
             saveToKeyfile("Resize", "Unit", Glib::ustring(u), keyFile);
+            const std::map<ResizeParams::Filter, const char *> filter_mapping = {
+                {ResizeParams::LANCZOS3, "Lanczos3"},
+                {ResizeParams::LANCZOS2, "Lanczos2"},
+                {ResizeParams::LANCZOS4, "Lanczos4"},
+                {ResizeParams::MITCHELL, "Mitchell"},
+                {ResizeParams::CATMULL_ROM, "CatmullRom"}
+            };
+            saveToKeyfile("Resize", "Filter", filter_mapping, resize.filter, keyFile);
         }
 
 // Post resize sharpening
@@ -5001,6 +5011,14 @@ int ProcParams::load(ProgressListener *pl, bool load_general,
                     resize.unit = ResizeParams::PX;
                 }
             }
+            const std::map<std::string, ResizeParams::Filter> filter_mapping = {
+                {"Lanczos3", ResizeParams::LANCZOS3},
+                {"Lanczos2", ResizeParams::LANCZOS2},
+                {"Lanczos4", ResizeParams::LANCZOS4},
+                {"Mitchell", ResizeParams::MITCHELL},
+                {"CatmullRom", ResizeParams::CATMULL_ROM}
+            };
+            assignFromKeyfile(keyFile, "Resize", "Filter", filter_mapping, resize.filter);
         }
         
 	if (keyFile.has_group ("Spot Removal") && RELEVANT_(spot)) {
@@ -1082,6 +1082,14 @@ struct ResizeParams {
         INCHES
     };
     Unit unit;
+    enum Filter {
+        LANCZOS3,
+        LANCZOS2,
+        LANCZOS4,
+        MITCHELL,
+        CATMULL_ROM
+    };
+    Filter filter;
 
     ResizeParams();
 
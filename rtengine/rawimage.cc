@@ -17,6 +17,17 @@
 #include "utils.h"
 #include "metadata.h"
 #include "image8.h"
+#include "mytime.h"
+#include <algorithm>
+#include <atomic>
+#ifdef BENCHMARK
+#  include <cstdlib>
+#  include <thread>
+#  include <vector>
+#endif
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
 
 #ifdef ART_USE_LIBRAW
 # include <libraw.h>
@@ -26,7 +37,38 @@
 namespace rtengine {
 
 extern const Settings *settings;
-extern MyMutex *librawMutex;
+
+#ifdef LIBRAW_USE_OPENMP
+namespace {
+
+std::atomic<int> libraw_running_decodes(0);
+
+// LibRaw instances (libraw_r) share no state, so several files can be
+// decoded at once. Some of the LibRaw decoders however run OpenMP parallel
+// regions of their own, with the thread count of the calling thread. While
+// an object of this class is alive, that count is capped to the share of
+// the cores of each of the decodes running at that moment
+class LibRawThreads {
+public:
+    LibRawThreads():
+        prev_threads_(omp_get_max_threads())
+    {
+        const int n = ++libraw_running_decodes;
+        omp_set_num_threads(std::max(std::min(prev_threads_, omp_get_num_procs() / n), 1));
+    }
+
+    ~LibRawThreads()
+    {
+        --libraw_running_decodes;
+        omp_set_num_threads(prev_threads_);
+    }
+
+private:
+    int prev_threads_;
+};
+
+} // namespace
+#endif // LIBRAW_USE_OPENMP
 
 
 RawImage::RawImage(const Glib::ustring &name)
@@ -768,7 +810,14 @@ int RawImage::loadRaw (bool loadData, unsigned int imageNum, bool closeFile, Pro
 
             // Load raw pixels data
             fseek(ifp, data_offset, SEEK_SET);
+            MyTime t1, t2;
+            t1.set();
             (this->*load_raw)();
+            t2.set();
+
+            if (settings->verbose) {
+                printf("Raw decoding (%s) took %d ms\n", load_raw_name(), t2.etime(t1) / 1000);
+            }
         } else {
 #ifdef ART_USE_LIBRAW
             libraw_->imgdata.rawparams.shot_select = shot_select;
@@ -779,7 +828,7 @@ int RawImage::loadRaw (bool loadData, unsigned int imageNum, bool closeFile, Pro
             }
             {
 #ifdef LIBRAW_USE_OPENMP
-                MyMutex::MyLock lock(*librawMutex);
+                LibRawThreads threads;
 #endif
                 err = libraw_->unpack();
             }
@@ -799,7 +848,7 @@ int RawImage::loadRaw (bool loadData, unsigned int imageNum, bool closeFile, Pro
                 }
             } else {
 #ifdef LIBRAW_USE_OPENMP
-                MyMutex::MyLock lock(*librawMutex);
+                LibRawThreads threads;
 #endif
                 float_raw_image = nullptr;
                 err = libraw_->raw2image();
@@ -1422,6 +1471,83 @@ Image8 *RawImage::getThumbnail()
     return nullptr;
 }
 
+
+#ifdef BENCHMARK
+
+namespace {
+
+// Decodes fname and appends its raw data to out, row by row
+bool benchmark_decode_raw(const Glib::ustring &fname, std::vector<float> &out)
+{
+    RawImage ri(fname);
+    if (ri.loadRaw(true)) {
+        return false;
+    }
+    float **data = ri.compress_image(0);
+    if (!data) {
+        return false;
+    }
+    const int W = (ri.isBayer() || ri.isXtrans() || ri.get_colors() == 1) ? ri.get_width() : 3 * ri.get_width();
+    for (int y = 0; y < ri.get_height(); ++y) {
+        out.insert(out.end(), data[y], data[y] + W);
+    }
+    return true;
+}
+
+} // namespace
+
+
+bool benchmark_raw_decode()
+{
+    const char *fname = std::getenv("ART_BENCHMARK_RAW");
+    if (!fname) {
+        std::cout << "rawdecode: set ART_BENCHMARK_RAW to the name of a raw file to run this check" << std::endl;
+        return true;
+    }
+
+    std::vector<float> ref;
+    MyTime t1, t2;
+    t1.set();
+    if (!benchmark_decode_raw(fname, ref)) {
+        std::cout << "rawdecode: can't decode " << fname << std::endl;
+        return false;
+    }
+    t2.set();
+    std::cout << "rawdecode, 1 decode: " << t2.etime(t1) / 1000.0 << " ms" << std::endl;
+
+    constexpr int N = 4;
+    std::vector<float> out[N];
+    bool ok[N];
+    std::vector<std::thread> workers;
+    t1.set();
+    for (int i = 0; i < N; ++i) {
+        workers.emplace_back(
+            [&, i]() -> void
+            {
+                ok[i] = benchmark_decode_raw(fname, out[i]);
+            });
+    }
+    for (auto &w : workers) {
+        w.join();
+    }
+    t2.set();
+    std::cout << "rawdecode, " << N << " concurrent decodes: " << t2.etime(t1) / 1000.0 << " ms" << std::endl;
+
+    bool res = true;
+    for (int i = 0; i < N; ++i) {
+        if (!ok[i] || out[i].size() != ref.size() || memcmp(out[i].data(), ref.data(), ref.size() * sizeof(float)) != 0) {
+            std::cout << "rawdecode: concurrent decode " << i << " differs from the serial one" << std::endl;
+            res = false;
+        }
+    }
+    if (res) {
+        std::cout << "rawdecode: concurrent decodes identical to the serial one" << std::endl;
+    }
+    return res;
+}
+
+#endif // BENCHMARK
+
 } //namespace rtengine
 
 bool
@@ -216,4 +216,11 @@ protected:
     void set_black_from_masked_areas();
 };
 
+#ifdef BENCHMARK
+// Decodes the raw file named by the ART_BENCHMARK_RAW environment variable
+// serially and from several threads at once, and checks that all the
+// decodes give the same data
+bool benchmark_raw_decode();
+#endif
+
 } // namespace rtengine
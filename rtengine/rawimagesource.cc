@@ -621,7 +621,12 @@ RawImageSource::RawImageSource ()
     , green(0, 0)
     , red(0, 0)
     , blue(0, 0)
+    , demosaicReduction(1)
     , rawDirty(true)
+    , demosaicCacheEnabled(false)
+    , demosaicCachePreprocessed(false)
+    , demosaicCacheHit(false)
+    , demosaicCacheContrast(0.0)
 {
     camProfile = nullptr;
     embProfile = nullptr;
@@ -882,7 +887,9 @@ void RawImageSource::getImage (const ColorTemp &ctemp, int tran, Imagefloat* ima
 
     bool doHr = (hrenabled && hrp.hrmode == procparams::ExposureParams::HR_BLEND);
 
-    if (hrp.enabled && (hrp.hrmode == procparams::ExposureParams::HR_COLOR ||
+    // the colour propagation needs the full-size planes, the coordinator
+    // doesn't use previewDemosaic() when it is enabled
+    if (hrp.enabled && demosaicReduction == 1 && (hrp.hrmode == procparams::ExposureParams::HR_COLOR ||
                         hrp.hrmode == procparams::ExposureParams::HR_COLORSOFT)) {
         if (!rgbSourceModified) {
             if (hrp.hrmode == procparams::ExposureParams::HR_COLOR) {
@@ -949,12 +956,22 @@ void RawImageSource::getImage (const ColorTemp &ctemp, int tran, Imagefloat* ima
 
                     float rtot = 0.f, gtot = 0.f, btot = 0.f;
 
-                    for (int m = 0; m < skip; m++)
-                        for (int n = 0; n < skip; n++) {
-                            rtot += red[i + m][jx + n];
-                            gtot += green[i + m][jx + n];
-                            btot += blue[i + m][jx + n];
-                        }
+                    if (demosaicReduction > 1) {
+                        const int r = demosaicReduction;
+                        for (int m = 0; m < skip; m++)
+                            for (int n = 0; n < skip; n++) {
+                                rtot += red[(i + m) / r][(jx + n) / r];
+                                gtot += green[(i + m) / r][(jx + n) / r];
+                                btot += blue[(i + m) / r][(jx + n) / r];
+                            }
+                    } else {
+                        for (int m = 0; m < skip; m++)
+                            for (int n = 0; n < skip; n++) {
+                                rtot += red[i + m][jx + n];
+                                gtot += green[i + m][jx + n];
+                                btot += blue[i + m][jx + n];
+                            }
+                    }
 
                     rtot *= rm;
                     gtot *= gm;
@@ -1513,6 +1530,32 @@ void RawImageSource::preprocess(const RAWParams &raw, const LensProfParams &lens
         }
     }
 
+    demosaicCacheHit = false;
+    demosaicCacheKey.clear();
+    demosaicCachePreprocessed = useDemosaicCache(raw);
+    if (demosaicCachePreprocessed) {
+        demosaicCacheLensProf = lensProf;
+        demosaicCacheCoarse = coarse;
+        demosaicCacheWB = wb;
+
+        const auto key = DemosaicCache::getKey(fileName, currFrame, raw, lensProf, coarse, wb);
+        DemosaicCache::State state;
+        array2D<float> *planes[DemosaicCache::NUM_PLANES] = { &rawData, &red, &green, &blue };
+        if (DemosaicCache::getInstance()->load(key, W, H, state, planes)) {
+            demosaicReduction = 1;
+            setDemosaicCacheState(state);
+            demosaicCacheHit = true;
+            demosaicCacheKey = key;
+            rawDirty = true;
+
+            if (settings->verbose) {
+                t2.set();
+                printf("Preprocessing (from cache): %d usec\n", t2.etime(t1));
+            }
+            return;
+        }
+    }
+
     Glib::ustring newDF = raw.dark_frame;
     RawImage *rid = nullptr;
 
@@ -1847,11 +1890,95 @@ void RawImageSource::preprocess(const RAWParams &raw, const LensProfParams &lens
 }
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
+bool RawImageSource::useDemosaicCache(const RAWParams &raw) const
+{
+    if (!demosaicCacheEnabled || !DemosaicCache::getInstance()->enabled() || numFrames != 1) {
+        return false;
+    }
+    if (ri->getSensorType() == ST_BAYER) {
+        if (raw.bayersensor.method == RAWParams::BayerSensor::Method::PIXELSHIFT) {
+            return false;
+        }
+    } else if (ri->getSensorType() != ST_FUJI_XTRANS) {
+        return false;
+    }
+    // with auto-selection, the dark frame and flat field in use depend on
+    // the contents of their directories, which are not part of the key
+    if ((raw.enable_darkframe && raw.df_autoselect) || (raw.enable_flatfield && raw.ff_AutoSelect)) {
+        return false;
+    }
+    return true;
+}
+
+
+void RawImageSource::getDemosaicCacheState(DemosaicCache::State &state, double contrastThreshold) const
+{
+    for (int i = 0; i < 4; ++i) {
+        state.scale_mul[i] = scale_mul[i];
+        state.c_white[i] = c_white[i];
+        state.cblacksom[i] = cblacksom[i];
+        state.ref_pre_mul[i] = ref_pre_mul[i];
+        state.chmax[i] = chmax[i];
+        state.clmax[i] = clmax[i];
+    }
+    state.refwb_red = refwb_red;
+    state.refwb_green = refwb_green;
+    state.refwb_blue = refwb_blue;
+    state.initialGain = initialGain;
+    state.defGain = defGain;
+    state.contrastThreshold = contrastThreshold;
+    state.flatFieldAutoClipValue = flatFieldAutoClipValue;
+}
+
+
+void RawImageSource::setDemosaicCacheState(const DemosaicCache::State &state)
+{
+    for (int i = 0; i < 4; ++i) {
+        scale_mul[i] = state.scale_mul[i];
+        c_white[i] = state.c_white[i];
+        cblacksom[i] = state.cblacksom[i];
+        ref_pre_mul[i] = state.ref_pre_mul[i];
+        chmax[i] = state.chmax[i];
+        clmax[i] = state.clmax[i];
+    }
+    refwb_red = state.refwb_red;
+    refwb_green = state.refwb_green;
+    refwb_blue = state.refwb_blue;
+    initialGain = state.initialGain;
+    defGain = state.defGain;
+    demosaicCacheContrast = state.contrastThreshold;
+    flatFieldAutoClipValue = state.flatFieldAutoClipValue;
+}
+
+//%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
 void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &contrastThreshold)
 {
     MyTime t1, t2;
     t1.set();
 
+    std::string cache_key;
+    if (demosaicCachePreprocessed && useDemosaicCache(raw)) {
+        cache_key = DemosaicCache::getKey(fileName, currFrame, raw, demosaicCacheLensProf, demosaicCacheCoarse, demosaicCacheWB);
+        if (demosaicCacheHit && cache_key == demosaicCacheKey) {
+            demosaicCacheHit = false;
+            if (autoContrast) {
+                contrastThreshold = demosaicCacheContrast;
+            }
+            rgbSourceModified = false;
+            return;
+        }
+    }
+    demosaicCacheHit = false;
+
+    if (demosaicReduction != 1) {
+        // the planes hold the output of previewDemosaic()
+        red(W, H);
+        green(W, H);
+        blue(W, H);
+        demosaicReduction = 1;
+    }
+
     double raw_expos = raw.enable_whitepoint ? raw.expos : 1.0;
 
     if (ri->getSensorType() == ST_BAYER) {
@@ -1947,6 +2074,14 @@ void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &c
 
     rgbSourceModified = false;
 
+    if (!cache_key.empty() && cache_key != demosaicCacheKey) {
+        DemosaicCache::State state;
+        getDemosaicCacheState(state, contrastThreshold);
+        const array2D<float> *const planes[DemosaicCache::NUM_PLANES] = { &rawData, &red, &green, &blue };
+        DemosaicCache::getInstance()->store(cache_key, W, H, state, planes);
+        demosaicCacheKey = cache_key;
+    }
+
 
     if( settings->verbose ) {
         if (getSensorType() == ST_BAYER) {
@@ -1958,6 +2093,45 @@ void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &c
 }
 
 
+bool RawImageSource::previewDemosaic(const RAWParams &raw, int skip)
+{
+    // superpixels of 2x2 pixels for Bayer and 3x3 for X-Trans. They can be
+    // used only if the preview is not going to be sampled more finely than
+    // that, and when a real demosaic was asked for
+    int n = 0;
+    if (ri->getSensorType() == ST_BAYER) {
+        if (raw.bayersensor.method != RAWParams::BayerSensor::Method::NONE && raw.bayersensor.method != RAWParams::BayerSensor::Method::MONO) {
+            n = 2;
+        }
+    } else if (ri->getSensorType() == ST_FUJI_XTRANS) {
+        if (raw.xtranssensor.method != RAWParams::XTransSensor::Method::NONE && raw.xtranssensor.method != RAWParams::XTransSensor::Method::MONO) {
+            n = 3;
+        }
+    }
+
+    // a cache hit already has the full demosaic, which is faster to get
+    if (n == 0 || skip < n || W < n || H < n || demosaicCacheHit) {
+        return false;
+    }
+
+    demosaicCacheHit = false;
+
+    MyTime t1, t2;
+    t1.set();
+
+    superpixel_demosaic(n);
+    rgbSourceModified = false;
+
+    t2.set();
+
+    if (settings->verbose) {
+        std::cout << "Demosaicing " << (n == 2 ? "Bayer" : "X-Trans") << " data for the preview: superpixel " << n << "x" << n << " - " << t2.etime(t1) << " usec\n";
+    }
+
+    return true;
+}
+
+
 void RawImageSource::flushRawData()
 {
     if (rawData) {
@@ -1967,6 +2141,8 @@ void RawImageSource::flushRawData()
 
 void RawImageSource::flushRGB()
 {
+    demosaicCacheHit = false;
+
     if (green) {
         green(0, 0);
     }
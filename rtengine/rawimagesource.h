@@ -28,6 +28,7 @@
 #include "iimage.h"
 #include <iostream>
 #include "pixelsmap.h"
+#include "demosaiccache.h"
 #define HR_SCALE 2
 
 namespace rtengine
@@ -88,11 +89,29 @@ protected:
     array2D<float> red;
     // the interpolated blue plane:
     array2D<float> blue;
+    // if > 1, red, green and blue hold one pixel for each block of n x n raw
+    // pixels (see previewDemosaic())
+    int demosaicReduction;
     bool rawDirty;
     float psRedBrightness[4];
     float psGreenBrightness[4];
     float psBlueBrightness[4];
 
+    // on-disk cache of the preprocessed and demosaiced data, see
+    // DemosaicCache. Only used by the editor
+    bool demosaicCacheEnabled;
+    bool demosaicCachePreprocessed; // preprocess() went through the cache
+    bool demosaicCacheHit; // red, green and blue come from the cache
+    std::string demosaicCacheKey; // key of the last entry loaded or stored
+    double demosaicCacheContrast; // dual demosaic threshold of the cached data
+    LensProfParams demosaicCacheLensProf;
+    CoarseTransformParams demosaicCacheCoarse;
+    ColorTemp demosaicCacheWB;
+
+    bool useDemosaicCache(const RAWParams &raw) const;
+    void getDemosaicCacheState(DemosaicCache::State &state, double contrastThreshold) const;
+    void setDemosaicCacheState(const DemosaicCache::State &state);
+
     std::vector<double> histMatchingCache;
     std::vector<double> histMatchingCache2;
     ColorManagementParams histMatchingParams;
@@ -120,11 +139,13 @@ public:
     int load(const Glib::ustring &fname, bool firstFrameOnly);
     void preprocess(const RAWParams &raw, const LensProfParams &lensProf, const CoarseTransformParams& coarse, bool prepareDenoise=true, const ColorTemp &wb=ColorTemp()) override;
     void demosaic(const RAWParams &raw, bool autoContrast, double &contrastThreshold) override;
+    bool previewDemosaic(const RAWParams &raw, int skip) override;
     void flushRawData() override;
     void flushRGB() override;
     void HLRecovery_Global(const ExposureParams &hrp) override;
     void refinement(int PassCount);
     void setBorder(unsigned int rawBorder) override {border = rawBorder;}
+    void enableDemosaicCache(bool yes) override { demosaicCacheEnabled = yes; }
     bool isRGBSourceModified() const override
     {
         return rgbSourceModified;   // tracks whether cached rgb output of demosaic has been modified
@@ -258,6 +279,7 @@ protected:
     void green_equilibrate (const GreenEqulibrateThreshold &greenthresh, array2D<float> &rawData);//Emil's green equilibration
 
     void nodemosaic(bool bw);
+    void superpixel_demosaic(int n);
     void eahd_demosaic();
     void hphd_demosaic();
     void vng4_demosaic(const array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue);
@@ -309,6 +331,15 @@ public:
     void wbCamera2Mul(double &rm, double &gm, double &bm) override;    
 
     void getWBMults(const ColorTemp &ctemp, const procparams::RAWParams &raw, std::array<float, 4>& scale_mul, float &autoGainComp, float &rm, float &gm, float &bm) const override;
+
+#ifdef BENCHMARK
+    // generic builds of the functions above, see demosaic_benchmark.cc
+    void amaze_demosaic_RT_reference(int winx, int winy, int winw, int winh, const array2D<float> &rawData, array2D<float> &red, array2D<float> &green, array2D<float> &blue);
+    void rcd_demosaic_reference();
+
+    friend bool benchmark_amaze_demosaic();
+    friend bool benchmark_rcd_demosaic();
+#endif
 };
 
 } // namespace rtengine
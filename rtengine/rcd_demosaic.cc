@@ -21,6 +21,7 @@
 #include "rawimagesource.h"
 #include "rt_math.h"
 #include "../rtgui/multilangmgr.h"
+#include "opthelper.h"
 #include "StopWatch.h"
 
 namespace
@@ -48,6 +49,7 @@ namespace rtengine
 // coefficients in an exact, shorter and more performant formula.
 // In cooperation with Hanno Schwalm (hanno@schwalm-bremen.de) and Luis Sanz Rodriguez this has been tuned for performance.
 
+RT_AVX2_CLONES
 void RawImageSource::rcd_demosaic()
 {
     constexpr size_t chunkSize = 2;
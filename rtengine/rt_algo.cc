@@ -33,6 +33,7 @@
 #include "gauss.h"
 #include "opthelper.h"
 #include "rt_algo.h"
+#include "fftplancache.h"
 #include "rt_math.h"
 #include "sleef.h"
 #include "../rtgui/threadutils.h"
@@ -743,7 +744,7 @@ void do_convolution(fftwf_plan fwd_plan, fftwf_plan inv_plan, fftwf_complex *ker
         }
     }
 
-    fftwf_execute(fwd_plan);
+    fftwf_execute_dft_r2c(fwd_plan, buf, buf_fft);
 
 #ifdef _OPENMP
 #   pragma omp parallel for if (multithread)
@@ -758,7 +759,7 @@ void do_convolution(fftwf_plan fwd_plan, fftwf_plan inv_plan, fftwf_complex *ker
         }
     }
 
-    fftwf_execute(inv_plan);
+    fftwf_execute_dft_c2r(inv_plan, buf_fft, buf);
 
     const int K = 2 * kernel_radius;
     const float norm = pH * pW;
@@ -793,9 +794,8 @@ fftwf_complex *prepare_kernel(const array2D<float> &kernel, float *buf, int pW,
         }
     }
 
-    auto plan = fftwf_plan_dft_r2c_2d(pH, pW, buf, kernel_fft, FFTW_ESTIMATE);
-    fftwf_execute(plan);
-    fftwf_destroy_plan(plan);
+    const auto plan = FFTPlanCache::getInstance()->r2c_2d(pH, pW, buf, kernel_fft, FFTW_ESTIMATE);
+    fftwf_execute_dft_r2c(plan.get(), buf, kernel_fft);
 
     return kernel_fft;
 }
@@ -810,8 +810,8 @@ struct ConvolutionData {
     fftwf_complex *kernel_fft;
     float *buf;
     fftwf_complex *buf_fft;
-    fftwf_plan fwd_plan;
-    fftwf_plan inv_plan;
+    FFTPlanCache::Plan fwd_plan;
+    FFTPlanCache::Plan inv_plan;
     bool multithread;
 
     ConvolutionData(const array2D<float> &kernel, int W, int H, bool multithread):
@@ -819,21 +819,17 @@ struct ConvolutionData {
         kernel_fft(nullptr),
         buf(nullptr),
         buf_fft(nullptr),
-        fwd_plan(nullptr),
-        inv_plan(nullptr),
         multithread(multithread)
     {
         K = kernel.width();
         if (K == kernel.height()) {
-            MyMutex::MyLock lock(*fftwMutex);
-
-#ifdef RT_FFTW3F_OMP
+            int nthreads = 1;
+#if defined RT_FFTW3F_OMP && defined _OPENMP
             if (multithread) {
-                fftwf_init_threads();
-                fftwf_plan_with_nthreads(omp_get_num_procs());
+                nthreads = omp_get_num_procs();
             }
 #endif
-            
+
             this->W = W;
             this->H = H;
             pW = find_fast_dim(W + K);
@@ -843,19 +839,14 @@ struct ConvolutionData {
             buf_fft = fftwf_alloc_complex(pH * (pW / 2 + 1));
             kernel_fft = prepare_kernel(kernel, buf, pW, pH, false);
 
-            fwd_plan = fftwf_plan_dft_r2c_2d(pH, pW, buf, buf_fft, FFTW_ESTIMATE);
-            inv_plan = fftwf_plan_dft_c2r_2d(pH, pW, buf_fft, buf, FFTW_ESTIMATE);
+            FFTPlanCache *fftcache = FFTPlanCache::getInstance();
+            fwd_plan = fftcache->r2c_2d(pH, pW, buf, buf_fft, FFTW_ESTIMATE, nthreads);
+            inv_plan = fftcache->c2r_2d(pH, pW, buf_fft, buf, FFTW_ESTIMATE, nthreads);
         }
     }
 
     ~ConvolutionData()
     {
-        if (inv_plan) {
-            fftwf_destroy_plan(inv_plan);
-        }
-        if (fwd_plan) {
-            fftwf_destroy_plan(fwd_plan);
-        }
         if (kernel_fft) {
             fftwf_free(kernel_fft);
         }
@@ -889,7 +880,7 @@ void Convolution::operator()(float **src, float **dst)
     ConvolutionData *d = static_cast<ConvolutionData *>(data_);
     MyMutex::MyLock lock(*fftwMutex);
 
-    do_convolution(d->fwd_plan, d->inv_plan, d->kernel_fft, d->K/2, d->pH, d->pW, d->buf, d->buf_fft, d->W, d->H, src, dst, d->multithread);
+    do_convolution(d->fwd_plan.get(), d->inv_plan.get(), d->kernel_fft, d->K/2, d->pH, d->pW, d->buf, d->buf_fft, d->W, d->H, src, dst, d->multithread);
 }
 
 
@@ -610,6 +610,10 @@ public:
                    * @return the next ProcessingJob to process */
     virtual ProcessingJob* imageReady(IImagefloat* img) = 0;
 
+    /** This function is called when the current job could not be processed, after error() has been called with the reason.
+                   * Unlike error(), which is also used for non-fatal warnings, it means that the job is over. */
+    virtual void jobFailed() {}
+
     virtual const procparams::PartialProfile *getBatchProfile() = 0;
 };
 /** This function performs all the image processing steps corresponding to the given ProcessingJob. It runs in the background, thus it returns immediately,
@@ -618,8 +622,9 @@ public:
    * The ProcessingJob passed becomes invalid, you can not use it any more.
    * @param job the ProcessingJob to cancel.
    * @param bpl is the BatchProcessingListener that is called when the image is ready or the next job is needed. It also acts as a ProgressListener.
+   * @param num_threads if > 0, the number of OpenMP threads used for the processing (e.g. when several batches run concurrently)
    **/
-void startBatchProcessing (ProcessingJob* job, BatchProcessingListener* bpl);
+void startBatchProcessing (ProcessingJob* job, BatchProcessingListener* bpl, int num_threads=0);
 
 
 extern MyMutex* lcmsMutex;
@@ -165,6 +165,116 @@ void scale_colors (rtengine::RawImage *ri, float scale_mul[4], float cblack[4],
     }
 }
 
+
+/*
+ * Downscales Bayer or X-Trans data into img, by averaging each colour over
+ * blocks of vskip x hskip sensor pixels. Samples are scaled like in
+ * scale_colors(), but the raw data is only read, and only once. If awb_sum
+ * is not null, the sums and counts of the samples not above clipval outside
+ * a border of 32 pixels are also accumulated into awb_sum and awb_n, for the
+ * auto white balance of the thumbnail.
+ */
+void bin_cfa(rtengine::RawImage *ri, const float scale_mul[4], const float cblack[4], int hskip, int vskip, rtengine::Imagefloat *img, double clipval, double awb_sum[3], unsigned awb_n[3], bool multiThread)
+{
+    const rtengine::RawImage::ImageType image = ri->get_image();
+    const int width = ri->get_width();
+    const int height = ri->get_height();
+    const int iwidth = ri->get_iwidth();
+    const int top_margin = ri->get_topmargin();
+    const int left_margin = ri->get_leftmargin();
+    const int raw_width = ri->get_rawwidth();
+    const float * const float_raw_image = ri->isFloat() ? ri->get_FloatRawImage() : nullptr;
+    const bool xtrans = ri->isXtrans();
+    const int W = img->getWidth();
+    const int H = img->getHeight();
+
+    // colour of a sensor pixel. Before pre_interpolate(), the second green
+    // of a Bayer pattern has colour 3
+    const auto color =
+        [&](int row, int col) -> int
+        {
+            return xtrans ? ri->XTRANSFC(row, col) : ri->FC(row, col);
+        };
+
+    // image has already been cropped by the decoder (rows are iwidth apart,
+    // as in scale_colors()), only the float raw data still has the margins
+    const auto sample =
+        [&](int row, int col, int c) -> float
+        {
+            const float val = float_raw_image ? float_raw_image[(row + top_margin) * raw_width + col + left_margin] : image[row * iwidth + col][c];
+            return rtengine::CLIP((val - cblack[c]) * scale_mul[c]);
+        };
+
+#ifdef _OPENMP
+    #pragma omp parallel for if(multiThread)
+#endif
+    for (int y = 0; y < H; ++y) {
+        // the last row (and column) of blocks also takes the remaining pixels
+        const int r0 = y * vskip;
+        const int r1 = y == H - 1 ? height : r0 + vskip;
+        double row_awb_sum[3] = {};
+        unsigned row_awb_n[3] = {};
+
+        for (int x = 0; x < W; ++x) {
+            const int c0 = x * hskip;
+            const int c1 = x == W - 1 ? width : c0 + hskip;
+            float sum[3] = {};
+            int cnt[3] = {};
+
+            for (int row = r0; row < r1; ++row) {
+                const bool awb = awb_sum && row >= 32 && row < height - 32;
+
+                for (int col = c0; col < c1; ++col) {
+                    const int c = color(row, col);
+                    const int ch = c == 3 ? 1 : c;
+                    const float v = sample(row, col, c);
+                    sum[ch] += v;
+                    ++cnt[ch];
+
+                    if (awb && col >= 32 && col < width - 32 && v <= clipval) {
+                        row_awb_sum[ch] += v;
+                        ++row_awb_n[ch];
+                    }
+                }
+            }
+
+            // with small blocks, a colour of the X-Trans pattern might be
+            // missing: take it from the neighbouring pixels
+            if (!cnt[0] || !cnt[1] || !cnt[2]) {
+                const bool missing[3] = { !cnt[0], !cnt[1], !cnt[2] };
+
+                for (int row = std::max(r0 - 1, 0); row < std::min(r1 + 1, height); ++row) {
+                    for (int col = std::max(c0 - 1, 0); col < std::min(c1 + 1, width); ++col) {
+                        const int c = color(row, col);
+                        const int ch = c == 3 ? 1 : c;
+
+                        if (missing[ch]) {
+                            sum[ch] += sample(row, col, c);
+                            ++cnt[ch];
+                        }
+                    }
+                }
+            }
+
+            img->r(y, x) = cnt[0] ? sum[0] / cnt[0] : 0.f;
+            img->g(y, x) = cnt[1] ? sum[1] / cnt[1] : 0.f;
+            img->b(y, x) = cnt[2] ? sum[2] / cnt[2] : 0.f;
+        }
+
+        if (awb_sum) {
+#ifdef _OPENMP
+            #pragma omp critical
+#endif
+            {
+                for (int c = 0; c < 3; ++c) {
+                    awb_sum[c] += row_awb_sum[c];
+                    awb_n[c] += row_awb_n[c];
+                }
+            }
+        }
+    }
+}
+
 } // namespace
 
 extern Options options;
@@ -397,9 +507,15 @@ Thumbnail* Thumbnail::loadFromRaw (const Glib::ustring& fname, eSensorType &sens
 
     float pre_mul[4], scale_mul[4], cblack[4];
     ri->get_colorsCoeff (pre_mul, scale_mul, cblack, false);
-    scale_colors (ri, scale_mul, cblack, forHistogramMatching); // enable multithreading when forHistogramMatching is true
 
-    ri->pre_interpolate();
+    // Bayer and X-Trans data (except for Fuji SuperCCD) is binned directly
+    // from the raw data by bin_cfa(), without scaling the whole image first
+    const bool use_binning = (ri->getSensorType() == ST_BAYER || ri->getSensorType() == ST_FUJI_XTRANS) && ri->get_FujiWidth() == 0;
+
+    if (!use_binning) {
+        scale_colors (ri, scale_mul, cblack, forHistogramMatching); // enable multithreading when forHistogramMatching is true
+        ri->pre_interpolate();
+    }
 
     tpp->camwbRed = tpp->redMultiplier / pre_mul[0]; //ri->get_pre_mul(0);
     tpp->camwbGreen = tpp->greenMultiplier / pre_mul[1]; //ri->get_pre_mul(1);
@@ -414,6 +530,11 @@ Thumbnail* Thumbnail::loadFromRaw (const Glib::ustring& fname, eSensorType &sens
     unsigned filter = ri->get_filters();
     int firstgreen = 1;
 
+    if (use_binning && ri->getSensorType() == ST_BAYER) {
+        // same as in pre_interpolate(), which has not been called
+        filter &= ~((filter & 0x55555555) << 1);
+    }
+
     // locate first green location in the first row
     if (ri->getSensorType() == ST_BAYER)
         while (!FISGREEN (filter, 1, firstgreen) && firstgreen < 3) {
@@ -458,7 +579,14 @@ Thumbnail* Thumbnail::loadFromRaw (const Glib::ustring& fname, eSensorType &sens
 
     Imagefloat* tmpImg = new Imagefloat (tmpw, tmph);
 
-    if (ri->getSensorType() == ST_BAYER) {
+    double pixSum[3] = {0.0};
+    unsigned int n[3] = {0};
+    const double clipval = 64000.0 / tpp->defGain;
+
+    if (use_binning) {
+        // the auto WB statistics are collected in the same pass
+        bin_cfa(ri, scale_mul, cblack, hskip, vskip, tmpImg, clipval, forHistogramMatching ? nullptr : pixSum, n, forHistogramMatching);
+    } else if (ri->getSensorType() == ST_BAYER) {
         // demosaicing! (sort of)
         for (int row = 1, y = 0; row < height - 1 && y < tmph; row += vskip, y++) {
             rofs = (row + top_margin) * iwidth;
@@ -623,13 +751,24 @@ Thumbnail* Thumbnail::loadFromRaw (const Glib::ustring& fname, eSensorType &sens
         delete tpp->thumbImg;
     }
 
-    if (rotate_90) {
-        tpp->thumbImg = resizeTo<Image16> (h, w, TI_Bilinear, tmpImg);
-    } else {
-        tpp->thumbImg = resizeTo<Image16> (w, h, TI_Bilinear, tmpImg);
-    }
+    {
+        // the rotation is applied later, so we resize to the unrotated size
+        Imagefloat *resized = rotate_90 ? new Imagefloat(h, w) : new Imagefloat(w, h);
+        const float scale = float(resized->getWidth()) / float(tmpImg->getWidth());
+        ImProcFunctions::resample(tmpImg, resized, scale, procparams::ResizeParams::LANCZOS3, forHistogramMatching);
+        delete tmpImg;
 
-    delete tmpImg;
+        // remove the Lanczos over/undershoots before converting to 16 bit
+        for (int y = 0; y < resized->getHeight(); ++y) {
+            for (int x = 0; x < resized->getWidth(); ++x) {
+                resized->r(y, x) = CLIP(resized->r(y, x));
+                resized->g(y, x) = CLIP(resized->g(y, x));
+                resized->b(y, x) = CLIP(resized->b(y, x));
+            }
+        }
+        tpp->thumbImg = resizeTo<Image16> (resized->getWidth(), resized->getHeight(), TI_Nearest, resized);
+        delete resized;
+    }
 
 
     if (ri->get_FujiWidth() != 0) {
@@ -638,107 +777,105 @@ Thumbnail* Thumbnail::loadFromRaw (const Glib::ustring& fname, eSensorType &sens
         tpp->scale = (double) height / (rotate_90 ? w : h);
     }
     if(!forHistogramMatching) { // we don't need this for histogram matching
-        double pixSum[3] = {0.0};
-        unsigned int n[3] = {0};
-        const double clipval = 64000.0 / tpp->defGain;
-
-        for (int i = 32; i < height - 32; i++) {
-            int start, end;
-
-            if (ri->get_FujiWidth() != 0) {
-                int fw = ri->get_FujiWidth();
-                start = ABS (fw - i) + 32;
-                end = min (height + width - fw - i, fw + i) - 32;
-            } else {
-                start = 32;
-                end = width - 32;
-            }
+        if (!use_binning) {
+            for (int i = 32; i < height - 32; i++) {
+                int start, end;
+
+                if (ri->get_FujiWidth() != 0) {
+                    int fw = ri->get_FujiWidth();
+                    start = ABS (fw - i) + 32;
+                    end = min (height + width - fw - i, fw + i) - 32;
+                } else {
+                    start = 32;
+                    end = width - 32;
+                }
 
-            if (ri->getSensorType() == ST_BAYER) {
-                int c0 = ri->FC(i, start);
-                int c1 = ri->FC(i, start + 1);
-                int j = start;
-                int n0 = 0;
-                int n1 = 0;
-                double pixSum0 = 0.0;
-                double pixSum1 = 0.0;
-                for (; j < end - 1; j+=2) {
-                    double v0 = image[i * width + j][c0];
-                    if (v0 <= clipval) {
-                        pixSum0 += v0;
-                        n0++;
-                    }
-                    double v1 = image[i * width + j + 1][c1];
-                    if (v1 <= clipval) {
-                        pixSum1 += v1;
-                        n1++;
+                if (ri->getSensorType() == ST_BAYER) {
+                    int c0 = ri->FC(i, start);
+                    int c1 = ri->FC(i, start + 1);
+                    int j = start;
+                    int n0 = 0;
+                    int n1 = 0;
+                    double pixSum0 = 0.0;
+                    double pixSum1 = 0.0;
+                    for (; j < end - 1; j+=2) {
+                        double v0 = image[i * width + j][c0];
+                        if (v0 <= clipval) {
+                            pixSum0 += v0;
+                            n0++;
+                        }
+                        double v1 = image[i * width + j + 1][c1];
+                        if (v1 <= clipval) {
+                            pixSum1 += v1;
+                            n1++;
+                        }
                     }
-                }
-                if (j < end) {
-                    double v0 = image[i * width + j][c0];
-                    if (v0 <= clipval) {
-                        pixSum0 += v0;
-                        n0++;
+                    if (j < end) {
+                        double v0 = image[i * width + j][c0];
+                        if (v0 <= clipval) {
+                            pixSum0 += v0;
+                            n0++;
+                        }
                     }
-                }
-                n[c0] += n0;
-                n[c1] += n1;
-                pixSum[c0] += pixSum0;
-                pixSum[c1] += pixSum1;
-            } else if (ri->getSensorType() == ST_FUJI_XTRANS) {
-                int c[6];
-                for(int cc = 0; cc < 6; ++cc) {
-                    c[cc] = ri->XTRANSFC(i, start + cc);
-                }
-                int j = start;
-                for (; j < end - 5; j += 6) {
+                    n[c0] += n0;
+                    n[c1] += n1;
+                    pixSum[c0] += pixSum0;
+                    pixSum[c1] += pixSum1;
+                } else if (ri->getSensorType() == ST_FUJI_XTRANS) {
+                    int c[6];
                     for(int cc = 0; cc < 6; ++cc) {
-                        double d = image[i * width + j + cc][c[cc]];
-                        if (d <= clipval) {
-                            pixSum[c[cc]] += d;
-                            n[c[cc]]++;
+                        c[cc] = ri->XTRANSFC(i, start + cc);
+                    }
+                    int j = start;
+                    for (; j < end - 5; j += 6) {
+                        for(int cc = 0; cc < 6; ++cc) {
+                            double d = image[i * width + j + cc][c[cc]];
+                            if (d <= clipval) {
+                                pixSum[c[cc]] += d;
+                                n[c[cc]]++;
+                            }
                         }
                     }
-                }
-                for (; j < end; j++) {
-                    if (ri->ISXTRANSGREEN (i, j)) {
-                        double d = image[i * width + j][1];
-                        if (d <= clipval) {
-                            pixSum[1] += d;
-                            n[1]++;
+                    for (; j < end; j++) {
+                        if (ri->ISXTRANSGREEN (i, j)) {
+                            double d = image[i * width + j][1];
+                            if (d <= clipval) {
+                                pixSum[1] += d;
+                                n[1]++;
+                            }
+                        } else if (ri->ISXTRANSRED (i, j)) {
+                            double d = image[i * width + j][0];
+                            if (d <= clipval) {
+                                pixSum[0] += d;
+                                n[0]++;
+                            }
+                        } else if (ri->ISXTRANSBLUE (i, j)) {
+                            double d = image[i * width + j][2];
+                            if (d <= clipval) {
+                                pixSum[2] += d;
+                                n[2]++;
+                            }
                         }
-                    } else if (ri->ISXTRANSRED (i, j)) {
-                        double d = image[i * width + j][0];
-                        if (d <= clipval) {
-                            pixSum[0] += d;
+                    }
+                } else { /* if(ri->getSensorType()==ST_FOVEON) */
+                    for (int j = start; j < end; j++) {
+                        double r = image[i * width + j][0];
+                        if (r <= clipval) {
+                            pixSum[0] += r;
                             n[0]++;
                         }
-                    } else if (ri->ISXTRANSBLUE (i, j)) {
-                        double d = image[i * width + j][2];
-                        if (d <= clipval) {
-                            pixSum[2] += d;
+                        double g = image[i * width + j][1];
+                        if (g <= clipval) {
+                            pixSum[1] += g;
+                            n[1]++;
+                        }
+                        double b = image[i * width + j][2];
+                        if (b <= clipval) {
+                            pixSum[2] += b;
                             n[2]++;
                         }
                     }
                 }
-            } else { /* if(ri->getSensorType()==ST_FOVEON) */
-                for (int j = start; j < end; j++) {
-                    double r = image[i * width + j][0];
-                    if (r <= clipval) {
-                        pixSum[0] += r;
-                        n[0]++;
-                    }
-                    double g = image[i * width + j][1];
-                    if (g <= clipval) {
-                        pixSum[1] += g;
-                        n[1]++;
-                    }
-                    double b = image[i * width + j][2];
-                    if (b <= clipval) {
-                        pixSum[2] += b;
-                        n[2]++;
-                    }
-                }
             }
         }
 
@@ -1487,45 +1624,35 @@ unsigned char* Thumbnail::getGrayscaleHistEQ (int trim_width)
     return tmpdata;
 }
 
-bool Thumbnail::writeImage (const Glib::ustring& fname)
+bool Thumbnail::writeImage (std::string &buf)
 {
 
     if (!thumbImg) {
         return false;
     }
 
-    Glib::ustring fullFName = fname + ".rtti";
-
-    FILE* f = g_fopen (fullFName.c_str (), "wb");
-
-    if (!f) {
-        return false;
-    }
-
-    fwrite (thumbImg->getType(), sizeof (char), strlen (thumbImg->getType()), f);
-    fputc ('\n', f);
+    buf = thumbImg->getType();
+    buf.push_back('\n');
     guint32 w = guint32 (thumbImg->getWidth());
     guint32 h = guint32 (thumbImg->getHeight());
-    fwrite (&w, sizeof (guint32), 1, f);
-    fwrite (&h, sizeof (guint32), 1, f);
+    buf.append (reinterpret_cast<const char *>(&w), sizeof (guint32));
+    buf.append (reinterpret_cast<const char *>(&h), sizeof (guint32));
 
     if (thumbImg->getType() == sImage8) {
         Image8 *image = static_cast<Image8*> (thumbImg);
-        image->writeData (f);
+        image->writeData (buf);
     } else if (thumbImg->getType() == sImage16) {
         Image16 *image = static_cast<Image16*> (thumbImg);
-        image->writeData (f);
+        image->writeData (buf);
     } else if (thumbImg->getType() == sImagefloat) {
         Imagefloat *image = static_cast<Imagefloat*> (thumbImg);
-        image->writeData (f);
+        image->writeData (buf);
     }
 
-    //thumbImg->writeData(f);
-    fclose (f);
     return true;
 }
 
-bool Thumbnail::readImage (const Glib::ustring& fname)
+bool Thumbnail::readImage (const std::string &buf)
 {
 
     if (thumbImg) {
@@ -1533,59 +1660,51 @@ bool Thumbnail::readImage (const Glib::ustring& fname)
         thumbImg = nullptr;
     }
 
-    Glib::ustring fullFName = fname + ".rtti";
-
-    if (!Glib::file_test(fullFName, Glib::FILE_TEST_EXISTS)) {
-        return false;
-    }
-
-    FILE* f = g_fopen(fullFName.c_str (), "rb");
+    const size_t eol = buf.find('\n');
 
-    if (!f) {
+    // 30 -> arbitrary size, but should be enough for all image type's name
+    if (eol == std::string::npos || eol > 30 || buf.size() < eol + 1 + 2 * sizeof(guint32)) {
         return false;
     }
 
-    char imgType[31];  // 30 -> arbitrary size, but should be enough for all image type's name
-    fgets(imgType, 30, f);
-    imgType[strlen(imgType) - 1] = '\0'; // imgType has a \n trailing character, so we overwrite it by the \0 char
+    const std::string imgType = buf.substr(0, eol);
+    size_t pos = eol + 1;
 
     guint32 width, height;
+    memcpy(&width, buf.data() + pos, sizeof(guint32));
+    pos += sizeof(guint32);
+    memcpy(&height, buf.data() + pos, sizeof(guint32));
+    pos += sizeof(guint32);
 
-    if (fread(&width, 1, sizeof(guint32), f) < sizeof(guint32)) {
-        width = 0;
-    }
-
-    if (fread(&height, 1, sizeof(guint32), f) < sizeof(guint32)) {
-        height = 0;
-    }
+    const char *data = buf.data() + pos;
+    const size_t size = buf.size() - pos;
 
     bool success = false;
 
     if (std::min(width , height) > 0) {
-        if (!strcmp(imgType, sImage8)) {
+        if (imgType == sImage8) {
             Image8 *image = new Image8(width, height);
-            image->readData(f);
+            image->readData(data, size);
             thumbImg = image;
             success = true;
-        } else if (!strcmp(imgType, sImage16)) {
+        } else if (imgType == sImage16) {
             Image16 *image = new Image16(width, height);
-            image->readData(f);
+            image->readData(data, size);
             thumbImg = image;
             success = true;
-        } else if (!strcmp(imgType, sImagefloat)) {
+        } else if (imgType == sImagefloat) {
             Imagefloat *image = new Imagefloat(width, height);
-            image->readData(f);
+            image->readData(data, size);
             thumbImg = image;
             success = true;
         } else {
-            printf ("readImage: Unsupported image type \"%s\"!\n", imgType);
+            printf ("readImage: Unsupported image type \"%s\"!\n", imgType.c_str());
         }
     }
-    fclose(f);
     return success;
 }
 
-bool Thumbnail::readData  (const Glib::ustring& fname)
+bool Thumbnail::readData  (const std::string &buf)
 {
     setlocale (LC_NUMERIC, "C"); // to set decimal point to "."
     Glib::KeyFile keyFile;
@@ -1594,7 +1713,9 @@ bool Thumbnail::readData  (const Glib::ustring& fname)
         MyMutex::MyLock thmbLock (thumbMutex);
 
         try {
-            keyFile.load_from_file (fname);
+            if (buf.empty() || !keyFile.load_from_data (buf)) {
+                return false;
+            }
         } catch (Glib::Error&) {
             return false;
         }
@@ -1670,18 +1791,18 @@ bool Thumbnail::readData  (const Glib::ustring& fname)
         return true;
     } catch (Glib::Error &err) {
         if (options.rtSettings.verbose) {
-            printf ("Thumbnail::readData / Error code %d while reading values from \"%s\":\n%s\n", err.code(), fname.c_str(), err.what().c_str());
+            printf ("Thumbnail::readData / Error code %d while reading values:\n%s\n", err.code(), err.what().c_str());
         }
     } catch (...) {
         if (options.rtSettings.verbose) {
-            printf ("Thumbnail::readData / Unknown exception while trying to load \"%s\"!\n", fname.c_str());
+            printf ("Thumbnail::readData / Unknown exception while trying to load the data!\n");
         }
     }
 
     return false;
 }
 
-bool Thumbnail::writeData  (const Glib::ustring& fname)
+bool Thumbnail::writeData  (std::string &buf)
 {
     MyMutex::MyLock thmbLock (thumbMutex);
 
@@ -1692,7 +1813,9 @@ bool Thumbnail::writeData  (const Glib::ustring& fname)
         Glib::KeyFile keyFile;
 
         try {
-            keyFile.load_from_file (fname);
+            if (!buf.empty()) {
+                keyFile.load_from_data (buf);
+            }
         } catch (Glib::Error&) {}
 
         keyFile.set_double  ("LiveThumbData", "CamWBRed", camwbRed);
@@ -1716,11 +1839,11 @@ bool Thumbnail::writeData  (const Glib::ustring& fname)
 
     } catch (Glib::Error& err) {
         if (options.rtSettings.verbose) {
-            printf ("Thumbnail::writeData / Error code %d while reading values from \"%s\":\n%s\n", err.code(), fname.c_str(), err.what().c_str());
+            printf ("Thumbnail::writeData / Error code %d while reading values:\n%s\n", err.code(), err.what().c_str());
         }
     } catch (...) {
         if (options.rtSettings.verbose) {
-            printf ("Thumbnail::writeData / Unknown exception while trying to save \"%s\"!\n", fname.c_str());
+            printf ("Thumbnail::writeData / Unknown exception while trying to save the data!\n");
         }
     }
 
@@ -1728,64 +1851,33 @@ bool Thumbnail::writeData  (const Glib::ustring& fname)
         return false;
     }
 
-    FILE *f = g_fopen (fname.c_str (), "wt");
-
-    if (!f) {
-        if (options.rtSettings.verbose) {
-            printf ("Thumbnail::writeData / Error: unable to open file \"%s\" with write access!\n", fname.c_str());
-        }
-
-        return false;
-    } else {
-        fprintf (f, "%s", keyData.c_str ());
-        fclose (f);
-    }
-
+    buf = keyData;
     return true;
 }
 
-bool Thumbnail::readEmbProfile  (const Glib::ustring& fname)
+bool Thumbnail::readEmbProfile  (const std::string &buf)
 {
 
     embProfileData = nullptr;
     embProfile = nullptr;
     embProfileLength = 0;
 
-    FILE* f = g_fopen (fname.c_str (), "rb");
-
-    if (f) {
-        if (!fseek (f, 0, SEEK_END)) {
-            int profileLength = ftell (f);
-
-            if (profileLength > 0) {
-                embProfileLength = profileLength;
-
-                if (!fseek (f, 0, SEEK_SET)) {
-                    embProfileData = new unsigned char[embProfileLength];
-                    embProfileLength = fread (embProfileData, 1, embProfileLength, f);
-                    embProfile = cmsOpenProfileFromMem (embProfileData, embProfileLength);
-                }
-            }
-        }
-
-        fclose (f);
-        return embProfile != nullptr;
+    if (!buf.empty()) {
+        embProfileLength = buf.size();
+        embProfileData = new unsigned char[embProfileLength];
+        memcpy (embProfileData, buf.data(), embProfileLength);
+        embProfile = cmsOpenProfileFromMem (embProfileData, embProfileLength);
     }
 
-    return false;
+    return embProfile != nullptr;
 }
 
-bool Thumbnail::writeEmbProfile (const Glib::ustring& fname)
+bool Thumbnail::writeEmbProfile (std::string &buf)
 {
 
     if (embProfileData) {
-        FILE* f = g_fopen (fname.c_str (), "wb");
-
-        if (f) {
-            fwrite (embProfileData, 1, embProfileLength, f);
-            fclose (f);
-            return true;
-        }
+        buf.assign (reinterpret_cast<const char *>(embProfileData), embProfileLength);
+        return true;
     }
 
     return false;
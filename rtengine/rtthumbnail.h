@@ -90,14 +90,16 @@ public:
     void getSpotWB(const procparams::ProcParams& params, int x, int y, int rect, ColorTemp &out);
 
     unsigned char* getGrayscaleHistEQ (int trim_width);
-    bool writeImage (const Glib::ustring& fname);
-    bool readImage (const Glib::ustring& fname);
+    // (de)serialization of the cached data, from/to memory buffers.
+    // writeData updates the LiveThumbData section of the key file in buf
+    bool writeImage (std::string &buf);
+    bool readImage (const std::string &buf);
 
-    bool readData  (const Glib::ustring& fname);
-    bool writeData  (const Glib::ustring& fname);
+    bool readData  (const std::string &buf);
+    bool writeData  (std::string &buf);
 
-    bool readEmbProfile  (const Glib::ustring& fname);
-    bool writeEmbProfile (const Glib::ustring& fname);
+    bool readEmbProfile  (const std::string &buf);
+    bool writeEmbProfile (std::string &buf);
 
     unsigned char* getImage8Data();  // accessor to the 8bit image if it is one, which should be the case for the "Inspector" mode.
 
@@ -78,6 +78,12 @@ public:
 
     bool ctl_scripts_fast_preview;
 
+    int pipeline_cache_size; ///< memory (in MB) for the outputs of the expensive steps of the editor's pipelines; 0 disables it
+    int mask_cache_size; ///< memory (in MB) for the masks of the editor's pipelines; 0 disables it
+    int preview_pyramid_cache_size; ///< memory (in MB) for the multi-resolution copies of the source image kept by the editor; 0 disables it
+    int demosaic_cache_size; ///< disk space (in MB) for the preprocessed and demosaiced raw data of the images opened in the editor; 0 disables it
+    int output_strip_height; ///< if > 0, the per-pixel steps of the output pipeline run on strips of this many rows instead of on the full frame
+
     enum class StdMonitorProfile {
         SRGB,
         DISPLAY_P3,
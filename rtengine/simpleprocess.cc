@@ -32,6 +32,9 @@
 #include "rescale.h"
 #include "metadata.h"
 #include "threadpool.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #undef THREAD_PRIORITY_NORMAL
 
@@ -417,13 +420,17 @@ private:
             ipf.prsharpening(img);
         }
 
-        Imagefloat *readyImg = ipf.rgb2out(img, params.icm);
+        // img is not needed anymore, so the conversion to the output space
+        // is done in place to avoid allocating another full-size buffer
+        Imagefloat *readyImg = ipf.rgb2out(img, params.icm, true);
 
         if (settings->verbose) {
             printf ("Output profile_: \"%s\"\n", params.icm.outputProfile.c_str());
         }
 
-        delete img;
+        if (readyImg != img) {
+            delete img;
+        }
         img = nullptr;
 
         if (pl) {
@@ -583,8 +590,15 @@ IImagefloat* processImage (ProcessingJob* pjob, int& errorCode, ProgressListener
     return proc();
 }
 
-void batchProcessingThread (ProcessingJob* job, BatchProcessingListener* bpl)
+void batchProcessingThread (ProcessingJob* job, BatchProcessingListener* bpl, int num_threads)
 {
+#ifdef _OPENMP
+    // this runs on a thread of the pool, restore its setting when done
+    const int prev_num_threads = omp_get_max_threads();
+    if (num_threads > 0) {
+        omp_set_num_threads(num_threads);
+    }
+#endif
 
     ProcessingJob* currentJob = job;
 
@@ -599,23 +613,29 @@ void batchProcessingThread (ProcessingJob* job, BatchProcessingListener* bpl)
 
         if (errorCode) {
             bpl->error (M ("MAIN_MSG_CANNOTLOAD"));
+            bpl->jobFailed();
             currentJob = nullptr;
         } else {
             try {
                 currentJob = bpl->imageReady (img);
             } catch (Glib::Exception& ex) {
                 bpl->error (ex.what());
+                bpl->jobFailed();
                 currentJob = nullptr;
             }
         }
     }
+
+#ifdef _OPENMP
+    omp_set_num_threads(prev_num_threads);
+#endif
 }
 
 
-void startBatchProcessing(ProcessingJob *job, BatchProcessingListener *bpl)
+void startBatchProcessing(ProcessingJob *job, BatchProcessingListener *bpl, int num_threads)
 {
     if (bpl) {
-        ThreadPool::add_task(ThreadPool::Priority::NORMAL, sigc::bind(sigc::ptr_fun(batchProcessingThread), job, bpl));
+        ThreadPool::add_task(ThreadPool::Priority::NORMAL, sigc::bind(sigc::ptr_fun(batchProcessingThread), job, bpl, num_threads));
     }
 
 }
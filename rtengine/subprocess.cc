@@ -25,6 +25,7 @@
 #include <giomm.h>
 
 #include <set>
+#include <algorithm>
 
 #ifdef WIN32
 #  include <windows.h>
@@ -34,6 +35,7 @@
 #  include <sys/types.h>
 #  include <sys/wait.h>
 #  include <signal.h>
+#  include <errno.h>
 #endif
 
 #include "subprocess.h"
@@ -343,10 +345,33 @@ int SubprocessInfo::read()
 }
 
 
+size_t SubprocessInfo::read(char *buf, size_t n)
+{
+    size_t done = 0;
+    while (done < n) {
+        DWORD r = 0;
+        DWORD chunk = DWORD(std::min(n - done, size_t(1) << 30));
+        if (!ReadFile(D(impl_)->child_out, buf + done, chunk, &r, nullptr) || r == 0) {
+            break;
+        }
+        done += r;
+    }
+    return done;
+}
+
+
 bool SubprocessInfo::write(const char *msg, size_t n)
 {
-    DWORD w = 0;
-    return WriteFile(D(impl_)->child_in, msg, n, &w, nullptr);
+    while (n > 0) {
+        DWORD w = 0;
+        DWORD chunk = DWORD(std::min(n, size_t(1) << 30));
+        if (!WriteFile(D(impl_)->child_in, msg, chunk, &w, nullptr)) {
+            return false;
+        }
+        msg += w;
+        n -= w;
+    }
+    return true;
 }
 
 
@@ -362,7 +387,7 @@ int SubprocessInfo::id() const
 }
 
 
-std::unique_ptr<SubprocessInfo> popen(const Glib::ustring &workdir, const std::vector<Glib::ustring> &argv, bool search_in_path, bool pipe_in, bool pipe_out)
+std::unique_ptr<SubprocessInfo> popen(const Glib::ustring &workdir, const std::vector<Glib::ustring> &argv, bool search_in_path, bool pipe_in, bool pipe_out, bool merge_stderr)
 {
     std::unique_ptr<SubprocessData> data(new SubprocessData());
     
@@ -410,7 +435,7 @@ std::unique_ptr<SubprocessInfo> popen(const Glib::ustring &workdir, const std::v
     }
     if (pipe_out) {
         si.hStdOutput = fds_from[1];
-        si.hStdError = fds_from[1];
+        si.hStdError = merge_stderr ? fds_from[1] : GetStdHandle(STD_ERROR_HANDLE);
     } else {
         si.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
         si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
@@ -582,9 +607,35 @@ int SubprocessInfo::read()
 }
 
 
+size_t SubprocessInfo::read(char *buf, size_t n)
+{
+    size_t done = 0;
+    while (done < n) {
+        auto r = ::read(D(impl_)->child_out, buf + done, n - done);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        } else if (r <= 0) {
+            break;
+        }
+        done += r;
+    }
+    return done;
+}
+
+
 bool SubprocessInfo::write(const char *msg, size_t n)
 {
-    return ::write(D(impl_)->child_in, msg, n) >= 0;
+    while (n > 0) {
+        auto w = ::write(D(impl_)->child_in, msg, n);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        } else if (w < 0) {
+            return false;
+        }
+        msg += w;
+        n -= w;
+    }
+    return true;
 }
 
 
@@ -595,7 +646,7 @@ bool SubprocessInfo::flush()
 }
 
 
-std::unique_ptr<SubprocessInfo> popen(const Glib::ustring &workdir, const std::vector<Glib::ustring> &argv, bool search_in_path, bool pipe_in, bool pipe_out)
+std::unique_ptr<SubprocessInfo> popen(const Glib::ustring &workdir, const std::vector<Glib::ustring> &argv, bool search_in_path, bool pipe_in, bool pipe_out, bool merge_stderr)
 {
     int fds_to[2];
     int fds_from[2];
@@ -656,7 +707,9 @@ std::unique_ptr<SubprocessInfo> popen(const Glib::ustring &workdir, const std::v
             close(fds_from[0]);
             data->toclose.erase(fds_from[0]);
             dup2(fds_from[1], 1);
-            dup2(fds_from[1], 2);
+            if (merge_stderr) {
+                dup2(fds_from[1], 2);
+            }
         }
 
         if (!workdir.empty()) {
@@ -684,7 +737,9 @@ std::unique_ptr<SubprocessInfo> popen(const Glib::ustring &workdir, const std::v
         }
         if (pipe_out) {
             close(1);
-            close(2);
+            if (merge_stderr) {
+                close(2);
+            }
         }
         return res;
     }
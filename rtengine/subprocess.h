@@ -73,6 +73,7 @@ public:
     ~SubprocessInfo();
     
     int read();
+    size_t read(char *buf, size_t n);
     bool write(const char *s, size_t n);
     bool flush();
 
@@ -86,6 +87,6 @@ private:
     uintptr_t impl_;
 };
 
-std::unique_ptr<SubprocessInfo> popen(const Glib::ustring &workdir, const std::vector<Glib::ustring> &argv, bool search_in_path, bool pipe_in, bool pipe_out);
+std::unique_ptr<SubprocessInfo> popen(const Glib::ustring &workdir, const std::vector<Glib::ustring> &argv, bool search_in_path, bool pipe_in, bool pipe_out, bool merge_stderr=true);
 
 }} // namespace rtengine::subprocess
@@ -75,6 +75,7 @@
 #include "rt_algo.h"
 #include "rescale.h"
 #include "ipdenoise.h"
+#include "fftplancache.h"
 
 namespace rtengine
 {
@@ -84,7 +85,6 @@ namespace rtengine
  ******************************************************************************/
 
 extern const Settings *settings;
-extern MyMutex *fftwMutex;
 
 namespace
 {
@@ -645,10 +645,7 @@ void tmo_fattal02 (size_t width,
     //delete Gx; // RT - reused as temp buffer in solve_pde_fft, deleted later
 
     // solve pde and exponentiate (ie recover compressed image)
-    {
-        MyMutex::MyLock lock (*fftwMutex);
-        solve_pde_fft (FI, &L, Gx, multithread);
-    }
+    solve_pde_fft (FI, &L, Gx, multithread);
     delete Gx;
     delete FI;
 
@@ -726,6 +723,17 @@ void tmo_fattal02 (size_t width,
 // for both solvers.
 
 
+// number of threads for the fft routines
+int fft_threads(bool multithread)
+{
+#if defined RT_FFTW3F_OMP && defined _OPENMP
+    return multithread ? omp_get_num_procs() : 1;
+#else
+    return 1;
+#endif
+}
+
+
 // returns T = EVy A EVx^tr
 // note, modifies input data
 void transform_ev2normal (Array2Df *A, Array2Df *T, bool multithread)
@@ -765,11 +773,8 @@ void transform_ev2normal (Array2Df *A, Array2Df *T, bool multithread)
     // fftwf_free(in);
 
     // executes 2d discrete cosine transform
-    fftwf_plan p;
-    p = fftwf_plan_r2r_2d (height, width, A->data(), T->data(),
-                           FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
-    fftwf_execute (p);
-    fftwf_destroy_plan (p);
+    const auto p = FFTPlanCache::getInstance()->r2r_2d(height, width, 1, FFTW_REDFT00, FFTW_REDFT00, A->data(), T->data(), FFTW_ESTIMATE, fft_threads(multithread));
+    fftwf_execute_r2r(p.get(), A->data(), T->data());
 }
 
 
@@ -781,11 +786,8 @@ void transform_normal2ev (Array2Df *A, Array2Df *T, bool multithread)
     assert ((int)T->getCols() == width && (int)T->getRows() == height);
 
     // executes 2d discrete cosine transform
-    fftwf_plan p;
-    p = fftwf_plan_r2r_2d (height, width, A->data(), T->data(),
-                           FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
-    fftwf_execute (p);
-    fftwf_destroy_plan (p);
+    const auto p = FFTPlanCache::getInstance()->r2r_2d(height, width, 1, FFTW_REDFT00, FFTW_REDFT00, A->data(), T->data(), FFTW_ESTIMATE, fft_threads(multithread));
+    fftwf_execute_r2r(p.get(), A->data(), T->data());
 
     // need to scale the output matrix to get the right transform
     float factor = (1.0f / ((height - 1) * (width - 1)));
@@ -876,18 +878,6 @@ void solve_pde_fft (Array2Df *F, Array2Df *U, Array2Df *buf, bool multithread)/*
     assert ((int)U->getCols() == width && (int)U->getRows() == height);
     assert (buf->getCols() == width && buf->getRows() == height);
 
-    // activate parallel execution of fft routines
-#ifdef RT_FFTW3F_OMP
-
-    if (multithread) {
-        fftwf_init_threads();
-        fftwf_plan_with_nthreads(omp_get_num_procs());
-    }
-
-// #else
-//   fftwf_plan_with_nthreads( 2 );
-#endif
-
     // in general there might not be a solution to the Poisson pde
     // with Neumann boundary conditions unless the boundary satisfies
     // an integral condition, this function modifies the boundary so that
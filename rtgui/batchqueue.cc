@@ -37,11 +37,14 @@
 #include "rtimage.h"
 #include <sys/time.h>
 #include "../rtengine/imgiomanager.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace rtengine;
 
 BatchQueue::BatchQueue (FileCatalog* aFileCatalog):
-    processing(nullptr),
+    mem_in_use_(0),
     fileCatalog(aFileCatalog),
     sequence(0),
     listener(nullptr),
@@ -637,52 +640,176 @@ void BatchQueue::openItemInEditor(ThumbBrowserEntryBase* item)
 }
 
 
-void BatchQueue::startProcessing ()
+bool BatchQueue::isProcessing() const
 {
+    for (auto &w : workers_) {
+        if (w->entry) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+size_t BatchQueue::estimateMemoryUsage(BatchQueueEntry* entry)
+{
+    int w = 0, h = 0;
+    if (entry->thumbnail) {
+        entry->thumbnail->getOriginalSize(w, h);
+    }
+    // working image, transformed image, a temporary copy made by some of the
+    // tools and the output image, all full-size with 3 float channels
+    constexpr size_t num_buffers = 4;
+    return size_t(std::max(w, 0)) * size_t(std::max(h, 0)) * 3 * sizeof(float) * num_buffers;
+}
 
-    if (!processing) {
-        MYWRITERLOCK(l, entryRW);
 
-        if (!fd.empty()) {
-            BatchQueueEntry* next;
+// Number of OpenMP threads given to each job, so that the jobs currently
+// running share the cores instead of oversubscribing them (as the -P option
+// of the CLI does). 0 means that the default is used. Must be called with
+// entryRW held.
+int BatchQueue::getThreadsPerJob() const
+{
+#ifdef _OPENMP
+    int running = 0;
+    for (auto &w : workers_) {
+        if (w->entry) {
+            ++running;
+        }
+    }
+    if (running > 1) {
+        return std::max(omp_get_num_procs() / running, 1);
+    }
+#endif
+    return 0;
+}
 
-            next = static_cast<BatchQueueEntry*>(fd[0]);
-            // tag it as processing and set sequence
-            next->processing = true;
-            next->sequence = sequence = 1;
-            processing = next;
 
-            // remove from selection
-            if (processing->selected) {
-                std::vector<ThumbBrowserEntryBase*>::iterator pos = std::find (selected.begin(), selected.end(), processing);
+// Assigns the next entries of the queue to idle workers, as long as the
+// estimated memory usage stays within options.batch_queue_memory_limit (at
+// least one job is always admitted). Entries whose processing failed are
+// skipped. If first is not null, it is the first worker to be considered. Must be called with entryRW held in write mode.
+// Returns the workers that got a new entry.
+std::vector<BatchQueue::Worker*> BatchQueue::admitJobs(Worker* first)
+{
+    std::vector<Worker*> ret;
 
-                if (pos != selected.end()) {
-                    selected.erase (pos);
+    size_t max_jobs = 1;
+    size_t limit = 0;
+    if (options.batch_queue_memory_limit > 0) {
+        max_jobs = std::max(options.batch_queue_max_jobs, 1);
+        limit = size_t(options.batch_queue_memory_limit) << 20;
+    }
+
+    size_t running = 0;
+    for (auto &w : workers_) {
+        if (w->entry) {
+            ++running;
+        }
+    }
+
+    const auto owned =
+        [this](const ThumbBrowserEntryBase* e) -> bool
+        {
+            for (auto &w : workers_) {
+                if (w->entry == e) {
+                    return true;
                 }
+            }
+            return false;
+        };
 
-                processing->selected = false;
+    while (running < max_jobs) {
+        const auto pos = std::find_if(fd.begin(), fd.end(), [&](const ThumbBrowserEntryBase* fdEntry) { return !fdEntry->processing && !static_cast<const BatchQueueEntry*>(fdEntry)->failed && !owned(fdEntry); });
+        if (pos == fd.end()) {
+            break;
+        }
+
+        BatchQueueEntry* next = static_cast<BatchQueueEntry*>(*pos);
+        const size_t mem = estimateMemoryUsage(next);
+        if (running > 0 && mem_in_use_ + mem > limit) {
+            break;
+        }
+
+        Worker* worker = nullptr;
+        if (first && !first->entry) {
+            worker = first;
+        } else {
+            for (auto &w : workers_) {
+                if (!w->entry) {
+                    worker = w.get();
+                    break;
+                }
             }
+            if (!worker) {
+                workers_.emplace_back(new Worker(this));
+                worker = workers_.back().get();
+            }
+        }
 
-            MYWRITERLOCK_RELEASE(l);
+        // tag it as processing and set sequence
+        next->processing = true;
+        next->sequence = ++sequence;
+        worker->entry = next;
+        worker->mem_usage = mem;
+        mem_in_use_ += mem;
+        ++running;
 
-            // remove button set
-            next->removeButtonSet ();
+        // remove from selection
+        if (next->selected) {
+            std::vector<ThumbBrowserEntryBase*>::iterator sel = std::find (selected.begin(), selected.end(), next);
 
-            // start batch processing
-            rtengine::startBatchProcessing (next->job, this);
-            queue_draw ();
+            if (sel != selected.end()) {
+                selected.erase (sel);
+            }
 
-            notifyListener();
+            next->selected = false;
         }
+
+        ret.push_back(worker);
     }
+
+    return ret;
 }
 
-void BatchQueue::setProgress(double p)
+
+void BatchQueue::startProcessing ()
 {
-    if (processing) {
-        processing->progress = p;
+    std::vector<Worker*> started;
+    int num_threads = 0;
+
+    {
+        MYWRITERLOCK(l, entryRW);
+
+        if (!isProcessing()) {
+            sequence = 0;
+        }
+
+        // give the entries that failed another chance
+        for (auto entry : fd) {
+            static_cast<BatchQueueEntry*>(entry)->failed = false;
+        }
+
+        started = admitJobs(nullptr);
+        num_threads = getThreadsPerJob();
+    }
+
+    if (!started.empty()) {
+        for (auto w : started) {
+            // remove button set
+            w->entry->removeButtonSet ();
+
+            // start batch processing
+            rtengine::startBatchProcessing (w->entry->job, w, num_threads);
+        }
+        queue_draw ();
+
+        notifyListener();
     }
+}
 
+void BatchQueue::setProgress(double p)
+{
     // No need to acquire the GUI, setProgressUI will do it
     idle_register.add(
         [this]() -> bool
@@ -693,6 +820,15 @@ void BatchQueue::setProgress(double p)
     );
 }
 
+void BatchQueue::setProgress(Worker* worker, double p)
+{
+    if (worker->entry) {
+        worker->entry->progress = p;
+    }
+
+    setProgress(p);
+}
+
 void BatchQueue::setProgressStr(const Glib::ustring& str)
 {
 }
@@ -703,24 +839,14 @@ void BatchQueue::setProgressState(bool inProcessing)
 
 void BatchQueue::error(const Glib::ustring& descr)
 {
-    if (processing && processing->processing) {
-        // restore failed thumb
-        BatchQueueButtonSet* bqbs = new BatchQueueButtonSet (processing);
-        bqbs->setButtonListener (this);
-        processing->addButtonSet (bqbs);
-        processing->processing = false;
-        processing->job = rtengine::ProcessingJob::create(processing->filename, processing->thumbnail->getType() == FT_Raw, processing->params);
-        processing = nullptr;
-        redraw ();
-    }
-
     if (listener) {
         BatchQueueListener* const bql = listener;
-        const bool running = processing;
         int qsize = 0;
+        bool running = false;
         {
             MYREADERLOCK(l, entryRW);
             qsize = fd.size();
+            running = isProcessing();
         }        
 
         idle_register.add(
@@ -733,6 +859,96 @@ void BatchQueue::error(const Glib::ustring& descr)
     }
 }
 
+void BatchQueue::error(Worker* worker, const Glib::ustring& descr)
+{
+    // this is also used for non-fatal warnings: the worker is released by
+    // jobFailed() when the job is actually over
+    error(descr);
+}
+
+
+void BatchQueue::jobFailed(Worker* worker)
+{
+    BatchQueueEntry* processing = worker->entry;
+
+    if (processing) {
+        // restore failed thumb
+        BatchQueueButtonSet* bqbs = new BatchQueueButtonSet (processing);
+        bqbs->setButtonListener (this);
+        processing->addButtonSet (bqbs);
+        processing->processing = false;
+        processing->job = rtengine::ProcessingJob::create(processing->filename, processing->thumbnail->getType() == FT_Raw, processing->params);
+    }
+
+    std::vector<Worker*> started;
+    int num_threads = 0;
+
+    {
+        MYWRITERLOCK(l, entryRW);
+
+        // keep the entry in the queue, but do not admit it again until the
+        // processing is restarted
+        if (processing) {
+            processing->failed = true;
+        }
+
+        worker->entry = nullptr;
+        mem_in_use_ -= worker->mem_usage;
+        worker->mem_usage = 0;
+
+        // move on to the next entries
+        if (!fd.empty() && listener && listener->canStartNext ()) {
+            started = admitJobs(worker);
+            num_threads = getThreadsPerJob();
+        }
+    }
+
+    if (!started.empty()) {
+        GThreadLock lock;
+        for (auto w : started) {
+            w->entry->removeButtonSet ();
+        }
+    }
+
+    // the thread of worker is over, so its next job is started as well
+    for (auto w : started) {
+        rtengine::startBatchProcessing (w->entry->job, w, num_threads);
+    }
+
+    redraw ();
+    notifyListener ();
+}
+
+
+void BatchQueue::Worker::setProgress(double p)
+{
+    parent_->setProgress(this, p);
+}
+
+
+void BatchQueue::Worker::error(const Glib::ustring& descr)
+{
+    parent_->error(this, descr);
+}
+
+
+void BatchQueue::Worker::jobFailed()
+{
+    parent_->jobFailed(this);
+}
+
+
+rtengine::ProcessingJob* BatchQueue::Worker::imageReady(rtengine::IImagefloat* img)
+{
+    return parent_->imageReady(this, img);
+}
+
+
+const rtengine::procparams::PartialProfile *BatchQueue::Worker::getBatchProfile()
+{
+    return parent_->getBatchProfile();
+}
+
 
 namespace {
 
@@ -907,8 +1123,10 @@ Glib::ustring calcAutoFileNameBase(const Glib::ustring& origFileName, rtengine::
 } // namespace
 
 
-rtengine::ProcessingJob* BatchQueue::imageReady(rtengine::IImagefloat* img)
+rtengine::ProcessingJob* BatchQueue::imageReady(Worker* worker, rtengine::IImagefloat* img)
 {
+    BatchQueueEntry* processing = worker->entry;
+
     // save image img
     Glib::ustring fname;
     SaveFormat saveFormat;
@@ -936,7 +1154,7 @@ rtengine::ProcessingJob* BatchQueue::imageReady(rtengine::IImagefloat* img)
         int err = 0;
         processing->processing = false;
 
-        img->setSaveProgressListener(this);
+        img->setSaveProgressListener(worker);
 
         if (saveFormat.format == "tif") {
             err = img->saveAsTIFF (fname, saveFormat.tiffBits, saveFormat.tiffFloat, saveFormat.tiffUncompressed);
@@ -949,6 +1167,7 @@ rtengine::ProcessingJob* BatchQueue::imageReady(rtengine::IImagefloat* img)
         }
 
         img->free ();
+        releaseFileName(fname);
 
         if (err) {
             throw Glib::FileError(Glib::FileError::FAILED, M("MAIN_MSG_CANNOTSAVE") + ": " + fname);
@@ -974,50 +1193,51 @@ rtengine::ProcessingJob* BatchQueue::imageReady(rtengine::IImagefloat* img)
             processing->thumbnail->imageDeveloped ();
             processing->thumbnail->imageRemovedFromQueue ();
         }
+    } else {
+        releaseFileName(fname);
     }
 
     // save temporary params file name: delete as last thing
     Glib::ustring processedParams = processing->savedParamsFile;
 
     // delete from the queue
-    bool remove_button_set = false;
+    std::vector<Worker*> started;
+    int num_threads = 0;
 
     {
         MYWRITERLOCK(l, entryRW);
 
+        const auto pos = std::find (fd.begin (), fd.end (), processing);
+        if (pos != fd.end ()) {
+            fd.erase (pos);
+        }
         delete processing;
-        processing = nullptr;
 
-        fd.erase (fd.begin());
+        worker->entry = nullptr;
+        mem_in_use_ -= worker->mem_usage;
+        worker->mem_usage = 0;
 
-        // return next job
+        // get the next job for this worker, and possibly start other ones
+        // if memory allows
         if (!fd.empty() && listener && listener->canStartNext ()) {
-            BatchQueueEntry* next = static_cast<BatchQueueEntry*>(fd[0]);
-            // tag it as selected and set sequence
-            next->processing = true;
-            next->sequence = ++sequence;
-            processing = next;
-
-            // remove from selection
-            if (processing->selected) {
-                std::vector<ThumbBrowserEntryBase*>::iterator pos = std::find (selected.begin(), selected.end(), processing);
-
-                if (pos != selected.end()) {
-                    selected.erase (pos);
-                }
-
-                processing->selected = false;
-            }
-
-            // remove button set
-            remove_button_set = true;
+            started = admitJobs(worker);
+            num_threads = getThreadsPerJob();
         }
     }
 
-    if (remove_button_set) {
+    if (!started.empty()) {
         // ButtonSet have Cairo::Surface which might be rendered while we're trying to delete them
         GThreadLock lock;
-        processing->removeButtonSet ();
+        for (auto w : started) {
+            w->entry->removeButtonSet ();
+        }
+    }
+
+    // all the jobs, including the next one of this worker, are started
+    // afresh, so that they get a share of the cores matching the number of
+    // jobs now running
+    for (auto w : started) {
+        rtengine::startBatchProcessing (w->entry->job, w, num_threads);
     }
 
     if (saveBatchQueue ()) {
@@ -1051,7 +1271,7 @@ rtengine::ProcessingJob* BatchQueue::imageReady(rtengine::IImagefloat* img)
     redraw ();
     notifyListener ();
 
-    return processing ? processing->job : nullptr;
+    return nullptr;
 }
 
 
@@ -1074,6 +1294,10 @@ Glib::ustring BatchQueue::autoCompleteFileName (const Glib::ustring& fileName, c
         return Glib::ustring ();
     }
 
+    // several jobs can be saving at the same time, so names that have been
+    // handed out but whose files are not yet written are taken as well
+    MyMutex::MyLock lock(mutex_output_names_);
+
     // In overwrite mode we TRY to delete the old file first.
     // if that's not possible (e.g. locked by viewer, R/O), we revert to the standard naming scheme
     bool inOverwriteMode = options.overwriteOutputFile;
@@ -1085,6 +1309,10 @@ Glib::ustring BatchQueue::autoCompleteFileName (const Glib::ustring& fileName, c
             fname = Glib::ustring::compose ("%1-%2.%3", Glib::build_filename (dstdir,  dstfname), tries, ext);
         }
 
+        if (output_names_.count(fname)) {
+            continue;
+        }
+
         int fileExists = Glib::file_test (fname, Glib::FILE_TEST_EXISTS);
 
         if (inOverwriteMode && fileExists) {
@@ -1096,6 +1324,7 @@ Glib::ustring BatchQueue::autoCompleteFileName (const Glib::ustring& fileName, c
         }
 
         if (!fileExists) {
+            output_names_.insert(fname);
             return fname;
         }
     }
@@ -1103,6 +1332,13 @@ Glib::ustring BatchQueue::autoCompleteFileName (const Glib::ustring& fileName, c
     return "";
 }
 
+
+void BatchQueue::releaseFileName(const Glib::ustring& fname)
+{
+    MyMutex::MyLock lock(mutex_output_names_);
+    output_names_.erase(fname);
+}
+
 void BatchQueue::buttonPressed (LWButton* button, int actionCode, void* actionData)
 {
     const std::vector<ThumbBrowserEntryBase*> bqe = {static_cast<BatchQueueEntry*>(actionData)};
@@ -1118,14 +1354,15 @@ void BatchQueue::buttonPressed (LWButton* button, int actionCode, void* actionDa
 
 void BatchQueue::notifyListener ()
 {
-    const bool queueRunning = processing;
     if (listener) {
         BatchQueueListener* const bql = listener;
 
         int qsize = 0;
+        bool queueRunning = false;
         {
             MYREADERLOCK(l, entryRW);
             qsize = fd.size();
+            queueRunning = isProcessing();
         }
 
         idle_register.add(
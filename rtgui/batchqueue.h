@@ -20,6 +20,7 @@
 #define _BATCHQUEUE_
 
 #include <set>
+#include <memory>
 
 #include <gtkmm.h>
 
@@ -44,7 +45,7 @@ class FileCatalog;
 
 class BatchQueue final :
     public ThumbBrowserBase,
-    public rtengine::BatchProcessingListener,
+    public rtengine::ProgressListener,
     public LWButtonListener
 {
 public:
@@ -72,7 +73,6 @@ public:
     void setProgressStr(const Glib::ustring& str) override;
     void setProgressState(bool inProcessing) override;
     void error(const Glib::ustring& descr) override;
-    rtengine::ProcessingJob* imageReady(rtengine::IImagefloat* img) override;
 
     void rightClicked (ThumbBrowserEntryBase* entry) override;
     void doubleClicked (ThumbBrowserEntryBase* entry) override;
@@ -91,22 +91,56 @@ public:
     static int calcMaxThumbnailHeight();
 
     void setBatchProfile(const rtengine::procparams::PartialProfile *bp);
-    const rtengine::procparams::PartialProfile *getBatchProfile() override;
+    const rtengine::procparams::PartialProfile *getBatchProfile();
 
 private:
+    // Each worker runs one batch processing thread, and acts as the listener
+    // of the entry it is processing. Several workers can be active at the
+    // same time, subject to the memory limit set in the options
+    class Worker: public rtengine::BatchProcessingListener {
+    public:
+        explicit Worker(BatchQueue *parent): entry(nullptr), mem_usage(0), parent_(parent) {}
+
+        void setProgress(double p) override;
+        void setProgressStr(const Glib::ustring& str) override {}
+        void setProgressState(bool inProcessing) override {}
+        void error(const Glib::ustring& descr) override;
+        void jobFailed() override;
+        rtengine::ProcessingJob* imageReady(rtengine::IImagefloat* img) override;
+        const rtengine::procparams::PartialProfile *getBatchProfile() override;
+
+        BatchQueueEntry* entry; // the image currently processed by this worker
+        size_t mem_usage;       // estimated memory reserved for entry
+
+    private:
+        BatchQueue *parent_;
+    };
+
+    void setProgress(Worker* worker, double p);
+    void error(Worker* worker, const Glib::ustring& descr);
+    void jobFailed(Worker* worker);
+    rtengine::ProcessingJob* imageReady(Worker* worker, rtengine::IImagefloat* img);
+
+    bool isProcessing() const;
+    std::vector<Worker*> admitJobs(Worker* first);
+    static size_t estimateMemoryUsage(BatchQueueEntry* entry);
+    int getThreadsPerJob() const;
+
     void cancelItems_(const std::vector<ThumbBrowserEntryBase*>& items) { cancelItems(items, false); }
     int getMaxThumbnailHeight() const override;
     void saveThumbnailHeight (int height) override;
     int  getThumbnailHeight () override;
 
     Glib::ustring autoCompleteFileName (const Glib::ustring& fileName, const Glib::ustring& format);
+    void releaseFileName(const Glib::ustring& fname);
     Glib::ustring getTempFilenameForParams( const Glib::ustring &filename );
     bool saveBatchQueue ();
     void notifyListener ();
 
     using ThumbBrowserBase::redrawEntryNeeded;
 
-    BatchQueueEntry* processing;  // holds the currently processed image
+    std::vector<std::unique_ptr<Worker>> workers_; // protected by entryRW
+    size_t mem_in_use_; // sum of the mem_usage of the active workers
     FileCatalog* fileCatalog;
     int sequence; // holds the current sequence index
 
@@ -122,6 +156,9 @@ private:
 
     BatchQueueListener* listener;
 
+    std::set<Glib::ustring> output_names_; // output files being written
+    MyMutex mutex_output_names_;
+
     std::set<BatchQueueEntry*> removable_batch_queue_entries;
     MyMutex mutex_removable_batch_queue_entries;
 
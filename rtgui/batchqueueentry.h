@@ -56,6 +56,7 @@ public:
     bool forceFormatOpts;
     bool fast_pipeline;
     bool use_batch_profile;
+    bool failed; // processing failed, skipped until the queue is restarted
 
     BatchQueueEntry (rtengine::ProcessingJob* job, const rtengine::procparams::ProcParams& pparams, Glib::ustring fname, int prevw, int prevh, Thumbnail* thm = nullptr);
     ~BatchQueueEntry () override;
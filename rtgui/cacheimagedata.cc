@@ -21,6 +21,7 @@
 #include <vector>
 #include <glib/gstdio.h>
 #include "version.h"
+#include "cachemanager.h"
 #include <locale.h>
 
 CacheImageData::CacheImageData ()
@@ -43,9 +44,10 @@ int CacheImageData::load (const Glib::ustring& fname)
     setlocale(LC_NUMERIC, "C"); // to set decimal point to "."
 
     Glib::KeyFile keyFile;
+    std::string data;
 
     try {
-        if (keyFile.load_from_file (fname)) {
+        if (cacheMgr->loadCacheFile(fname, data) && keyFile.load_from_data(data)) {
 
             if (keyFile.has_group ("General")) {
                 if (keyFile.has_key ("General", "MD5")) {
@@ -233,7 +235,10 @@ int CacheImageData::save (const Glib::ustring& fname)
     Glib::KeyFile keyFile;
 
     try {
-        keyFile.load_from_file (fname);
+        std::string data;
+        if (cacheMgr->loadCacheFile(fname, data)) {
+            keyFile.load_from_data(data);
+        }
     } catch (Glib::Error&) {}
 
     keyFile.set_string  ("General", "MD5", md5);
@@ -306,17 +311,13 @@ int CacheImageData::save (const Glib::ustring& fname)
         return 1;
     }
 
-    FILE *f = g_fopen (fname.c_str (), "wt");
-
-    if (!f) {
+    if (!cacheMgr->storeCacheFile(fname, keyData)) {
         if (options.rtSettings.verbose) {
-            printf("CacheImageData::save / Error: unable to open file \"%s\" with write access!\n", fname.c_str());
+            printf("CacheImageData::save / Error: unable to write \"%s\"!\n", fname.c_str());
         }
 
         return 1;
     } else {
-        fprintf (f, "%s", keyData.c_str ());
-        fclose (f);
         return 0;
     }
 }
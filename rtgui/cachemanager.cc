@@ -20,6 +20,8 @@
 
 #include <memory>
 #include <iostream>
+#include <algorithm>
+#include <cstring>
 
 #include <glib/gstdio.h>
 #include <giomm.h>
@@ -33,6 +35,7 @@
 #include "procparamchangers.h"
 #include "thumbnail.h"
 #include "../rtengine/utils.h"
+#include "../rtengine/demosaiccache.h"
 #ifdef ART_USE_OCIO
 # include "../rtengine/extclut.h"
 #endif
@@ -47,6 +50,13 @@ constexpr const char* cacheDirs[] = {
     "data"
 };
 
+// the cache subdirectories whose files go in the pack store, when enabled
+constexpr const char* packDirs[] = {
+    "images",
+    "embprofiles",
+    "data"
+};
+
 } // namespace
 
 CacheManager::CacheManager():
@@ -78,6 +88,17 @@ void CacheManager::init()
     if (error != 0 && options.rtSettings.verbose) {
         std::cerr << "Failed to create all cache directories: " << g_strerror(errno) << std::endl;
     }
+
+    pack_.reset();
+    if (options.cache_pack_store) {
+        pack_.reset(new CachePack(baseDir));
+        if (!pack_->open()) {
+            if (options.rtSettings.verbose) {
+                std::cerr << "Failed to open the cache pack store, using separate files" << std::endl;
+            }
+            pack_.reset();
+        }
+    }
 }
 
 
@@ -200,10 +221,10 @@ void CacheManager::renameEntry(const std::string& oldfilename, const std::string
     const auto newmd5 = getMD5(newfilename);
 
     auto error = g_rename(getCacheFileName("profiles", oldfilename, paramFileExtension, oldmd5).c_str(), getCacheFileName("profiles", newfilename, paramFileExtension, newmd5).c_str());
-    error |= g_rename(getCacheFileName("images", oldfilename, ".rtti", oldmd5).c_str(), getCacheFileName("images", newfilename, ".rtti", newmd5).c_str());
-    error |= g_rename(getCacheFileName("embprofiles", oldfilename, ".icc", oldmd5).c_str(), getCacheFileName("embprofiles", newfilename, ".icc", newmd5).c_str());
-    error |= g_rename(getCacheFileName("data", oldfilename, ".txt", oldmd5).c_str(), getCacheFileName("data", newfilename, ".txt", newmd5).c_str());
-    error |= g_rename(getCacheFileName("images", oldfilename, ".artt", oldmd5).c_str(), getCacheFileName("images", newfilename, ".artt", newmd5).c_str());
+    error |= renameCacheFile(getCacheFileName("images", oldfilename, ".rtti", oldmd5), getCacheFileName("images", newfilename, ".rtti", newmd5));
+    error |= renameCacheFile(getCacheFileName("embprofiles", oldfilename, ".icc", oldmd5), getCacheFileName("embprofiles", newfilename, ".icc", newmd5));
+    error |= renameCacheFile(getCacheFileName("data", oldfilename, ".txt", oldmd5), getCacheFileName("data", newfilename, ".txt", newmd5));
+    error |= renameCacheFile(getCacheFileName("images", oldfilename, ".artt", oldmd5), getCacheFileName("images", newfilename, ".artt", newmd5));
     
     if (error != 0 && options.rtSettings.verbose) {
         std::cerr << "Failed to rename all files for cache entry '" << oldfilename << "': " << g_strerror(errno) << std::endl;
@@ -239,7 +260,13 @@ void CacheManager::closeCache() const
 {
     MyMutex::MyLock lock(mutex);
 
-    applyCacheSizeLimitation();
+    if (pack_) {
+        applyPackSizeLimitation();
+        pack_->compact();
+        pack_->close();
+    } else {
+        applyCacheSizeLimitation();
+    }
 #ifdef ART_USE_OCIO
     rtengine::ExternalLUT3D::trim_cache();
 #endif
@@ -254,6 +281,12 @@ void CacheManager::clearAll() const
         deleteDir(cacheDir);
     }
 
+    if (pack_) {
+        pack_->compact(true);
+    }
+
+    rtengine::DemosaicCache::getInstance()->clear();
+
 #ifdef ART_USE_OCIO
     rtengine::ExternalLUT3D::clear_cache();
 #endif
@@ -267,6 +300,10 @@ void CacheManager::clearImages() const
     deleteDir("data");
     deleteDir("images");
     deleteDir("aehistograms");
+
+    if (pack_) {
+        pack_->compact(true);
+    }
 }
 
 
@@ -280,6 +317,15 @@ void CacheManager::clearProfiles() const
 
 void CacheManager::deleteDir(const Glib::ustring& dirName) const
 {
+    if (pack_) {
+        const std::string prefix = dirName + "/";
+        pack_->removeIf(
+            [&](const std::string &key) -> bool
+            {
+                return key.compare(0, prefix.size(), prefix) == 0;
+            });
+    }
+
     try {
 
         Glib::Dir dir(Glib::build_filename(baseDir, dirName));
@@ -303,12 +349,12 @@ void CacheManager::deleteFiles(const Glib::ustring& fname, const std::string& md
         return;
     }
 
-    auto error = g_remove(getCacheFileName("images", fname, ".rtti", md5).c_str());
-    error |= g_remove(getCacheFileName("embprofiles", fname, ".icc", md5).c_str());
-    error |= g_remove(getCacheFileName("images", fname, ".artt", md5).c_str());
+    auto error = removeCacheFile(getCacheFileName("images", fname, ".rtti", md5));
+    error |= removeCacheFile(getCacheFileName("embprofiles", fname, ".icc", md5));
+    error |= removeCacheFile(getCacheFileName("images", fname, ".artt", md5));
 
     if (purgeData) {
-        error |= g_remove(getCacheFileName("data", fname, ".txt", md5).c_str());
+        error |= removeCacheFile(getCacheFileName("data", fname, ".txt", md5));
     }
 
     if (purgeProfile) {
@@ -422,3 +468,142 @@ bool CacheManager::getImageData(const Glib::ustring &fname, CacheImageData &out)
 
     return true;
 }
+
+
+void CacheManager::applyPackSizeLimitation() const
+{
+    // the keys are sorted from the least recently written, which corresponds
+    // to the modification time used for separate files
+    std::vector<std::string> data;
+    for (auto &key : pack_->keys()) {
+        if (key.compare(0, 5, "data/") == 0) {
+            data.push_back(key.substr(5));
+        }
+    }
+
+    if (data.size() <= options.maxCacheEntries) {
+        return;
+    }
+
+    auto cacheEntries = data.size();
+
+    for (auto entry = data.begin(); cacheEntries-- > options.maxCacheEntries; ++entry) {
+        const auto& name = *entry;
+
+        constexpr auto md5_size = 32;
+        const auto name_size = name.size();
+
+        if (name_size < md5_size + 5) {
+            continue;
+        }
+
+        const auto fname = name.substr(0, name_size - md5_size - 5);
+        const auto md5 = name.substr(name_size - md5_size - 4, md5_size);
+
+        deleteFiles(fname, md5, true, false);
+    }
+}
+
+
+std::string CacheManager::getPackKey(const Glib::ustring& fname) const
+{
+    if (!pack_ || fname.compare(0, baseDir.size(), baseDir) != 0 || fname.size() <= baseDir.size() + 1) {
+        return "";
+    }
+
+    std::string key = fname.substr(baseDir.size() + 1);
+    std::replace(key.begin(), key.end(), '\\', '/');
+
+    for (const auto& packDir : packDirs) {
+        const size_t n = strlen(packDir);
+        if (key.compare(0, n, packDir) == 0 && key.size() > n && key[n] == '/') {
+            return key;
+        }
+    }
+
+    return "";
+}
+
+
+bool CacheManager::loadCacheFile(const Glib::ustring& fname, std::string &data) const
+{
+    const auto key = getPackKey(fname);
+
+    if (!key.empty() && pack_->get(key, data)) {
+        return true;
+    }
+
+    gchar *contents = nullptr;
+    gsize length = 0;
+    if (!g_file_get_contents(fname.c_str(), &contents, &length, nullptr)) {
+        return false;
+    }
+    data.assign(contents, length);
+    g_free(contents);
+
+    if (!key.empty() && pack_->put(key, data)) {
+        // migrate the file written before the pack store was enabled
+        g_remove(fname.c_str());
+    }
+
+    return true;
+}
+
+
+bool CacheManager::storeCacheFile(const Glib::ustring& fname, const std::string &data) const
+{
+    const auto key = getPackKey(fname);
+
+    if (!key.empty()) {
+        return pack_->put(key, data);
+    }
+
+    FILE *f = g_fopen(fname.c_str(), "wb");
+
+    if (!f) {
+        if (options.rtSettings.verbose) {
+            std::cerr << "Failed to write cache file '" << fname << "': " << g_strerror(errno) << std::endl;
+        }
+        return false;
+    }
+
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    ok = (fclose(f) == 0) && ok;
+    return ok;
+}
+
+
+int CacheManager::removeCacheFile(const Glib::ustring& fname) const
+{
+    const auto key = getPackKey(fname);
+
+    if (!key.empty()) {
+        pack_->remove(key);
+        // there might still be a file from before the pack store was enabled
+        g_remove(fname.c_str());
+        return 0;
+    }
+
+    return g_remove(fname.c_str());
+}
+
+
+int CacheManager::renameCacheFile(const Glib::ustring& oldname, const Glib::ustring& newname) const
+{
+    const auto oldkey = getPackKey(oldname);
+    const auto newkey = getPackKey(newname);
+
+    if (!oldkey.empty() && !newkey.empty()) {
+        if (pack_->rename(oldkey, newkey)) {
+            return 0;
+        }
+        // not in the pack yet: migrate the legacy file, if any
+        std::string data;
+        if (loadCacheFile(oldname, data)) {
+            return pack_->rename(oldkey, newkey) ? 0 : -1;
+        }
+        return 0;
+    }
+
+    return g_rename(oldname.c_str(), newname.c_str());
+}
@@ -21,6 +21,7 @@
 
 #include <string>
 #include <map>
+#include <memory>
 
 #include <glibmm/ustring.h>
 
@@ -28,6 +29,7 @@
 #include "../rtengine/rtengine.h"
 #include "threadutils.h"
 #include "cacheimagedata.h"
+#include "cachepack.h"
 
 class Thumbnail;
 
@@ -38,11 +40,16 @@ private:
     Glib::ustring    baseDir;
     mutable MyMutex  mutex;
     rtengine::ProgressListener *pl_;
+    std::unique_ptr<CachePack> pack_;
 
     void deleteDir   (const Glib::ustring& dirName) const;
     void deleteFiles (const Glib::ustring& fname, const std::string& md5, bool purgeData, bool purgeProfile) const;
 
     void applyCacheSizeLimitation () const;
+    void applyPackSizeLimitation () const;
+
+    std::string getPackKey(const Glib::ustring& fname) const;
+    int renameCacheFile(const Glib::ustring& oldname, const Glib::ustring& newname) const;
 
 public:
     CacheManager();
@@ -72,6 +79,13 @@ public:
                                    const Glib::ustring& md5) const;
 
     bool getImageData(const Glib::ustring &fn, CacheImageData &out);
+
+    // read/write the contents of a cache file (as given by getCacheFileName),
+    // which is kept in the pack store instead of a separate file if
+    // options.cache_pack_store is set
+    bool loadCacheFile(const Glib::ustring& fname, std::string &data) const;
+    bool storeCacheFile(const Glib::ustring& fname, const std::string &data) const;
+    int removeCacheFile(const Glib::ustring& fname) const;
 };
 
 #define cacheMgr CacheManager::getInstance()
@@ -0,0 +1,616 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cachepack.h"
+#include "options.h"
+
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <zlib.h>
+#include <glib/gstdio.h>
+#include <glibmm.h>
+
+extern Options options;
+
+/******************************************************************************
+ * pack file format:
+ *
+ * "ARTPACK1" header
+ * pack id (guint64)
+ * records, each made of:
+ *   magic (guint32)
+ *   flags (guint32)
+ *   key size (guint32)
+ *   crc32 of the other header fields, the key and the data (guint32)
+ *   data size (guint64)
+ *   key
+ *   data
+ *
+ * index file format:
+ *
+ * "ARTIDX01" header
+ * pack id (guint64)
+ * size of the pack covered by the index (guint64)
+ * size of the stale records in the covered part (guint64)
+ * number of entries (guint64)
+ * entries, each made of:
+ *   key size (guint32)
+ *   data offset (guint64)
+ *   data size (guint64)
+ *   key
+ * crc32 of all the above (guint32)
+ ******************************************************************************/
+
+namespace {
+
+constexpr const char *PACK_MAGIC = "ARTPACK1";
+constexpr const char *INDEX_MAGIC = "ARTIDX01";
+constexpr size_t MAGIC_SIZE = 8;
+constexpr guint64 PACK_HEADER_SIZE = MAGIC_SIZE + sizeof(guint64);
+
+constexpr guint32 RECORD_MAGIC = 0x52545241; // "ARTR"
+constexpr guint32 RECORD_REMOVED = 1;
+constexpr guint64 RECORD_HEADER_SIZE = 4 * sizeof(guint32) + sizeof(guint64);
+
+// minimum amount of stale data for a non-forced compaction
+constexpr guint64 MIN_COMPACT_SIZE = 16 << 20;
+
+
+template <class T>
+void put_value(std::string &buf, T val)
+{
+    buf.append(reinterpret_cast<const char *>(&val), sizeof(T));
+}
+
+
+template <class T>
+T get_value(const char *p)
+{
+    T ret;
+    memcpy(&ret, p, sizeof(T));
+    return ret;
+}
+
+
+guint32 record_crc(guint32 flags, const char *key, guint32 key_size, const char *data, guint64 size)
+{
+    std::string hdr;
+    put_value(hdr, flags);
+    put_value(hdr, key_size);
+    put_value(hdr, size);
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(hdr.data()), hdr.size());
+    crc = crc32(crc, reinterpret_cast<const Bytef *>(key), key_size);
+    if (size) { // crc32() with a null buffer would reset the checksum
+        crc = crc32(crc, reinterpret_cast<const Bytef *>(data), size);
+    }
+    return guint32(crc);
+}
+
+
+std::string make_record(const std::string &key, const char *data, guint64 size, guint32 flags)
+{
+    std::string rec;
+    rec.reserve(RECORD_HEADER_SIZE + key.size() + size);
+    put_value(rec, RECORD_MAGIC);
+    put_value(rec, flags);
+    put_value(rec, guint32(key.size()));
+    put_value(rec, record_crc(flags, key.data(), key.size(), data, size));
+    put_value(rec, size);
+    rec.append(key);
+    if (size) {
+        rec.append(data, size);
+    }
+    return rec;
+}
+
+
+std::string make_header(guint64 id)
+{
+    std::string hdr(PACK_MAGIC, MAGIC_SIZE);
+    put_value(hdr, id);
+    return hdr;
+}
+
+
+guint64 new_pack_id()
+{
+    return (guint64(g_get_real_time()) << 16) ^ guint64(g_random_int());
+}
+
+
+bool write_file(const Glib::ustring &fname, const std::string &data)
+{
+    FILE *f = g_fopen(fname.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    ok = (fclose(f) == 0) && ok;
+    return ok;
+}
+
+} // namespace
+
+
+CachePack::CachePack(const Glib::ustring &dir):
+    pack_fname_(Glib::build_filename(dir, "cache.pack")),
+    index_fname_(Glib::build_filename(dir, "cache.idx")),
+    pack_id_(0),
+    pack_size_(0),
+    dead_size_(0),
+    mapping_(nullptr),
+    out_(nullptr),
+    index_dirty_(false)
+{
+}
+
+
+CachePack::~CachePack()
+{
+    close();
+}
+
+
+bool CachePack::open()
+{
+    MyMutex::MyLock lock(mutex_);
+
+    // leftovers of an interrupted compaction or index save
+    g_remove((pack_fname_ + ".tmp").c_str());
+    g_remove((index_fname_ + ".tmp").c_str());
+
+    index_.clear();
+    dead_size_ = 0;
+
+    bool valid = Glib::file_test(pack_fname_, Glib::FILE_TEST_EXISTS) && map();
+    if (valid) {
+        const char *data = g_mapped_file_get_contents(mapping_);
+        valid = g_mapped_file_get_length(mapping_) >= PACK_HEADER_SIZE && memcmp(data, PACK_MAGIC, MAGIC_SIZE) == 0;
+        if (valid) {
+            pack_id_ = get_value<guint64>(data + MAGIC_SIZE);
+        }
+    }
+
+    if (!valid) {
+        unmap();
+        pack_id_ = new_pack_id();
+        if (!write_file(pack_fname_, make_header(pack_id_)) || !map()) {
+            if (options.rtSettings.verbose) {
+                std::cerr << "CachePack: cannot create " << pack_fname_ << std::endl;
+            }
+            return false;
+        }
+        g_remove(index_fname_.c_str());
+    }
+
+    guint64 from = PACK_HEADER_SIZE;
+    if (loadIndex()) {
+        from = pack_size_;
+    } else {
+        index_.clear();
+        dead_size_ = 0;
+    }
+
+    if (!scan(from)) {
+        // torn record at the end, left by an interrupted write: get rid of
+        // it before appending anything else
+        if (options.rtSettings.verbose) {
+            std::cout << "CachePack: discarding incomplete data at the end of " << pack_fname_ << std::endl;
+        }
+        if (!do_compact()) {
+            return false;
+        }
+    }
+    index_dirty_ = index_dirty_ || from != pack_size_;
+
+    out_ = g_fopen(pack_fname_.c_str(), "ab");
+    return out_ != nullptr;
+}
+
+
+void CachePack::close()
+{
+    MyMutex::MyLock lock(mutex_);
+
+    if (out_) {
+        fclose(out_);
+        out_ = nullptr;
+    }
+    if (index_dirty_) {
+        saveIndex();
+    }
+    unmap();
+}
+
+
+bool CachePack::get(const std::string &key, std::string &data)
+{
+    MyMutex::MyLock lock(mutex_);
+
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        return false;
+    }
+
+    const Entry &e = it->second;
+    if (!mapping_ || e.offset + e.size > g_mapped_file_get_length(mapping_)) {
+        // the entry was written after the pack was mapped
+        if (out_) {
+            fflush(out_);
+        }
+        if (!map() || e.offset + e.size > g_mapped_file_get_length(mapping_)) {
+            return false;
+        }
+    }
+
+    data.assign(g_mapped_file_get_contents(mapping_) + e.offset, e.size);
+    return true;
+}
+
+
+bool CachePack::put(const std::string &key, const std::string &data)
+{
+    MyMutex::MyLock lock(mutex_);
+    return append(key, data.data(), data.size(), 0);
+}
+
+
+bool CachePack::remove(const std::string &key)
+{
+    MyMutex::MyLock lock(mutex_);
+
+    if (index_.find(key) == index_.end()) {
+        return false;
+    }
+    return append(key, nullptr, 0, RECORD_REMOVED);
+}
+
+
+bool CachePack::rename(const std::string &oldkey, const std::string &newkey)
+{
+    std::string data;
+    if (!get(oldkey, data)) {
+        return false;
+    }
+
+    MyMutex::MyLock lock(mutex_);
+    return append(newkey, data.data(), data.size(), 0) && append(oldkey, nullptr, 0, RECORD_REMOVED);
+}
+
+
+void CachePack::removeIf(const std::function<bool(const std::string &)> &pred)
+{
+    MyMutex::MyLock lock(mutex_);
+
+    std::vector<std::string> toremove;
+    for (auto &p : index_) {
+        if (pred(p.first)) {
+            toremove.push_back(p.first);
+        }
+    }
+
+    for (auto &key : toremove) {
+        append(key, nullptr, 0, RECORD_REMOVED);
+    }
+}
+
+
+std::vector<std::string> CachePack::keys() const
+{
+    MyMutex::MyLock lock(mutex_);
+
+    std::vector<std::pair<guint64, std::string>> entries;
+    entries.reserve(index_.size());
+    for (auto &p : index_) {
+        entries.emplace_back(p.second.offset, p.first);
+    }
+    std::sort(entries.begin(), entries.end());
+
+    std::vector<std::string> ret;
+    ret.reserve(entries.size());
+    for (auto &e : entries) {
+        ret.push_back(std::move(e.second));
+    }
+    return ret;
+}
+
+
+bool CachePack::compact(bool force)
+{
+    MyMutex::MyLock lock(mutex_);
+
+    if (!force && (dead_size_ < MIN_COMPACT_SIZE || dead_size_ < pack_size_ / 2)) {
+        return true;
+    }
+
+    const bool reopen = out_;
+    if (out_) {
+        fclose(out_);
+        out_ = nullptr;
+    }
+    bool ok = do_compact();
+    if (reopen) {
+        out_ = g_fopen(pack_fname_.c_str(), "ab");
+    }
+    return ok && (!reopen || out_);
+}
+
+
+bool CachePack::do_compact()
+{
+    // make sure all the records are visible in the mapping
+    if (!mapping_ || pack_size_ > g_mapped_file_get_length(mapping_)) {
+        if (!map()) {
+            return false;
+        }
+    }
+
+    std::vector<std::pair<guint64, std::string>> entries;
+    entries.reserve(index_.size());
+    for (auto &p : index_) {
+        entries.emplace_back(p.second.offset, p.first);
+    }
+    std::sort(entries.begin(), entries.end());
+
+    const Glib::ustring tmpname = pack_fname_ + ".tmp";
+    FILE *f = g_fopen(tmpname.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+
+    const guint64 id = new_pack_id();
+    std::string hdr = make_header(id);
+    bool ok = fwrite(hdr.data(), 1, hdr.size(), f) == hdr.size();
+
+    const char *src = g_mapped_file_get_contents(mapping_);
+    std::unordered_map<std::string, Entry> new_index;
+    guint64 pos = hdr.size();
+
+    for (size_t i = 0; ok && i < entries.size(); ++i) {
+        const std::string &key = entries[i].second;
+        const Entry &e = index_[key];
+        std::string rec = make_record(key, src + e.offset, e.size, 0);
+        ok = fwrite(rec.data(), 1, rec.size(), f) == rec.size();
+        new_index[key] = { pos + RECORD_HEADER_SIZE + key.size(), e.size };
+        pos += rec.size();
+    }
+
+    ok = (fclose(f) == 0) && ok;
+
+    if (ok) {
+        // the mapping must be released before replacing the file (for Windows)
+        unmap();
+        ok = g_rename(tmpname.c_str(), pack_fname_.c_str()) == 0;
+    }
+
+    if (!ok) {
+        g_remove(tmpname.c_str());
+        if (options.rtSettings.verbose) {
+            std::cerr << "CachePack: compaction of " << pack_fname_ << " failed" << std::endl;
+        }
+        map();
+        return false;
+    }
+
+    if (options.rtSettings.verbose) {
+        std::cout << "CachePack: compacted " << pack_fname_ << " from " << pack_size_ << " to " << pos << " bytes" << std::endl;
+    }
+
+    index_.swap(new_index);
+    pack_id_ = id;
+    pack_size_ = pos;
+    dead_size_ = 0;
+    saveIndex();
+    return map();
+}
+
+
+bool CachePack::map()
+{
+    unmap();
+
+    GError *err = nullptr;
+    mapping_ = g_mapped_file_new(pack_fname_.c_str(), FALSE, &err);
+    if (!mapping_) {
+        if (err) {
+            if (options.rtSettings.verbose) {
+                std::cerr << "CachePack: cannot map " << pack_fname_ << ": " << err->message << std::endl;
+            }
+            g_error_free(err);
+        }
+        return false;
+    }
+    return true;
+}
+
+
+void CachePack::unmap()
+{
+    if (mapping_) {
+        g_mapped_file_unref(mapping_);
+        mapping_ = nullptr;
+    }
+}
+
+
+bool CachePack::scan(guint64 from)
+{
+    const char *data = g_mapped_file_get_contents(mapping_);
+    const guint64 len = g_mapped_file_get_length(mapping_);
+
+    guint64 pos = from;
+    while (pos + RECORD_HEADER_SIZE <= len) {
+        const char *p = data + pos;
+        const guint32 magic = get_value<guint32>(p);
+        const guint32 flags = get_value<guint32>(p + 4);
+        const guint32 key_size = get_value<guint32>(p + 8);
+        const guint32 crc = get_value<guint32>(p + 12);
+        const guint64 size = get_value<guint64>(p + 16);
+
+        if (magic != RECORD_MAGIC || key_size > len || size > len || pos + RECORD_HEADER_SIZE + key_size + size > len) {
+            break;
+        }
+
+        const char *key = p + RECORD_HEADER_SIZE;
+        if (record_crc(flags, key, key_size, key + key_size, size) != crc) {
+            break;
+        }
+
+        const guint64 rec_size = RECORD_HEADER_SIZE + key_size + size;
+        std::string k(key, key_size);
+        auto it = index_.find(k);
+        if (it != index_.end()) {
+            dead_size_ += RECORD_HEADER_SIZE + k.size() + it->second.size;
+        }
+        if (flags & RECORD_REMOVED) {
+            if (it != index_.end()) {
+                index_.erase(it);
+            }
+            dead_size_ += rec_size;
+        } else {
+            index_[k] = { pos + RECORD_HEADER_SIZE + key_size, size };
+        }
+
+        pos += rec_size;
+    }
+
+    pack_size_ = pos;
+    return pos == len;
+}
+
+
+bool CachePack::append(const std::string &key, const char *data, guint64 size, guint32 flags)
+{
+    if (!out_) {
+        return false;
+    }
+
+    std::string rec = make_record(key, data, size, flags);
+    if (fwrite(rec.data(), 1, rec.size(), out_) != rec.size() || fflush(out_) != 0) {
+        // the pack might now end with a partial record, which will be
+        // discarded at the next open(); stop writing to it until then
+        fclose(out_);
+        out_ = nullptr;
+        return false;
+    }
+
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        dead_size_ += RECORD_HEADER_SIZE + key.size() + it->second.size;
+    }
+    if (flags & RECORD_REMOVED) {
+        if (it != index_.end()) {
+            index_.erase(it);
+        }
+        dead_size_ += rec.size();
+    } else {
+        index_[key] = { pack_size_ + RECORD_HEADER_SIZE + key.size(), size };
+    }
+    pack_size_ += rec.size();
+    index_dirty_ = true;
+
+    return true;
+}
+
+
+bool CachePack::loadIndex()
+{
+    if (!Glib::file_test(index_fname_, Glib::FILE_TEST_EXISTS)) {
+        return false;
+    }
+
+    GMappedFile *f = g_mapped_file_new(index_fname_.c_str(), FALSE, nullptr);
+    if (!f) {
+        return false;
+    }
+
+    const char *data = g_mapped_file_get_contents(f);
+    const guint64 len = g_mapped_file_get_length(f);
+    const guint64 hdr_size = MAGIC_SIZE + 4 * sizeof(guint64);
+    const guint64 entry_size = sizeof(guint32) + 2 * sizeof(guint64);
+    const guint64 mapped_len = g_mapped_file_get_length(mapping_);
+
+    bool ok = len >= hdr_size + sizeof(guint32) && memcmp(data, INDEX_MAGIC, MAGIC_SIZE) == 0;
+    if (ok) {
+        const guint32 crc = get_value<guint32>(data + len - sizeof(guint32));
+        ok = guint32(crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef *>(data), len - sizeof(guint32))) == crc;
+    }
+    if (ok) {
+        const guint64 id = get_value<guint64>(data + MAGIC_SIZE);
+        pack_size_ = get_value<guint64>(data + MAGIC_SIZE + sizeof(guint64));
+        dead_size_ = get_value<guint64>(data + MAGIC_SIZE + 2 * sizeof(guint64));
+        ok = id == pack_id_ && pack_size_ >= PACK_HEADER_SIZE && pack_size_ <= mapped_len;
+    }
+    if (ok) {
+        const guint64 n = get_value<guint64>(data + MAGIC_SIZE + 3 * sizeof(guint64));
+        const guint64 end = len - sizeof(guint32);
+        guint64 pos = hdr_size;
+        index_.reserve(n);
+
+        for (guint64 i = 0; ok && i < n; ++i) {
+            ok = pos + entry_size <= end;
+            if (ok) {
+                const guint32 key_size = get_value<guint32>(data + pos);
+                Entry e;
+                e.offset = get_value<guint64>(data + pos + sizeof(guint32));
+                e.size = get_value<guint64>(data + pos + sizeof(guint32) + sizeof(guint64));
+                pos += entry_size;
+                ok = pos + key_size <= end && e.offset + e.size <= pack_size_;
+                if (ok) {
+                    index_[std::string(data + pos, key_size)] = e;
+                    pos += key_size;
+                }
+            }
+        }
+    }
+
+    g_mapped_file_unref(f);
+    return ok;
+}
+
+
+bool CachePack::saveIndex()
+{
+    std::string buf(INDEX_MAGIC, MAGIC_SIZE);
+    put_value(buf, pack_id_);
+    put_value(buf, pack_size_);
+    put_value(buf, dead_size_);
+    put_value(buf, guint64(index_.size()));
+
+    for (auto &p : index_) {
+        put_value(buf, guint32(p.first.size()));
+        put_value(buf, p.second.offset);
+        put_value(buf, p.second.size);
+        buf.append(p.first);
+    }
+    put_value(buf, guint32(crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef *>(buf.data()), buf.size())));
+
+    // write to a temporary file and then replace the old index, so that a
+    // crash never leaves a truncated index behind
+    const Glib::ustring tmpname = index_fname_ + ".tmp";
+    if (!write_file(tmpname, buf) || g_rename(tmpname.c_str(), index_fname_.c_str()) != 0) {
+        g_remove(tmpname.c_str());
+        return false;
+    }
+
+    index_dirty_ = false;
+    return true;
+}
@@ -0,0 +1,90 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <stdio.h>
+#include <glib.h>
+#include <glibmm/ustring.h>
+
+#include "../rtengine/noncopyable.h"
+#include "threadutils.h"
+
+/******************************************************************************
+ * Single-file store for the cache data, used by CacheManager as an
+ * alternative to one file per cached item.
+ *
+ * The pack file is append-only: each put() or remove() appends a record
+ * (header, key, data) protected by a checksum, and the most recent record for
+ * a key wins. Reads are served from a read-only memory mapping of the pack.
+ * The index (key -> record location) is kept in memory and saved to a
+ * separate file on close(). On open(), records appended after the last saved
+ * index are recovered by scanning the tail of the pack, and a torn record
+ * left by an interrupted write is discarded. compact() rewrites the pack with
+ * only the live records, and atomically replaces the old one.
+ ******************************************************************************/
+class CachePack: public rtengine::NonCopyable {
+public:
+    explicit CachePack(const Glib::ustring &dir);
+    ~CachePack();
+
+    bool open();
+    void close();
+
+    bool get(const std::string &key, std::string &data);
+    bool put(const std::string &key, const std::string &data);
+    bool remove(const std::string &key);
+    bool rename(const std::string &oldkey, const std::string &newkey);
+    void removeIf(const std::function<bool(const std::string &)> &pred);
+
+    // live keys, least recently written first
+    std::vector<std::string> keys() const;
+
+    // rewrites the pack without the stale records. If force is false, this
+    // happens only if they take a significant fraction of the file
+    bool compact(bool force=false);
+
+private:
+    struct Entry {
+        guint64 offset; // of the data
+        guint64 size;
+    };
+
+    bool do_compact();
+    bool map();
+    void unmap();
+    bool scan(guint64 from);
+    bool append(const std::string &key, const char *data, guint64 size, guint32 flags);
+    bool loadIndex();
+    bool saveIndex();
+
+    Glib::ustring pack_fname_;
+    Glib::ustring index_fname_;
+    guint64 pack_id_;
+    guint64 pack_size_;
+    guint64 dead_size_;
+    std::unordered_map<std::string, Entry> index_;
+    GMappedFile *mapping_;
+    FILE *out_;
+    bool index_dirty_;
+    mutable MyMutex mutex_;
+};
@@ -1945,6 +1945,13 @@ void FileBrowser::selectionChanged ()
     notifySelectionListener ();
 }
 
+void FileBrowser::visibleRangeChanged (const Glib::ustring& first, const Glib::ustring& last)
+{
+    if (tbl) {
+        tbl->visibleRangeChanged(first, last);
+    }
+}
+
 void FileBrowser::notifySelectionListener ()
 {
     if (tbl) {
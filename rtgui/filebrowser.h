@@ -45,6 +45,7 @@ public:
     virtual void deleteRequested(const std::vector<FileBrowserEntry*>& tbe, bool onlySelected) = 0;
     virtual void copyMoveRequested(const std::vector<FileBrowserEntry*>& tbe, bool moveRequested) = 0;
     virtual void selectionChanged(const std::vector<Thumbnail*>& tbe) = 0;
+    virtual void visibleRangeChanged(const Glib::ustring& first, const Glib::ustring& last) = 0;
     virtual void clearFromCacheRequested(const std::vector<FileBrowserEntry*>& tbe, bool leavenotrace) = 0;
     virtual bool isInTabMode() const = 0;
 };
@@ -188,6 +189,7 @@ public:
     void thumbRearrangementNeeded () override;
 
     void selectionChanged () override;
+    void visibleRangeChanged (const Glib::ustring& first, const Glib::ustring& last) override;
 
     void storeCurrentValue() override;
     void updateProfileList() override;
@@ -1519,6 +1519,12 @@ void FileCatalog::selectionChanged(const std::vector<Thumbnail*>& tbe)
     }
 }
 
+void FileCatalog::visibleRangeChanged(const Glib::ustring& first, const Glib::ustring& last)
+{
+    // load the previews of the thumbnails on screen (and around them) first
+    previewLoader->setVisibleRange(selectedDirectoryId, first, last);
+}
+
 void FileCatalog::clearFromCacheRequested(const std::vector<FileBrowserEntry*>& tbe, bool leavenotrace)
 {
     if (tbe.empty()) {
@@ -220,6 +220,7 @@ public:
     void developRequested(const std::vector<FileBrowserEntry*>& tbe, bool fastmode) override;
     //void renameRequested(const std::vector<FileBrowserEntry*>& tbe) override;
     void selectionChanged(const std::vector<Thumbnail*>& tbe) override;
+    void visibleRangeChanged(const Glib::ustring& first, const Glib::ustring& last) override;
     void clearFromCacheRequested(const std::vector<FileBrowserEntry*>& tbe, bool leavenotrace) override;
     bool isInTabMode() const override;
 
@@ -44,6 +44,9 @@
 #include "makeicc.h"
 #include "../rtengine/clutstore.h"
 #include "../rtengine/settings.h"
+#ifdef BENCHMARK
+#include "../rtengine/benchmark.h"
+#endif
 
 #ifndef WIN32
 #include <glibmm/fileutils.h>
@@ -58,6 +61,13 @@
 
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <memory>
+#include <limits>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #ifdef WITH_MIMALLOC
 #  include <mimalloc.h>
@@ -84,6 +94,68 @@ bool check_partial_profile(const PartialProfile &pp)
     return pp->applyTo(params);
 }
 
+
+/*
+ * Memory budget shared by the concurrent jobs of "-P". A job asks for its
+ * estimated footprint before entering the processing pipeline, and waits
+ * until enough of the budget is released by the other jobs. A job is always
+ * admitted when nothing else is in flight, so that images larger than the
+ * whole budget can still be processed (one at a time).
+ */
+class MemoryBudget {
+public:
+    explicit MemoryBudget(size_t limit): limit_(limit), used_(0) {}
+
+    bool enabled() const { return limit_ > 0; }
+
+    // returns the amount actually reserved, which must be given back to
+    // release() (requests larger than the whole budget reserve all of it)
+    size_t acquire(size_t amount)
+    {
+        if (!enabled()) {
+            return 0;
+        }
+        amount = std::min(amount, limit_);
+        MyMutex::MyLock lock(mutex_);
+        cond_.wait(lock, [&]() -> bool { return used_ == 0 || used_ + amount <= limit_; });
+        used_ += amount;
+        return amount;
+    }
+
+    void release(size_t amount)
+    {
+        {
+            MyMutex::MyLock lock(mutex_);
+            used_ -= std::min(amount, used_);
+        }
+        cond_.notify_all();
+    }
+
+private:
+    MyMutex mutex_;
+    std::condition_variable_any cond_;
+    size_t limit_;
+    size_t used_;
+};
+
+
+// the estimate is made from the metadata, so that it is available before
+// loading the image. If the size is unknown, the job is treated as if it
+// needed the whole budget
+size_t estimate_memory_usage(const Glib::ustring &fname)
+{
+    int w = 0, h = 0;
+    std::unique_ptr<rtengine::FramesMetaData> md(rtengine::FramesMetaData::fromFile(fname));
+    md->getDimensions(w, h);
+    if (w <= 0 || h <= 0) {
+        return std::numeric_limits<size_t>::max();
+    }
+    // working image, transformed image, a temporary copy made by some of
+    // the tools and the output image, all with 3 float channels
+    constexpr size_t num_buffers = 4;
+    return size_t(w) * size_t(h) * 3 * sizeof(float) * num_buffers;
+}
+
 } // namespace
 
 
@@ -193,6 +265,12 @@ int main (int argc, char **argv)
         return -2;
     }
 
+#ifdef BENCHMARK
+    if (argc > 1 && strcmp(argv[1], "--benchmark") == 0) {
+        return rtengine::run_benchmarks(std::vector<std::string>(argv + 2, argv + argc));
+    }
+#endif
+
     if (options.is_defProfRawMissing()) {
         options.defProfRaw = Options::DEFPROFILE_RAW;
         std::cerr << std::endl
@@ -370,7 +448,9 @@ int processLineParams ( int argc, char **argv )
     int bits = -1;
     bool isFloat = false;
     std::string outputType = "";
-    unsigned errors = 0;
+    std::atomic<unsigned> errors(0);
+    int num_jobs = 1;
+    size_t memory_budget = 0;
 
     for ( int iArg = 1; iArg < argc; iArg++) {
         Glib::ustring currParam (argv[iArg]);
@@ -531,6 +611,32 @@ int processLineParams ( int argc, char **argv )
                 }
                 break;
 
+            case 'P':
+            case 'M': {
+                const char opt = currParam.at(1);
+                Glib::ustring val;
+                if (currParam.size() > 2) {
+                    val = currParam.substr(2);
+                } else if (iArg + 1 < argc) {
+                    ++iArg;
+                    val = argv[iArg];
+                } else {
+                    std::cerr << "Error: the -" << opt << " switch requires a mandatory value!" << std::endl;
+                    return -3;
+                }
+                int n = atoi(val.c_str());
+                if (n < (opt == 'P' ? 1 : 0)) {
+                    std::cerr << "Error: invalid value for the -" << opt << " switch: " << val << std::endl;
+                    return -3;
+                }
+                if (opt == 'P') {
+                    num_jobs = n;
+                } else {
+                    memory_budget = size_t(n) << 20;
+                }
+            }
+                break;
+
             case 'c': // MUST be last option
                 while (iArg + 1 < argc) {
                     iArg++;
@@ -725,181 +831,230 @@ int processLineParams ( int argc, char **argv )
         std::thread(monitor).detach();
     }
 
-    for ( size_t iFile = 0; iFile < inputFiles.size(); iFile++) {
-        cpl.incr();
+    if (outputType.empty()) {
+        outputType = "jpg";
+    }
 
-        // Has to be reinstanciated at each profile to have a ProcParams object with default values
-        rtengine::procparams::ProcParams currentParams;
+    MemoryBudget budget(memory_budget);
+    MyMutex profiles_mutex;
 
-        Glib::ustring inputFile = inputFiles[iFile];
-        //cpl.info(Glib::ustring::compose("Output is %1-bit %2.", bits, (isFloat ? "floating-point" : "integer")));
-        if (progress) {
-            cpl.msg(Glib::ustring::compose("Processing: %1 (%2/%3)", inputFile, iFile+1, inputFiles.size()));
-        } else {
-            cpl.info(Glib::ustring::compose("Processing: %1", inputFile));
-        }
-        
-        rtengine::InitialImage* ii = nullptr;
-        rtengine::ProcessingJob* job = nullptr;
-        int errorCode;
-        bool isRaw = false;
+    const auto process_file =
+            [&](size_t iFile) -> void
+            {
+                cpl.incr();
 
-        Glib::ustring outputFile;
+                // Has to be reinstanciated at each profile to have a ProcParams object with default values
+                rtengine::procparams::ProcParams currentParams;
 
-        if (outputType.empty()) {
-            outputType = "jpg";
-        }
+                Glib::ustring inputFile = inputFiles[iFile];
+                //cpl.info(Glib::ustring::compose("Output is %1-bit %2.", bits, (isFloat ? "floating-point" : "integer")));
+                if (progress) {
+                    cpl.msg(Glib::ustring::compose("Processing: %1 (%2/%3)", inputFile, iFile+1, inputFiles.size()));
+                } else {
+                    cpl.info(Glib::ustring::compose("Processing: %1", inputFile));
+                }
+        
+                rtengine::InitialImage* ii = nullptr;
+                rtengine::ProcessingJob* job = nullptr;
+                int errorCode;
+                bool isRaw = false;
 
-        auto oext = output_ext[outputType];
-        if (oext.empty()) {
-            oext = outputType;
-        }
+                Glib::ustring outputFile;
 
-        if (outputPath.empty()) {
-            Glib::ustring s = inputFile;
-            Glib::ustring::size_type ext = s.find_last_of('.');
-            outputFile = s.substr(0, ext) + "." + oext;
-        } else if (outputDirectory) {
-            Glib::ustring s = Glib::path_get_basename(inputFile);
-            Glib::ustring::size_type ext = s.find_last_of('.');
-            outputFile = Glib::build_filename(outputPath, s.substr(0, ext) + "." + oext);
-        } else {
-            if (leaveUntouched) {
-                outputFile = outputPath;
-            } else {
-                Glib::ustring s = outputPath;
-                Glib::ustring::size_type ext = s.find_last_of('.');
-                outputFile = s.substr(0, ext) + "." + oext;
-            }
-        }
+                auto it = output_ext.find(outputType);
+                Glib::ustring oext = it != output_ext.end() ? it->second : Glib::ustring();
+                if (oext.empty()) {
+                    oext = outputType;
+                }
 
-        if (inputFile == outputFile) {
-            cpl.error(Glib::ustring::compose("cannot overwrite: %1", inputFile));
-            continue;
-        }
+                if (outputPath.empty()) {
+                    Glib::ustring s = inputFile;
+                    Glib::ustring::size_type ext = s.find_last_of('.');
+                    outputFile = s.substr(0, ext) + "." + oext;
+                } else if (outputDirectory) {
+                    Glib::ustring s = Glib::path_get_basename(inputFile);
+                    Glib::ustring::size_type ext = s.find_last_of('.');
+                    outputFile = Glib::build_filename(outputPath, s.substr(0, ext) + "." + oext);
+                } else {
+                    if (leaveUntouched) {
+                        outputFile = outputPath;
+                    } else {
+                        Glib::ustring s = outputPath;
+                        Glib::ustring::size_type ext = s.find_last_of('.');
+                        outputFile = s.substr(0, ext) + "." + oext;
+                    }
+                }
 
-        if (!overwriteFiles && Glib::file_test(outputFile, Glib::FILE_TEST_EXISTS ) ) {
-            cpl.error(Glib::ustring::compose("%1 already exists: use -Y option to overwrite. This image has been skipped.", outputFile));
-            continue;
-        }
+                if (inputFile == outputFile) {
+                    cpl.error(Glib::ustring::compose("cannot overwrite: %1", inputFile));
+                    return;
+                }
+
+                if (!overwriteFiles && Glib::file_test(outputFile, Glib::FILE_TEST_EXISTS ) ) {
+                    cpl.error(Glib::ustring::compose("%1 already exists: use -Y option to overwrite. This image has been skipped.", outputFile));
+                    return;
+                }
 
-        // Load the image
-        isRaw = true;
-        Glib::ustring ext = getExtension(inputFile).lowercase();
+                // Load the image
+                isRaw = true;
+                Glib::ustring ext = getExtension(inputFile).lowercase();
 
-        if (ext == "jpg" || ext == "jpeg" || ext == "tif" || ext == "tiff" || ext == "png" || rtengine::ImageIOManager::getInstance()->canLoad(ext)) {
-            isRaw = false;
-        }
+                if (ext == "jpg" || ext == "jpeg" || ext == "tif" || ext == "tiff" || ext == "png" || rtengine::ImageIOManager::getInstance()->canLoad(ext)) {
+                    isRaw = false;
+                }
 
-        ii = rtengine::InitialImage::load(inputFile, isRaw, &errorCode, nullptr);
+                // wait until there is enough memory for processing this
+                // image (only relevant when running concurrent jobs)
+                const size_t mem_usage = budget.acquire(budget.enabled() ? estimate_memory_usage(inputFile) : 0);
 
-        if (!ii) {
-            errors++;
-            cpl.error(Glib::ustring::compose("impossible to load file: %1", inputFile));
-            continue;
-        }
+                ii = rtengine::InitialImage::load(inputFile, isRaw, &errorCode, nullptr);
 
-        if (useDefault) {
-            if (isRaw) {
-                if (options.defProfRaw == Options::DEFPROFILE_DYNAMIC) {
-                    rawParams = ProfileStore::getInstance()->loadDynamicProfile(ii->getMetaData());
+                if (!ii) {
+                    budget.release(mem_usage);
+                    errors++;
+                    cpl.error(Glib::ustring::compose("impossible to load file: %1", inputFile));
+                    return;
                 }
+
+                if (useDefault) {
+                    // the dynamic profile is per image, so it must not
+                    // replace the shared one when running concurrent jobs
+                    PartialProfile dynParams;
+                    if (isRaw) {
+                        if (options.defProfRaw == Options::DEFPROFILE_DYNAMIC) {
+                            MyMutex::MyLock lock(profiles_mutex);
+                            dynParams = ProfileStore::getInstance()->loadDynamicProfile(ii->getMetaData());
+                        }
                 
-                cpl.info("Merging default raw processing profile.");
-                rawParams->applyTo(currentParams);
-            } else {
-                if (options.defProfImg == Options::DEFPROFILE_DYNAMIC) {
-                    imgParams = ProfileStore::getInstance()->loadDynamicProfile(ii->getMetaData());
+                        cpl.info("Merging default raw processing profile.");
+                        (dynParams ? dynParams : rawParams)->applyTo(currentParams);
+                    } else {
+                        if (options.defProfImg == Options::DEFPROFILE_DYNAMIC) {
+                            MyMutex::MyLock lock(profiles_mutex);
+                            dynParams = ProfileStore::getInstance()->loadDynamicProfile(ii->getMetaData());
+                        }
+
+                        cpl.info("Merging default non-raw processing profile.");
+                        (dynParams ? dynParams : imgParams)->applyTo(currentParams);
+                    }
                 }
 
-                cpl.info("Merging default non-raw processing profile.");
-                imgParams->applyTo(currentParams);
-            }
-        }
+                bool sideCarFound = false;
+                unsigned int i = 0;
 
-        bool sideCarFound = false;
-        unsigned int i = 0;
+                // Iterate the procparams file list in order to build the final ProcParams
+                do {
+                    if (sideProcParams && i == sideCarFilePos) {
+                        // using the sidecar file
+                        Glib::ustring sideProcessingParams = options.getParamFile(inputFile);
 
-        // Iterate the procparams file list in order to build the final ProcParams
-        do {
-            if (sideProcParams && i == sideCarFilePos) {
-                // using the sidecar file
-                Glib::ustring sideProcessingParams = options.getParamFile(inputFile);
+                        // the "load" method don't reset the procparams values anymore, so values found in the procparam file override the one of currentParams
+                        if (!Glib::file_test(sideProcessingParams, Glib::FILE_TEST_EXISTS) || currentParams.load(nullptr, sideProcessingParams)) {
+                            cpl.info(Glib::ustring::compose("Warning: sidecar file requested but not found for: %1", sideProcessingParams));
+                        } else {
+                            sideCarFound = true;
+                            cpl.info("Merging sidecar procparams.");
+                        }
+                    }
 
-                // the "load" method don't reset the procparams values anymore, so values found in the procparam file override the one of currentParams
-                if (!Glib::file_test(sideProcessingParams, Glib::FILE_TEST_EXISTS) || currentParams.load(nullptr, sideProcessingParams)) {
-                    cpl.info(Glib::ustring::compose("Warning: sidecar file requested but not found for: %1", sideProcessingParams));
-                } else {
-                    sideCarFound = true;
-                    cpl.info("Merging sidecar procparams.");
-                }
-            }
+                    if (processingParams.size() > i) {
+                        cpl.info(Glib::ustring::compose("Merging procparams #%1", i));
+                        processingParams[i]->applyTo(currentParams);
+                    }
 
-            if (processingParams.size() > i) {
-                cpl.info(Glib::ustring::compose("Merging procparams #%1", i));
-                processingParams[i]->applyTo(currentParams);
-            }
+                    i++;
+                } while (i < processingParams.size() + (sideProcParams ? 1 : 0));
 
-            i++;
-        } while (i < processingParams.size() + (sideProcParams ? 1 : 0));
+                if (sideProcParams && !sideCarFound && skipIfNoSidecar) {
+                    budget.release(mem_usage);
+                    delete ii;
+                    errors++;
+                    cpl.error(Glib::ustring::compose("no sidecar procparams found for: %1", inputFile));
+                    return;
+                }
 
-        if (sideProcParams && !sideCarFound && skipIfNoSidecar) {
-            delete ii;
-            errors++;
-            cpl.error(Glib::ustring::compose("no sidecar procparams found for: %1", inputFile));
-            continue;
-        }
+                auto p = rtengine::ImageIOManager::getInstance()->getSaveProfile(outputType);
+                if (p) {
+                    p->applyTo(currentParams);
+                }
 
-        auto p = rtengine::ImageIOManager::getInstance()->getSaveProfile(outputType);
-        if (p) {
-            p->applyTo(currentParams);
-        }
+                job = create_processing_job(ii, currentParams, fast_export);
 
-        job = create_processing_job(ii, currentParams, fast_export);
+                if (!job) {
+                    budget.release(mem_usage);
+                    errors++;
+                    cpl.error(Glib::ustring::compose("impossible to create processing job for: %1", inputFile));
+                    ii->decreaseRef();
+                    return;
+                }
 
-        if (!job) {
-            errors++;
-            cpl.error(Glib::ustring::compose("impossible to create processing job for: %1", inputFile));
-            ii->decreaseRef();
-            continue;
-        }
+                // Process image
+                rtengine::IImagefloat *resultImage = rtengine::processImage(job, errorCode, pl);
 
-        // Process image
-        rtengine::IImagefloat *resultImage = rtengine::processImage(job, errorCode, pl);
+                if (!resultImage) {
+                    budget.release(mem_usage);
+                    errors++;
+                    cpl.error(Glib::ustring::compose("failure in processing: %1", inputFile));
+                    rtengine::ProcessingJob::destroy(job);
+                    return;
+                }
 
-        if (!resultImage) {
-            errors++;
-            cpl.error(Glib::ustring::compose("failure in processing: %1", inputFile));
-            rtengine::ProcessingJob::destroy(job);
-            continue;
-        }
+                // save image to disk
+                if (outputType == "jpg") {
+                    errorCode = resultImage->saveAsJPEG(outputFile, compression, subsampling);
+                } else if (outputType == "tif") {
+                    errorCode = resultImage->saveAsTIFF(outputFile, bits, isFloat, compression == 0);
+                } else if (outputType == "png") {
+                    errorCode = resultImage->saveAsPNG(outputFile, bits);
+                } else {
+                    errorCode = rtengine::ImageIOManager::getInstance()->save(resultImage, outputType, outputFile, nullptr) ? 0 : 1;
+                    //errorCode = resultImage->saveToFile(outputFile);
+                }
 
-        // save image to disk
-        if (outputType == "jpg") {
-            errorCode = resultImage->saveAsJPEG(outputFile, compression, subsampling);
-        } else if (outputType == "tif") {
-            errorCode = resultImage->saveAsTIFF(outputFile, bits, isFloat, compression == 0);
-        } else if (outputType == "png") {
-            errorCode = resultImage->saveAsPNG(outputFile, bits);
-        } else {
-            errorCode = rtengine::ImageIOManager::getInstance()->save(resultImage, outputType, outputFile, nullptr) ? 0 : 1;
-            //errorCode = resultImage->saveToFile(outputFile);
-        }
+                if (errorCode) {
+                    errors++;
+                    cpl.error(Glib::ustring::compose("failure in saving to: %1", outputFile));
+                } else {
+                    if (copyParamsFile) {
+                        Glib::ustring outputProcessingParams = outputFile + paramFileExtension;
+                        if (!options.params_out_embed || currentParams.saveEmbedded(pl, outputFile) != 0) {
+                            currentParams.save(pl, outputProcessingParams);
+                        }
+                    }
+                }
 
-        if (errorCode) {
-            errors++;
-            cpl.error(Glib::ustring::compose("failure in saving to: %1", outputFile));
-        } else {
-            if (copyParamsFile) {
-                Glib::ustring outputProcessingParams = outputFile + paramFileExtension;
-                if (!options.params_out_embed || currentParams.saveEmbedded(pl, outputFile) != 0) {
-                    currentParams.save(pl, outputProcessingParams);
+                ii->decreaseRef();
+                resultImage->free();
+                budget.release(mem_usage);
+            };
+
+    if (num_jobs > 1 && inputFiles.size() > 1) {
+        // process several images concurrently: while one is being decoded,
+        // others can be in the processing pipeline or being encoded and
+        // written to disk. The OpenMP threads are split among the jobs
+        const int jobs = std::min<size_t>(num_jobs, inputFiles.size());
+        std::atomic<size_t> next_file(0);
+        const auto worker =
+            [&]() -> void
+            {
+#ifdef _OPENMP
+                omp_set_num_threads(std::max(omp_get_num_procs() / jobs, 1));
+#endif
+                for (size_t i = next_file++; i < inputFiles.size(); i = next_file++) {
+                    process_file(i);
                 }
-            }
+            };
+        std::vector<std::thread> workers;
+        for (int i = 0; i < jobs; ++i) {
+            workers.emplace_back(worker);
+        }
+        for (auto &t : workers) {
+            t.join();
+        }
+    } else {
+        for (size_t iFile = 0; iFile < inputFiles.size(); iFile++) {
+            process_file(iFile);
         }
-
-        ii->decreaseRef();
-        resultImage->free();
     }
 
     if (progress) {
@@ -396,6 +396,7 @@ void Options::setDefaults()
     maxThumbnailHeight = 250;
     maxThumbnailWidth = 800;
     maxCacheEntries = 20000;
+    cache_pack_store = false;
     thumbInterp = 1;
     autoSuffix = true;
     forceFormatOpts = true;
@@ -465,6 +466,9 @@ void Options::setDefaults()
     inspectorDelay = 0;
     serializeTiffRead = true;
     denoiseZoomedOut = true;
+    batch_queue_memory_limit = 0;
+    batch_queue_max_jobs = 4;
+    extlut_cache_size = 256;
     wb_preview_mode = WB_BEFORE_HIGH_DETAIL;
 
     FileBrowserToolbarSingleRow = false;
@@ -574,6 +578,11 @@ void Options::setDefaults()
 #endif
     rtSettings.thread_pool_size = 0;
     rtSettings.ctl_scripts_fast_preview = true;
+    rtSettings.pipeline_cache_size = 0;
+    rtSettings.mask_cache_size = 0;
+    rtSettings.preview_pyramid_cache_size = 0;
+    rtSettings.demosaic_cache_size = 0;
+    rtSettings.output_strip_height = 0;
     show_exiftool_makernotes = false;
 
     browser_width_for_inspector = 0;
@@ -996,6 +1005,10 @@ void Options::readFromFile(Glib::ustring fname)
                     maxCacheEntries = keyFile.get_integer("File Browser", "MaxCacheEntries");
                 }
 
+                if (keyFile.has_key("File Browser", "CachePackStore")) {
+                    cache_pack_store = keyFile.get_boolean("File Browser", "CachePackStore");
+                }
+
                 if (keyFile.has_key("File Browser", "ParseExtensions")) {
                     auto l = keyFile.get_string_list("File Browser", "ParseExtensions");
                     if (!l.empty()) {
@@ -1147,6 +1160,38 @@ void Options::readFromFile(Glib::ustring fname)
                 if (keyFile.has_key("Performance", "CTLScriptsFastPreview")) {
                     rtSettings.ctl_scripts_fast_preview = keyFile.get_boolean("Performance", "CTLScriptsFastPreview");
                 }
+
+                if (keyFile.has_key("Performance", "PipelineCacheSize")) {
+                    rtSettings.pipeline_cache_size = std::max(keyFile.get_integer("Performance", "PipelineCacheSize"), 0);
+                }
+
+                if (keyFile.has_key("Performance", "MaskCacheSize")) {
+                    rtSettings.mask_cache_size = std::max(keyFile.get_integer("Performance", "MaskCacheSize"), 0);
+                }
+
+                if (keyFile.has_key("Performance", "PreviewPyramidCacheSize")) {
+                    rtSettings.preview_pyramid_cache_size = std::max(keyFile.get_integer("Performance", "PreviewPyramidCacheSize"), 0);
+                }
+
+                if (keyFile.has_key("Performance", "DemosaicCacheSize")) {
+                    rtSettings.demosaic_cache_size = std::max(keyFile.get_integer("Performance", "DemosaicCacheSize"), 0);
+                }
+
+                if (keyFile.has_key("Performance", "OutputStripHeight")) {
+                    rtSettings.output_strip_height = std::max(keyFile.get_integer("Performance", "OutputStripHeight"), 0);
+                }
+
+                if (keyFile.has_key("Performance", "BatchQueueMemoryLimit")) {
+                    batch_queue_memory_limit = std::max(keyFile.get_integer("Performance", "BatchQueueMemoryLimit"), 0);
+                }
+
+                if (keyFile.has_key("Performance", "BatchQueueMaxJobs")) {
+                    batch_queue_max_jobs = std::max(keyFile.get_integer("Performance", "BatchQueueMaxJobs"), 1);
+                }
+
+                if (keyFile.has_key("Performance", "ExtLUTCacheSize")) {
+                    extlut_cache_size = std::max(keyFile.get_integer("Performance", "ExtLUTCacheSize"), 1);
+                }
             }
 
             if (keyFile.has_group("Inspector")) {
@@ -1833,6 +1878,7 @@ void Options::saveToFile(Glib::ustring fname)
         keyFile.set_integer("File Browser", "MaxPreviewHeight", maxThumbnailHeight);
         keyFile.set_integer("File Browser", "MaxPreviewWidth", maxThumbnailWidth);
         keyFile.set_integer("File Browser", "MaxCacheEntries", maxCacheEntries);
+        keyFile.set_boolean("File Browser", "CachePackStore", cache_pack_store);
         Glib::ArrayHandle<Glib::ustring> pext = parseExtensions;
         keyFile.set_string_list("File Browser", "ParseExtensions", pext);
         Glib::ArrayHandle<int> pextena = parseExtensionsEnabled;
@@ -1886,6 +1932,14 @@ void Options::saveToFile(Glib::ustring fname)
         keyFile.set_boolean("Performance", "ThumbLazyCaching", thumb_lazy_caching);
         keyFile.set_boolean("Performance", "ThumbCacheProcessed", thumb_cache_processed);
         keyFile.set_boolean("Performance", "CTLScriptsFastPreview", rtSettings.ctl_scripts_fast_preview);
+        keyFile.set_integer("Performance", "PipelineCacheSize", rtSettings.pipeline_cache_size);
+        keyFile.set_integer("Performance", "MaskCacheSize", rtSettings.mask_cache_size);
+        keyFile.set_integer("Performance", "PreviewPyramidCacheSize", rtSettings.preview_pyramid_cache_size);
+        keyFile.set_integer("Performance", "DemosaicCacheSize", rtSettings.demosaic_cache_size);
+        keyFile.set_integer("Performance", "OutputStripHeight", rtSettings.output_strip_height);
+        keyFile.set_integer("Performance", "BatchQueueMemoryLimit", batch_queue_memory_limit);
+        keyFile.set_integer("Performance", "BatchQueueMaxJobs", batch_queue_max_jobs);
+        keyFile.set_integer("Performance", "ExtLUTCacheSize", extlut_cache_size);
         
         keyFile.set_integer("Performance", "WBPreviewMode", wb_preview_mode);
         keyFile.set_integer("Inspector", "Mode", int(rtSettings.thumbnail_inspector_mode));
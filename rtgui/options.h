@@ -298,6 +298,7 @@ public:
     int maxThumbnailHeight;
     int maxThumbnailWidth;
     std::size_t maxCacheEntries;
+    bool cache_pack_store; // keep the thumbnail cache in a single pack file
     int thumbInterp; // 0: nearest, 1: bilinear
     std::vector<Glib::ustring> parseExtensions;   // List containing all extensions type
     std::vector<int> parseExtensionsEnabled;      // List of bool to retain extension or not
@@ -366,6 +367,9 @@ public:
     prevdemo_t prevdemo; // Demosaicing method used for the <100% preview
     bool serializeTiffRead;
     bool denoiseZoomedOut;
+    int batch_queue_memory_limit; // memory (in MB) for processing queue entries in parallel; 0 = one entry at a time
+    int batch_queue_max_jobs; // maximum number of queue entries processed in parallel
+    int extlut_cache_size; // memory (in MB) for the generated external 3D LUTs kept in memory
     enum WBPreviewMode {
         WB_AFTER, // apply WB after demosaicing (faster)
         WB_BEFORE, // always apply WB before demosaicing
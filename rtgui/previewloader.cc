@@ -21,12 +21,13 @@
 #include "previewloader.h"
 #include "guiutils.h"
 #include "threadutils.h"
-#include <thread>
 #include <chrono>
-#include <deque>
-#include <atomic>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
 #include "options.h"
 #include "../rtengine/threadpool.h"
+#include "../rtengine/rt_math.h"
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -55,79 +56,179 @@ public:
         Glib::ustring dir_entry_;
         PreviewLoaderListener* listener_;
     };
-    /* Issue 2406
-        struct OutputJob
-        {
-            bool complete;
-            int dir_id;
-            PreviewLoaderListener* listener;
-            FileBrowserEntry* fdn;
-        };
-    */
-    struct JobCompare {
-        bool operator()(const Job& lhs, const Job& rhs) const
-        {
-            if ( lhs.dir_id_ == rhs.dir_id_ ) {
-                return lhs.dir_entry_ < rhs.dir_entry_;
-            }
 
-            return lhs.dir_id_ < rhs.dir_id_;
+    typedef std::chrono::steady_clock Clock;
+
+    Impl():
+        dir_id_(0),
+        listener_(nullptr),
+        next_position_(0),
+        visible_first_(0),
+        visible_last_(0),
+        num_workers_(0),
+        max_workers_(1),
+        direction_(1),
+        window_jobs_(0),
+        last_throughput_(0)
+    {
+        int n = 1;
+#ifdef _OPENMP
+        n = omp_get_num_procs();
+#endif
+        workers_limit_ = std::max(n, 1);
+        max_workers_ = std::max(workers_limit_ / 2, 1);
+    }
+
+    MyMutex mutex_;
+
+    // the queued jobs of the current directory, indexed by their position in
+    // the directory listing (which is sorted like the file browser)
+    int dir_id_;
+    PreviewLoaderListener *listener_;
+    std::map<int, Job> jobs_;
+    std::unordered_map<std::string, int> positions_;
+    int next_position_;
+
+    // range of positions currently shown by the file browser
+    int visible_first_;
+    int visible_last_;
+
+    // concurrency control: each worker is a chain of thread pool tasks, each
+    // running one job and then queueing the next one, so that tasks of
+    // higher priority are not starved
+    int num_workers_;
+    int max_workers_;
+    int workers_limit_;
+    int direction_;
+    int window_jobs_;
+    Clock::time_point window_start_;
+    double last_throughput_;
+
+    void clear()
+    {
+        listener_ = nullptr;
+        jobs_.clear();
+        positions_.clear();
+        next_position_ = 0;
+        visible_first_ = visible_last_ = 0;
+    }
+
+    // the queued job nearest to the visible range, looking ahead on ties
+    std::map<int, Job>::iterator nextJob()
+    {
+        auto it = jobs_.lower_bound(visible_first_);
+        if (it == jobs_.begin() || (it != jobs_.end() && it->first <= visible_last_)) {
+            return it;
         }
-    };
+        auto prev = std::prev(it);
+        if (it == jobs_.end() || visible_first_ - prev->first < it->first - visible_last_) {
+            return prev;
+        }
+        return it;
+    }
 
-    typedef std::set<Job, JobCompare> JobSet;
+    void startWorkers()
+    {
+        while (num_workers_ < max_workers_ && num_workers_ < int(jobs_.size())) {
+            ++num_workers_;
+            rtengine::ThreadPool::add_task(rtengine::ThreadPool::Priority::LOWEST, sigc::mem_fun(*this, &PreviewLoader::Impl::processNextJob));
+        }
+    }
 
-    Impl(): num_concurrent_threads_(0), job_count_(0)
+    // Hill climbing on the throughput: every few jobs the number of workers
+    // is moved by one in the current direction, and the direction is
+    // reversed when that did not help. On a local SSD with cached entries
+    // this converges to the number of cores, on a slow disk or a network
+    // share (where more concurrent reads only add latency) to a few workers
+    void updateConcurrency()
     {
+        const auto now = Clock::now();
+        if (window_jobs_ == 0) {
+            window_start_ = now;
+        }
+        if (++window_jobs_ < std::max(2 * max_workers_, 8)) {
+            return;
+        }
+
+        const double secs = std::chrono::duration<double>(now - window_start_).count();
+        const double throughput = window_jobs_ / std::max(secs, 1e-6);
+        if (throughput < last_throughput_ * 1.05) {
+            direction_ = -direction_;
+        }
+        last_throughput_ = throughput;
+        window_jobs_ = 0;
+
+        max_workers_ = rtengine::LIM(max_workers_ + direction_, 1, workers_limit_);
+        DEBUG("%.1f jobs/s, now using %d workers", throughput, max_workers_);
     }
 
-    MyMutex mutex_;
-    std::deque<Job> jobs_;
-    std::atomic<int> num_concurrent_threads_;
-    size_t job_count_;
+    // called with mutex_ locked. Returns the listener to notify if this was
+    // the last worker and there is nothing left to do
+    PreviewLoaderListener *stopWorker()
+    {
+        if (--num_workers_ > 0 || !jobs_.empty()) {
+            return nullptr;
+        }
+        window_jobs_ = 0;
+        return listener_;
+    }
 
     void processNextJob()
     {
         Job j;
+        bool found = false;
+        PreviewLoaderListener *finished = nullptr;
+        int finished_dir_id = 0;
+
         {
             MyMutex::MyLock lock(mutex_);
 
-            // nothing to do; could be jobs have been removed
-            if ( jobs_.empty() ) {
+            // nothing to do, or too many workers: could be jobs have been
+            // removed or the concurrency has been reduced
+            if (jobs_.empty() || num_workers_ > max_workers_) {
                 DEBUG("processing: nothing to do");
-                return;
+                finished = stopWorker();
+                finished_dir_id = dir_id_;
+            } else {
+                auto it = nextJob();
+                j = it->second;
+                jobs_.erase(it);
+                found = true;
+                DEBUG("processing %s", j.dir_entry_.c_str());
+                DEBUG("%d job(s) remaining", jobs_.size());
             }
-
-            // copy and remove front job
-            j = jobs_.front();
-            jobs_.pop_front();
-            DEBUG("processing %s", j.dir_entry_.c_str());
-            DEBUG("%d job(s) remaining", jobs_.size());
         }
 
-        ++num_concurrent_threads_; // to detect when last thread in pool has run out
-        try {
-            Thumbnail* tmb = nullptr;
-            if (Glib::file_test(j.dir_entry_, Glib::FILE_TEST_EXISTS)) {
-                tmb = cacheMgr->getEntry(j.dir_entry_);
-            }
-
-            if (tmb) {
-                DEBUG("Preview Ready\n");
-                j.listener_->previewReady(j.dir_id_, new FileBrowserEntry(tmb, j.dir_entry_));
-            }
+        if (found) {
+            try {
+                Thumbnail* tmb = nullptr;
+                if (Glib::file_test(j.dir_entry_, Glib::FILE_TEST_EXISTS)) {
+                    tmb = cacheMgr->getEntry(j.dir_entry_);
+                }
 
-            if (++job_count_ % 20 == 0) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-            }                
+                if (tmb) {
+                    DEBUG("Preview Ready\n");
+                    j.listener_->previewReady(j.dir_id_, new FileBrowserEntry(tmb, j.dir_entry_));
+                }
+            } catch (Glib::Error &e) {} catch(...) {}
 
-        } catch (Glib::Error &e) {} catch(...) {}
+            MyMutex::MyLock lock(mutex_);
 
-        bool last = num_concurrent_threads_--;
+            if (j.dir_id_ == dir_id_) {
+                updateConcurrency();
+            }
+            if (jobs_.empty() || num_workers_ > max_workers_) {
+                finished = stopWorker();
+                finished_dir_id = dir_id_;
+            } else {
+                rtengine::ThreadPool::add_task(rtengine::ThreadPool::Priority::LOWEST, sigc::mem_fun(*this, &PreviewLoader::Impl::processNextJob));
+                startWorkers();
+            }
+        }
 
         // signal at end
-        if (last && jobs_.empty()) {
-            j.listener_->previewsFinished(j.dir_id_);
+        if (finished) {
+            finished->previewsFinished(finished_dir_id);
         }
     }
 };
@@ -156,17 +257,41 @@ void PreviewLoader::add(int dir_id, const Glib::ustring& dir_entry, PreviewLoade
 {
     // somebody listening?
     if (l != nullptr) {
-        {
-            MyMutex::MyLock lock(impl_->mutex_);
+        MyMutex::MyLock lock(impl_->mutex_);
 
-            // create a new job and append to queue
-            DEBUG("saving job %s", dir_entry.c_str());
-            impl_->jobs_.push_back(Impl::Job(dir_id, dir_entry, l));
+        // the jobs of a directory that has been left are cancelled
+        if (dir_id != impl_->dir_id_) {
+            impl_->clear();
+            impl_->dir_id_ = dir_id;
         }
 
-        // queue a run request
-        DEBUG("adding run request %s", dir_entry.c_str());
-        rtengine::ThreadPool::add_task(rtengine::ThreadPool::Priority::LOWEST, sigc::mem_fun(*impl_, &PreviewLoader::Impl::processNextJob));
+        // create a new job and append to queue
+        DEBUG("saving job %s", dir_entry.c_str());
+        const int pos = impl_->next_position_++;
+        impl_->positions_[dir_entry.raw()] = pos;
+        impl_->jobs_[pos] = Impl::Job(dir_id, dir_entry, l);
+        impl_->listener_ = l;
+
+        // queue a run request, if needed
+        impl_->startWorkers();
+    }
+}
+
+
+void PreviewLoader::setVisibleRange(int dir_id, const Glib::ustring& first, const Glib::ustring& last)
+{
+    MyMutex::MyLock lock(impl_->mutex_);
+
+    if (dir_id != impl_->dir_id_) {
+        return;
+    }
+
+    const auto f = impl_->positions_.find(first.raw());
+    const auto l = impl_->positions_.find(last.raw());
+    if (f != impl_->positions_.end() && l != impl_->positions_.end()) {
+        impl_->visible_first_ = std::min(f->second, l->second);
+        impl_->visible_last_ = std::max(f->second, l->second);
+        DEBUG("visible range: %d-%d", impl_->visible_first_, impl_->visible_last_);
     }
 }
 
@@ -174,5 +299,5 @@ void PreviewLoader::add(int dir_id, const Glib::ustring& dir_entry, PreviewLoade
 void PreviewLoader::removeAllJobs()
 {
     MyMutex::MyLock lock(impl_->mutex_);
-    impl_->jobs_.clear();
+    impl_->clear();
 }
@@ -71,10 +71,24 @@ public:
      */
     void add(int dir_id, const Glib::ustring& dir_entry, PreviewLoaderListener* l);
 
+    /**
+     * @brief Tell which entries are currently shown.
+     *
+     * Jobs are processed in order of distance from the range of entries
+     * between \c first and \c last (in the order they were added), so
+     * that the previews on screen are loaded first.
+     *
+     * @param dir_id directory we're looking at
+     * @param first first visible entry
+     * @param last last visible entry
+     */
+    void setVisibleRange(int dir_id, const Glib::ustring& first, const Glib::ustring& last);
+
     /**
      * @brief Stop processing and remove all jobs.
      *
-     * Will not return till all jobs have completed.
+     * Jobs being processed will be finished, but their results are ignored
+     * by the listeners if the directory has changed.
      *
      * @note expects to be called inside gtk thread lock
      */
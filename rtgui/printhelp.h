@@ -45,9 +45,12 @@ inline void ART_print_help(std::ostream &out, const char *progname, bool gui)
         out << "  " << pn << " <other options> -c <dir>|<files>   Convert files in batch with your own settings." << std::endl;
         out << "  " << pn << " --make-icc <make-icc options>   Build an ICC output color profile." << std::endl;
         out << "  " << pn << " --check-lut <lut-filename>   Check the validity of the given LUT file." << std::endl;
+#ifdef BENCHMARK
+        out << "  " << pn << " --benchmark [<name> ...]   Run the benchmarks of the processing engine." << std::endl;
+#endif
         out << std::endl;
         out << "Options:" << std::endl;
-        out << "  " << pn << "[-o <output>|-O <output>] [-q] [-a] [-s|-S] [-p <one" << paramFileExtension << "> [-p <two" << paramFileExtension << "> ...] ] [-d] [ -j[1-100] -js<1-3> | -t[z] -b<8|16|16f|32> | -n -b<8|16> | -Ttype ] [-Y] [-f] -c <input>" << std::endl;
+        out << "  " << pn << "[-o <output>|-O <output>] [-q] [-a] [-s|-S] [-p <one" << paramFileExtension << "> [-p <two" << paramFileExtension << "> ...] ] [-d] [ -j[1-100] -js<1-3> | -t[z] -b<8|16|16f|32> | -n -b<8|16> | -Ttype ] [-Y] [-f] [-P <n> [-M <MB>]] -c <input>" << std::endl;
         out << std::endl;
         out << "  -c <files>       Specify one or more input files or folders. When specifying\n"
             << "                   folders, ART will look for image file types which comply with\n"
@@ -98,6 +101,9 @@ inline void ART_print_help(std::ostream &out, const char *progname, bool gui)
             << "                   by a user-defined custom image saver." << std::endl;
         out << "  -Y               Overwrite output if present." << std::endl;
         out << "  -f               Use the custom fast-export processing pipeline." << std::endl;
+        out << "  -P <n>           Process up to n images concurrently (default: 1)." << std::endl;
+        out << "  -M <MB>          Limit the estimated memory used by the images processed\n"
+            << "                   concurrently with -P (default: 0, no limit)." << std::endl;
         out << "  -V               Verbose output." << std::endl;
         out << "  --progress       Show progress info in a format compatible with zenity." << std::endl;
         out << std::endl;
@@ -35,6 +35,7 @@ Resize::Resize():
     EvResizeAllowUpscaling = m->newEvent(RESIZE, "HISTORY_MSG_RESIZE_ALLOWUPSCALING");
     EvUnit = m->newEvent(RESIZE, "HISTORY_MSG_RESIZE_UNIT");
     EvPPI = m->newEvent(RESIZE, "HISTORY_MSG_RESIZE_PPI");
+    EvFilter = m->newEvent(RESIZE, "HISTORY_MSG_RESIZE_FILTER");
     EvToolReset.set_action(RESIZE);
 
     cropw = 0;
@@ -52,6 +53,19 @@ Resize::Resize():
     combos->attach (*label, 0, 1, 0, 1, Gtk::SHRINK, Gtk::SHRINK, 2, 2);
     combos->attach (*appliesTo, 1, 2, 0, 1, Gtk::EXPAND | Gtk::FILL, Gtk::SHRINK, 2, 2);
 
+    filter = Gtk::manage (new MyComboBoxText ());
+    filter->append (M("TP_RESIZE_LANCZOS3"));
+    filter->append (M("TP_RESIZE_LANCZOS2"));
+    filter->append (M("TP_RESIZE_LANCZOS4"));
+    filter->append (M("TP_RESIZE_MITCHELL"));
+    filter->append (M("TP_RESIZE_CATMULLROM"));
+    filter->set_active (0);
+
+    label = Gtk::manage (new Gtk::Label (M("TP_RESIZE_FILTER")));
+    label->set_alignment(0., 0.);
+    combos->attach (*label, 0, 1, 1, 2, Gtk::SHRINK, Gtk::SHRINK, 2, 2);
+    combos->attach (*filter, 1, 2, 1, 2, Gtk::EXPAND | Gtk::FILL, Gtk::SHRINK, 2, 2);
+
     spec = Gtk::manage (new MyComboBoxText ());
     spec->append (M("TP_RESIZE_SCALE"));
     spec->append (M("TP_RESIZE_WIDTH"));
@@ -168,6 +182,7 @@ Resize::Resize():
     hconn = h->signal_value_changed().connect ( sigc::mem_fun(*this, &Resize::entryHChanged), true);
     aconn = appliesTo->signal_changed().connect ( sigc::mem_fun(*this, &Resize::appliesToChanged) );
     sconn = spec->signal_changed().connect ( sigc::mem_fun(*this, &Resize::specChanged) );
+    fconn = filter->signal_changed().connect ( sigc::mem_fun(*this, &Resize::filterChanged) );
     ppiconn = ppi->signal_value_changed().connect(sigc::mem_fun(*this, &Resize::ppiChanged));
     unitconn = unit->signal_changed().connect(sigc::mem_fun(*this, &Resize::unitChanged));
 
@@ -199,6 +214,7 @@ void Resize::read(const ProcParams* pp)
     ConnectionBlocker wb(wconn);
     ConnectionBlocker hb(hconn);
     ConnectionBlocker sb(sconn);
+    ConnectionBlocker fb(fconn);
     ConnectionBlocker ub(unitconn);
     ConnectionBlocker pb(ppiconn);
     scale->block(true);
@@ -213,6 +229,7 @@ void Resize::read(const ProcParams* pp)
     allowUpscaling->set_active(pp->resize.allowUpscaling);
     unit->set_active(int(pp->resize.unit));
     ppi->set_value(pp->resize.ppi);
+    filter->set_active(int(pp->resize.filter));
 
     updateInfoLabels();
     updateGUI();
@@ -258,6 +275,7 @@ void Resize::write(ProcParams* pp)
 
     pp->resize.unit = ResizeParams::Unit(unit->get_active_row_number());
     pp->resize.ppi = ppi->get_value_as_int();
+    pp->resize.filter = ResizeParams::Filter(filter->get_active_row_number());
 }
 
 
@@ -526,6 +544,13 @@ void Resize::entryHChanged ()
     }
 }
 
+void Resize::filterChanged ()
+{
+    if (listener && getEnabled()) {
+        listener->panelChanged (EvFilter, filter->get_active_text ());
+    }
+}
+
 void Resize::specChanged ()
 {
 
@@ -48,7 +48,7 @@ public:
     void entryWChanged();
     void entryHChanged();
     void appliesToChanged();
-    void methodChanged();
+    void filterChanged();
     void specChanged();
     void update(bool isCropped, int cw, int ch, int ow = 0, int oh = 0);
     void setGUIFromCrop(bool isCropped, int cw, int ch);
@@ -80,10 +80,12 @@ private:
     rtengine::ProcEvent EvResizeAllowUpscaling;
     rtengine::ProcEvent EvUnit;
     rtengine::ProcEvent EvPPI;
+    rtengine::ProcEvent EvFilter;
     Adjuster *scale;
     Gtk::VBox *sizeBox;
     MyComboBoxText *appliesTo;
     MyComboBoxText *spec;
+    MyComboBoxText *filter;
     MySpinButton *w;
     MySpinButton *h;
     Gtk::CheckButton *allowUpscaling;
@@ -96,7 +98,7 @@ private:
     int maxw, maxh;
     int cropw, croph;
     rtengine::procparams::ResizeParams::Unit prev_unit;
-    sigc::connection sconn, aconn, wconn, hconn;
+    sigc::connection sconn, aconn, wconn, hconn, fconn;
     sigc::connection unitconn, ppiconn;
     bool wDirty, hDirty;
     ToolParamBlock *packBox;
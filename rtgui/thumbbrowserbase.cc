@@ -952,6 +952,7 @@ bool ThumbBrowserBase::Internal::on_draw(const ::Cairo::RefPtr< Cairo::Context>
 
     // std::cout << "\nREDRAWING\n" << std::endl;
 
+    Glib::ustring first, last;
     {
         MYWRITERLOCK(l, parent->entryRW);
 
@@ -960,6 +961,10 @@ bool ThumbBrowserBase::Internal::on_draw(const ::Cairo::RefPtr< Cairo::Context>
                 parent->fd[i]->updatepriority = false;
             } else {
                 parent->fd[i]->updatepriority = true;
+                if (first.empty()) {
+                    first = parent->fd[i]->filename;
+                }
+                last = parent->fd[i]->filename;
                 // if (parent->fd[i]->requestDraw()) {
                 //     // to_draw.push_back(parent->fd[i]);
                 // } else {
@@ -970,7 +975,12 @@ bool ThumbBrowserBase::Internal::on_draw(const ::Cairo::RefPtr< Cairo::Context>
         }
     }
     style->render_frame(cr, 0., 0., w, h);
-    
+
+    if (!first.empty() && (first != visible_first || last != visible_last)) {
+        visible_first = first;
+        visible_last = last;
+        parent->visibleRangeChanged(first, last);
+    }
 
     return true;
 }
@@ -39,6 +39,10 @@ class ThumbBrowserBase  :  public Gtk::Grid
         // int ofsX, ofsY;
         ThumbBrowserBase* parent;
         bool dirty;
+        // file names of the first and last visible entries, as last reported
+        // to visibleRangeChanged()
+        Glib::ustring visible_first;
+        Glib::ustring visible_last;
 
         // caching some very often used values
         Glib::RefPtr<Gtk::StyleContext> style;
@@ -237,6 +241,8 @@ public:
         return true;
     }
     virtual void selectionChanged () {}
+    // called from on_draw() when the set of entries on screen has changed
+    virtual void visibleRangeChanged (const Glib::ustring& first, const Glib::ustring& last) {}
 
     virtual void redrawEntryNeeded(ThumbBrowserEntryBase* entry);
     virtual void thumbRearrangementNeeded () {}
@@ -118,10 +118,12 @@ public:
                 }
             }
 
-            // if none, then use first
+            // if none, then use the most recent: jobs are queued when their
+            // entry is drawn, so the last ones are the nearest to what is
+            // on screen after scrolling
             if ( i == jobs_.end() ) {
-                i = jobs_.begin();
-                DEBUG("processing(first) %s", i->tbe_->thumbnail->getFileName().c_str());
+                i = std::prev(jobs_.end());
+                DEBUG("processing(last) %s", i->tbe_->thumbnail->getFileName().c_str());
             }
 
             // copy found job
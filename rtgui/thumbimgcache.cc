@@ -21,154 +21,279 @@
 #include "thumbimgcache.h"
 #include "../rtengine/image8.h"
 #include "options.h"
+#include "cachemanager.h"
 #include <iostream>
-#include <glib/gstdio.h>
+#include <cstring>
+#include <zlib.h>
 
 extern Options options;
 
 namespace art { namespace thumbimgcache {
 
-/******************************************************************************
- * file format:
- *
- * "ART\n" header
- * monitor hash
- * size of the procparams
- * compressed procparams
- * width
- * height
- * image data
- ******************************************************************************/
-rtengine::IImage8 *load(const Glib::ustring &cache_fname, const rtengine::procparams::ProcParams &pparams, int h)
+namespace {
+
+constexpr const char *HEADER = "ART2\n";
+constexpr size_t HEADER_SIZE = 5;
+constexpr guint32 MAX_HEIGHTS = 4;
+
+guint64 params_hash(const rtengine::procparams::ProcParams &pparams)
 {
-    if (!options.thumb_cache_processed) {
-        return nullptr;
+    // 64-bit FNV-1a of the serialized params
+    const std::string data = pparams.to_data();
+    guint64 h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : data) {
+        h ^= c;
+        h *= 0x100000001b3ULL;
     }
+    return h;
+}
+
+
+class Reader {
+public:
+    explicit Reader(const std::string &buf): buf_(buf), pos_(0) {}
+
+    bool read(void *dst, size_t n)
+    {
+        if (buf_.size() - pos_ < n) {
+            return false;
+        }
+        memcpy(dst, buf_.data() + pos_, n);
+        pos_ += n;
+        return true;
+    }
+
+    bool skip(size_t n)
+    {
+        if (buf_.size() - pos_ < n) {
+            return false;
+        }
+        pos_ += n;
+        return true;
+    }
+
+    const char *data() const { return buf_.data() + pos_; }
+    size_t pos() const { return pos_; }
     
-    Glib::ustring fname = cache_fname + ".artt";
+private:
+    const std::string &buf_;
+    size_t pos_;
+};
 
-    if (!Glib::file_test(fname, Glib::FILE_TEST_EXISTS)) {
-        return nullptr;
+
+template <class T>
+void put(std::string &buf, T val)
+{
+    buf.append(reinterpret_cast<const char *>(&val), sizeof(T));
+}
+
+
+// the pixels are delta-coded along each row before compression, which
+// typically makes the zlib output 2-3 times smaller than on the raw data
+std::string encode_pixels(rtengine::IImage8 *img)
+{
+    std::string pixels;
+    img->writeData(pixels);
+
+    const size_t rowsize = size_t(img->getWidth()) * 3;
+    for (size_t row = 0; rowsize > 3 && row + rowsize <= pixels.size(); row += rowsize) {
+        for (size_t i = rowsize - 1; i >= 3; --i) {
+            pixels[row + i] -= pixels[row + i - 3];
+        }
     }
 
-    FILE *f = g_fopen(fname.c_str(), "rb");
+    uLongf zsize = compressBound(pixels.size());
+    std::string res(zsize, '\0');
+    if (compress2(reinterpret_cast<Bytef *>(&res[0]), &zsize, reinterpret_cast<const Bytef *>(pixels.data()), pixels.size(), 1) != Z_OK) {
+        return "";
+    }
+    res.resize(zsize);
+    return res;
+}
+
 
-    if (!f) {
+rtengine::Image8 *decode_pixels(const char *zdata, size_t zsize, guint32 width, guint32 height)
+{
+    const size_t rowsize = size_t(width) * 3;
+    uLongf size = rowsize * height;
+    std::string pixels(size, '\0');
+    if (uncompress(reinterpret_cast<Bytef *>(&pixels[0]), &size, reinterpret_cast<const Bytef *>(zdata), zsize) != Z_OK || size != pixels.size()) {
         return nullptr;
     }
 
+    for (size_t row = 0; row < pixels.size(); row += rowsize) {
+        for (size_t i = 3; i < rowsize; ++i) {
+            pixels[row + i] += pixels[row + i - 3];
+        }
+    }
+
+    rtengine::Image8 *image = new rtengine::Image8(width, height);
+    image->readData(pixels.data(), pixels.size());
+    return image;
+}
+
+
+struct Entry {
+    guint32 width;
+    guint32 height;
+    size_t offset;
+    guint32 size;
+};
+
+
+// parses the header of a cache record, and returns the list of stored
+// images if it is valid for the given monitor and processing params
+bool parse(const std::string &buf, guint64 phash, std::vector<Entry> &entries)
+{
+    Reader rd(buf);
+
     // header
-    char buffer[64];
-    fgets(buffer, 5, f);
-    if (strcmp(buffer, "ART\n") != 0) {
-        return nullptr;
+    if (buf.compare(0, HEADER_SIZE, HEADER) != 0) {
+        return false;
     }
+    rd.skip(HEADER_SIZE);
 
     // monitor hash
-    if (fread(buffer, sizeof(char), 33, f) < 33) {
-        return nullptr;
+    guint32 len = 0;
+    if (!rd.read(&len, sizeof(guint32)) || len > 256) {
+        return false;
     }
-    buffer[33] = '\0';
-    if (strcmp(buffer, rtengine::ICCStore::getInstance()->getThumbnailMonitorHash().c_str()) != 0) {
-        fclose(f);
-        return nullptr;
+    std::string mhash(len, '\0');
+    if (!rd.read(&mhash[0], len) || mhash != rtengine::ICCStore::getInstance()->getThumbnailMonitorHash()) {
+        return false;
     }
 
-    // size of the profile data
-    guint32 profsz = 0;
-    if (fread(&profsz, 1, sizeof(guint32), f) < sizeof(guint32)) {
-        fclose(f);
-        return nullptr;
+    // procparams hash
+    guint64 h = 0;
+    if (!rd.read(&h, sizeof(guint64)) || h != phash) {
+        return false;
     }
 
-    rtengine::procparams::ProcParams imgparams;
-    {
-        std::vector<uint8_t> profzdata(profsz);
-        if (fread(&profzdata[0], sizeof(uint8_t), profsz, f) < profsz) {
-            fclose(f);
-            return nullptr;
+    guint32 count = 0;
+    if (!rd.read(&count, sizeof(guint32)) || count > MAX_HEIGHTS) {
+        return false;
+    }
+
+    for (guint32 i = 0; i < count; ++i) {
+        Entry e;
+        if (!rd.read(&e.width, sizeof(guint32)) || !rd.read(&e.height, sizeof(guint32)) || !rd.read(&e.size, sizeof(guint32))) {
+            return false;
         }
-        std::string profdata = rtengine::decompress(profzdata);
-        if (!imgparams.from_data(profdata.c_str())) {
-            fclose(f);
-            return nullptr;
+        e.offset = rd.pos();
+        if (!rd.skip(e.size)) {
+            return false;
         }
-    }
-    if (imgparams != pparams) {
-        fclose(f);
-        return nullptr;
+        entries.push_back(e);
     }
 
-    guint32 width = 0, height = 0;
+    return true;
+}
+
+} // namespace
 
-    if (fread(&width, 1, sizeof(guint32), f) < sizeof(guint32)) {
-        fclose(f);
-        return nullptr;
-    }
 
-    if (fread(&height, 1, sizeof(guint32), f) < sizeof(guint32)) {
-        fclose(f);
+/******************************************************************************
+ * file format:
+ *
+ * "ART2\n" header
+ * size of the monitor hash
+ * monitor hash
+ * 64-bit hash of the procparams
+ * number of stored images (one per thumbnail height, most recent first)
+ * for each image:
+ *   width
+ *   height
+ *   size of the compressed data
+ *   compressed, row delta-coded image data
+ ******************************************************************************/
+rtengine::IImage8 *load(const Glib::ustring &cache_fname, const rtengine::procparams::ProcParams &pparams, int h)
+{
+    if (!options.thumb_cache_processed) {
         return nullptr;
     }
+    
+    Glib::ustring fname = cache_fname + ".artt";
 
-    if (std::min(width , height) <= 0) {
-        fclose(f);
+    std::string buf;
+    if (!CacheManager::getInstance()->loadCacheFile(fname, buf)) {
         return nullptr;
     }
 
-    if (guint32(h) != height) {
-        fclose(f);
+    std::vector<Entry> entries;
+    if (!parse(buf, params_hash(pparams), entries)) {
         return nullptr;
     }
 
-    rtengine::Image8 *image = new rtengine::Image8(width, height);
-    image->readData(f);
-    fclose(f);
+    for (auto &e : entries) {
+        if (e.height == guint32(h) && e.width > 0) {
+            rtengine::Image8 *image = decode_pixels(buf.data() + e.offset, e.size, e.width, e.height);
 
-    // if (guint32(h) < height) {
-    //     int w = int(float(width) * float(guint32(h) / height));
-    //     rtengine::Image8 *resized = new rtengine::Image8(w, h);
-    //     image->resizeImgTo<>(w, h, rtengine::TI_Nearest, resized);
-    //     delete image;
-    //     image = resized;
-    // }
+            if (image && options.rtSettings.verbose > 1) {
+                std::cout << "read from cache: " << fname << " " << e.width << "x" << e.height << std::endl;
+            }
 
-    if (options.rtSettings.verbose > 1) {
-        std::cout << "read from cache: " << fname << " " << width << "x" << height << std::endl;
+            return image;
+        }
     }
 
-    return image;
+    return nullptr;
 }
 
 
 bool store(const Glib::ustring &cache_fname, const rtengine::procparams::ProcParams &pparams, rtengine::IImage8 *img)
 {
-    if (!options.thumb_cache_processed) {
+    if (!options.thumb_cache_processed || !img) {
         return false;
     }
     
     Glib::ustring fname = cache_fname + ".artt";
-    FILE *f = g_fopen(fname.c_str(), "wb");
 
-    if (!f) {
+    const guint64 phash = params_hash(pparams);
+    const guint32 w = guint32(img->getWidth());
+    const guint32 h = guint32(img->getHeight());
+
+    std::string zdata = encode_pixels(img);
+    if (zdata.empty()) {
         return false;
     }
 
-    fputs("ART\n", f);
-    fputs(rtengine::ICCStore::getInstance()->getThumbnailMonitorHash().c_str(), f);
-    std::vector<uint8_t> profzdata = rtengine::compress(pparams.to_data(), 1);
-    guint32 profsz = guint32(profzdata.size());
-    fwrite(&profsz, sizeof(guint32), 1, f);
-    fwrite(&profzdata[0], sizeof(uint8_t), profsz, f);
+    // keep the images at other heights stored for the same params
+    std::string old;
+    std::vector<Entry> entries;
+    if (CacheManager::getInstance()->loadCacheFile(fname, old) && !parse(old, phash, entries)) {
+        entries.clear();
+    }
 
-    guint32 w = guint32(img->getWidth());
-    guint32 h = guint32(img->getHeight());
-    fwrite(&w, sizeof(guint32), 1, f);
-    fwrite(&h, sizeof(guint32), 1, f);
+    const std::string &mhash = rtengine::ICCStore::getInstance()->getThumbnailMonitorHash();
+    
+    std::string buf = HEADER;
+    put(buf, guint32(mhash.size()));
+    buf += mhash;
+    put(buf, phash);
 
-    img->writeData(f);
+    std::vector<const Entry *> keep;
+    for (auto &e : entries) {
+        if (e.height != h && keep.size() + 1 < MAX_HEIGHTS) {
+            keep.push_back(&e);
+        }
+    }
+    put(buf, guint32(keep.size() + 1));
 
-    fclose(f);
+    put(buf, w);
+    put(buf, h);
+    put(buf, guint32(zdata.size()));
+    buf += zdata;
+
+    for (auto e : keep) {
+        put(buf, e->width);
+        put(buf, e->height);
+        put(buf, e->size);
+        buf.append(old, e->offset, e->size);
+    }
+
+    if (!CacheManager::getInstance()->storeCacheFile(fname, buf)) {
+        return false;
+    }
 
     if (options.rtSettings.verbose > 1) {
         std::cout << "saved in cache: " << fname << " " << w << "x" << h << std::endl;
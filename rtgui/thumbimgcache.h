@@ -24,22 +24,13 @@
 #include "../rtengine/iccstore.h"
 #include "../rtengine/procparams.h"
 #include "../rtengine/rtengine.h"
-#include "../rtengine/compress.h"
 #include <glibmm.h>
 
 namespace art { namespace thumbimgcache {
 
-/******************************************************************************
- * file format:
- *
- * "ART\n" header
- * monitor hash
- * size of the procparams
- * compressed procparams
- * width
- * height
- * image data
- ******************************************************************************/
+// processed thumbnails, stored in the "images" cache dir with the .artt
+// extension. Several heights can be stored for the same processing params;
+// see thumbimgcache.cc for the format
 rtengine::IImage8 *load(const Glib::ustring &cache_fname, const rtengine::procparams::ProcParams &pparams, int h);
 
 bool store(const Glib::ustring &cache_fname, const rtengine::procparams::ProcParams &pparams, rtengine::IImage8 *img);
@@ -884,15 +884,17 @@ void Thumbnail::_loadThumbnail(bool firstTrial, bool info_only)
     tpp = new rtengine::Thumbnail ();
     tpp->isRaw = (cfs.format == (int) FT_Raw);
 
+    std::string buf;
+
     // load supplementary data
-    bool succ = tpp->readData (getCacheFileName ("data", ".txt"));
+    bool succ = cachemgr->loadCacheFile(getCacheFileName("data", ".txt"), buf) && tpp->readData(buf);
 
     if (succ) {
         tpp->getAutoWBMultipliers(cfs.redAWBMul, cfs.greenAWBMul, cfs.blueAWBMul);
     }
 
     // thumbnail image
-    succ = succ && tpp->readImage (getCacheFileName ("images", ""));
+    succ = succ && cachemgr->loadCacheFile(getCacheFileName("images", ".rtti"), buf) && tpp->readImage(buf);
 
     if (!succ && firstTrial) {
         _generateThumbnailImage(false, info_only);
@@ -913,7 +915,9 @@ void Thumbnail::_loadThumbnail(bool firstTrial, bool info_only)
 
     if ( cfs.thumbImgType == CacheImageData::FULL_THUMBNAIL ) {
         // load embedded profile
-        tpp->readEmbProfile (getCacheFileName ("embprofiles", ".icc"));
+        if (cachemgr->loadCacheFile(getCacheFileName("embprofiles", ".icc"), buf)) {
+            tpp->readEmbProfile(buf);
+        }
 
         tpp->init ();
     }
@@ -952,16 +956,28 @@ void Thumbnail::_saveThumbnail ()
         return;
     }
 
-    g_remove (getCacheFileName ("images", ".rtti").c_str ());
+    const auto image_fname = getCacheFileName("images", ".rtti");
+    cachemgr->removeCacheFile(image_fname);
+
+    std::string buf;
 
     // save thumbnail image
-    tpp->writeImage (getCacheFileName ("images", ""));
+    if (tpp->writeImage(buf)) {
+        cachemgr->storeCacheFile(image_fname, buf);
+    }
 
     // save embedded profile
-    tpp->writeEmbProfile (getCacheFileName ("embprofiles", ".icc"));
+    if (tpp->writeEmbProfile(buf)) {
+        cachemgr->storeCacheFile(getCacheFileName("embprofiles", ".icc"), buf);
+    }
 
     // save supplementary data
-    tpp->writeData (getCacheFileName ("data", ".txt"));
+    const auto data_fname = getCacheFileName("data", ".txt");
+    buf.clear();
+    cachemgr->loadCacheFile(data_fname, buf);
+    if (tpp->writeData(buf)) {
+        cachemgr->storeCacheFile(data_fname, buf);
+    }
 }
 
 /*